@@ -3,345 +3,182 @@
 #include "altsound.h"
 
 #include "altsound_data.hpp"
+#include "altsound_cmd_decoder.hpp"
+#include "altsound_cmdlog.hpp"
+#include "altsound_context.hpp"
 #include "altsound_ini_processor.hpp"
+#include "altsound_load_control.hpp"
+#include "altsound_output_format.hpp"
 #include "altsound_processor_base.hpp"
 #include "altsound_processor.hpp"
+#include "altsound_rate_matcher.hpp"
+#include "altsound_realtime.hpp"
+#include "altsound_render_ahead.hpp"
+#include "altsound_ring.hpp"
+#include "altsound_rt_check.hpp"
+#include "altsound_stats.hpp"
+#include "altsound_trace.hpp"
 #include "gsound_processor.hpp"
 #include "miniaudio_bass_compat.hpp"
 #include "miniaudio_private.h"
 
+#include <algorithm>
 #include <thread>
 #include <chrono>
 #include <atomic>
+#include <cstring>
 #include <condition_variable>
 #include <unordered_map>
 
-StreamArray channel_stream;
-std::mutex io_mutex;
-BehaviorInfo music_behavior;
-BehaviorInfo callout_behavior;
-BehaviorInfo sfx_behavior;
-BehaviorInfo solo_behavior;
-BehaviorInfo overlay_behavior;
 AltsoundLogger alog;
 
-AltsoundProcessorBase* g_pProcessor = NULL;
-ALTSOUND_HARDWARE_GEN g_hardwareGen = ALTSOUND_HARDWARE_GEN_NONE;
-CmdData g_cmdData;
+// contexts between AltSoundInit and AltSoundShutdown. The realtime settings
+// and the trace are process-wide, so the last one to shut down resets them
+static std::atomic<int> g_initializedContexts{ 0 };
 
-std::unordered_map<unsigned int, _internal_stream_data> g_streamMap;
-std::mutex g_streamMapMutex;
-
-static AltSoundAudioCallback g_audioCallback = nullptr;
-static void* g_audioUserData = nullptr;
-static std::mutex g_audioMutex;
-uint32_t g_sampleRate = 44100;
-uint32_t g_channels = 2;
-uint32_t g_nextStreamId = 1;
-int g_last_ma_err = 0;
-ma_engine* g_engine = nullptr;
-ma_context* g_context = nullptr;
-
-static uint32_t g_bufferSizeFrames = 256;
+// room for the streams ending within one period, so queuing them does not
+// allocate on the audio thread
+static constexpr size_t ENDED_STREAMS_RESERVE = 4 * ALT_MAX_CHANNELS;
 
 /******************************************************
  * Audio mixing
  *
  * miniAudio owns the audio thread (a realtime-paced null device). Its engine
  * mixes every playing ma_sound (volume, channel conversion and resampling
- * included) and hands us the finished buffer through onProcess, which we just
- * forward to the host. miniAudio handles all timing, throttling and buffering.
+ * included) into the period buffer, which we forward to the host through its
+ * callbacks and, when enabled, the output ring. onProcess,
+ * called from within the mix, is where streams that ended fire their
+ * SYNCPROCs. miniAudio handles all timing, throttling and buffering.
+ * With render-ahead, our own mixer thread replaces the device and mixes
+ * whenever the host has read enough of the output ring. Either thread
+ * binds the context it mixes for, see AltsoundContext.
  ******************************************************/
 
-static void AltsoundEngineProcess(void* pUserData, float* pFramesOut, ma_uint64 frameCount)
+// Hands a mixed period to the output callback in the host's format, in
+// pieces if it is longer than the conversion buffer
+static void AltsoundOutputPeriod(AltsoundContext& ctx, const float* frames, size_t frameCount, bool silent)
 {
-    // Streams that just reached their end were queued by the miniAudio end
-    // callback. Fire their SYNCPROCs here (safe point, after the read), which
-    // frees the sounds and adjusts ducking.
-    std::vector<EndedStream> ended;
-    {
-        std::lock_guard<std::mutex> lock(g_endedMutex);
-        ended.swap(g_endedStreams);
+    if (!ctx.output_format.isConverting()) {
+        ctx.output_callback(frames, frameCount, ctx.sample_rate, ctx.channels, ctx.output_user_data);
+        return;
     }
 
-    for (const auto& e : ended)
-        e.callback(e.hsync, e.hstream, 0, e.userdata);
-
-    std::lock_guard<std::mutex> lock(g_audioMutex);
-    if (g_audioCallback)
-        g_audioCallback(pFramesOut, static_cast<size_t>(frameCount), g_sampleRate, g_channels, g_audioUserData);
+    const size_t capacity = ctx.output_buffer.size() / ctx.output_format.bytesPerFrame();
+    for (size_t done = 0; done < frameCount;) {
+        const size_t n = std::min(frameCount - done, capacity);
+        if (silent)
+            ctx.output_format.silence(ctx.output_buffer.data(), n);
+        else
+            ctx.output_format.convert(frames + done * ctx.channels, n, ctx.output_buffer.data());
+        ctx.output_callback(ctx.output_buffer.data(), n, ctx.sample_rate, ctx.channels, ctx.output_user_data);
+        done += n;
+    }
 }
 
-/******************************************************
- * altsound_preprocess_commands
- ******************************************************/
-
-void altsound_preprocess_commands(int cmd)
+// Mixes frameCount interleaved f32 frames into pOutput, true if they are
+// silence because nothing plays
+static bool AltsoundMix(AltsoundContext& ctx, void* pOutput, ma_uint64 frameCount)
 {
-	ALT_DEBUG(0, "BEGIN altsound_preprocess_commands()");
-	ALT_INDENT;
-
-	ALT_DEBUG(0, "MAME_GEN: 0x%013x", (uint64_t)g_hardwareGen);
-
-	switch (g_hardwareGen) {
-		case ALTSOUND_HARDWARE_GEN_WPCDCS:
-		case ALTSOUND_HARDWARE_GEN_WPCSECURITY:
-		case ALTSOUND_HARDWARE_GEN_WPC95DCS:
-		case ALTSOUND_HARDWARE_GEN_WPC95: {
-			ALT_DEBUG(0, "Hardware Generation: WPCDCS, WPCSECURITY, WPC95DCS, WPC95");
-
-			// For future improvements, also check https://github.com/mjrgh/DCSExplorer/ for a lot of new info on the DCS inner workings
-
-			// E.g.: One more note on command processing: each byte of a command sequence must be received on the DCS side within 100ms of the previous byte.
-			//   The DCS software clears any buffered bytes if more than 100ms elapses between consecutive bytes.
-			//   This implies that a sender can wait a little longer than 100ms before sending the first byte of a new command if it wants to essentially reset the network connection,
-			//   ensuring that the DCS receiver doesn't think it's in the middle of some earlier partially-sent command sequence.
-
-			ALT_DEBUG(0, "Hardware Generation: GEN_WPCDCS, GEN_WPCSECURITY, GEN_WPC95DCS, GEN_WPC95");
-
-			if ((g_cmdData.cmd_buffer[3] == 0x55) && (g_cmdData.cmd_buffer[2] >= 0xAB) && (g_cmdData.cmd_buffer[2] <= 0xB0) && (g_cmdData.cmd_buffer[1] == (g_cmdData.cmd_buffer[0] ^ 0xFF))) // per-DCS-channel mixing level, but on our interpretation level we do not have any knowledge about the internal channel structures of DCS
-			{
-				ALT_DEBUG(0, "Change volume pc %u %u", g_cmdData.cmd_buffer[2], g_cmdData.cmd_buffer[1]);
-
-				for (int i = 0; i < ALT_MAX_CMDS; ++i)
-					g_cmdData.cmd_buffer[i] = ~0;
-
-				g_cmdData.cmd_counter = 0;
-				g_cmdData.cmd_filter = 1;
-			}
-			else
-			if ((g_cmdData.cmd_buffer[3] == 0x55) && (g_cmdData.cmd_buffer[2] == 0xC2)) // DCS software major version number
-			{
-				for (int i = 0; i < ALT_MAX_CMDS; ++i)
-					g_cmdData.cmd_buffer[i] = ~0;
-
-				g_cmdData.cmd_counter = 0;
-				g_cmdData.cmd_filter = 1;
-			}
-			else
-			if ((g_cmdData.cmd_buffer[3] == 0x55) && (g_cmdData.cmd_buffer[2] == 0xC3)) // DCS software minor version number
-			{
-				for (int i = 0; i < ALT_MAX_CMDS; ++i)
-					g_cmdData.cmd_buffer[i] = ~0;
-
-				g_cmdData.cmd_counter = 0;
-				g_cmdData.cmd_filter = 1;
-			}
-			else
-			if ((g_cmdData.cmd_buffer[3] == 0x55) && (g_cmdData.cmd_buffer[2] >= 0xBA) && (g_cmdData.cmd_buffer[2] <= 0xC1) && (g_cmdData.cmd_buffer[1] == (g_cmdData.cmd_buffer[0] ^ 0xFF))) // mystery command, see http://mjrnet.org/pinscape/dcsref/DCS_format_reference.html#SpecialCommands
-			{
-				for (int i = 0; i < ALT_MAX_CMDS; ++i)
-					g_cmdData.cmd_buffer[i] = ~0;
-
-				g_cmdData.cmd_counter = 0;
-				g_cmdData.cmd_filter = 1;
-			}
-			else
-			if (((g_cmdData.cmd_buffer[3] == 0x55) && (g_cmdData.cmd_buffer[2] == 0xAA))) { // change master volume?
-				// DAR@20240208 The check below is dangerous.  If this is still a
-				//              problem, it would be better to revisit it when it
-				//              reappears to implement a more robust solution that
-				//              works for all systems
-				//              See https://github.com/vpinball/pinmame/issues/220
-				// Maybe implementing the 'nothing happened in >100ms' reset queue (see above) would also resolve this??
-				//|| ((g_cmdData.cmd_buffer[2] == 0x00) && (g_cmdData.cmd_buffer[1] == 0x00) && (g_cmdData.cmd_buffer[0] == 0x00))) { // glitch in command buffer?
-				if ((g_cmdData.cmd_buffer[3] == 0x55) && (g_cmdData.cmd_buffer[2] == 0xAA) && (g_cmdData.cmd_buffer[1] == (g_cmdData.cmd_buffer[0] ^ 0xFF))) { // change volume op (following first byte = volume, second = ~volume, if these don't match: ignore)
-					if (g_pProcessor->romControlsVol()) {
-						//g_pProcessor->setGlobalVol(std::min((float)g_cmdData.cmd_buffer[1] / 127.f, 1.0f)); //!! input is 0..255 (or ..248 in practice? BUT at least MM triggers 255 at max volume in the menu) though, not just 0..127!
-						g_pProcessor->setGlobalVol((g_cmdData.cmd_buffer[1] == 0) ? 0.f : std::min(powf(0.981201f, (float)(255u - g_cmdData.cmd_buffer[1])) * 4.0f,1.0f)); //!! *4 is magic, similar to the *2 above
-						ALT_INFO(0, "Change volume %.02f (%u)", g_pProcessor->getGlobalVol(), g_cmdData.cmd_buffer[1]);
-					}
-				}
-				else
-					ALT_DEBUG(0, "Command filtered %02X %02X %02X %02X", g_cmdData.cmd_buffer[3], g_cmdData.cmd_buffer[2], g_cmdData.cmd_buffer[1], g_cmdData.cmd_buffer[0]);
-
-				for (int i = 0; i < ALT_MAX_CMDS; ++i)
-					g_cmdData.cmd_buffer[i] = ~0;
-
-				g_cmdData.cmd_counter = 0;
-				g_cmdData.cmd_filter = 1;
-			}
-			else
-				g_cmdData.cmd_filter = 0;
-
-			break;
-		}
-
-		case ALTSOUND_HARDWARE_GEN_WPCALPHA_2: //!! ?? test this gen actually
-		case ALTSOUND_HARDWARE_GEN_WPCDMD: // remaps everything to 16bit, a bit stupid maybe
-		case ALTSOUND_HARDWARE_GEN_WPCFLIPTRON: {
-			ALT_DEBUG(0, "Hardware Generation: WPCALPHA_2, WPCDMD, WPCFLIPTRON");
-
-			g_cmdData.cmd_filter = 0;
-			if ((g_cmdData.cmd_buffer[2] == 0x79) && (g_cmdData.cmd_buffer[1] == (g_cmdData.cmd_buffer[0] ^ 0xFF))) { // change volume op (following first byte = volume, second = ~volume, if these don't match: ignore)
-				if (g_pProcessor->romControlsVol()) {
-					g_pProcessor->setGlobalVol(std::min((float)g_cmdData.cmd_buffer[1] / 127.f, 1.0f));
-					ALT_INFO(0, "Change volume %.02f", g_pProcessor->getGlobalVol());
-				}
-
-				for (int i = 0; i < ALT_MAX_CMDS; ++i)
-					g_cmdData.cmd_buffer[i] = ~0;
-
-				g_cmdData.cmd_counter = 0;
-				g_cmdData.cmd_filter = 1;
-			}
-			else if (g_cmdData.cmd_buffer[1] == 0x7A) { // 16bit command second part //!! TZ triggers a 0xFF in the beginning -> check sequence and filter?
-				g_cmdData.stored_command = g_cmdData.cmd_buffer[1];
-				g_cmdData.cmd_counter = 0;
-			}
-			else if (cmd != 0x7A) { // 8 bit command
-				g_cmdData.stored_command = 0;
-				g_cmdData.cmd_counter = 0;
-			}
-			else // 16bit command first part
-				g_cmdData.cmd_counter = 1;
-
-			break;
-		}
-
-		case ALTSOUND_HARDWARE_GEN_WPCALPHA_1: // remaps everything to 16bit, a bit stupid maybe //!! test all these generations!
-		case ALTSOUND_HARDWARE_GEN_S11:
-		case ALTSOUND_HARDWARE_GEN_S11X:
-		case ALTSOUND_HARDWARE_GEN_S11B2:
-		case ALTSOUND_HARDWARE_GEN_S11C: {
-			ALT_DEBUG(0, "Hardware Generation: WPCALPHA_1, S11, S11X, S11B2, S11C");
-
-			if (cmd != g_cmdData.cmd_buffer[1]) { //!! some stuff is doubled or tripled -> filter out?
-				g_cmdData.stored_command = 0; // 8 bit command //!! 7F & 7E opcodes?
-				g_cmdData.cmd_counter = 0;
-			}
-			else
-				g_cmdData.cmd_counter = 1;
-
-			break;
-		}
-
-		case ALTSOUND_HARDWARE_GEN_DEDMD16: // remaps everything to 16bit, a bit stupid maybe
-		case ALTSOUND_HARDWARE_GEN_DEDMD32:
-		case ALTSOUND_HARDWARE_GEN_DEDMD64:
-		case ALTSOUND_HARDWARE_GEN_DE: { // this one just tested with BTTF so far
-			ALT_DEBUG(0, "Hardware Generation: DEDMD16, DEDMD32, DEDMD64, DE");
-
-			if (cmd != 0xFF && cmd != 0x00) { // 8 bit command
-				g_cmdData.stored_command = 0;
-				g_cmdData.cmd_counter = 0;
-			}
-			else // ignore
-				g_cmdData.cmd_counter = 1;
-
-			if (g_cmdData.cmd_buffer[1] == 0x00 && cmd == 0x00) { // handle 0x0000 special //!! meh?
-				g_cmdData.stored_command = 0;
- 				g_cmdData.cmd_counter = 0;
-			}
-
-			break;
-		}
-
-		case ALTSOUND_HARDWARE_GEN_WS:
-		case ALTSOUND_HARDWARE_GEN_WS_1:
-		case ALTSOUND_HARDWARE_GEN_WS_2: {
-			ALT_DEBUG(0, "Hardware Generation: WS, WS_1, WS_2");
-
-			g_cmdData.cmd_filter = 0;
-			if (g_cmdData.cmd_buffer[1] == 0xFE) {
-				if (cmd >= 0x10 && cmd <= 0x2F) {
-					if (g_pProcessor->romControlsVol()) {
-						g_pProcessor->setGlobalVol((float)(0x2F - cmd) / 31.f);
-						ALT_INFO(0, "Change volume %.02f", g_pProcessor->getGlobalVol());
-					}
-
-					for (int i = 0; i < ALT_MAX_CMDS; ++i)
-						g_cmdData.cmd_buffer[i] = ~0;
-
-					g_cmdData.cmd_counter = 0;
-					g_cmdData.cmd_filter = 1;
-				}
-				else if (cmd >= 0x01 && cmd <= 0x0F) { // ignore FE 01 ... FE 0F
-					g_cmdData.stored_command = 0;
-					g_cmdData.cmd_counter = 0;
-					g_cmdData.cmd_filter = 1;
-				}
-			}
-
-			if ((cmd & 0xFC) == 0xFC) // start byte of a command will ALWAYS be FF, FE, FD, FC, and never the second byte!
-				g_cmdData.cmd_counter = 1;
-
-			break;
-		}
-
-		// DAR@20240207 Seems to be 8-bit commands
-		case ALTSOUND_HARDWARE_GEN_GTS80/*A*/: {  // Gottlieb System 80A
-			ALT_DEBUG(0, "Hardware Generation: GTS80A");
-
-			// DAR@29249297 It appears that this system sends 0x00 commands as a clock
-			//              signal, since we recieve a ridiculous number of them.
-			//              Filter them out
-			if (cmd == 0x00) { // handle 0x00
-				g_cmdData.stored_command = 0;
-				g_cmdData.cmd_counter = 0;
-				g_cmdData.cmd_filter = 1;
-			}
-			else {
-				g_cmdData.stored_command = 0;
-				g_cmdData.cmd_counter = 0;
-				g_cmdData.cmd_filter = 0;
-			}
-
-			break;
-		}
-
-		default: break;
-	}
+    ma_engine* pEngine = ctx.engine;
+    AltsoundRtCheck::AudioScope rt_check;
+
+    // timed: mixing, onProcess (SYNCPROCs) and the host callback
+    const uint64_t start = AltsoundStats::now();
+    const ma_uint64 engine_time = altsound_ma_engine_get_time_in_pcm_frames(pEngine);
+
+    // Nothing playing and no SYNCPROC pending: the period is silence, so
+    // skip the node graph. A stream started meanwhile is mixed next period.
+
+    // Load control only sees the node graph and onProcess, so a slow host
+    // callback never makes it shed voices
+    uint64_t mix_ns = 0;
+    const bool idle = MiniAudio_IsIdle();
+    if (idle) {
+        memset(pOutput, 0, static_cast<size_t>(frameCount) * ctx.channels * sizeof(float));
+        ctx.stats.idle_periods.fetch_add(1, std::memory_order_relaxed);
+    }
+    else {
+        const uint64_t read_start = AltsoundStats::now();
+        altsound_ma_engine_read_pcm_frames(pEngine, pOutput, frameCount);
+        mix_ns = AltsoundStats::now() - read_start;
+    }
 
-	ALT_OUTDENT;
-	ALT_DEBUG(0, "END altsound_preprocess_commands()");
+    // With no sound attached, the node graph outputs silence without
+    // advancing its clock. Keep it running, so scheduled start frames and
+    // stream events stay on the timeline of the frames actually output
+    if (altsound_ma_engine_get_time_in_pcm_frames(pEngine) == engine_time)
+        altsound_ma_engine_set_time_in_pcm_frames(pEngine, engine_time + frameCount);
+
+    // The host gets the whole period, silent or not, unless it opted out of
+    // idle periods. onProcess only sees the frames the node graph read,
+    // which is none while nothing plays
+    if (!idle || !ctx.skip_idle_callbacks) {
+        const auto lock = AltsoundRtCheck::lock(ctx.audio_mutex, "audio callback lock");
+        if (ctx.audio_callback)
+            ctx.audio_callback(static_cast<const float*>(pOutput), static_cast<size_t>(frameCount), ctx.sample_rate,
+                               ctx.channels, ctx.audio_user_data);
+        if (ctx.output_callback)
+            AltsoundOutputPeriod(ctx, static_cast<const float*>(pOutput), static_cast<size_t>(frameCount), idle);
+    }
+    if (ctx.rate_matcher.isEnabled())
+        ctx.rate_matcher.write(static_cast<const float*>(pOutput), static_cast<size_t>(frameCount));
+    else
+        ctx.output_ring.write(static_cast<const float*>(pOutput), static_cast<size_t>(frameCount));
+    const uint64_t end = AltsoundStats::now();
+    ctx.stats.mix.record(end - start);
+    ctx.load_control.update(mix_ns, frameCount);
+
+    if (AltsoundTrace::enabled()) {
+        AltsoundTrace::setThreadName("audio");
+        AltsoundTrace::complete("audio", "mix", start, end, { { "frames", (double)frameCount } });
+    }
+    return idle;
 }
 
-/******************************************************
- * altsound_postprocess_commands
- ******************************************************/
-
-void altsound_postprocess_commands(const unsigned int combined_cmd)
+static void AltsoundDeviceData(ma_device* pDevice, void* pOutput, const void* /*pInput*/, ma_uint32 frameCount)
 {
-	ALT_DEBUG(0, "BEGIN altsound_postprocess_commands()");
-	ALT_INDENT;
-
-	ALT_DEBUG(0, "MAME_GEN: 0x%013x", (uint64_t)g_hardwareGen);
-
-	switch (g_hardwareGen) {
-		case ALTSOUND_HARDWARE_GEN_WPCDCS:
-		case ALTSOUND_HARDWARE_GEN_WPCSECURITY:
-		case ALTSOUND_HARDWARE_GEN_WPC95DCS:
-		case ALTSOUND_HARDWARE_GEN_WPC95:
-			if (combined_cmd == 0x03E3) { // stop music
-				ALT_INFO(0, "Stopping MUSIC(2)");
-				g_pProcessor->stopMusic();
-			}
-			break;
-
-		//!! old WPC machines music stop? -> 0x00 for SYS11?
-
-		case ALTSOUND_HARDWARE_GEN_DEDMD32:
-			if ((combined_cmd == 0x0018 || combined_cmd == 0x0023)) { // stop music //!! ???? 0x0019??
-				ALT_INFO(0, "Stopping MUSIC(3)");
-				g_pProcessor->stopMusic();
-			}
-			break;
+    // miniAudio owns this thread, so it configures itself and binds the
+    // context it mixes for
+    const ma_engine* pEngine = static_cast<ma_engine*>(pDevice->pUserData);
+    AltsoundContext* ctx = static_cast<AltsoundContext*>(pEngine->pProcessUserData);
+    AltsoundContext::bind(ctx);
+    AltsoundRealtime::applyToAudioThread();
+    AltsoundMix(*ctx, pOutput, frameCount);
+}
 
-		case ALTSOUND_HARDWARE_GEN_WS:
-		case ALTSOUND_HARDWARE_GEN_WS_1:
-		case ALTSOUND_HARDWARE_GEN_WS_2:
-			if (((combined_cmd == 0x0000 || (combined_cmd & 0xf0ff) == 0xf000))) { // stop music
-				ALT_INFO(0, "Stopping MUSIC(4)");
-				g_pProcessor->stopMusic();
-			}
-			break;
+static void AltsoundRenderAheadMix(void* user, float* frames, size_t frameCount)
+{
+    AltsoundContext* ctx = static_cast<AltsoundContext*>(user);
+    AltsoundContext::bind(ctx);
+    AltsoundMix(*ctx, frames, frameCount);
+}
 
-		default: break;
-	}
+static void AltsoundEngineProcess(void* pUserData, float* /*pFramesOut*/, ma_uint64 /*frameCount*/)
+{
+    AltsoundContext& ctx = *static_cast<AltsoundContext*>(pUserData);
 
-	ALT_OUTDENT;
-	ALT_DEBUG(0, "END postprocess_commands()");
+    // Streams that just reached their end were queued by the miniAudio end
+    // callback. Fire their SYNCPROCs here (safe point, after the read), which
+    // frees the sounds and adjusts ducking. Virtual voices that ran out of
+    // timeline are queued the same way.
+    MiniAudio_UpdateStreams();
+
+    // swapped with the queue, so both keep the capacity reserved at init
+    MiniAudio_TakeEndedStreams(ctx.firing_streams);
+
+    for (const auto& e : ctx.firing_streams) {
+        // Streams are freed under io_mutex; holding it keeps the stream
+        // alive between the check and the SYNCPROC.  A stream freed since
+        // it was queued, or ended twice, must not fire again: its user
+        // data is gone
+        const auto guard = AltsoundRtCheck::lock(ctx.io_mutex, "io_mutex lock");
+        if (!MiniAudio_ChannelHasSync(e.hstream, e.hsync))
+            continue;
+
+        AltsoundTrace::Scope trace("audio", "syncproc");
+        trace.arg("stream", e.hstream);
+        e.callback(e.hsync, e.hstream, 0, e.userdata);
+    }
 }
 
 /******************************************************
@@ -356,42 +193,116 @@ ALTSOUNDAPI void AltSoundSetLogger(const string& logPath, ALTSOUND_LOG_LEVEL log
 }
 
 /******************************************************
- * AltSoundInit
+ * AltSoundCtxInit
  ******************************************************/
 
-ALTSOUNDAPI bool AltSoundInit(const string& pinmamePath, const string& gameName,
-                              uint32_t sampleRate, uint32_t channels, uint32_t bufferSizeFrames)
+ALTSOUNDAPI bool AltSoundCtxInit(AltSoundContext* context, const string& pinmamePath, const string& gameName,
+                                 uint32_t sampleRate, uint32_t channels, uint32_t bufferSizeFrames)
 {
-	ALT_DEBUG(0, "BEGIN AltSoundInit()");
+	AltSoundOptions options;
+	options.sampleRate = sampleRate;
+	options.channels = channels;
+	options.bufferSizeFrames = bufferSizeFrames;
+
+	return AltSoundCtxInitWithOptions(context, pinmamePath, gameName, options);
+}
+
+/******************************************************
+ * AltSoundCtxInitWithOptions
+ ******************************************************/
+
+ALTSOUNDAPI bool AltSoundCtxInitWithOptions(AltSoundContext* context, const string& pinmamePath,
+                                            const string& gameName, const AltSoundOptions& options)
+{
+	const AltsoundContext::Scope scope(context);
+	AltsoundContext& ctx = scope.context();
+
+	// stopped by the last shutdown.  Started here, so the audio thread never
+	// has to start it
+	alog.start();
+
+	ALT_DEBUG(0, "BEGIN AltSoundInitWithOptions()");
 	ALT_INDENT;
 
-	if (g_pProcessor) {
+	if (ctx.processor) {
 		ALT_ERROR(0, "Processor already defined");
 		ALT_OUTDENT;
-		ALT_DEBUG(0, "END AltSoundInit()");
+		ALT_DEBUG(0, "END AltSoundInitWithOptions()");
 		return false;
 	}
 
-	g_sampleRate = sampleRate;
-	g_channels = channels;
-	g_bufferSizeFrames = bufferSizeFrames;
+	if (options.outputFormat > ALTSOUND_SAMPLE_FORMAT_S32) {
+		ALT_ERROR(0, "Unknown output format: %d", (int)options.outputFormat);
+		ALT_OUTDENT;
+		ALT_DEBUG(0, "END AltSoundInitWithOptions()");
+		return false;
+	}
 
-	g_engine = new ma_engine();
-	g_context = new ma_context();
-	if (altsound_ma_engine_init_null_device(g_channels, g_sampleRate, g_bufferSizeFrames,
-			AltsoundEngineProcess, nullptr, g_context, g_engine) != MA_SUCCESS) {
+	ctx.sample_rate = options.sampleRate;
+	ctx.channels = options.channels;
+	ctx.buffer_size_frames = options.bufferSizeFrames;
+	ctx.skip_idle_callbacks = options.skipIdleCallbacks;
+	ctx.manual_render = options.manualRender;
+	ctx.emu_clock_synced = false;
+
+	// render-ahead mixes for the host's reads, which manual rendering does
+	// itself
+	const bool render_ahead = options.renderAheadPeriods > 0 && !options.manualRender;
+	if (options.renderAheadPeriods > 0 && options.manualRender)
+		ALT_WARNING(0, "Render-ahead ignored with manual rendering");
+
+	// Without a device, nothing drives the engine until the host calls
+	// AltSoundRender() or the render-ahead thread starts.  The engine hands
+	// the context to its callbacks
+	ctx.engine = new ma_engine();
+	ma_result result;
+	if (options.manualRender || render_ahead) {
+		result = altsound_ma_engine_init_no_device(ctx.channels, ctx.sample_rate, AltsoundEngineProcess, &ctx, ctx.engine);
+	}
+	else {
+		ctx.device_context = new ma_context();
+		ctx.device = new ma_device();
+		result = altsound_ma_engine_init_null_device(ctx.channels, ctx.sample_rate, ctx.buffer_size_frames,
+			AltsoundDeviceData, AltsoundEngineProcess, &ctx, ctx.device_context, ctx.device, ctx.engine);
+	}
+	if (result != MA_SUCCESS) {
 		ALT_ERROR(0, "FAILED to initialize miniAudio engine");
-		delete g_engine;
-		g_engine = nullptr;
-		delete g_context;
-		g_context = nullptr;
+		delete ctx.engine;
+		ctx.engine = nullptr;
+		delete ctx.device;
+		ctx.device = nullptr;
+		delete ctx.device_context;
+		ctx.device_context = nullptr;
 		ALT_OUTDENT;
-		ALT_DEBUG(0, "END AltSoundInit()");
+		ALT_DEBUG(0, "END AltSoundInitWithOptions()");
 		return false;
 	}
+	g_initializedContexts.fetch_add(1);
 
 	// initialize channel_stream storage
-	std::fill(channel_stream.begin(), channel_stream.end(), nullptr);
+	std::fill(ctx.channel_stream.begin(), ctx.channel_stream.end(), nullptr);
+
+	MiniAudio_ReserveEndedStreams(ENDED_STREAMS_RESERVE);
+	ctx.firing_streams.reserve(ENDED_STREAMS_RESERVE);
+
+	ctx.stats.setMixBudget((uint64_t)ctx.buffer_size_frames * 1000000000ull / ctx.sample_rate);
+	// render-ahead keeps its whole depth in the ring
+	const uint32_t ring_frames = render_ahead ? std::max(options.outputRingFrames,
+	                                                     options.renderAheadPeriods * ctx.buffer_size_frames)
+	                                          : options.outputRingFrames;
+	ctx.output_ring.init(ring_frames, ctx.channels);
+	ctx.output_format.init(options.outputFormat, options.outputPlanar, options.outputDither, ctx.channels,
+	                       ctx.buffer_size_frames);
+	const bool converting = ctx.output_format.isConverting();
+	ctx.output_buffer.assign(converting ? ctx.buffer_size_frames * ctx.output_format.bytesPerFrame() : 0, 0);
+	ctx.render_buffer.assign(converting && options.manualRender ? (size_t)ctx.buffer_size_frames * ctx.channels : 0,
+	                         0.0f);
+	// the host's reads pace render-ahead, so there is no drift to compensate
+	if (options.driftCompensation && render_ahead)
+		ALT_WARNING(0, "Drift compensation ignored with render-ahead");
+	else if (options.driftCompensation)
+		ctx.rate_matcher.init(ctx.output_ring, ctx.sample_rate, ctx.channels, ctx.buffer_size_frames,
+		                      options.ringTargetFrames);
 
 	string szPinmamePath = pinmamePath;
 
@@ -402,13 +313,15 @@ ALTSOUNDAPI bool AltSoundInit(const string& pinmamePath, const string& gameName,
 
 	const string szAltSoundPath = szPinmamePath + "altsound/" + gameName + '/';
 
-	// parse .ini file
+	// parse .ini file.  From here on, a failed init tears the engine down
+	// again, so the context can be initialized anew
 	AltsoundIniProcessor ini_proc;
 	if (!ini_proc.parse_altsound_ini(szAltSoundPath)) {
 		// Error message and return
 		ALT_ERROR(0, "Failed to parse_altsound_ini(%s)", szAltSoundPath.c_str());
+		AltSoundCtxShutdown(context);
 		ALT_OUTDENT;
-		ALT_DEBUG(0, "END AltSoundInit()");
+		ALT_DEBUG(0, "END AltSoundInitWithOptions()");
 		return false;
 	}
 
@@ -417,76 +330,133 @@ ALTSOUNDAPI bool AltSoundInit(const string& pinmamePath, const string& gameName,
 	if (format == "g-sound") {
 		// G-Sound only supports new CSV format. No need to specify format
 		// in the constructor
-		g_pProcessor = new GSoundProcessor(gameName, szPinmamePath);
+		ctx.processor = new GSoundProcessor(gameName, szPinmamePath);
 	}
 	else if (format == "altsound" || format == "legacy") {
-		g_pProcessor = new AltsoundProcessor(gameName, szPinmamePath, format);
+		ctx.processor = new AltsoundProcessor(gameName, szPinmamePath, format);
 	}
 	else {
 		ALT_ERROR(0, "Unknown AltSound format: %s", format.c_str());
+		AltSoundCtxShutdown(context);
 		ALT_OUTDENT;
-		ALT_DEBUG(0, "END AltSoundInit()");
+		ALT_DEBUG(0, "END AltSoundInitWithOptions()");
 		return false;
 	}
 
-	if (!g_pProcessor) {
+	if (!ctx.processor) {
 		ALT_ERROR(0, "FAILED: Unable to create AltSound Processor");
+		AltSoundCtxShutdown(context);
 		ALT_OUTDENT;
-		ALT_DEBUG(0, "END AltSoundInit()");
+		ALT_DEBUG(0, "END AltSoundInitWithOptions()");
 		return false;
 	}
 
 	ALT_INFO(0, "%s processor created", format.c_str());
 
-	g_pProcessor->setMasterVol(1.0f);
-	g_pProcessor->setGlobalVol(1.0f);
-	g_pProcessor->romControlsVol(ini_proc.usingRomVolumeControl());
-	g_pProcessor->recordSoundCmds(ini_proc.recordSoundCmds());
-	g_pProcessor->setSkipCount(ini_proc.getSkipCount());
+	ctx.processor->setMasterVol(1.0f);
+	ctx.processor->setGlobalVol(1.0f);
+	ctx.processor->romControlsVol(ini_proc.usingRomVolumeControl());
+	ctx.processor->setSkipCount(ini_proc.getSkipCount());
+	ctx.processor->setRetriggerConfig(ini_proc.getRetriggerConfig());
+	ctx.processor->setResamplerConfig(ini_proc.getResamplerConfig());
+	if (options.randomSeed)
+		ctx.processor->setRandomSeed(options.randomSeed);
+	MiniAudio_SetVirtualVoiceThreshold(ini_proc.getVirtualVoiceThreshold());
+
+	// offline rendering has no deadline, and its output must not depend on
+	// how fast it runs
+	ctx.load_control.configure(ini_proc.getLoadControlConfig(), !options.manualRender, ctx.sample_rate);
+
+	// the [realtime] section overrides the host's settings; this precedes
+	// loading the samples, so they are locked when requested.  The settings
+	// are process-wide, the last context initialized sets them
+	AltsoundRealtimeConfig realtime_config{ options.audioThread, options.workerThreads, options.lockMemory };
+	ini_proc.applyRealtimeConfig(realtime_config);
+	AltsoundRealtime::configure(realtime_config);
 
 	// perform processor initialization (load samples, etc)
-	g_pProcessor->init();
-
-	g_cmdData.cmd_counter = 0;
-	g_cmdData.stored_command = -1;
-	g_cmdData.cmd_filter = 0;
-	std::fill_n(g_cmdData.cmd_buffer, ALT_MAX_CMDS, ~0);
+	ctx.processor->init();
+
+	// decoder for the current hardware generation; AltSoundSetHardwareGen()
+	// replaces it when called after init
+	ctx.decoder = AltsoundCmdDecoder::create(ctx.hardware_gen);
+
+#ifndef ALTSOUND_STANDALONE
+	// ALTSOUND_STANDALONE builds replay recorded commands; recording them
+	// again would overwrite the log being replayed
+	if (ini_proc.recordSoundCmds()) {
+		const string recording_fname = szPinmamePath + "altsound/cmdlog.bin";
+		if (!ctx.cmd_recorder.start(recording_fname, szAltSoundPath, ctx.hardware_gen))
+			ALT_ERROR(0, "FAILED to start sound command recording");
+	}
+#endif
+
+	if (ctx.device)
+		altsound_ma_engine_start(ctx.engine);
+	else if (render_ahead && !ctx.render_ahead.start(ctx.output_ring, options.renderAheadPeriods, options.renderAheadBatch,
+	                                                 ctx.buffer_size_frames, ctx.sample_rate, ctx.channels,
+	                                                 AltsoundRenderAheadMix, &ctx)) {
+		// nothing would ever mix, and the host would read silence
+		ALT_ERROR(0, "FAILED to start the render-ahead thread");
+		AltSoundCtxShutdown(context);
+		ALT_OUTDENT;
+		ALT_DEBUG(0, "END AltSoundInitWithOptions()");
+		return false;
+	}
 
-	altsound_ma_engine_start(g_engine);
+	ALT_INFO(0, "Engine: %u Hz, %u channels, %u frame periods%s", ctx.sample_rate, ctx.channels,
+	         ctx.buffer_size_frames, ctx.manual_render ? ", manual rendering" : "");
+	if (ring_frames)
+		ALT_INFO(0, "Output ring: %u frames", ring_frames);
 
-	ALT_DEBUG(0, "END AltSoundInit()");
+	ALT_DEBUG(0, "END AltSoundInitWithOptions()");
 	return true;
 }
 
 /******************************************************
- * AltSoundProcessCommand
+ * AltSoundCtxSetHardwareGen
  ******************************************************/
 
-ALTSOUNDAPI void AltSoundSetHardwareGen(ALTSOUND_HARDWARE_GEN hardwareGen)
+ALTSOUNDAPI void AltSoundCtxSetHardwareGen(AltSoundContext* context, ALTSOUND_HARDWARE_GEN hardwareGen)
 {
+	const AltsoundContext::Scope scope(context);
+	AltsoundContext& ctx = scope.context();
+
 	ALT_DEBUG(0, "BEGIN AltSoundSetHardwareGen()");
 	ALT_INDENT;
 
-	g_hardwareGen = hardwareGen;
+	ctx.hardware_gen = hardwareGen;
+
+	ALT_DEBUG(0, "MAME_GEN: 0x%013x", (uint64_t)ctx.hardware_gen);
+
+	// bind the command decoder once, instead of dispatching on the
+	// generation for every command byte
+	ctx.decoder = AltsoundCmdDecoder::create(ctx.hardware_gen);
+	ALT_INFO(0, "Command decoder: %s", ctx.decoder->getName());
 
-	ALT_DEBUG(0, "MAME_GEN: 0x%013x", (uint64_t)g_hardwareGen);
+	if (ctx.cmd_recorder.recording())
+		ctx.cmd_recorder.recordHardwareGen(ctx.hardware_gen);
 
 	ALT_OUTDENT;
 	ALT_DEBUG(0, "END AltSoundSetHardwareGen()");
 }
 
 /******************************************************
- * AltSoundSetAudioCallback
+ * AltSoundCtxSetAudioCallback
  ******************************************************/
 
-ALTSOUNDAPI void AltSoundSetAudioCallback(AltSoundAudioCallback callback, void* userData)
+ALTSOUNDAPI void AltSoundCtxSetAudioCallback(AltSoundContext* context, AltSoundAudioCallback callback,
+                                             void* userData)
 {
+	const AltsoundContext::Scope scope(context);
+	AltsoundContext& ctx = scope.context();
+
 	ALT_DEBUG(0, "BEGIN AltSoundSetAudioCallback()");
 	ALT_INDENT;
 
-	std::lock_guard<std::mutex> lock(g_audioMutex);
-	g_audioCallback = callback;
-	g_audioUserData = userData;
+	std::lock_guard<std::mutex> lock(ctx.audio_mutex);
+	ctx.audio_callback = callback;
+	ctx.audio_user_data = userData;
 
 	ALT_DEBUG(0, "Audio callback %s", callback ? "set" : "cleared");
 
@@ -495,66 +465,106 @@ ALTSOUNDAPI void AltSoundSetAudioCallback(AltSoundAudioCallback callback, void*
 }
 
 /******************************************************
- * AltSoundProcessCommand
+ * AltSoundCtxSetOutputCallback
  ******************************************************/
 
-ALTSOUNDAPI bool AltSoundProcessCommand(const unsigned int cmd, int attenuation)
+ALTSOUNDAPI void AltSoundCtxSetOutputCallback(AltSoundContext* context, AltSoundOutputCallback callback,
+                                              void* userData)
 {
-	ALT_DEBUG(0, "BEGIN AltSoundProcessCommand()");
+	const AltsoundContext::Scope scope(context);
+	AltsoundContext& ctx = scope.context();
 
-	float master_vol = g_pProcessor->getMasterVol();
-	while (attenuation++ < 0) {
-		master_vol /= 1.122018454f; // = (10 ^ (1/20)) = 1dB
-	}
-	g_pProcessor->setMasterVol(master_vol);
-	ALT_DEBUG(0, "Master Volume (Post Attenuation): %.02f", master_vol);
+	ALT_DEBUG(0, "BEGIN AltSoundSetOutputCallback()");
+	ALT_INDENT;
+
+	std::lock_guard<std::mutex> lock(ctx.audio_mutex);
+	ctx.output_callback = callback;
+	ctx.output_user_data = userData;
+
+	ALT_DEBUG(0, "Output callback %s", callback ? "set" : "cleared");
+
+	ALT_OUTDENT;
+	ALT_DEBUG(0, "END AltSoundSetOutputCallback()");
+}
 
-	g_cmdData.cmd_counter++;
+/******************************************************
+ * altsound_clock_ns
+ *
+ * Timestamp for commands that arrive without an emulator time
+ ******************************************************/
 
-	//Shift all commands up to free up slot 0
-	for (int i = ALT_MAX_CMDS - 1; i > 0; --i)
-		g_cmdData.cmd_buffer[i] = g_cmdData.cmd_buffer[i - 1];
+static uint64_t altsound_clock_ns()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
-	g_cmdData.cmd_buffer[0] = cmd; //add command to slot 0
+/******************************************************
+ * altsound_process_command
+ ******************************************************/
 
-	// pre-process commands based on ROM hardware platform
-	altsound_preprocess_commands(cmd);
+static bool altsound_process_command(const unsigned int cmd, int attenuation, const uint64_t time_ns)
+{
+	AltsoundContext& ctx = AltsoundContext::current();
 
-	if (g_cmdData.cmd_filter || (g_cmdData.cmd_counter & 1) != 0) {
-		// Some commands are 16-bits collected from two 8-bit commands.  If
-		// the command is filtered or we have not received enough data yet,
-		// try again on the next command
-		//
-		// NOTE:
-		// Command size and filter requirements are ROM hardware platform
-		// dependent.  The command preprocessor will take care of the
-		// bookkeeping
+	ALT_DEBUG(0, "BEGIN altsound_process_command()");
 
-		// Store the command for accumulation
-		g_cmdData.stored_command = cmd;
+	if (ctx.cmd_recorder.recording())
+		ctx.cmd_recorder.recordByte(cmd, attenuation, time_ns);
 
-		if (g_cmdData.cmd_filter) {
-			ALT_DEBUG(0, "Command filtered: %04X", cmd);
-		}
+	// times the command and attributes the streams it creates to it
+	const AltsoundStats::CommandScope stats_scope(ctx.stats);
 
-		if ((g_cmdData.cmd_counter & 1) != 0) {
+	AltsoundTrace::Scope trace(ctx.decoder->getName(), "command");
+	if (AltsoundTrace::enabled()) {
+		AltsoundTrace::setThreadName("commands");
+		trace.arg("byte", cmd);
+	}
+
+	// the decoder's pre- and post-processing (ROM volume, music stops) walk
+	// channel_stream too, so the whole decode runs under io_mutex, not just
+	// the processor's handleCmd()
+	std::lock_guard<std::recursive_mutex> guard(ctx.io_mutex);
+
+	float master_vol = ctx.processor->getMasterVol();
+	while (attenuation++ < 0) {
+		master_vol /= 1.122018454f; // = (10 ^ (1/20)) = 1dB
+	}
+	ctx.processor->setMasterVol(master_vol);
+	ALT_DEBUG(0, "Master Volume (Post Attenuation): %.02f", master_vol);
+
+	unsigned int cmd_combined = 0;
+	switch (ctx.decoder->decode(cmd, time_ns, ctx.processor, cmd_combined)) {
+		case AltsoundCmdDecoder::Result::Filtered:
+			AltsoundStats::add(ctx.stats.filtered);
+			trace.rename("filtered");
+			ALT_DEBUG(0, "Command filtered: %04X", cmd);
+			ALT_OUTDENT;
+			ALT_DEBUG(0, "END altsound_process_command()");
+			return true;
+
+		case AltsoundCmdDecoder::Result::Incomplete:
+			// Some commands are 16-bits collected from two 8-bit commands.
+			// Try again on the next command
+			AltsoundStats::add(ctx.stats.incomplete);
+			trace.rename("incomplete");
 			ALT_DEBUG(0, "Command incomplete: %04X", cmd);
-		}
+			ALT_OUTDENT;
+			ALT_DEBUG(0, "END altsound_process_command()");
+			return true;
 
-		ALT_OUTDENT;
-		ALT_DEBUG(0, "END AltSoundProcessCommand");
-		return true;
+		case AltsoundCmdDecoder::Result::Complete:
+			break;
 	}
 	ALT_DEBUG(0, "Command complete. Processing...");
-
-	// combine stored command with the current
-	const unsigned int cmd_combined = (g_cmdData.stored_command << 8) | cmd;
+	trace.arg("cmd", cmd_combined);
 
 	// Handle the resulting command
-	if (!ALT_CALL(g_pProcessor->handleCmd(cmd_combined))) {
+	ctx.processor->setCommandTime(time_ns);
+	if (!ALT_CALL(ctx.processor->handleCmd(cmd_combined))) {
 		ALT_WARNING(0, "FAILED processor::handleCmd()");
 
-		altsound_postprocess_commands(cmd_combined);
+		ctx.decoder->postprocess(cmd_combined, ctx.processor);
 
 		ALT_OUTDENT;
 		ALT_DEBUG(0, "END alt_sound_handle()");
@@ -562,34 +572,219 @@ ALTSOUNDAPI bool AltSoundProcessCommand(const unsigned int cmd, int attenuation)
 	}
 	ALT_INFO(0, "SUCCESS processor::handleCmd()");
 
-	altsound_postprocess_commands(cmd_combined);
+	ctx.decoder->postprocess(cmd_combined, ctx.processor);
 
 	ALT_OUTDENT;
-	ALT_DEBUG(0, "END AltSoundProcessCommand()");
+	ALT_DEBUG(0, "END altsound_process_command()");
 	ALT_DEBUG(0, "");
 
 	return true;
 }
 
 /******************************************************
- * AltSoundPause
+ * altsound_schedule_frame
+ *
+ * Maps an emulator timestamp onto the engine's PCM clock. The first command
+ * anchors emulator time to the current engine time plus the lookahead; later
+ * commands keep their emulator-time spacing relative to that anchor, so
+ * samples the ROM sequences a few ms apart start exactly that far apart,
+ * independent of where in the engine period they were handled. If the target
+ * falls in the past or too far in the future (emulator paused, stalled or
+ * running off realtime), the anchor is re-established.
  ******************************************************/
 
-ALTSOUNDAPI void AltSoundPause(bool pause)
+static uint64_t altsound_schedule_frame(const uint64_t emu_time_ns)
+{
+	AltsoundContext& ctx = AltsoundContext::current();
+	const uint64_t now = MiniAudio_GetEngineTime();
+	const uint64_t lookahead = (uint64_t)ctx.lookahead_ms * ctx.sample_rate / 1000;
+
+	if (ctx.emu_clock_synced && emu_time_ns >= ctx.emu_clock_base_ns) {
+		const uint64_t delta_ns = emu_time_ns - ctx.emu_clock_base_ns;
+		const uint64_t frame = ctx.emu_clock_base_frame + (delta_ns / 1000000000ull) * ctx.sample_rate
+		                     + (delta_ns % 1000000000ull) * ctx.sample_rate / 1000000000ull;
+
+		if (frame >= now && frame <= now + 2 * lookahead + ctx.buffer_size_frames)
+			return frame;
+
+		ALT_DEBUG(0, "Emulator clock out of range (frame %llu, engine %llu). Resyncing",
+		          (unsigned long long)frame, (unsigned long long)now);
+	}
+
+	ctx.emu_clock_synced = true;
+	ctx.emu_clock_base_ns = emu_time_ns;
+	ctx.emu_clock_base_frame = now + lookahead;
+
+	return ctx.emu_clock_base_frame;
+}
+
+/******************************************************
+ * AltSoundCtxProcessCommand
+ ******************************************************/
+
+ALTSOUNDAPI bool AltSoundCtxProcessCommand(AltSoundContext* context, const unsigned int cmd, int attenuation)
+{
+	const AltsoundContext::Scope scope(context);
+
+	return altsound_process_command(cmd, attenuation, altsound_clock_ns());
+}
+
+/******************************************************
+ * AltSoundCtxProcessCommandAt
+ ******************************************************/
+
+ALTSOUNDAPI bool AltSoundCtxProcessCommandAt(AltSoundContext* context, const unsigned int cmd, int attenuation,
+                                             uint64_t emuTimeNs)
+{
+	const AltsoundContext::Scope scope(context);
+
+	ALT_DEBUG(0, "BEGIN AltSoundProcessCommandAt()");
+	ALT_INDENT;
+
+	const uint64_t start_frame = altsound_schedule_frame(emuTimeNs);
+	ALT_DEBUG(0, "Emulator time: %llu ns  Scheduled frame: %llu", (unsigned long long)emuTimeNs,
+	          (unsigned long long)start_frame);
+
+	// streams created while handling this command start at start_frame
+	MiniAudio_SetScheduledStart(start_frame);
+	// the emulator timestamp also drives the decoder's inter-byte timeouts,
+	// which keeps them correct when the emulator runs off realtime
+	const bool success = altsound_process_command(cmd, attenuation, emuTimeNs);
+	MiniAudio_SetScheduledStart(0);
+
+	ALT_OUTDENT;
+	ALT_DEBUG(0, "END AltSoundProcessCommandAt()");
+	return success;
+}
+
+/******************************************************
+ * AltSoundCtxProcessCommands
+ *
+ * ROMs often send a burst of bytes in one emulator frame (DCS volume
+ * sequences, WPC 0x7A prefixes, Whitestar FE xx).  The whole burst is
+ * decoded under a single io_mutex acquisition; streams created by the burst
+ * are started together, after a single volume/ducking update.
+ ******************************************************/
+
+ALTSOUNDAPI bool AltSoundCtxProcessCommands(AltSoundContext* context, const uint32_t* cmds, size_t n,
+                                            int attenuation)
+{
+	const AltsoundContext::Scope scope(context);
+	AltsoundContext& ctx = scope.context();
+
+	ALT_DEBUG(0, "BEGIN AltSoundProcessCommands()");
+	ALT_INDENT;
+
+	if (!ctx.processor || (!cmds && n > 0)) {
+		ALT_ERROR(0, "No processor or command buffer");
+		ALT_OUTDENT;
+		ALT_DEBUG(0, "END AltSoundProcessCommands()");
+		return false;
+	}
+
+	// io_mutex is recursive, so the processor can re-acquire it per command
+	// without contention while the batch holds it
+	std::lock_guard<std::recursive_mutex> guard(ctx.io_mutex);
+
+	bool success = true;
+	const uint64_t time_ns = altsound_clock_ns();
+	ctx.processor->beginBatch();
+
+	for (size_t i = 0; i < n; ++i) {
+		// attenuation applies once for the whole batch
+		success &= altsound_process_command(cmds[i], i == 0 ? attenuation : 0, time_ns);
+	}
+
+	success &= ctx.processor->endBatch();
+	ALT_DEBUG(0, "Processed batch of %zu command(s)", n);
+
+	ALT_OUTDENT;
+	ALT_DEBUG(0, "END AltSoundProcessCommands()");
+	return success;
+}
+
+/******************************************************
+ * AltSoundCtxSetCommandLookahead
+ ******************************************************/
+
+ALTSOUNDAPI void AltSoundCtxSetCommandLookahead(AltSoundContext* context, uint32_t lookaheadMs)
+{
+	const AltsoundContext::Scope scope(context);
+	AltsoundContext& ctx = scope.context();
+
+	ALT_DEBUG(0, "BEGIN AltSoundSetCommandLookahead()");
+	ALT_INDENT;
+
+	ctx.lookahead_ms = lookaheadMs;
+	ctx.emu_clock_synced = false; // re-anchor on the next timestamped command
+
+	ALT_INFO(0, "Command lookahead: %u ms", lookaheadMs);
+
+	ALT_OUTDENT;
+	ALT_DEBUG(0, "END AltSoundSetCommandLookahead()");
+}
+
+/******************************************************
+ * AltSoundCtxRender
+ *
+ * Mixes the next frameCount frames into frames, in the output format, when
+ * the engine was initialized with manualRender. Stream ends, SYNCPROCs and
+ * the host callbacks are processed as part of the render, exactly as on
+ * the audio thread
+ ******************************************************/
+
+ALTSOUNDAPI size_t AltSoundCtxRender(AltSoundContext* context, void* frames, size_t frameCount)
+{
+	const AltsoundContext::Scope scope(context);
+	AltsoundContext& ctx = scope.context();
+
+	if (!ctx.engine || !ctx.manual_render || !frames) {
+		ALT_ERROR(0, "AltSoundRender() requires an engine initialized with manualRender");
+		return 0;
+	}
+
+	if (!ctx.output_format.isConverting()) {
+		AltsoundMix(ctx, frames, frameCount);
+		return frameCount;
+	}
+
+	// mixed a period at a time, then converted into place
+	for (size_t done = 0; done < frameCount;) {
+		const size_t n = std::min<size_t>(frameCount - done, ctx.buffer_size_frames);
+		if (AltsoundMix(ctx, ctx.render_buffer.data(), n))
+			ctx.output_format.silence(frames, n, frameCount, done);
+		else
+			ctx.output_format.convert(ctx.render_buffer.data(), n, frames, frameCount, done);
+		done += n;
+	}
+	return frameCount;
+}
+
+/******************************************************
+ * AltSoundCtxPause
+ ******************************************************/
+
+ALTSOUNDAPI void AltSoundCtxPause(AltSoundContext* context, bool pause)
 {
+	const AltsoundContext::Scope scope(context);
+	AltsoundContext& ctx = scope.context();
+
 	ALT_DEBUG(0, "BEGIN alt_sound_pause()");
 	ALT_INDENT;
 
+	// SYNCPROCs free channel_stream entries from the audio thread
+	std::lock_guard<std::recursive_mutex> guard(ctx.io_mutex);
+
 	if (pause) {
 		ALT_INFO(0, "Pausing stream playback (ALL)");
 
 		// Pause all channels
 		for (int i = 0; i < ALT_MAX_CHANNELS; ++i) {
-			if (!channel_stream[i])
+			if (!ctx.channel_stream[i])
 				continue;
 
-			if (MiniAudio_ChannelPause(channel_stream[i]->hstream)) {
-				ALT_INFO(0, "SUCCESS: Paused stream %u", channel_stream[i]->hstream);
+			if (MiniAudio_ChannelPause(ctx.channel_stream[i]->hstream)) {
+				ALT_INFO(0, "SUCCESS: Paused stream %u", ctx.channel_stream[i]->hstream);
 			}
 		}
 	}
@@ -598,11 +793,11 @@ ALTSOUNDAPI void AltSoundPause(bool pause)
 
 		// Resume all channels
 		for (int i = 0; i < ALT_MAX_CHANNELS; ++i) {
-			if (!channel_stream[i])
+			if (!ctx.channel_stream[i])
 				continue;
 
-			if (MiniAudio_ChannelPlay(channel_stream[i]->hstream, false)) {
-				ALT_INFO(0, "SUCCESS: Resumed stream %u", channel_stream[i]->hstream);
+			if (MiniAudio_ChannelPlay(ctx.channel_stream[i]->hstream, false)) {
+				ALT_INFO(0, "SUCCESS: Resumed stream %u", ctx.channel_stream[i]->hstream);
 			}
 		}
 	}
@@ -612,48 +807,326 @@ ALTSOUNDAPI void AltSoundPause(bool pause)
 }
 
 /******************************************************
- * AltSoundShutdown
+ * AltSoundCtxRingRead
+ *
+ * Points samples at the oldest mixed frames in the output ring and returns
+ * how many of them are contiguous, at most maxFrames. The host consumes them
+ * in place, then releases them with AltSoundRingCommit(); at the end of the
+ * ring, a second read returns the rest. Lock-free, so it is safe to call from
+ * the host's device callback, but from one thread only
  ******************************************************/
 
-ALTSOUNDAPI void AltSoundShutdown()
+ALTSOUNDAPI size_t AltSoundCtxRingRead(AltSoundContext* context, const float** samples, size_t maxFrames)
+{
+	const AltsoundContext::Scope scope(context);
+	AltsoundContext& ctx = scope.context();
+
+	if (!samples)
+		return 0;
+
+	return ctx.output_ring.read(samples, maxFrames);
+}
+
+/******************************************************
+ * AltSoundCtxRingCommit
+ ******************************************************/
+
+ALTSOUNDAPI void AltSoundCtxRingCommit(AltSoundContext* context, size_t frameCount)
+{
+	const AltsoundContext::Scope scope(context);
+	AltsoundContext& ctx = scope.context();
+
+	ctx.output_ring.commit(frameCount);
+}
+
+/******************************************************
+ * AltSoundCtxGetRingStats
+ ******************************************************/
+
+ALTSOUNDAPI void AltSoundCtxGetRingStats(AltSoundContext* context, AltSoundRingStats* stats)
+{
+	const AltsoundContext::Scope scope(context);
+	AltsoundContext& ctx = scope.context();
+
+	if (stats) {
+		ctx.output_ring.snapshot(*stats);
+		ctx.rate_matcher.snapshot(*stats);
+		ctx.render_ahead.snapshot(*stats);
+	}
+}
+
+/******************************************************
+ * AltSoundCtxGetStats
+ ******************************************************/
+
+ALTSOUNDAPI void AltSoundCtxGetStats(AltSoundContext* context, AltSoundStats* stats)
+{
+	const AltsoundContext::Scope scope(context);
+	AltsoundContext& ctx = scope.context();
+
+	if (stats)
+		ctx.stats.snapshot(*stats);
+}
+
+/******************************************************
+ * AltSoundCtxResetStats
+ ******************************************************/
+
+ALTSOUNDAPI void AltSoundCtxResetStats(AltSoundContext* context)
+{
+	const AltsoundContext::Scope scope(context);
+	AltsoundContext& ctx = scope.context();
+
+	ctx.stats.reset();
+	ctx.output_ring.resetCounters();
+}
+
+/******************************************************
+ * AltSoundHistogramPercentile
+ *
+ * Upper bound of the bucket holding the given percentile (0-100), capped at
+ * the largest recorded value
+ ******************************************************/
+
+ALTSOUNDAPI uint64_t AltSoundHistogramPercentile(const AltSoundHistogram* histogram, double percentile)
+{
+	if (!histogram || histogram->count == 0)
+		return 0;
+
+	const double target = std::clamp(percentile, 0.0, 100.0) / 100.0 * (double)histogram->count;
+	uint64_t seen = 0;
+	for (unsigned int i = 0; i < ALTSOUND_HISTOGRAM_BUCKETS; ++i) {
+		seen += histogram->buckets[i];
+		if (seen > 0 && (double)seen >= target)
+			return std::min(AltsoundHistogramCounter::bucketLimit(i), histogram->max_ns);
+	}
+	return histogram->max_ns;
+}
+
+/******************************************************
+ * AltSoundStartTrace
+ *
+ * Records command and stream lifecycles until AltSoundStopTrace() or
+ * AltSoundShutdown(), then writes them as Chrome trace-event JSON
+ ******************************************************/
+
+ALTSOUNDAPI bool AltSoundStartTrace(const string& tracePath)
 {
+	return AltsoundTrace::start(tracePath);
+}
+
+/******************************************************
+ * AltSoundStopTrace
+ ******************************************************/
+
+ALTSOUNDAPI void AltSoundStopTrace()
+{
+	AltsoundTrace::stop();
+}
+
+/******************************************************
+ * AltSoundCtxShutdown
+ ******************************************************/
+
+ALTSOUNDAPI void AltSoundCtxShutdown(AltSoundContext* context)
+{
+	const AltsoundContext::Scope scope(context);
+	AltsoundContext& ctx = scope.context();
+
 	ALT_DEBUG(0, "BEGIN AltSoundShutdown()");
 	ALT_INDENT;
 
-	// Stop miniAudio's audio thread first so no further mixing/onProcess
-	// callbacks run while we tear down the streams and engine.
-	if (g_engine)
-		altsound_ma_engine_stop(g_engine);
+	// Stop the audio thread (miniAudio's, or the render-ahead mixer) first
+	// so no further mixing/onProcess callbacks run while we tear down the
+	// streams and engine.
+	if (ctx.device)
+		altsound_ma_engine_stop(ctx.engine);
+	ctx.render_ahead.stop();
+
+	// the host may still be reading; its last span stays valid until the
+	// context is initialized again
+	ctx.output_ring.disable();
+	ctx.rate_matcher.shutdown();
 
 	// Discard any end-of-stream notifications that were never drained; the
 	// streams they reference are about to be freed.
-	{
-		std::lock_guard<std::mutex> lock(g_endedMutex);
-		g_endedStreams.clear();
+	MiniAudio_ClearEndedStreams();
+
+	if (ctx.processor) {
+		delete ctx.processor;
+		ctx.processor = nullptr;
 	}
 
-	if (g_pProcessor) {
-		delete g_pProcessor;
-		g_pProcessor = NULL;
+	ctx.decoder.reset();
+
+	ctx.cmd_recorder.stop();
+
+	// the engine does not own the device, but stops it again on uninit, so
+	// the device is released after the engine.  It was stopped above, so its
+	// data callback can no longer reach the engine
+	if (ctx.engine) {
+		altsound_ma_engine_uninit(ctx.engine);
+		delete ctx.engine;
+		ctx.engine = nullptr;
+		g_initializedContexts.fetch_sub(1);
 	}
 
-	if (g_engine) {
-		altsound_ma_engine_uninit(g_engine);
-		delete g_engine;
-		g_engine = nullptr;
+	if (ctx.device) {
+		altsound_ma_device_uninit(ctx.device);
+		delete ctx.device;
+		ctx.device = nullptr;
 	}
 
-	if (g_context) {
-		altsound_ma_context_uninit(g_context);
-		delete g_context;
-		g_context = nullptr;
+	if (ctx.device_context) {
+		altsound_ma_context_uninit(ctx.device_context);
+		delete ctx.device_context;
+		ctx.device_context = nullptr;
 	}
 
-	std::lock_guard<std::mutex> lock(g_audioMutex);
-	g_audioCallback = nullptr;
-	g_audioUserData = nullptr;
+	// the worker threads restore their defaults on their next pass.  The
+	// settings are process-wide, so they stay while other contexts run
+	const bool last_context = g_initializedContexts.load() == 0;
+	if (last_context)
+		AltsoundRealtime::reset();
+
+	ctx.load_control.reset();
+
+	// ENABLE_RT_CHECK builds only
+	AltsoundRtCheck::logSummary();
+
+	std::lock_guard<std::mutex> lock(ctx.audio_mutex);
+	ctx.audio_callback = nullptr;
+	ctx.audio_user_data = nullptr;
+	ctx.output_callback = nullptr;
+	ctx.output_user_data = nullptr;
 
 	ALT_OUTDENT;
 	ALT_DEBUG(0, "END AltSoundShutdown()");
+
+	if (last_context)
+		AltsoundTrace::stop();
+
+	// write out everything still queued and stop the log writer thread,
+	// unless other contexts still log
+	if (last_context)
+		alog.flush();
+}
+
+/******************************************************
+ * AltSoundCreateContext
+ *
+ * Each context runs a table of its own, independent of all others
+ ******************************************************/
+
+ALTSOUNDAPI AltSoundContext* AltSoundCreateContext()
+{
+	return new AltsoundContext();
+}
+
+/******************************************************
+ * AltSoundDestroyContext
+ ******************************************************/
+
+ALTSOUNDAPI void AltSoundDestroyContext(AltSoundContext* context)
+{
+	if (!context)
+		return;
+
+	if (context->engine || context->processor)
+		AltSoundCtxShutdown(context);
+
+	delete context;
+}
+
+/******************************************************
+ * API without a context
+ *
+ * Each works on the default context
+ ******************************************************/
+
+ALTSOUNDAPI bool AltSoundInit(const string& pinmamePath, const string& gameName,
+                              uint32_t sampleRate, uint32_t channels, uint32_t bufferSizeFrames)
+{
+	return AltSoundCtxInit(nullptr, pinmamePath, gameName, sampleRate, channels, bufferSizeFrames);
+}
+
+ALTSOUNDAPI bool AltSoundInitWithOptions(const string& pinmamePath, const string& gameName,
+                                         const AltSoundOptions& options)
+{
+	return AltSoundCtxInitWithOptions(nullptr, pinmamePath, gameName, options);
 }
 
+ALTSOUNDAPI void AltSoundSetHardwareGen(ALTSOUND_HARDWARE_GEN hardwareGen)
+{
+	AltSoundCtxSetHardwareGen(nullptr, hardwareGen);
+}
+
+ALTSOUNDAPI void AltSoundSetAudioCallback(AltSoundAudioCallback callback, void* userData)
+{
+	AltSoundCtxSetAudioCallback(nullptr, callback, userData);
+}
+
+ALTSOUNDAPI void AltSoundSetOutputCallback(AltSoundOutputCallback callback, void* userData)
+{
+	AltSoundCtxSetOutputCallback(nullptr, callback, userData);
+}
+
+ALTSOUNDAPI bool AltSoundProcessCommand(const unsigned int cmd, int attenuation)
+{
+	return AltSoundCtxProcessCommand(nullptr, cmd, attenuation);
+}
+
+ALTSOUNDAPI bool AltSoundProcessCommandAt(const unsigned int cmd, int attenuation, uint64_t emuTimeNs)
+{
+	return AltSoundCtxProcessCommandAt(nullptr, cmd, attenuation, emuTimeNs);
+}
+
+ALTSOUNDAPI bool AltSoundProcessCommands(const uint32_t* cmds, size_t n, int attenuation)
+{
+	return AltSoundCtxProcessCommands(nullptr, cmds, n, attenuation);
+}
+
+ALTSOUNDAPI void AltSoundSetCommandLookahead(uint32_t lookaheadMs)
+{
+	AltSoundCtxSetCommandLookahead(nullptr, lookaheadMs);
+}
+
+ALTSOUNDAPI size_t AltSoundRender(void* frames, size_t frameCount)
+{
+	return AltSoundCtxRender(nullptr, frames, frameCount);
+}
+
+ALTSOUNDAPI void AltSoundPause(bool pause)
+{
+	AltSoundCtxPause(nullptr, pause);
+}
+
+ALTSOUNDAPI size_t AltSoundRingRead(const float** samples, size_t maxFrames)
+{
+	return AltSoundCtxRingRead(nullptr, samples, maxFrames);
+}
+
+ALTSOUNDAPI void AltSoundRingCommit(size_t frameCount)
+{
+	AltSoundCtxRingCommit(nullptr, frameCount);
+}
+
+ALTSOUNDAPI void AltSoundGetRingStats(AltSoundRingStats* stats)
+{
+	AltSoundCtxGetRingStats(nullptr, stats);
+}
+
+ALTSOUNDAPI void AltSoundGetStats(AltSoundStats* stats)
+{
+	AltSoundCtxGetStats(nullptr, stats);
+}
+
+ALTSOUNDAPI void AltSoundResetStats()
+{
+	AltSoundCtxResetStats(nullptr);
+}
+
+ALTSOUNDAPI void AltSoundShutdown()
+{
+	AltSoundCtxShutdown(nullptr);
+}
@@ -57,14 +57,230 @@ typedef enum {
 	ALTSOUND_LOG_LEVEL_UNDEFINED,
 } ALTSOUND_LOG_LEVEL;
 
+typedef enum {
+	ALTSOUND_SAMPLE_TYPE_UNDEFINED = 0,
+	ALTSOUND_SAMPLE_TYPE_MUSIC,
+	ALTSOUND_SAMPLE_TYPE_JINGLE,
+	ALTSOUND_SAMPLE_TYPE_SFX,
+	ALTSOUND_SAMPLE_TYPE_CALLOUT,
+	ALTSOUND_SAMPLE_TYPE_SOLO,
+	ALTSOUND_SAMPLE_TYPE_OVERLAY,
+	ALTSOUND_SAMPLE_TYPE_COUNT
+} ALTSOUND_SAMPLE_TYPE;
+
+// Log-linear histogram of durations in ns: bucket i < 4 counts the value i,
+// above that every power of two is split into 4 buckets (25% resolution).
+// The last bucket counts everything from 7.5 s up
+#define ALTSOUND_HISTOGRAM_BUCKETS 128
+
+typedef struct {
+	uint64_t count;
+	uint64_t total_ns;
+	uint64_t max_ns;
+	uint64_t buckets[ALTSOUND_HISTOGRAM_BUCKETS];
+} AltSoundHistogram;
+
+typedef struct {
+	AltSoundHistogram process_command;  // AltSoundProcessCommand*() per byte
+	AltSoundHistogram command_to_audio; // command received to first mixed period of its sample
+	AltSoundHistogram stream_create;    // opening a sample for playback
+	AltSoundHistogram mix;              // engine mix per audio period
+	uint64_t mix_budget_ns;             // duration of one audio period
+	float mix_load;                     // average mix time / period, 1.0 = 100%
+	float mix_load_peak;                // longest mix time / period
+
+	uint32_t voices[ALTSOUND_SAMPLE_TYPE_COUNT];      // playing, by sample type
+	uint32_t peak_voices[ALTSOUND_SAMPLE_TYPE_COUNT];
+	uint32_t virtual_voices;                          // playing but not mixed
+	uint32_t shed_voices;                             // of those, virtualized for mixer load
+
+	uint64_t commands;      // command bytes received
+	uint64_t filtered;      // consumed by control sequences
+	uint64_t incomplete;    // first half of a 16-bit command
+	uint64_t unmatched;     // complete commands without a sample
+	uint64_t skipped;       // ignored by cmd_skip_count
+	uint64_t channel_full;  // samples not played for lack of a free channel
+	uint64_t idle_periods;  // audio periods output as silence without mixing
+
+	uint64_t retrigger_coalesced; // repeats within the [retrigger] dedup window
+	uint64_t retrigger_restarted; // repeats that restarted the playing instance
+	uint64_t retrigger_ignored;   // repeats dropped in "ignore" mode
+	uint64_t retrigger_limited;   // commands dropped at max_instances
+
+	uint32_t load_level;      // mixer load control: 0 = normal, 1 = cheap resampler,
+	uint32_t peak_load_level; //   2 = + voices virtualized, 3 = + voices refused
+	uint64_t load_resampled;  // voices created with the cheap resampler
+	uint64_t load_shed;       // voices virtualized for mixer load
+	uint64_t load_refused;    // voices refused for mixer load
+
+	uint64_t rt_violations; // allocations, locks and file I/O on the audio thread (ENABLE_RT_CHECK builds)
+} AltSoundStats;
+
+// Output ring state, see AltSoundOptions::outputRingFrames
+typedef struct {
+	uint32_t capacity_frames;  // 0 = no ring
+	uint32_t fill_frames;      // mixed frames waiting to be read
+	uint64_t written_frames;
+	uint64_t read_frames;
+	uint64_t overruns;         // mixed periods that did not fit
+	uint64_t overrun_frames;   // frames dropped by them
+	uint64_t underruns;        // reads that found fewer frames than requested
+	uint64_t underrun_frames;  // frames missing from them
+
+	// drift compensation, see AltSoundOptions::driftCompensation
+	uint32_t target_frames;    // fill level it holds, 0 when off
+	float rate_ratio;          // output/input rate, 1.0 when off
+	uint64_t resyncs;          // times the fill level was reset to the target
+
+	// render-ahead, see AltSoundOptions::renderAheadPeriods
+	uint32_t render_ahead_frames; // frames kept mixed, 0 when off
+	uint64_t render_batches;      // top-ups of the ring
+} AltSoundRingStats;
+
+// Scheduling policy of a library thread, see AltSoundThreadConfig
+typedef enum {
+	ALTSOUND_SCHED_DEFAULT = 0, // as the thread was created
+	ALTSOUND_SCHED_FIFO,
+	ALTSOUND_SCHED_RR
+} ALTSOUND_SCHED_POLICY;
+
+typedef struct {
+	ALTSOUND_SCHED_POLICY policy;
+	int priority;       // clamped to the policy's range, 1-99 on Linux
+	uint64_t cpu_mask;  // bit n = CPU n, 0 = any CPU
+} AltSoundThreadConfig;
+
+// Sample format of the output callback and AltSoundRender(), see
+// AltSoundOptions::outputFormat
+typedef enum {
+	ALTSOUND_SAMPLE_FORMAT_F32 = 0, // full scale is -1.0 to 1.0
+	ALTSOUND_SAMPLE_FORMAT_S16,
+	ALTSOUND_SAMPLE_FORMAT_S32
+} ALTSOUND_SAMPLE_FORMAT;
+
+// Engine configuration for AltSoundInitWithOptions()
+struct AltSoundOptions {
+	uint32_t sampleRate = 44100;
+	uint32_t channels = 2;
+	uint32_t bufferSizeFrames = 256; // mixing period
+
+	// Periods in which nothing plays are output as silence without mixing.
+	// This skips the audio callback for them as well, for hosts that treat
+	// no callback as silence; the output ring still gets every period.
+	// Mixing and callbacks resume with the period after a sample starts
+	bool skipIdleCallbacks = false;
+
+	// Format of the frames AltSoundRender() writes and the output callback
+	// (AltSoundSetOutputCallback) gets, converted once in the library.
+	// Integer formats clip at full scale; outputDither adds TPDF dither of
+	// +-1 LSB to s16. Planar buffers hold the frameCount samples of the
+	// first channel, then those of the second, and so on. The audio
+	// callback and the output ring always get interleaved f32
+	ALTSOUND_SAMPLE_FORMAT outputFormat = ALTSOUND_SAMPLE_FORMAT_F32;
+	bool outputPlanar = false;
+	bool outputDither = false;
+
+	// No audio thread: the host pulls mixed frames with AltSoundRender(),
+	// e.g. to render offline faster than realtime. The engine mixes exactly
+	// the frames requested, so its clock is the number of frames rendered
+	bool manualRender = false;
+
+	// Nonzero keeps the last outputRingFrames mixed frames in a lock-free
+	// ring the host reads with AltSoundRingRead()/AltSoundRingCommit(),
+	// e.g. from its own device callback. Several periods absorb the jitter
+	// between the mixer and the host device
+	uint32_t outputRingFrames = 0;
+
+	// With the output ring, the mixer is paced by its own timer and the
+	// host device by its own clock, so the ring slowly fills or drains.
+	// Drift compensation resamples the mixed frames by a tiny ratio (at most
+	// 0.2%), steered by a PI controller so the ring stays at
+	// ringTargetFrames (0 = half the ring) and the latency stays constant
+	bool driftCompensation = false;
+	uint32_t ringTargetFrames = 0;
+
+	// Nonzero replaces the timer-paced mixer: a mixer thread keeps
+	// renderAheadPeriods periods mixed in the output ring and tops it up
+	// renderAheadBatch periods at a time (0 = half the depth) once the host
+	// has read that many. The host's reads pace the mixer, so a slow period
+	// is absorbed by the frames mixed ahead. Commands apply from the next
+	// period mixed, so they are heard up to the depth later. The ring grows
+	// to the depth if needed; drift compensation does not apply, and the
+	// audio and output callbacks get the periods as they are mixed
+	uint32_t renderAheadPeriods = 0;
+	uint32_t renderAheadBatch = 0;
+
+	// Realtime configuration of the mixer thread (audioThread) and of the
+	// log and command recording writers (workerThreads). Each thread
+	// applies it to itself and logs whether that worked. lockMemory locks
+	// the process in RAM, loads samples into memory instead of reading
+	// files on the audio thread, and prefaults the threads' stacks. The
+	// [realtime] section of altsound.ini overrides these
+	AltSoundThreadConfig audioThread = { ALTSOUND_SCHED_DEFAULT, 0, 0 };
+	AltSoundThreadConfig workerThreads = { ALTSOUND_SCHED_DEFAULT, 0, 0 };
+	bool lockMemory = false;
+
+	// Nonzero seeds sample selection, so the same commands always pick the
+	// same samples. With manualRender and AltSoundProcessCommandAt(), the
+	// rendered output is then fully deterministic
+	uint32_t randomSeed = 0;
+};
+
 typedef void (*AltSoundAudioCallback)(const float* samples, size_t frameCount, uint32_t sampleRate, uint32_t channels, void* userData);
+typedef void (*AltSoundOutputCallback)(const void* samples, size_t frameCount, uint32_t sampleRate, uint32_t channels, void* userData);
 
 ALTSOUNDAPI void AltSoundSetLogger(const string& logPath, ALTSOUND_LOG_LEVEL logLevel, bool console);
 ALTSOUNDAPI bool AltSoundInit(const string& pinmamePath, const string& gameName,
                               uint32_t sampleRate = 44100, uint32_t channels = 2, uint32_t bufferSizeFrames = 256);
+ALTSOUNDAPI bool AltSoundInitWithOptions(const string& pinmamePath, const string& gameName,
+                                         const AltSoundOptions& options);
+ALTSOUNDAPI size_t AltSoundRender(void* frames, size_t frameCount);
 ALTSOUNDAPI void AltSoundSetHardwareGen(ALTSOUND_HARDWARE_GEN hardwareGen);
 ALTSOUNDAPI void AltSoundSetAudioCallback(AltSoundAudioCallback callback, void* userData);
+ALTSOUNDAPI void AltSoundSetOutputCallback(AltSoundOutputCallback callback, void* userData);
 ALTSOUNDAPI bool AltSoundProcessCommand(const unsigned int cmd, int attenuation);
+ALTSOUNDAPI bool AltSoundProcessCommandAt(const unsigned int cmd, int attenuation, uint64_t emuTimeNs);
+ALTSOUNDAPI bool AltSoundProcessCommands(const uint32_t* cmds, size_t n, int attenuation);
+ALTSOUNDAPI void AltSoundSetCommandLookahead(uint32_t lookaheadMs);
 ALTSOUNDAPI void AltSoundPause(bool pause);
 ALTSOUNDAPI void AltSoundShutdown();
+ALTSOUNDAPI size_t AltSoundRingRead(const float** samples, size_t maxFrames);
+ALTSOUNDAPI void AltSoundRingCommit(size_t frameCount);
+ALTSOUNDAPI void AltSoundGetRingStats(AltSoundRingStats* stats);
+ALTSOUNDAPI void AltSoundGetStats(AltSoundStats* stats);
+ALTSOUNDAPI void AltSoundResetStats();
+ALTSOUNDAPI uint64_t AltSoundHistogramPercentile(const AltSoundHistogram* histogram, double percentile);
+ALTSOUNDAPI bool AltSoundStartTrace(const string& tracePath);
+ALTSOUNDAPI void AltSoundStopTrace();
+
+// Handle of an engine instance. Contexts share no state, so each can run a
+// table of its own, on threads of its own. The functions above work on a
+// default context; the AltSoundCtx* variants work on the given one, or the
+// default context for nullptr. Logging, tracing and the realtime thread
+// settings stay process-wide
+typedef struct AltsoundContext AltSoundContext;
+
+ALTSOUNDAPI AltSoundContext* AltSoundCreateContext();
+ALTSOUNDAPI void AltSoundDestroyContext(AltSoundContext* context);
+ALTSOUNDAPI bool AltSoundCtxInit(AltSoundContext* context, const string& pinmamePath, const string& gameName,
+                                 uint32_t sampleRate = 44100, uint32_t channels = 2, uint32_t bufferSizeFrames = 256);
+ALTSOUNDAPI bool AltSoundCtxInitWithOptions(AltSoundContext* context, const string& pinmamePath,
+                                            const string& gameName, const AltSoundOptions& options);
+ALTSOUNDAPI size_t AltSoundCtxRender(AltSoundContext* context, void* frames, size_t frameCount);
+ALTSOUNDAPI void AltSoundCtxSetHardwareGen(AltSoundContext* context, ALTSOUND_HARDWARE_GEN hardwareGen);
+ALTSOUNDAPI void AltSoundCtxSetAudioCallback(AltSoundContext* context, AltSoundAudioCallback callback, void* userData);
+ALTSOUNDAPI void AltSoundCtxSetOutputCallback(AltSoundContext* context, AltSoundOutputCallback callback, void* userData);
+ALTSOUNDAPI bool AltSoundCtxProcessCommand(AltSoundContext* context, const unsigned int cmd, int attenuation);
+ALTSOUNDAPI bool AltSoundCtxProcessCommandAt(AltSoundContext* context, const unsigned int cmd, int attenuation,
+                                             uint64_t emuTimeNs);
+ALTSOUNDAPI bool AltSoundCtxProcessCommands(AltSoundContext* context, const uint32_t* cmds, size_t n,
+                                            int attenuation);
+ALTSOUNDAPI void AltSoundCtxSetCommandLookahead(AltSoundContext* context, uint32_t lookaheadMs);
+ALTSOUNDAPI void AltSoundCtxPause(AltSoundContext* context, bool pause);
+ALTSOUNDAPI void AltSoundCtxShutdown(AltSoundContext* context);
+ALTSOUNDAPI size_t AltSoundCtxRingRead(AltSoundContext* context, const float** samples, size_t maxFrames);
+ALTSOUNDAPI void AltSoundCtxRingCommit(AltSoundContext* context, size_t frameCount);
+ALTSOUNDAPI void AltSoundCtxGetRingStats(AltSoundContext* context, AltSoundRingStats* stats);
+ALTSOUNDAPI void AltSoundCtxGetStats(AltSoundContext* context, AltSoundStats* stats);
+ALTSOUNDAPI void AltSoundCtxResetStats(AltSoundContext* context);
 
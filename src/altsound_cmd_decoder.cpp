@@ -0,0 +1,388 @@
+// ---------------------------------------------------------------------------
+// altsound_cmd_decoder.cpp
+//
+// Per-hardware-generation sound command decoders
+// ---------------------------------------------------------------------------
+// license:BSD-3-Clause
+// copyright-holders: Dave Roscoe
+// ---------------------------------------------------------------------------
+
+#include "altsound_cmd_decoder.hpp"
+#include "altsound_logger.hpp"
+#include "altsound_processor_base.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+extern AltsoundLogger alog;
+
+// ---------------------------------------------------------------------------
+// AltsoundCmdDecoder
+// ---------------------------------------------------------------------------
+
+AltsoundCmdDecoder::AltsoundCmdDecoder(const char* name_in)
+: name(name_in)
+{
+	reset();
+}
+
+// ---------------------------------------------------------------------------
+
+void AltsoundCmdDecoder::reset()
+{
+	clearHistory();
+	stored_command = -1;
+	cmd_filter = 0;
+	last_time_ns = NO_TIME;
+}
+
+// ---------------------------------------------------------------------------
+
+void AltsoundCmdDecoder::clearHistory()
+{
+	std::fill_n(cmd_buffer, ALT_MAX_CMDS, ~0u);
+	head = 0;
+	cmd_counter = 0;
+}
+
+// ---------------------------------------------------------------------------
+
+AltsoundCmdDecoder::Result AltsoundCmdDecoder::decode(unsigned int cmd, uint64_t time_ns,
+                                                      AltsoundProcessorBase* processor,
+                                                      unsigned int& cmd_out)
+{
+	if (last_time_ns != NO_TIME && time_ns > last_time_ns)
+		onByteGap(time_ns - last_time_ns);
+	last_time_ns = time_ns;
+
+	cmd_counter++;
+
+	// add command to the history; the ring index replaces shifting the
+	// whole buffer on every byte
+	head = (head + 1) & (ALT_MAX_CMDS - 1);
+	cmd_buffer[head] = cmd;
+
+	// pre-process commands based on ROM hardware platform
+	preprocess(cmd, processor);
+
+	if (cmd_filter || (cmd_counter & 1) != 0) {
+		// Some commands are 16-bits collected from two 8-bit commands.  If
+		// the command is filtered or we have not received enough data yet,
+		// try again on the next command.  Store the command for accumulation
+		stored_command = cmd;
+		return cmd_filter ? Result::Filtered : Result::Incomplete;
+	}
+
+	// combine stored command with the current
+	cmd_out = (stored_command << 8) | cmd;
+	return Result::Complete;
+}
+
+// ---------------------------------------------------------------------------
+// WPCDCS, WPCSECURITY, WPC95DCS, WPC95
+// ---------------------------------------------------------------------------
+
+class DcsCmdDecoder final : public AltsoundCmdDecoder {
+public:
+	DcsCmdDecoder() : AltsoundCmdDecoder("WPCDCS, WPCSECURITY, WPC95DCS, WPC95") {}
+
+	void postprocess(unsigned int cmd_combined, AltsoundProcessorBase* processor) override
+	{
+		if (cmd_combined == 0x03E3 && processor) { // stop music
+			ALT_INFO(0, "Stopping MUSIC(2)");
+			processor->stopMusic();
+		}
+	}
+
+protected:
+
+	// For future improvements, also check https://github.com/mjrgh/DCSExplorer/
+	// for a lot of new info on the DCS inner workings
+
+	// Each byte of a command sequence must be received on the DCS side within
+	// 100ms of the previous byte.  The DCS software clears any buffered bytes
+	// if more than 100ms elapses between consecutive bytes, which a sender can
+	// use to reset the connection before starting a new command sequence.
+	void onByteGap(uint64_t gap_ns) override
+	{
+		if (gap_ns > 100000000ull) {
+			ALT_DEBUG(0, "DCS inter-byte timeout. Clearing buffered bytes");
+			clearHistory();
+		}
+	}
+
+	void preprocess(unsigned int /*cmd*/, AltsoundProcessorBase* processor) override
+	{
+		if (hist(3) == 0x55 && hist(2) >= 0xAB && hist(2) <= 0xB0 && hist(1) == (hist(0) ^ 0xFF)) {
+			// per-DCS-channel mixing level, but on our interpretation level we
+			// do not have any knowledge about the internal channel structures of DCS
+			ALT_DEBUG(0, "Change volume pc %u %u", hist(2), hist(1));
+		}
+		else if (hist(3) == 0x55 && (hist(2) == 0xC2 || hist(2) == 0xC3)) {
+			// DCS software major/minor version number
+		}
+		else if (hist(3) == 0x55 && hist(2) >= 0xBA && hist(2) <= 0xC1 && hist(1) == (hist(0) ^ 0xFF)) {
+			// mystery command, see http://mjrnet.org/pinscape/dcsref/DCS_format_reference.html#SpecialCommands
+		}
+		else if (hist(3) == 0x55 && hist(2) == 0xAA) { // change master volume?
+			// DAR@20240208 The check below is dangerous.  If this is still a
+			//              problem, it would be better to revisit it when it
+			//              reappears to implement a more robust solution that
+			//              works for all systems
+			//              See https://github.com/vpinball/pinmame/issues/220
+			//|| (hist(2) == 0x00 && hist(1) == 0x00 && hist(0) == 0x00) { // glitch in command buffer?
+			if (hist(1) == (hist(0) ^ 0xFF)) { // change volume op (following first byte = volume, second = ~volume, if these don't match: ignore)
+				if (processor && processor->romControlsVol()) {
+					//!! input is 0..255 (or ..248 in practice? BUT at least MM triggers 255 at max volume in the menu) though, not just 0..127!
+					processor->setGlobalVol((hist(1) == 0) ? 0.f : std::min(powf(0.981201f, (float)(255u - hist(1))) * 4.0f, 1.0f)); //!! *4 is magic
+					ALT_INFO(0, "Change volume %.02f (%u)", processor->getGlobalVol(), hist(1));
+				}
+			}
+			else
+				ALT_DEBUG(0, "Command filtered %02X %02X %02X %02X", hist(3), hist(2), hist(1), hist(0));
+		}
+		else {
+			cmd_filter = 0;
+			return;
+		}
+
+		// control sequence consumed
+		clearHistory();
+		cmd_filter = 1;
+	}
+};
+
+// ---------------------------------------------------------------------------
+// WPCALPHA_2, WPCDMD, WPCFLIPTRON
+// ---------------------------------------------------------------------------
+
+class WpcCmdDecoder final : public AltsoundCmdDecoder {
+public:
+	WpcCmdDecoder() : AltsoundCmdDecoder("WPCALPHA_2, WPCDMD, WPCFLIPTRON") {}
+
+protected:
+
+	// remaps everything to 16bit, a bit stupid maybe
+	void preprocess(unsigned int cmd, AltsoundProcessorBase* processor) override
+	{
+		cmd_filter = 0;
+		if (hist(2) == 0x79 && hist(1) == (hist(0) ^ 0xFF)) { // change volume op (following first byte = volume, second = ~volume, if these don't match: ignore)
+			if (processor && processor->romControlsVol()) {
+				processor->setGlobalVol(std::min((float)hist(1) / 127.f, 1.0f));
+				ALT_INFO(0, "Change volume %.02f", processor->getGlobalVol());
+			}
+
+			clearHistory();
+			cmd_filter = 1;
+		}
+		else if (hist(1) == 0x7A) { // 16bit command second part //!! TZ triggers a 0xFF in the beginning -> check sequence and filter?
+			stored_command = hist(1);
+			cmd_counter = 0;
+		}
+		else if (cmd != 0x7A) { // 8 bit command
+			stored_command = 0;
+			cmd_counter = 0;
+		}
+		else // 16bit command first part
+			cmd_counter = 1;
+	}
+};
+
+// ---------------------------------------------------------------------------
+// WPCALPHA_1, S11, S11X, S11B2, S11C
+// ---------------------------------------------------------------------------
+
+class S11CmdDecoder final : public AltsoundCmdDecoder {
+public:
+	S11CmdDecoder() : AltsoundCmdDecoder("WPCALPHA_1, S11, S11X, S11B2, S11C") {}
+
+protected:
+
+	// remaps everything to 16bit, a bit stupid maybe //!! test all these generations!
+	void preprocess(unsigned int cmd, AltsoundProcessorBase* /*processor*/) override
+	{
+		if (cmd != hist(1)) { //!! some stuff is doubled or tripled -> filter out?
+			stored_command = 0; // 8 bit command //!! 7F & 7E opcodes?
+			cmd_counter = 0;
+		}
+		else
+			cmd_counter = 1;
+	}
+};
+
+// ---------------------------------------------------------------------------
+// DE, DEDMD16, DEDMD32, DEDMD64
+// ---------------------------------------------------------------------------
+
+class DeCmdDecoder final : public AltsoundCmdDecoder {
+public:
+	explicit DeCmdDecoder(bool stop_music_cmds_in)
+	: AltsoundCmdDecoder("DEDMD16, DEDMD32, DEDMD64, DE"),
+	  stop_music_cmds(stop_music_cmds_in)
+	{}
+
+	void postprocess(unsigned int cmd_combined, AltsoundProcessorBase* processor) override
+	{
+		if (stop_music_cmds && (cmd_combined == 0x0018 || cmd_combined == 0x0023) && processor) { // stop music //!! ???? 0x0019??
+			ALT_INFO(0, "Stopping MUSIC(3)");
+			processor->stopMusic();
+		}
+	}
+
+protected:
+
+	// remaps everything to 16bit, a bit stupid maybe.  This one just tested
+	// with BTTF so far
+	void preprocess(unsigned int cmd, AltsoundProcessorBase* /*processor*/) override
+	{
+		if (cmd != 0xFF && cmd != 0x00) { // 8 bit command
+			stored_command = 0;
+			cmd_counter = 0;
+		}
+		else // ignore
+			cmd_counter = 1;
+
+		if (hist(1) == 0x00 && cmd == 0x00) { // handle 0x0000 special //!! meh?
+			stored_command = 0;
+			cmd_counter = 0;
+		}
+	}
+
+private:
+	bool stop_music_cmds; // DEDMD32 only
+};
+
+// ---------------------------------------------------------------------------
+// WS, WS_1, WS_2
+// ---------------------------------------------------------------------------
+
+class WhitestarCmdDecoder final : public AltsoundCmdDecoder {
+public:
+	WhitestarCmdDecoder() : AltsoundCmdDecoder("WS, WS_1, WS_2") {}
+
+	void postprocess(unsigned int cmd_combined, AltsoundProcessorBase* processor) override
+	{
+		if ((cmd_combined == 0x0000 || (cmd_combined & 0xf0ff) == 0xf000) && processor) { // stop music
+			ALT_INFO(0, "Stopping MUSIC(4)");
+			processor->stopMusic();
+		}
+	}
+
+protected:
+
+	void preprocess(unsigned int cmd, AltsoundProcessorBase* processor) override
+	{
+		cmd_filter = 0;
+		if (hist(1) == 0xFE) {
+			if (cmd >= 0x10 && cmd <= 0x2F) {
+				if (processor && processor->romControlsVol()) {
+					processor->setGlobalVol((float)(0x2F - cmd) / 31.f);
+					ALT_INFO(0, "Change volume %.02f", processor->getGlobalVol());
+				}
+
+				clearHistory();
+				cmd_filter = 1;
+			}
+			else if (cmd >= 0x01 && cmd <= 0x0F) { // ignore FE 01 ... FE 0F
+				stored_command = 0;
+				cmd_counter = 0;
+				cmd_filter = 1;
+			}
+		}
+
+		if ((cmd & 0xFC) == 0xFC) // start byte of a command will ALWAYS be FF, FE, FD, FC, and never the second byte!
+			cmd_counter = 1;
+	}
+};
+
+// ---------------------------------------------------------------------------
+// GTS80 (Gottlieb System 80A)
+// ---------------------------------------------------------------------------
+
+class Gts80CmdDecoder final : public AltsoundCmdDecoder {
+public:
+	Gts80CmdDecoder() : AltsoundCmdDecoder("GTS80A") {}
+
+protected:
+
+	// DAR@20240207 Seems to be 8-bit commands
+	void preprocess(unsigned int cmd, AltsoundProcessorBase* /*processor*/) override
+	{
+		// DAR@29249297 It appears that this system sends 0x00 commands as a
+		//              clock signal, since we recieve a ridiculous number of
+		//              them.  Filter them out
+		stored_command = 0;
+		cmd_counter = 0;
+		cmd_filter = (cmd == 0x00) ? 1 : 0;
+	}
+};
+
+// ---------------------------------------------------------------------------
+// Generic: pairs bytes into 16-bit commands
+// ---------------------------------------------------------------------------
+
+class GenericCmdDecoder final : public AltsoundCmdDecoder {
+public:
+	GenericCmdDecoder() : AltsoundCmdDecoder("generic") {}
+};
+
+// ---------------------------------------------------------------------------
+// Factory
+// ---------------------------------------------------------------------------
+
+namespace {
+
+template <typename T>
+std::unique_ptr<AltsoundCmdDecoder> make_decoder()
+{
+	return std::unique_ptr<AltsoundCmdDecoder>(new T());
+}
+
+std::unique_ptr<AltsoundCmdDecoder> make_de_decoder()
+{
+	return std::unique_ptr<AltsoundCmdDecoder>(new DeCmdDecoder(false));
+}
+
+std::unique_ptr<AltsoundCmdDecoder> make_dedmd32_decoder()
+{
+	return std::unique_ptr<AltsoundCmdDecoder>(new DeCmdDecoder(true));
+}
+
+struct DecoderEntry {
+	ALTSOUND_HARDWARE_GEN gen;
+	std::unique_ptr<AltsoundCmdDecoder> (*create)();
+};
+
+const DecoderEntry decoder_table[] = {
+	{ ALTSOUND_HARDWARE_GEN_WPCDCS,      make_decoder<DcsCmdDecoder> },
+	{ ALTSOUND_HARDWARE_GEN_WPCSECURITY, make_decoder<DcsCmdDecoder> },
+	{ ALTSOUND_HARDWARE_GEN_WPC95DCS,    make_decoder<DcsCmdDecoder> },
+	{ ALTSOUND_HARDWARE_GEN_WPC95,       make_decoder<DcsCmdDecoder> },
+	{ ALTSOUND_HARDWARE_GEN_WPCALPHA_2,  make_decoder<WpcCmdDecoder> }, //!! ?? test this gen actually
+	{ ALTSOUND_HARDWARE_GEN_WPCDMD,      make_decoder<WpcCmdDecoder> },
+	{ ALTSOUND_HARDWARE_GEN_WPCFLIPTRON, make_decoder<WpcCmdDecoder> },
+	{ ALTSOUND_HARDWARE_GEN_WPCALPHA_1,  make_decoder<S11CmdDecoder> },
+	{ ALTSOUND_HARDWARE_GEN_S11,         make_decoder<S11CmdDecoder> },
+	{ ALTSOUND_HARDWARE_GEN_S11X,        make_decoder<S11CmdDecoder> },
+	{ ALTSOUND_HARDWARE_GEN_S11B2,       make_decoder<S11CmdDecoder> },
+	{ ALTSOUND_HARDWARE_GEN_S11C,        make_decoder<S11CmdDecoder> },
+	{ ALTSOUND_HARDWARE_GEN_DE,          make_de_decoder },
+	{ ALTSOUND_HARDWARE_GEN_DEDMD16,     make_de_decoder },
+	{ ALTSOUND_HARDWARE_GEN_DEDMD32,     make_dedmd32_decoder },
+	{ ALTSOUND_HARDWARE_GEN_DEDMD64,     make_de_decoder },
+	{ ALTSOUND_HARDWARE_GEN_WS,          make_decoder<WhitestarCmdDecoder> },
+	{ ALTSOUND_HARDWARE_GEN_WS_1,        make_decoder<WhitestarCmdDecoder> },
+	{ ALTSOUND_HARDWARE_GEN_WS_2,        make_decoder<WhitestarCmdDecoder> },
+	{ ALTSOUND_HARDWARE_GEN_GTS80,       make_decoder<Gts80CmdDecoder> },
+};
+
+} // namespace
+
+std::unique_ptr<AltsoundCmdDecoder> AltsoundCmdDecoder::create(ALTSOUND_HARDWARE_GEN gen)
+{
+	for (const DecoderEntry& entry : decoder_table) {
+		if (entry.gen == gen)
+			return entry.create();
+	}
+	return make_decoder<GenericCmdDecoder>();
+}
@@ -0,0 +1,96 @@
+// ---------------------------------------------------------------------------
+// altsound_cmd_decoder.hpp
+//
+// Per-hardware-generation sound command decoders.  A decoder assembles the
+// raw bytes the ROM sends to its sound board into the (up to) 16-bit
+// commands that are looked up in the sample tables, filters board control
+// sequences (volume, version queries) and applies generation-specific
+// post-processing.  One decoder is selected when the hardware generation is
+// set, so the per-byte path never re-dispatches on the generation.
+// ---------------------------------------------------------------------------
+// license:BSD-3-Clause
+// copyright-holders: Dave Roscoe
+// ---------------------------------------------------------------------------
+
+#ifndef ALTSOUND_CMD_DECODER_HPP
+#define ALTSOUND_CMD_DECODER_HPP
+#if !defined(__GNUC__) || (__GNUC__ == 3 && __GNUC_MINOR__ >= 4) || (__GNUC__ >= 4)	// GCC supports "pragma once" correctly since 3.4
+#pragma once
+#endif
+
+#include "altsound.h"
+#include "altsound_data.hpp"
+
+#include <cstdint>
+#include <memory>
+
+class AltsoundProcessorBase;
+
+class AltsoundCmdDecoder {
+public:
+
+	enum class Result {
+		Filtered,   // byte consumed by a control sequence (or ignored)
+		Incomplete, // first half of a 16-bit command
+		Complete    // cmd_out holds a command ready for the processor
+	};
+
+	virtual ~AltsoundCmdDecoder() {}
+
+	// Creates the decoder for the given hardware generation.  Unknown
+	// generations get the generic decoder, which pairs bytes into 16-bit
+	// commands
+	static std::unique_ptr<AltsoundCmdDecoder> create(ALTSOUND_HARDWARE_GEN gen);
+
+	// Feeds one command byte.  time_ns is a monotonic timestamp of the byte
+	// (emulator or wall clock), used for inter-byte timeouts.  processor
+	// receives volume changes decoded from control sequences; it may be null
+	// when decoding without playback
+	Result decode(unsigned int cmd, uint64_t time_ns, AltsoundProcessorBase* processor,
+	              unsigned int& cmd_out);
+
+	// Generation-specific handling of a completed command (e.g. stop music)
+	virtual void postprocess(unsigned int /*cmd_combined*/, AltsoundProcessorBase* /*processor*/) {}
+
+	// Clears the command history and any partially received command
+	void reset();
+
+	// Name of the generation family handled by this decoder
+	const char* getName() const { return name; }
+
+protected:
+
+	explicit AltsoundCmdDecoder(const char* name_in);
+
+	// Generation-specific bookkeeping for the byte just pushed.  Adjusts
+	// cmd_counter/stored_command/cmd_filter
+	virtual void preprocess(unsigned int /*cmd*/, AltsoundProcessorBase* /*processor*/) {}
+
+	// Called before a byte is pushed, with the elapsed time since the
+	// previous byte
+	virtual void onByteGap(uint64_t /*gap_ns*/) {}
+
+	// Command history, 0 = most recent byte
+	unsigned int hist(unsigned int i) const { return cmd_buffer[(head - i) & (ALT_MAX_CMDS - 1)]; }
+
+	// Discards the history and restarts command assembly with the next byte
+	void clearHistory();
+
+protected: // data
+	unsigned int cmd_counter;
+	int stored_command;
+	unsigned int cmd_filter;
+
+private: // data
+	static_assert((ALT_MAX_CMDS & (ALT_MAX_CMDS - 1)) == 0, "ALT_MAX_CMDS must be a power of two");
+
+	unsigned int cmd_buffer[ALT_MAX_CMDS];
+	unsigned int head;
+	// time of the previous byte; emulator timestamps and replayed logs
+	// start at 0, so "none yet" is a value of its own
+	static constexpr uint64_t NO_TIME = UINT64_MAX;
+	uint64_t last_time_ns;
+	const char* name;
+};
+
+#endif // ALTSOUND_CMD_DECODER_HPP
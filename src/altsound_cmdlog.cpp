@@ -0,0 +1,434 @@
+// ---------------------------------------------------------------------------
+// altsound_cmdlog.cpp
+//
+// Binary sound command recorder and command log conversion
+// ---------------------------------------------------------------------------
+// license:BSD-3-Clause
+// copyright-holders: Dave Roscoe
+// ---------------------------------------------------------------------------
+
+#include "altsound_cmdlog.hpp"
+#include "altsound_cmd_decoder.hpp"
+#include "altsound_logger.hpp"
+#include "altsound_realtime.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+
+extern AltsoundLogger alog;
+
+namespace {
+
+constexpr char magic[8] = { 'A', 'L', 'T', 'C', 'M', 'D', 'L', 'G' };
+constexpr uint32_t formatVersion = 1;
+constexpr uint32_t entrySize = 24;
+
+// longest altsound path accepted when reading a header
+constexpr uint32_t maxPathLength = 4096;
+
+void put(uint8_t* dst, uint64_t value, size_t size)
+{
+	for (size_t i = 0; i < size; ++i)
+		dst[i] = (uint8_t)(value >> (8 * i));
+}
+
+uint64_t get(const uint8_t* src, size_t size)
+{
+	uint64_t value = 0;
+	for (size_t i = 0; i < size; ++i)
+		value |= (uint64_t)src[i] << (8 * i);
+	return value;
+}
+
+bool readExact(FILE* in, uint8_t* dst, size_t size)
+{
+	return fread(dst, 1, size, in) == size;
+}
+
+} // namespace
+
+// ----------------------------------------------------------------------------
+// AltsoundCmdLog
+// ----------------------------------------------------------------------------
+
+bool AltsoundCmdLog::isBinary(const string& path)
+{
+	FILE* in = fopen(path.c_str(), "rb");
+	if (!in)
+		return false;
+
+	uint8_t buf[sizeof(magic)];
+	const bool binary = readExact(in, buf, sizeof(buf)) && memcmp(buf, magic, sizeof(magic)) == 0;
+	fclose(in);
+	return binary;
+}
+
+// ----------------------------------------------------------------------------
+
+bool AltsoundCmdLog::load(const string& path)
+{
+	altsound_path.clear();
+	hardware_gen = ALTSOUND_HARDWARE_GEN_NONE;
+	entries.clear();
+
+	return isBinary(path) ? loadBinary(path) : loadText(path);
+}
+
+// ----------------------------------------------------------------------------
+
+bool AltsoundCmdLog::loadBinary(const string& path)
+{
+	FILE* in = fopen(path.c_str(), "rb");
+	if (!in) {
+		ALT_ERROR(0, "Unable to open command log: %s", path.c_str());
+		return false;
+	}
+
+	uint8_t header[sizeof(magic) + 20];
+	if (!readExact(in, header, sizeof(header))) {
+		ALT_ERROR(0, "Truncated command log header: %s", path.c_str());
+		fclose(in);
+		return false;
+	}
+
+	const uint32_t version = (uint32_t)get(header + 8, 4);
+	const uint32_t size = (uint32_t)get(header + 12, 4);
+	const uint32_t path_length = (uint32_t)get(header + 24, 4);
+	if (version != formatVersion || size < entrySize || path_length > maxPathLength) {
+		ALT_ERROR(0, "Unsupported command log (version %u): %s", version, path.c_str());
+		fclose(in);
+		return false;
+	}
+	hardware_gen = (ALTSOUND_HARDWARE_GEN)get(header + 16, 8);
+
+	altsound_path.resize(path_length);
+	if (path_length && !readExact(in, (uint8_t*)altsound_path.data(), path_length)) {
+		ALT_ERROR(0, "Truncated command log header: %s", path.c_str());
+		fclose(in);
+		return false;
+	}
+
+	// later versions may append fields to an entry; they are skipped
+	std::vector<uint8_t> buf(size);
+	while (readExact(in, buf.data(), size)) {
+		AltsoundCmdLogEntry& entry = entries.emplace_back();
+		entry.time_ns = get(&buf[0], 8);
+		entry.value = get(&buf[8], 8);
+		entry.attenuation = (int32_t)(uint32_t)get(&buf[16], 4);
+		entry.type = (AltsoundCmdLogEntry::Type)buf[20];
+	}
+	fclose(in);
+
+	ALT_INFO(0, "Loaded %zu command log entries: %s", entries.size(), path.c_str());
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+
+bool AltsoundCmdLog::loadText(const string& path)
+{
+	std::ifstream in(path);
+	if (!in.is_open()) {
+		ALT_ERROR(0, "Unable to open command log: %s", path.c_str());
+		return false;
+	}
+
+	// header: "altsound_path: <path>" and "hardware_gen: 0x<gen>"
+	string line;
+	for (int i = 0; i < 2; ++i) {
+		size_t colon;
+		if (!std::getline(in, line) || (colon = line.find(':')) == string::npos) {
+			ALT_ERROR(0, "Missing command log header: %s", path.c_str());
+			return false;
+		}
+
+		size_t start = colon + 1;
+		while (start < line.size() && line[start] == ' ')
+			++start;
+
+		string value = line.substr(start);
+		if (!value.empty() && value.back() == '\r')
+			value.pop_back();
+
+		if (i == 0)
+			altsound_path = value;
+		else
+			hardware_gen = (ALTSOUND_HARDWARE_GEN)std::strtoull(value.c_str(), nullptr, 16);
+	}
+
+	// "<msec since previous command>, 0x<command>, <comment>"
+	uint64_t time_ns = 0;
+	while (std::getline(in, line)) {
+		char* end;
+		const unsigned long msec = std::strtoul(line.c_str(), &end, 10);
+		if (end == line.c_str())
+			continue;
+
+		const size_t hex = line.find("0x", end - line.c_str());
+		if (hex == string::npos)
+			continue;
+
+		const unsigned long cmd = std::strtoul(line.c_str() + hex + 2, nullptr, 16);
+		time_ns += (uint64_t)msec * 1000000ull;
+
+		AltsoundCmdLogEntry entry;
+		entry.time_ns = time_ns;
+		entry.value = (cmd >> 8) & 0xFF;
+		entries.push_back(entry);
+		entry.value = cmd & 0xFF;
+		entries.push_back(entry);
+	}
+
+	ALT_INFO(0, "Loaded %zu command log entries: %s", entries.size(), path.c_str());
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+
+bool AltsoundCmdLog::writeHeader(FILE* out, const string& altsound_path, ALTSOUND_HARDWARE_GEN gen)
+{
+	uint8_t header[sizeof(magic) + 20];
+	memcpy(header, magic, sizeof(magic));
+	put(header + 8, formatVersion, 4);
+	put(header + 12, entrySize, 4);
+	put(header + 16, (uint64_t)gen, 8);
+	put(header + 24, altsound_path.size(), 4);
+
+	return fwrite(header, 1, sizeof(header), out) == sizeof(header)
+	    && fwrite(altsound_path.data(), 1, altsound_path.size(), out) == altsound_path.size();
+}
+
+// ----------------------------------------------------------------------------
+
+bool AltsoundCmdLog::writeEntry(FILE* out, const AltsoundCmdLogEntry& entry)
+{
+	uint8_t buf[entrySize] = {};
+	put(&buf[0], entry.time_ns, 8);
+	put(&buf[8], entry.value, 8);
+	put(&buf[16], (uint32_t)entry.attenuation, 4);
+	buf[20] = (uint8_t)entry.type;
+
+	return fwrite(buf, 1, sizeof(buf), out) == sizeof(buf);
+}
+
+// ----------------------------------------------------------------------------
+
+bool AltsoundCmdLog::saveBinary(const string& path) const
+{
+	FILE* out = fopen(path.c_str(), "wb");
+	if (!out) {
+		ALT_ERROR(0, "Unable to create command log: %s", path.c_str());
+		return false;
+	}
+
+	bool success = writeHeader(out, altsound_path, hardware_gen);
+	for (const AltsoundCmdLogEntry& entry : entries)
+		success = success && writeEntry(out, entry);
+
+	success = (fclose(out) == 0) && success;
+	if (!success)
+		ALT_ERROR(0, "Unable to write command log: %s", path.c_str());
+
+	return success;
+}
+
+// ----------------------------------------------------------------------------
+
+bool AltsoundCmdLog::saveText(const string& path) const
+{
+	FILE* out = fopen(path.c_str(), "w");
+	if (!out) {
+		ALT_ERROR(0, "Unable to create command log: %s", path.c_str());
+		return false;
+	}
+
+	ALTSOUND_HARDWARE_GEN gen = initialHardwareGen();
+	fprintf(out, "altsound_path: %s\n", altsound_path.c_str());
+	fprintf(out, "hardware_gen: 0x%013llx\n", (unsigned long long)gen);
+
+	// Replay the bytes through the decoder of the recorded generation, so
+	// the file lists the same commands the processor received
+	std::unique_ptr<AltsoundCmdDecoder> decoder = AltsoundCmdDecoder::create(gen);
+	uint64_t last_ms = 0;
+
+	for (const AltsoundCmdLogEntry& entry : entries) {
+		if (entry.type == AltsoundCmdLogEntry::Type::HardwareGen) {
+			if ((ALTSOUND_HARDWARE_GEN)entry.value != gen) {
+				gen = (ALTSOUND_HARDWARE_GEN)entry.value;
+				decoder = AltsoundCmdDecoder::create(gen);
+			}
+			continue;
+		}
+
+		unsigned int cmd = 0;
+		if (decoder->decode((unsigned int)entry.value, entry.time_ns, nullptr, cmd)
+		    != AltsoundCmdDecoder::Result::Complete)
+			continue;
+		decoder->postprocess(cmd, nullptr);
+
+		// deltas between whole milliseconds, so rounding does not accumulate
+		const uint64_t ms = entry.time_ns / 1000000ull;
+		fprintf(out, "%010llu, 0x%04x, <user comments here>\n", (unsigned long long)(ms - last_ms), cmd);
+		last_ms = ms;
+	}
+
+	const bool success = !ferror(out);
+	if (fclose(out) != 0 || !success) {
+		ALT_ERROR(0, "Unable to write command log: %s", path.c_str());
+		return false;
+	}
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+
+ALTSOUND_HARDWARE_GEN AltsoundCmdLog::initialHardwareGen() const
+{
+	ALTSOUND_HARDWARE_GEN gen = hardware_gen;
+	for (const AltsoundCmdLogEntry& entry : entries) {
+		if (entry.type == AltsoundCmdLogEntry::Type::Byte)
+			break;
+		gen = (ALTSOUND_HARDWARE_GEN)entry.value;
+	}
+	return gen;
+}
+
+// ----------------------------------------------------------------------------
+// AltsoundCmdRecorder
+// ----------------------------------------------------------------------------
+
+AltsoundCmdRecorder::~AltsoundCmdRecorder()
+{
+	stop();
+}
+
+// ----------------------------------------------------------------------------
+
+bool AltsoundCmdRecorder::start(const string& path, const string& altsound_path, ALTSOUND_HARDWARE_GEN gen)
+{
+	if (recording()) {
+		ALT_ERROR(0, "Already recording sound commands: %s", file_path.c_str());
+		return false;
+	}
+
+	file = fopen(path.c_str(), "wb");
+	if (!file) {
+		ALT_ERROR(0, "Unable to create sound command log: %s", path.c_str());
+		return false;
+	}
+
+	if (!AltsoundCmdLog::writeHeader(file, altsound_path, gen)) {
+		ALT_ERROR(0, "Unable to write sound command log: %s", path.c_str());
+		fclose(file);
+		file = nullptr;
+		return false;
+	}
+
+	file_path = path;
+	pending.reserve(wakeThreshold);
+	stopping = false;
+	have_base = false;
+	num_written = 0;
+	write_failed = false;
+
+	writer = std::thread(&AltsoundCmdRecorder::writerMain, this);
+	active.store(true, std::memory_order_release);
+
+	ALT_INFO(0, "Recording sound commands: %s", path.c_str());
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundCmdRecorder::stop()
+{
+	if (!active.exchange(false))
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_one();
+	writer.join();
+
+	fclose(file);
+	file = nullptr;
+
+	if (write_failed)
+		ALT_ERROR(0, "Unable to write sound command log: %s", file_path.c_str());
+	ALT_INFO(0, "Sound command log closed: %s (%zu entries)", file_path.c_str(), num_written);
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundCmdRecorder::recordByte(unsigned int cmd, int attenuation, uint64_t time_ns)
+{
+	AltsoundCmdLogEntry entry;
+	entry.value = cmd;
+	entry.attenuation = attenuation;
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	// timestamps are relative to the first byte.  time_ns is the decoder's
+	// clock, so a replay reproduces its inter-byte timeouts
+	if (!have_base) {
+		have_base = true;
+		base_ns = time_ns;
+	}
+	last_ns = time_ns > base_ns ? time_ns - base_ns : 0;
+	entry.time_ns = last_ns;
+
+	pending.push_back(entry);
+	if (pending.size() == wakeThreshold)
+		wake.notify_one();
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundCmdRecorder::recordHardwareGen(ALTSOUND_HARDWARE_GEN gen)
+{
+	AltsoundCmdLogEntry entry;
+	entry.type = AltsoundCmdLogEntry::Type::HardwareGen;
+	entry.value = (uint64_t)gen;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	entry.time_ns = last_ns;
+	pending.push_back(entry);
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundCmdRecorder::writerMain()
+{
+	std::vector<AltsoundCmdLogEntry> writing;
+	writing.reserve(wakeThreshold);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		// Wakes early when the queue fills; otherwise writes a few times per
+		// second so a crash loses little of the log
+		wake.wait_for(lock, std::chrono::milliseconds(250),
+			[this]() { return stopping || pending.size() >= wakeThreshold; });
+
+		writing.swap(pending);
+		const bool done = stopping;
+		lock.unlock();
+
+		AltsoundRealtime::applyToWorkerThread("command recorder");
+
+		for (const AltsoundCmdLogEntry& entry : writing)
+			write_failed |= !AltsoundCmdLog::writeEntry(file, entry);
+		if (!writing.empty())
+			fflush(file);
+		num_written += writing.size();
+		writing.clear();
+
+		if (done)
+			return;
+		lock.lock();
+	}
+}
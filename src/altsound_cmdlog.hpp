@@ -0,0 +1,131 @@
+// ---------------------------------------------------------------------------
+// altsound_cmdlog.hpp
+//
+// Sound command logs.  AltsoundCmdRecorder captures every command byte the
+// ROM sends, with its attenuation and a nanosecond timestamp, into a binary
+// log written by a background thread.  AltsoundCmdLog reads and writes those
+// logs, and converts them to and from the cmdlog.txt text format used by
+// altsound_test.
+//
+// Binary layout (little-endian):
+//   header: "ALTCMDLG", u32 version, u32 entry size, u64 hardware gen,
+//           u32 path length, altsound path
+//   entry:  u64 time_ns, u64 value, i32 attenuation, u8 type, 3 reserved
+// ---------------------------------------------------------------------------
+// license:BSD-3-Clause
+// copyright-holders: Dave Roscoe
+// ---------------------------------------------------------------------------
+
+#ifndef ALTSOUND_CMDLOG_HPP
+#define ALTSOUND_CMDLOG_HPP
+#if !defined(__GNUC__) || (__GNUC__ == 3 && __GNUC_MINOR__ >= 4) || (__GNUC__ >= 4)	// GCC supports "pragma once" correctly since 3.4
+#pragma once
+#endif
+
+#include "altsound.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using std::string;
+
+struct AltsoundCmdLogEntry {
+	enum class Type : uint8_t {
+		Byte,       // value is a command byte
+		HardwareGen // value is the hardware generation set from here on
+	};
+
+	uint64_t time_ns = 0; // since the first recorded byte
+	uint64_t value = 0;
+	int32_t attenuation = 0;
+	Type type = Type::Byte;
+};
+
+// ----------------------------------------------------------------------------
+
+class AltsoundCmdLog {
+public:
+
+	// Loads a binary or text command log.  Text logs hold 16-bit commands,
+	// which are expanded into their high and low bytes
+	bool load(const string& path);
+
+	bool saveBinary(const string& path) const;
+
+	// Writes the commands the decoder assembles from the recorded bytes.
+	// Filtered bytes (volume and control sequences) and attenuation have no
+	// text representation and are dropped
+	bool saveText(const string& path) const;
+
+	// hardware generation in effect for the first recorded byte
+	ALTSOUND_HARDWARE_GEN initialHardwareGen() const;
+
+	static bool isBinary(const string& path);
+
+	// binary serialization, shared with the recorder
+	static bool writeHeader(FILE* out, const string& altsound_path, ALTSOUND_HARDWARE_GEN gen);
+	static bool writeEntry(FILE* out, const AltsoundCmdLogEntry& entry);
+
+public: // data
+
+	string altsound_path;
+	ALTSOUND_HARDWARE_GEN hardware_gen = ALTSOUND_HARDWARE_GEN_NONE;
+	std::vector<AltsoundCmdLogEntry> entries;
+
+private: // functions
+
+	bool loadBinary(const string& path);
+	bool loadText(const string& path);
+};
+
+// ----------------------------------------------------------------------------
+
+class AltsoundCmdRecorder {
+public:
+
+	~AltsoundCmdRecorder();
+
+	// Creates the log file and starts the writer thread
+	bool start(const string& path, const string& altsound_path, ALTSOUND_HARDWARE_GEN gen);
+
+	// Writes the remaining entries and closes the log
+	void stop();
+
+	bool recording() const { return active.load(std::memory_order_relaxed); }
+
+	// Queues an entry for the writer.  Never touches the file
+	void recordByte(unsigned int cmd, int attenuation, uint64_t time_ns);
+	void recordHardwareGen(ALTSOUND_HARDWARE_GEN gen);
+
+private: // functions
+
+	void writerMain();
+
+private: // data
+
+	// entries queued before the writer is woken early
+	static constexpr size_t wakeThreshold = 1024;
+
+	std::atomic<bool> active{ false };
+	FILE* file = nullptr;
+	string file_path;
+	std::thread writer;
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::vector<AltsoundCmdLogEntry> pending;
+	bool stopping = false;
+	bool have_base = false;
+	uint64_t base_ns = 0;
+	uint64_t last_ns = 0;
+	size_t num_written = 0;
+	bool write_failed = false;
+};
+
+#endif // ALTSOUND_CMDLOG_HPP
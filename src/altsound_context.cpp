@@ -0,0 +1,20 @@
+// ---------------------------------------------------------------------------
+// altsound_context.cpp
+//
+// Engine instance state and its binding to threads
+// ---------------------------------------------------------------------------
+// license:BSD-3-Clause
+// copyright-holders: Dave Roscoe
+// ---------------------------------------------------------------------------
+
+#include "altsound_context.hpp"
+
+thread_local AltsoundContext* AltsoundContext::bound = nullptr;
+
+// ----------------------------------------------------------------------------
+
+AltsoundContext& AltsoundContext::defaultContext()
+{
+	static AltsoundContext context;
+	return context;
+}
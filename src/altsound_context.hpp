@@ -0,0 +1,132 @@
+// ---------------------------------------------------------------------------
+// altsound_context.hpp
+//
+// State of one engine instance behind AltSoundCreateContext().  Everything
+// a table needs (processor, streams, mixer, output, statistics) lives here,
+// so contexts never share state and can run in parallel.  The context a
+// thread works on is bound to it: API calls bind theirs for their duration,
+// the audio threads bind theirs for good.  Threads that bound none work on
+// the default context behind the API functions without a context.
+// ---------------------------------------------------------------------------
+// license:BSD-3-Clause
+// copyright-holders: Dave Roscoe
+// ---------------------------------------------------------------------------
+
+#ifndef ALTSOUND_CONTEXT_HPP
+#define ALTSOUND_CONTEXT_HPP
+#if !defined(__GNUC__) || (__GNUC__ == 3 && __GNUC_MINOR__ >= 4) || (__GNUC__ >= 4)	// GCC supports "pragma once" correctly since 3.4
+#pragma once
+#endif
+
+#include "altsound.h"
+#include "altsound_cmd_decoder.hpp"
+#include "altsound_cmdlog.hpp"
+#include "altsound_data.hpp"
+#include "altsound_load_control.hpp"
+#include "altsound_output_format.hpp"
+#include "altsound_rate_matcher.hpp"
+#include "altsound_render_ahead.hpp"
+#include "altsound_ring.hpp"
+#include "altsound_stats.hpp"
+#include "miniaudio_bass_compat.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class AltsoundProcessorBase;
+struct ma_context;
+struct ma_device;
+struct ma_engine;
+
+struct AltsoundContext {
+
+	AltsoundContext() = default;
+	AltsoundContext(const AltsoundContext&) = delete;
+	AltsoundContext& operator=(const AltsoundContext&) = delete;
+
+	// the context bound to the calling thread, the default one if none is
+	static AltsoundContext& current() { return bound ? *bound : defaultContext(); }
+
+	// behind the API functions without a context
+	static AltsoundContext& defaultContext();
+
+	// Binds ctx to the calling thread for good, e.g. for an audio thread
+	static void bind(AltsoundContext* ctx) { bound = ctx; }
+
+	// Binds a context (nullptr = the default one) to the calling thread for
+	// the duration of an API call
+	class Scope {
+	public:
+		explicit Scope(AltsoundContext* ctx) : previous(bound) { bound = ctx ? ctx : &defaultContext(); }
+		~Scope() { bound = previous; }
+		AltsoundContext& context() const { return *bound; }
+	private:
+		AltsoundContext* previous;
+	};
+
+	// processing
+	AltsoundProcessorBase* processor = nullptr;
+	ALTSOUND_HARDWARE_GEN hardware_gen = ALTSOUND_HARDWARE_GEN_NONE;
+	std::unique_ptr<AltsoundCmdDecoder> decoder;
+	AltsoundCmdRecorder cmd_recorder;
+
+	StreamArray channel_stream = {};
+	// recursive so a command batch can hold it across the per-command processing
+	std::recursive_mutex io_mutex;
+
+	// sample type behaviors of G-Sound packages, from altsound.ini
+	BehaviorInfo music_behavior;
+	BehaviorInfo callout_behavior;
+	BehaviorInfo sfx_behavior;
+	BehaviorInfo solo_behavior;
+	BehaviorInfo overlay_behavior;
+
+	// Emulator-time to engine-time mapping used by AltSoundProcessCommandAt()
+	uint32_t lookahead_ms = 20;
+	bool emu_clock_synced = false;
+	uint64_t emu_clock_base_ns = 0;
+	uint64_t emu_clock_base_frame = 0;
+
+	// engine
+	ma_engine* engine = nullptr;
+	ma_context* device_context = nullptr;
+	ma_device* device = nullptr;
+	MiniAudioState miniaudio;
+	uint32_t sample_rate = 44100;
+	uint32_t channels = 2;
+	uint32_t buffer_size_frames = 256;
+	bool skip_idle_callbacks = false;
+	bool manual_render = false;
+
+	// ended streams whose SYNCPROCs the audio thread is firing
+	std::vector<EndedStream> firing_streams;
+
+	// host output
+	AltSoundAudioCallback audio_callback = nullptr;
+	void* audio_user_data = nullptr;
+	AltSoundOutputCallback output_callback = nullptr;
+	void* output_user_data = nullptr;
+	std::mutex audio_mutex;
+
+	// a period converted to the output format for the output callback, and
+	// the f32 pieces AltSoundRender() mixes before converting them
+	std::vector<uint8_t> output_buffer;
+	std::vector<float> render_buffer;
+
+	AltsoundStats stats;
+	AltsoundLoadControl load_control{ stats };
+	AltsoundOutputFormat output_format;
+	AltsoundRing output_ring;
+	AltsoundRateMatcher rate_matcher;
+
+	// last, so its thread stops before the rest is destroyed
+	AltsoundRenderAhead render_ahead;
+
+private: // data
+
+	static thread_local AltsoundContext* bound;
+};
+
+#endif // ALTSOUND_CONTEXT_HPP
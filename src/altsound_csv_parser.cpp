@@ -182,16 +182,18 @@ bool AltsoundCsvParser::parse(std::vector<AltsoundSampleInfo>& samples_out)
 
 			samples_out.emplace_back(entry);
 
-			std::ostringstream debug_stream;
-			debug_stream << "ID = 0x" << std::setfill('0') << std::setw(4) << std::hex << entry.id << std::dec
-						 << ", CHANNEL = " << entry.channel
-						 << ", DUCKING = " << std::fixed << std::setprecision(2) << entry.ducking
-						 << ", GAIN = " << std::fixed << std::setprecision(2) << entry.gain
-						 << ", LOOP = " << entry.loop
-						 << ", NAME = " << entry.name
-						 << ", FNAME = " << entry.fname;
-
-			ALT_DEBUG(0, debug_stream.str().c_str());
+			if (ALT_LOG_ENABLED(Debug)) {
+				std::ostringstream debug_stream;
+				debug_stream << "ID = 0x" << std::setfill('0') << std::setw(4) << std::hex << entry.id << std::dec
+							 << ", CHANNEL = " << entry.channel
+							 << ", DUCKING = " << std::fixed << std::setprecision(2) << entry.ducking
+							 << ", GAIN = " << std::fixed << std::setprecision(2) << entry.gain
+							 << ", LOOP = " << entry.loop
+							 << ", NAME = " << entry.name
+							 << ", FNAME = " << entry.fname;
+
+				ALT_DEBUG(0, debug_stream.str().c_str());
+			}
 		}
 	}
 	catch (std::exception& e) { // catch by reference
@@ -74,6 +74,76 @@ float _behavior_info::getDuckVolume(unsigned int profile_num, AltsoundSampleType
 	return 1.0f;
 }
 
+// ---------------------------------------------------------------------------
+// Helper function to fill unset retrigger policy fields
+// ---------------------------------------------------------------------------
+
+void _retrigger_policy::inherit(const _retrigger_policy& from)
+{
+	if (!dedup_ms)
+		dedup_ms = from.dedup_ms;
+	if (!max_instances)
+		max_instances = from.max_instances;
+	if (!mode)
+		mode = from.mode;
+}
+
+// ---------------------------------------------------------------------------
+// Helper function to resolve the retrigger policy of a command.  Command
+// policies take precedence over sample type policies, which take precedence
+// over the defaults
+// ---------------------------------------------------------------------------
+
+RetriggerPolicy _retrigger_config::resolve(unsigned int cmd, AltsoundSampleType type) const
+{
+	RetriggerPolicy policy;
+
+	const auto cmd_it = commands.find(cmd);
+	if (cmd_it != commands.end())
+		policy = cmd_it->second;
+
+	const auto type_it = types.find(type);
+	if (type_it != types.end())
+		policy.inherit(type_it->second);
+
+	policy.inherit(defaults);
+	policy.inherit(RetriggerPolicy{ 0u, 0u, RetriggerMode::New });
+
+	return policy;
+}
+
+// ---------------------------------------------------------------------------
+// Helper function to fill unset resampler setting fields
+// ---------------------------------------------------------------------------
+
+void _resampler_setting::inherit(const _resampler_setting& from)
+{
+	if (!algorithm)
+		algorithm = from.algorithm;
+	if (!order)
+		order = from.order;
+}
+
+// ---------------------------------------------------------------------------
+// Helper function to resolve the resampler of a sample type.  Sample type
+// settings take precedence over the defaults, which fall back to miniaudio's
+// linear resampler with a 4th order filter
+// ---------------------------------------------------------------------------
+
+ResamplerSetting _resampler_config::resolve(AltsoundSampleType type) const
+{
+	ResamplerSetting setting;
+
+	const auto type_it = types.find(type);
+	if (type_it != types.end())
+		setting = type_it->second;
+
+	setting.inherit(defaults);
+	setting.inherit(ResamplerSetting{ ResamplerAlgorithm::Linear, 4u });
+
+	return setting;
+}
+
 // ---------------------------------------------------------------------------
 // Helper function to translate AltsoundSample type constants to strings
 // ---------------------------------------------------------------------------
@@ -92,6 +162,20 @@ const char* toString(AltsoundSampleType sampleType)
 	}
 }
 
+// ---------------------------------------------------------------------------
+// Helper function to translate RetriggerMode constants to strings
+// ---------------------------------------------------------------------------
+
+const char* toString(RetriggerMode mode)
+{
+	switch (mode) {
+	case RetriggerMode::New:     return "NEW";
+	case RetriggerMode::Restart: return "RESTART";
+	case RetriggerMode::Ignore:  return "IGNORE";
+	default:                     return "UNKNOWN";
+	}
+}
+
 // ---------------------------------------------------------------------------
 // Helper function to translate string reprsentation of AltsoundSampleType to
 // enum value
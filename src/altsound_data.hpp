@@ -33,6 +33,7 @@
 #include <unordered_map>
 #include <vector>
 #include <cstdint>
+#include <optional>
 
 #define ALT_MAX_CMDS 4
 #define MINIAUDIO_NO_STREAM 0
@@ -44,13 +45,6 @@
 // Global Data Structures
 // ----------------------------------------------------------------------------
 
-typedef struct _cmd_data {
-  unsigned int cmd_counter;
-  int stored_command;
-  unsigned int cmd_filter;
-  unsigned int cmd_buffer[ALT_MAX_CMDS];
-} CmdData;
-
 struct _stream_info;  // forward declaration for clarity
 typedef _stream_info AltsoundStreamInfo;
 typedef std::array<AltsoundStreamInfo*, ALT_MAX_CHANNELS> StreamArray;
@@ -114,6 +108,94 @@ typedef struct _behavior_info {
 
 } BehaviorInfo;
 
+// What a command does when its sample is already playing
+enum class RetriggerMode {
+	New = 0, // start another instance
+	Restart, // restart the playing instance from the beginning
+	Ignore   // drop the command
+};
+
+// Structure for limiting retriggers of the same sample during command storms.
+// Unset fields are inherited from the next broader policy (command, sample
+// type, defaults)
+typedef struct _retrigger_policy {
+	std::optional<unsigned int> dedup_ms;      // coalesce repeats of a command within this window
+	std::optional<unsigned int> max_instances; // concurrent instances of a sample, 0 = unlimited
+	std::optional<RetriggerMode> mode;
+
+	// fill fields not set here from the supplied policy
+	void inherit(const _retrigger_policy& from);
+
+} RetriggerPolicy;
+
+// Structure for holding all parsed retrigger policies
+typedef struct _retrigger_config {
+	RetriggerPolicy defaults;
+	std::unordered_map<AltsoundSampleType, RetriggerPolicy> types;
+	std::unordered_map<unsigned int, RetriggerPolicy> commands;
+
+	// Effective policy for the given command and sample type. All fields are
+	// set in the result
+	RetriggerPolicy resolve(unsigned int cmd, AltsoundSampleType type) const;
+
+} RetriggerConfig;
+
+// Resampler of samples not at the output rate
+enum class ResamplerAlgorithm {
+	Linear = 0, // cheapest
+	Cubic       // 4-point spline, smoother highs
+};
+
+// Structure for the resampler of a sample type.  Unset fields are inherited
+// from the defaults
+typedef struct _resampler_setting {
+	std::optional<ResamplerAlgorithm> algorithm;
+	std::optional<unsigned int> order; // low-pass filter order 0-8, 0 = none
+
+	// fill fields not set here from the supplied setting
+	void inherit(const _resampler_setting& from);
+
+} ResamplerSetting;
+
+// Structure for holding the parsed resampler settings
+typedef struct _resampler_config {
+	ResamplerSetting defaults;
+	std::unordered_map<AltsoundSampleType, ResamplerSetting> types;
+
+	// Effective setting for the given sample type. All fields are set in the
+	// result
+	ResamplerSetting resolve(AltsoundSampleType type) const;
+
+} ResamplerConfig;
+
+// Measures against mixer overload, taken per sample type as the mixer load
+// rises.  See AltsoundLoadControl
+enum LoadMeasure : uint8_t {
+	LOAD_RESAMPLE = 1 << 0,   // new voices get the cheapest resampler
+	LOAD_VIRTUALIZE = 1 << 1, // the quietest playing voices are virtualized
+	LOAD_REFUSE = 1 << 2      // new voices are refused
+};
+
+// Structure for holding the mixer load control settings.  The load is the
+// mix time of an audio period relative to the budget
+typedef struct _load_control_config {
+	unsigned int budget = 80;        // percent of the audio period the mixer may use, 0 = off
+	unsigned int resample_at = 50;   // load at which each measure starts, in percent of the budget
+	unsigned int virtualize_at = 75;
+	unsigned int refuse_at = 100;
+
+	// LoadMeasure bits by sample type
+	std::array<uint8_t, OVERLAY + 1> measures = {
+		LOAD_RESAMPLE,                                     // UNDEFINED
+		LOAD_RESAMPLE,                                     // MUSIC
+		LOAD_RESAMPLE,                                     // JINGLE
+		LOAD_RESAMPLE | LOAD_VIRTUALIZE | LOAD_REFUSE,     // SFX
+		LOAD_RESAMPLE,                                     // CALLOUT
+		LOAD_RESAMPLE,                                     // SOLO
+		LOAD_RESAMPLE                                      // OVERLAY
+	};
+} LoadControlConfig;
+
 // Structure for holding traditional AltSound sample data
 typedef struct _altsound_sample_info {
 	unsigned int id;
@@ -160,4 +242,7 @@ std::string trim(const std::string& str);
 // convert string to lowercase
 std::string toLowerCase(const std::string& str);
 
+// translate RetriggerMode enum values to strings
+const char* toString(RetriggerMode mode);
+
 #endif // ALTSOUND_DATA_H
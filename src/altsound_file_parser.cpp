@@ -163,14 +163,14 @@ bool AltsoundFileParser::parse(std::vector<AltsoundSampleInfo>& samples_out)
 				string PATH2 = PATH + entry->d_name;
 
 				// Check for overriding gain value
-				string PATHG = PATH2 + "gain.txt";
+				string PATHG = PATH2 + "/gain.txt";
 				float parsedGain = parseFileValue(PATHG);
 				if (parsedGain != -1.0f) {
 					gain = parsedGain;
 				}
 
 				// check for overriding ducking value
-				PATHG = PATH2 + "ducking.txt";
+				PATHG = PATH2 + "/ducking.txt";
 				float parsedDucking = parseFileValue(PATHG);
 				if (parsedDucking != -1.0f) {
 					ducking = parsedDucking;
@@ -191,7 +191,7 @@ bool AltsoundFileParser::parse(std::vector<AltsoundSampleInfo>& samples_out)
 
 						AltsoundSampleInfo sample;
 
-						sample.fname = PATH2 + entry2->d_name;
+						sample.fname = PATH2 + '/' + entry2->d_name;
 
 						memcpy(id, ptr + 1, 6);
 						sample.id = std::stoul(trim(id), nullptr);
@@ -227,15 +227,17 @@ bool AltsoundFileParser::parse(std::vector<AltsoundSampleInfo>& samples_out)
 
 						samples_out.push_back(sample);
 
-						std::ostringstream debug_stream;
-						debug_stream << "ID = 0x" << std::setfill('0') << std::setw(4) << std::hex << sample.id << std::dec
-							<< ", CHANNEL = " << sample.channel
-							<< ", DUCKING = " << std::fixed << std::setprecision(2) << sample.ducking
-							<< ", GAIN = " << std::fixed << std::setprecision(2) << sample.gain
-							<< ", LOOP = " << sample.loop
-							<< ", FNAME = " << sample.fname;
+						if (ALT_LOG_ENABLED(Debug)) {
+							std::ostringstream debug_stream;
+							debug_stream << "ID = 0x" << std::setfill('0') << std::setw(4) << std::hex << sample.id << std::dec
+								<< ", CHANNEL = " << sample.channel
+								<< ", DUCKING = " << std::fixed << std::setprecision(2) << sample.ducking
+								<< ", GAIN = " << std::fixed << std::setprecision(2) << sample.gain
+								<< ", LOOP = " << sample.loop
+								<< ", FNAME = " << sample.fname;
 
-						ALT_DEBUG(0, debug_stream.str().c_str());
+							ALT_DEBUG(0, debug_stream.str().c_str());
+						}
 					}
 					entry2 = readdir(dir2);
 				}
@@ -8,8 +8,11 @@
 // ---------------------------------------------------------------------------
 
 #include "altsound_ini_processor.hpp"
+#include "altsound_context.hpp"
 #include "altsound_logger.hpp"
 
+#include <cmath>
+
 // ----------------------------------------------------------------------------
 // Global variables
 // ----------------------------------------------------------------------------
@@ -17,13 +20,6 @@
 // reference to global AltSound logger
 extern AltsoundLogger alog;
 
-// references to global G-Sound behaviors
-extern BehaviorInfo music_behavior;
-extern BehaviorInfo callout_behavior;
-extern BehaviorInfo sfx_behavior;
-extern BehaviorInfo solo_behavior;
-extern BehaviorInfo overlay_behavior;
-
 // ----------------------------------------------------------------------------
 // Functional code
 // ----------------------------------------------------------------------------
@@ -99,6 +95,30 @@ bool AltsoundIniProcessor::parse_altsound_ini(const string& path_in)
 		return false;
 	}
 
+	// get virtual voice threshold
+	string virtual_voice_str;
+	inipp::get_value(ini.sections["system"], "virtual_voice_db", virtual_voice_str);
+	virtual_voice_str = normalizeString(virtual_voice_str);
+	if (virtual_voice_str == "off") {
+		virtual_voice_threshold = 0.0f;
+		ALT_INFO(0, "Parsed \"virtual_voice_db\": off");
+	}
+	else if (!virtual_voice_str.empty()) {
+		try {
+			const float db = std::stof(virtual_voice_str);
+			virtual_voice_threshold = std::pow(10.0f, db / 20.0f);
+			ALT_INFO(0, "Parsed \"virtual_voice_db\": %.1f", db);
+		}
+		catch (const std::invalid_argument& e) {
+			ALT_ERROR(0, "Invalid number format while parsing virtual_voice_db value: %s\n", virtual_voice_str.c_str());
+			return false;
+		}
+		catch (const std::out_of_range& e) {
+			ALT_ERROR(0, "Number out of range while parsing virtual_voice_db value: %s\n", virtual_voice_str.c_str());
+			return false;
+		}
+	}
+
 	// get AltSound format type
 	inipp::get_value(ini.sections["format"], "format", altsound_format);
 	altsound_format = normalizeString(altsound_format);
@@ -129,6 +149,22 @@ bool AltsoundIniProcessor::parse_altsound_ini(const string& path_in)
 	using BB = BehaviorInfo::BehaviorBits;
 	bool success = true;
 
+	// G-Sound behaviors of the calling thread's context
+	AltsoundContext& context = AltsoundContext::current();
+	BehaviorInfo& music_behavior = context.music_behavior;
+	BehaviorInfo& callout_behavior = context.callout_behavior;
+	BehaviorInfo& sfx_behavior = context.sfx_behavior;
+	BehaviorInfo& solo_behavior = context.solo_behavior;
+	BehaviorInfo& overlay_behavior = context.overlay_behavior;
+
+	// start from defaults, not from the behaviors of a previously
+	// initialized table
+	music_behavior = BehaviorInfo();
+	callout_behavior = BehaviorInfo();
+	sfx_behavior = BehaviorInfo();
+	solo_behavior = BehaviorInfo();
+	overlay_behavior = BehaviorInfo();
+
 	// ------------------------------------------------------------------------
 	// MUSIC behavior parsing
 	// ------------------------------------------------------------------------
@@ -298,6 +334,30 @@ bool AltsoundIniProcessor::parse_altsound_ini(const string& path_in)
 	// Parse OVERLAY "GROUP_VOL" behavior
 	success &= parseVolumeValue(overlay_section, "group_vol", overlay_behavior.group_vol);
 
+	// ------------------------------------------------------------------------
+	// Retrigger policy parsing
+	// ------------------------------------------------------------------------
+
+	success &= parseRetriggerSection(ini.sections["retrigger"], retrigger_config);
+
+	// ------------------------------------------------------------------------
+	// Resampler parsing
+	// ------------------------------------------------------------------------
+
+	success &= parseResamplerSection(ini.sections["resampler"], resampler_config);
+
+	// ------------------------------------------------------------------------
+	// Mixer load control parsing
+	// ------------------------------------------------------------------------
+
+	success &= parseLoadControlSection(ini.sections["load_control"], load_control_config);
+
+	// ------------------------------------------------------------------------
+	// Realtime settings parsing
+	// ------------------------------------------------------------------------
+
+	success &= parseRealtimeSection(ini.sections["realtime"]);
+
 	// ------------------------------------------------------------------------
 
 	ALT_OUTDENT;
@@ -473,6 +533,372 @@ bool AltsoundIniProcessor::parseDuckingProfile(const IniSection& ducking_section
 	return true;
 }
 
+// ---------------------------------------------------------------------------
+// Helper function to parse retrigger policies
+//
+// Keys are <scope>_<field>, where scope is "default" or a sample type, and
+// field is one of dedup_ms, max_instances or mode.  Per-command policies use
+// cmd_<hex command> = field:value, field:value, ...
+// ---------------------------------------------------------------------------
+
+bool AltsoundIniProcessor::parseRetriggerSection(const IniSection& section, RetriggerConfig& config)
+{
+	ALT_DEBUG(0, "BEGIN AltsoundIniProcessor::parseRetriggerSection()");
+	ALT_INDENT;
+
+	bool success = true;
+
+	for (const auto& pair : section) {
+		const string key = normalizeString(pair.first);
+		const size_t sep = key.find('_');
+
+		if (sep == string::npos) {
+			ALT_ERROR(1, "Failed to parse ini file - unexpected retrigger key: %s", key.c_str());
+			success = false;
+			continue;
+		}
+
+		const string scope = key.substr(0, sep);
+		const string field = key.substr(sep + 1);
+
+		if (scope == "cmd") {
+			// per-command policy
+			unsigned int cmd = 0;
+			try {
+				cmd = static_cast<unsigned int>(std::stoul(field, nullptr, 16));
+			}
+			catch (const std::exception&) {
+				ALT_ERROR(1, "Invalid retrigger command: %s", field.c_str());
+				success = false;
+				continue;
+			}
+
+			RetriggerPolicy& policy = config.commands[cmd];
+
+			std::istringstream value_stream(pair.second);
+			string token;
+			while (std::getline(value_stream, token, ',')) {
+				const size_t colon = token.find(':');
+				if (colon == string::npos) {
+					ALT_ERROR(1, "Failed to parse retrigger value: %s", token.c_str());
+					success = false;
+					continue;
+				}
+
+				success &= parseRetriggerValue(normalizeString(token.substr(0, colon)),
+				                               normalizeString(token.substr(colon + 1)), policy);
+			}
+			ALT_INFO(1, "Parsed retrigger policy for command %04X", cmd);
+		}
+		else if (scope == "default") {
+			success &= parseRetriggerValue(field, normalizeString(pair.second), config.defaults);
+		}
+		else {
+			const AltsoundSampleType type = toSampleType(scope);
+			if (type == UNDEFINED) {
+				ALT_ERROR(1, "Unknown sample type in retrigger key: %s", key.c_str());
+				success = false;
+				continue;
+			}
+
+			success &= parseRetriggerValue(field, normalizeString(pair.second), config.types[type]);
+		}
+	}
+
+	ALT_OUTDENT;
+	ALT_DEBUG(0, "END AltsoundIniProcessor::parseRetriggerSection()");
+	return success;
+}
+
+// ---------------------------------------------------------------------------
+// Helper function to parse resampler settings
+//
+// Keys are <scope>_<field>, where scope is "default" or a sample type, and
+// field is algorithm (linear or cubic) or order (low-pass filter, 0-8)
+// ---------------------------------------------------------------------------
+
+bool AltsoundIniProcessor::parseResamplerSection(const IniSection& section, ResamplerConfig& config)
+{
+	ALT_DEBUG(0, "BEGIN AltsoundIniProcessor::parseResamplerSection()");
+	ALT_INDENT;
+
+	bool success = true;
+
+	for (const auto& pair : section) {
+		const string key = normalizeString(pair.first);
+		const string value = normalizeString(pair.second);
+		const size_t sep = key.find('_');
+
+		if (sep == string::npos) {
+			ALT_ERROR(1, "Failed to parse ini file - unexpected resampler key: %s", key.c_str());
+			success = false;
+			continue;
+		}
+		if (value.empty())
+			continue;
+
+		const string scope = key.substr(0, sep);
+		const string field = key.substr(sep + 1);
+		ResamplerSetting* setting = &config.defaults;
+
+		if (scope != "default") {
+			const AltsoundSampleType type = toSampleType(scope);
+			if (type == UNDEFINED) {
+				ALT_ERROR(1, "Unknown sample type in resampler key: %s", key.c_str());
+				success = false;
+				continue;
+			}
+			setting = &config.types[type];
+		}
+
+		if (field == "algorithm") {
+			if (value == "linear") {
+				setting->algorithm = ResamplerAlgorithm::Linear;
+			}
+			else if (value == "cubic") {
+				setting->algorithm = ResamplerAlgorithm::Cubic;
+			}
+			else {
+				ALT_ERROR(1, "Unknown resampler algorithm: %s", value.c_str());
+				success = false;
+				continue;
+			}
+		}
+		else if (field == "order") {
+			try {
+				setting->order = clamp(std::stoi(value), 0, 8);
+			}
+			catch (const std::exception&) {
+				ALT_ERROR(1, "Invalid number format while parsing %s value: %s", key.c_str(), value.c_str());
+				success = false;
+				continue;
+			}
+		}
+		else {
+			ALT_ERROR(1, "Unknown resampler field: %s", field.c_str());
+			success = false;
+			continue;
+		}
+		ALT_INFO(1, "Parsed \"%s\": %s", key.c_str(), value.c_str());
+	}
+
+	ALT_OUTDENT;
+	ALT_DEBUG(0, "END AltsoundIniProcessor::parseResamplerSection()");
+	return success;
+}
+
+// ---------------------------------------------------------------------------
+// Helper function to parse mixer load control settings
+//
+// budget and the <measure>_at thresholds are percentages.  A sample type key
+// lists the measures applied to its voices: resample, virtualize, refuse or
+// none
+// ---------------------------------------------------------------------------
+
+bool AltsoundIniProcessor::parseLoadControlSection(const IniSection& section, LoadControlConfig& config)
+{
+	ALT_DEBUG(0, "BEGIN AltsoundIniProcessor::parseLoadControlSection()");
+	ALT_INDENT;
+
+	bool success = true;
+
+	for (const auto& pair : section) {
+		const string key = normalizeString(pair.first);
+		const string value = normalizeString(pair.second);
+		if (value.empty())
+			continue;
+
+		unsigned int* percent = key == "budget" ? &config.budget
+		                      : key == "resample_at" ? &config.resample_at
+		                      : key == "virtualize_at" ? &config.virtualize_at
+		                      : key == "refuse_at" ? &config.refuse_at : nullptr;
+		if (percent) {
+			try {
+				*percent = static_cast<unsigned int>(std::max(std::stoi(value), 0));
+			}
+			catch (const std::exception&) {
+				ALT_ERROR(1, "Invalid number format while parsing %s value: %s", key.c_str(), value.c_str());
+				success = false;
+				continue;
+			}
+			ALT_INFO(1, "Parsed \"%s\": %u", key.c_str(), *percent);
+			continue;
+		}
+
+		const AltsoundSampleType type = toSampleType(key);
+		if (type == UNDEFINED) {
+			ALT_ERROR(1, "Failed to parse ini file - unexpected load_control key: %s", key.c_str());
+			success = false;
+			continue;
+		}
+
+		uint8_t measures = 0;
+		std::istringstream value_stream(value);
+		string token;
+		while (std::getline(value_stream, token, ',')) {
+			token = normalizeString(token);
+			if (token == "resample") {
+				measures |= LOAD_RESAMPLE;
+			}
+			else if (token == "virtualize") {
+				measures |= LOAD_VIRTUALIZE;
+			}
+			else if (token == "refuse") {
+				measures |= LOAD_REFUSE;
+			}
+			else if (token != "none") {
+				ALT_ERROR(1, "Unknown load control measure for %s: %s", key.c_str(), token.c_str());
+				success = false;
+			}
+		}
+		config.measures[type] = measures;
+		ALT_INFO(1, "Parsed \"%s\": %s", key.c_str(), value.c_str());
+	}
+
+	ALT_OUTDENT;
+	ALT_DEBUG(0, "END AltsoundIniProcessor::parseLoadControlSection()");
+	return success;
+}
+
+// ---------------------------------------------------------------------------
+// Helper function to parse realtime thread settings
+// ---------------------------------------------------------------------------
+
+bool AltsoundIniProcessor::parseRealtimeSection(const IniSection& section)
+{
+	ALT_DEBUG(0, "BEGIN AltsoundIniProcessor::parseRealtimeSection()");
+	ALT_INDENT;
+
+	bool success = true;
+
+	for (const auto& pair : section) {
+		const string key = normalizeString(pair.first);
+		const string value = normalizeString(pair.second);
+		if (value.empty())
+			continue;
+
+		if (key == "lock_memory") {
+			realtime_lock_memory = (value == "1");
+			ALT_INFO(1, "Parsed \"lock_memory\": %s", *realtime_lock_memory ? "true" : "false");
+			continue;
+		}
+
+		// audio_<field> or worker_<field>
+		const size_t sep = key.find('_');
+		const string scope = key.substr(0, sep);
+		const string field = sep == string::npos ? string() : key.substr(sep + 1);
+		if (scope != "audio" && scope != "worker") {
+			ALT_ERROR(1, "Failed to parse ini file - unexpected realtime key: %s", key.c_str());
+			success = false;
+			continue;
+		}
+		RealtimeOverrides& thread = scope == "audio" ? realtime_audio : realtime_workers;
+
+		if (field == "sched") {
+			ALTSOUND_SCHED_POLICY policy;
+			if (!AltsoundRealtime::parsePolicy(value, policy)) {
+				ALT_ERROR(1, "Unknown scheduling policy for %s: %s", key.c_str(), value.c_str());
+				success = false;
+				continue;
+			}
+			thread.policy = policy;
+		}
+		else if (field == "priority") {
+			try {
+				thread.priority = std::stoi(value);
+			}
+			catch (const std::exception&) {
+				ALT_ERROR(1, "Invalid number format while parsing %s value: %s", key.c_str(), value.c_str());
+				success = false;
+				continue;
+			}
+		}
+		else if (field == "cpus") {
+			uint64_t mask = 0;
+			if (!AltsoundRealtime::parseCpuList(value, mask)) {
+				ALT_ERROR(1, "Invalid CPU list for %s: %s", key.c_str(), value.c_str());
+				success = false;
+				continue;
+			}
+			thread.cpu_mask = mask;
+		}
+		else {
+			ALT_ERROR(1, "Failed to parse ini file - unexpected realtime key: %s", key.c_str());
+			success = false;
+			continue;
+		}
+		ALT_INFO(1, "Parsed \"%s\": %s", key.c_str(), value.c_str());
+	}
+
+	ALT_OUTDENT;
+	ALT_DEBUG(0, "END AltsoundIniProcessor::parseRealtimeSection()");
+	return success;
+}
+
+// ---------------------------------------------------------------------------
+
+void AltsoundIniProcessor::applyRealtimeConfig(AltsoundRealtimeConfig& config) const
+{
+	auto apply = [](const RealtimeOverrides& overrides, AltSoundThreadConfig& thread) {
+		thread.policy = overrides.policy.value_or(thread.policy);
+		thread.priority = overrides.priority.value_or(thread.priority);
+		thread.cpu_mask = overrides.cpu_mask.value_or(thread.cpu_mask);
+	};
+
+	apply(realtime_audio, config.audio);
+	apply(realtime_workers, config.workers);
+	config.lock_memory = realtime_lock_memory.value_or(config.lock_memory);
+}
+
+// ---------------------------------------------------------------------------
+// Helper function to parse a single retrigger policy field
+// ---------------------------------------------------------------------------
+
+bool AltsoundIniProcessor::parseRetriggerValue(const string& field, const string& value,
+                                               RetriggerPolicy& policy)
+{
+	if (value.empty())
+		return true;
+
+	if (field == "mode") {
+		if (value == "new") {
+			policy.mode = RetriggerMode::New;
+		}
+		else if (value == "restart") {
+			policy.mode = RetriggerMode::Restart;
+		}
+		else if (value == "ignore") {
+			policy.mode = RetriggerMode::Ignore;
+		}
+		else {
+			ALT_ERROR(1, "Unknown retrigger mode: %s", value.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	unsigned int val = 0;
+	try {
+		val = static_cast<unsigned int>(std::max(std::stoi(value), 0));
+	}
+	catch (const std::exception&) {
+		ALT_ERROR(1, "Invalid number format while parsing retrigger %s: %s", field.c_str(), value.c_str());
+		return false;
+	}
+
+	if (field == "dedup_ms") {
+		policy.dedup_ms = val;
+	}
+	else if (field == "max_instances") {
+		policy.max_instances = val;
+	}
+	else {
+		ALT_ERROR(1, "Unknown retrigger field: %s", field.c_str());
+		return false;
+	}
+
+	return true;
+}
 
 // ---------------------------------------------------------------------------
 // Helper function to determine AltSound format
@@ -572,9 +998,11 @@ bool AltsoundIniProcessor::create_altsound_ini(const string& path_in)
 		";                     playback times. This can be useful for testing altsound\n"
 		";                     sample combinations without having to recreate them on\n"
 		";                     the table. The file can also be edited or created by hand\n"
-		";                     to create custom testing scenarios. The\n"
-		";                     \"cmdlog.txt\" file is created in the \"tables\"\n"
-		";                     folder. This feature is turned off by default\n"
+		";                     to create custom testing scenarios. The binary\n"
+		";                     \"cmdlog.bin\" file is created in the \"altsound\"\n"
+		";                     folder; altsound_cmdlog converts it to the\n"
+		";                     editable \"cmdlog.txt\" format and back. This\n"
+		";                     feature is turned off by default\n"
 		";\n"
 		"; rom_volume_ctrl   : the AltSound processor attempts to recreate original\n"
 		";                     playback behavior using commands sent from the ROM.\n"
@@ -590,12 +1018,19 @@ bool AltsoundIniProcessor::create_altsound_ini(const string& path_in)
 		";                     specify how many initial commands to ignore at startup.\n"
 		";                     NOTE:  If the record_sound_cmds flag is set, the skipped\n"
 		";                     commands will be included in the recording file.\n"
+		";\n"
+		"; virtual_voice_db  : sounds playing below this volume (in dB) are not decoded\n"
+		";                     or mixed, but keep their place in time. They resume at\n"
+		";                     the right position as soon as they become audible again,\n"
+		";                     e.g. music ducked to silence under a callout. Use \"off\"\n"
+		";                     to always mix every sound. Default is -60\n"
 		"; ----------------------------------------------------------------------------\n"
 		"\n"
 		"[system]\n"
 		"record_sound_cmds = 0\n"
 		"rom_volume_ctrl = 1\n"
 		"cmd_skip_count = 0\n"
+		"virtual_voice_db = -60\n"
 		"\n"
 		"; ----------------------------------------------------------------------------\n"
 		"; There are three supported AltSound formats:\n"
@@ -711,7 +1146,106 @@ bool AltsoundIniProcessor::create_altsound_ini(const string& path_in)
 		"[overlay_ducking_profiles]\n"
 		";profile0 is reserved\n"
 		"ducking_profile1 = sfx:65, music:65\n"
-		"ducking_profile2 = sfx:80, music:50\n";
+		"ducking_profile2 = sfx:80, music:50\n"
+		"\n"
+		"; ----------------------------------------------------------------------------\n"
+		"; Some ROMs re-send the same command many times in a burst. The section below\n"
+		"; limits how often a sample can be retriggered. It applies to all formats.\n"
+		";\n"
+		"; dedup_ms      : repeats of the same command within this many milliseconds\n"
+		";                 are coalesced into the first one. 0 disables it\n"
+		"; max_instances : maximum number of concurrent instances of the same sample.\n"
+		";                 Commands beyond the limit are dropped. 0 = unlimited\n"
+		"; mode          : what a command does when its sample is already playing\n"
+		";                 new     - start another instance (default)\n"
+		";                 restart - restart the playing instance from the beginning\n"
+		";                 ignore  - drop the command\n"
+		";\n"
+		"; Policies are set with <scope>_<variable>, where scope is \"default\" or a\n"
+		"; sample type (music, jingle, sfx, callout, solo, overlay). A single command\n"
+		"; can be given its own policy, e.g.:\n"
+		";\n"
+		"; cmd_0x0123 = dedup_ms:50, max_instances:2, mode:restart\n"
+		";\n"
+		"; Variables not set for a command fall back to its sample type, then to the\n"
+		"; defaults\n"
+		"; ----------------------------------------------------------------------------\n"
+		"\n"
+		"[retrigger]\n"
+		"default_dedup_ms = 0\n"
+		"default_max_instances = 0\n"
+		"default_mode = new\n"
+		"\n"
+		"; ----------------------------------------------------------------------------\n"
+		"; Samples not recorded at the output rate are resampled while they play.\n"
+		";\n"
+		"; algorithm : linear - cheapest, slightly dull or grainy on high notes\n"
+		";             cubic  - 4-point spline, cleaner highs for more CPU\n"
+		"; order     : order of the low-pass filter against aliasing, 0-8. 0 turns\n"
+		";             it off, higher orders cut harder and cost more\n"
+		";\n"
+		"; Settings are made with <scope>_<variable>, where scope is \"default\" or a\n"
+		"; sample type (music, jingle, sfx, callout, solo, overlay). Variables not\n"
+		"; set for a sample type fall back to the defaults. The README lists the CPU\n"
+		"; cost of each setting\n"
+		"; ----------------------------------------------------------------------------\n"
+		"\n"
+		"[resampler]\n"
+		"default_algorithm = linear\n"
+		"default_order = 4\n"
+		";music_algorithm = cubic\n"
+		";music_order = 8\n"
+		";sfx_order = 0\n"
+		"\n"
+		"; ----------------------------------------------------------------------------\n"
+		"; When the mixer takes too long for an audio period, e.g. during a multiball\n"
+		"; flood of sounds, the measures below kick in one after the other. They are\n"
+		"; lifted again once the load has dropped.\n"
+		";\n"
+		"; budget        : percent of each audio period the mixer may use. 0 turns\n"
+		";                 load control off\n"
+		"; resample_at   : load, in percent of the budget, at which new voices get\n"
+		";                 the cheapest resampler (for samples not at the output rate)\n"
+		"; virtualize_at : load at which the quietest playing voices are virtualized,\n"
+		";                 one at a time: they keep their place but are not mixed\n"
+		"; refuse_at     : load at which new voices are refused\n"
+		";\n"
+		"; Each sample type (music, jingle, sfx, callout, solo, overlay) lists the\n"
+		"; measures applied to it: resample, virtualize, refuse or none\n"
+		"; ----------------------------------------------------------------------------\n"
+		"\n"
+		"[load_control]\n"
+		"budget = 80\n"
+		"resample_at = 50\n"
+		"virtualize_at = 75\n"
+		"refuse_at = 100\n"
+		"music = resample\n"
+		"jingle = resample\n"
+		"sfx = resample, virtualize, refuse\n"
+		"callout = resample\n"
+		"solo = resample\n"
+		"overlay = resample\n"
+		"\n"
+		"; ----------------------------------------------------------------------------\n"
+		"; Realtime settings for the mixer thread (audio_) and the log and command\n"
+		"; recording writers (worker_). Settings made here override the host's.\n"
+		";\n"
+		"; <thread>_sched    : default, fifo or rr (SCHED_FIFO/SCHED_RR, usually\n"
+		";                     needs root, CAP_SYS_NICE or an rtprio limit)\n"
+		"; <thread>_priority : 1-99 with fifo or rr\n"
+		"; <thread>_cpus     : CPUs the thread may run on, e.g. 3 or 0-2,5\n"
+		"; lock_memory       : 1 locks the process and all samples in memory and\n"
+		";                     prefaults the thread stacks\n"
+		";\n"
+		"; The log shows whether each setting was applied\n"
+		"; ----------------------------------------------------------------------------\n"
+		"\n"
+		"[realtime]\n"
+		";audio_sched = fifo\n"
+		";audio_priority = 70\n"
+		";audio_cpus = 3\n"
+		";worker_cpus = 0-2\n"
+		";lock_memory = 1\n";
 
 	const string ini_path = path_in + "altsound.ini";
 	std::ofstream file_out(ini_path);
@@ -20,10 +20,12 @@
 #endif
 
 #include "altsound_data.hpp"
+#include "altsound_realtime.hpp"
 
 #include "inipp.h"
 
 #include <assert.h>
+#include <optional>
 
 using std::string;
 
@@ -59,6 +61,21 @@ public:
 	// Return parsed skip count value
 	unsigned int getSkipCount() const;
 
+	// Return parsed retrigger policies
+	const RetriggerConfig& getRetriggerConfig() const;
+
+	// Return parsed resampler settings
+	const ResamplerConfig& getResamplerConfig() const;
+
+	// Return parsed virtual voice threshold (linear volume, 0 = disabled)
+	float getVirtualVoiceThreshold() const;
+
+	// Return parsed mixer load control settings
+	const LoadControlConfig& getLoadControlConfig() const;
+
+	// Override config with the parsed [realtime] settings
+	void applyRealtimeConfig(AltsoundRealtimeConfig& config) const;
+
 private: // functions
 
 	// helper function to parse behavior variable values
@@ -70,6 +87,21 @@ private: // functions
 	// helper function to parse ducking profiles
 	bool parseDuckingProfile(const IniSection& ducking_section, ProfileMap& profiles);
 
+	// helper function to parse retrigger policies
+	bool parseRetriggerSection(const IniSection& section, RetriggerConfig& config);
+
+	// helper function to parse a single retrigger policy field
+	bool parseRetriggerValue(const string& field, const string& value, RetriggerPolicy& policy);
+
+	// helper function to parse resampler settings
+	bool parseResamplerSection(const IniSection& section, ResamplerConfig& config);
+
+	// helper function to parse mixer load control settings
+	bool parseLoadControlSection(const IniSection& section, LoadControlConfig& config);
+
+	// helper function to parse realtime thread settings
+	bool parseRealtimeSection(const IniSection& section);
+
 	// determine altsound format from installed data
 	string get_altsound_format(const string& path_in);
 
@@ -89,10 +121,24 @@ private: // functions
 
 private: // data
 
+	// [realtime] settings present in the file
+	struct RealtimeOverrides {
+		std::optional<ALTSOUND_SCHED_POLICY> policy;
+		std::optional<int> priority;
+		std::optional<uint64_t> cpu_mask;
+	};
+
 	bool record_sound_commands = false;
 	bool rom_volume_control = true;
 	string altsound_format;
 	unsigned int skip_count = 0;
+	RetriggerConfig retrigger_config;
+	ResamplerConfig resampler_config;
+	float virtual_voice_threshold = 0.001f; // -60 dB
+	LoadControlConfig load_control_config;
+	RealtimeOverrides realtime_audio;
+	RealtimeOverrides realtime_workers;
+	std::optional<bool> realtime_lock_memory;
 };
 
 // ----------------------------------------------------------------------------
@@ -122,4 +168,28 @@ inline unsigned int AltsoundIniProcessor::getSkipCount() const {
 	return skip_count;
 }
 
+// ----------------------------------------------------------------------------
+
+inline const RetriggerConfig& AltsoundIniProcessor::getRetriggerConfig() const {
+	return retrigger_config;
+}
+
+// ----------------------------------------------------------------------------
+
+inline const ResamplerConfig& AltsoundIniProcessor::getResamplerConfig() const {
+	return resampler_config;
+}
+
+// ----------------------------------------------------------------------------
+
+inline float AltsoundIniProcessor::getVirtualVoiceThreshold() const {
+	return virtual_voice_threshold;
+}
+
+// ----------------------------------------------------------------------------
+
+inline const LoadControlConfig& AltsoundIniProcessor::getLoadControlConfig() const {
+	return load_control_config;
+}
+
 #endif // ALTSOUND_INI_PROCESSOR_H
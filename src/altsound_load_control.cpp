@@ -0,0 +1,139 @@
+// ---------------------------------------------------------------------------
+// altsound_load_control.cpp
+//
+// Mixer load control
+// ---------------------------------------------------------------------------
+// license:BSD-3-Clause
+// copyright-holders: Dave Roscoe
+// ---------------------------------------------------------------------------
+
+#include "altsound_load_control.hpp"
+#include "altsound_logger.hpp"
+#include "altsound_stats.hpp"
+#include "altsound_trace.hpp"
+#include "miniaudio_bass_compat.hpp"
+
+#include <algorithm>
+
+extern AltsoundLogger alog;
+
+// The load is smoothed over about this many periods, so a single slow
+// period (a page fault, a preemption) does not trigger anything
+static constexpr float LOAD_SMOOTHING = 1.0f / 8.0f;
+
+// a level is left once the load drops below this share of its threshold
+static constexpr float LOAD_RECOVERY = 0.8f;
+
+// periods between two voices shed or restored, so the load can follow
+static constexpr uint32_t SHED_INTERVAL = 8;
+
+// ----------------------------------------------------------------------------
+
+void AltsoundLoadControl::configure(const LoadControlConfig& config_in, bool enabled_in, uint32_t sampleRate)
+{
+	config = config_in;
+	enabled = enabled_in && config.budget > 0;
+	sample_rate = sampleRate;
+
+	// a measure never starts before the ones below it
+	const float budget = config.budget / 100.0f;
+	thresholds[LEVEL_NORMAL] = 0.0f;
+	thresholds[LEVEL_RESAMPLE] = budget * config.resample_at / 100.0f;
+	thresholds[LEVEL_VIRTUALIZE] = std::max(thresholds[LEVEL_RESAMPLE], budget * config.virtualize_at / 100.0f);
+	thresholds[LEVEL_REFUSE] = std::max(thresholds[LEVEL_VIRTUALIZE], budget * config.refuse_at / 100.0f);
+
+	virtualize_types = 0;
+	for (size_t type = 0; type < config.measures.size(); ++type) {
+		if (config.measures[type] & LOAD_VIRTUALIZE)
+			virtualize_types |= 1u << type;
+	}
+
+	load = 0.0f;
+	shed_wait = 0;
+	current_level.store(LEVEL_NORMAL, std::memory_order_relaxed);
+	stats.loadLevelChanged(LEVEL_NORMAL);
+
+	if (enabled)
+		ALT_INFO(0, "Load control: budget %u%% of the period, measures at %.0f%%, %.0f%% and %.0f%%",
+		         config.budget, thresholds[LEVEL_RESAMPLE] * 100.0f, thresholds[LEVEL_VIRTUALIZE] * 100.0f,
+		         thresholds[LEVEL_REFUSE] * 100.0f);
+	else
+		ALT_INFO(0, "Load control: off");
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundLoadControl::reset()
+{
+	if (enabled) {
+		AltSoundStats snapshot;
+		stats.snapshot(snapshot);
+		ALT_INFO(0, "Load control: peak level %u, %llu voice(s) with the cheap resampler, %llu virtualized, %llu refused",
+		         snapshot.peak_load_level, (unsigned long long)snapshot.load_resampled,
+		         (unsigned long long)snapshot.load_shed, (unsigned long long)snapshot.load_refused);
+	}
+
+	enabled = false;
+	current_level.store(LEVEL_NORMAL, std::memory_order_relaxed);
+	stats.loadLevelChanged(LEVEL_NORMAL);
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundLoadControl::update(uint64_t mix_ns, uint64_t frameCount)
+{
+	if (!enabled || !frameCount)
+		return;
+
+	const float period_load = (float)((double)mix_ns * sample_rate / ((double)frameCount * 1e9));
+	load += (period_load - load) * LOAD_SMOOTHING;
+
+	uint32_t level = current_level.load(std::memory_order_relaxed);
+	const uint32_t previous = level;
+	while (level < LEVEL_REFUSE && load >= thresholds[level + 1])
+		++level;
+	while (level > LEVEL_NORMAL && load < thresholds[level] * LOAD_RECOVERY)
+		--level;
+
+	if (level != previous) {
+		current_level.store(level, std::memory_order_relaxed);
+		stats.loadLevelChanged(level);
+		AltsoundTrace::instant("load", "level", { { "level", (double)level }, { "load", load } });
+	}
+
+	// one voice at a time, then give the load time to follow
+	if (shed_wait > 0) {
+		--shed_wait;
+	}
+	else if (level >= LEVEL_VIRTUALIZE) {
+		if (virtualize_types && MiniAudio_ShedQuietestVoice(virtualize_types)) {
+			AltsoundStats::add(stats.load_shed);
+			shed_wait = SHED_INTERVAL;
+		}
+	}
+	else if (MiniAudio_RestoreShedVoice()) {
+		shed_wait = SHED_INTERVAL;
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+bool AltsoundLoadControl::admit(AltsoundSampleType type)
+{
+	if (level() < LEVEL_REFUSE || !(config.measures[type] & LOAD_REFUSE))
+		return true;
+
+	AltsoundStats::add(stats.load_refused);
+	return false;
+}
+
+// ----------------------------------------------------------------------------
+
+bool AltsoundLoadControl::cheapResampler(AltsoundSampleType type)
+{
+	if (level() < LEVEL_RESAMPLE || !(config.measures[type] & LOAD_RESAMPLE))
+		return false;
+
+	AltsoundStats::add(stats.load_resampled);
+	return true;
+}
@@ -0,0 +1,79 @@
+// ---------------------------------------------------------------------------
+// altsound_load_control.hpp
+//
+// Mixer load control.  The audio thread measures the mix time of every
+// period against a CPU budget.  As the smoothed load crosses the configured
+// thresholds, the measures of [load_control] kick in one after the other:
+// new voices get the cheapest resampler, the quietest playing voices are
+// virtualized, and new voices are refused.  They are lifted in reverse
+// order once the load has dropped well below each threshold.
+// ---------------------------------------------------------------------------
+// license:BSD-3-Clause
+// copyright-holders: Dave Roscoe
+// ---------------------------------------------------------------------------
+
+#ifndef ALTSOUND_LOAD_CONTROL_HPP
+#define ALTSOUND_LOAD_CONTROL_HPP
+#if !defined(__GNUC__) || (__GNUC__ == 3 && __GNUC_MINOR__ >= 4) || (__GNUC__ >= 4)	// GCC supports "pragma once" correctly since 3.4
+#pragma once
+#endif
+
+#include "altsound_data.hpp"
+#include "altsound_stats.hpp"
+
+#include <atomic>
+#include <cstdint>
+
+class AltsoundLoadControl {
+public:
+
+	// Load levels, each adding a measure to the ones below
+	enum Level : uint32_t {
+		LEVEL_NORMAL = 0,
+		LEVEL_RESAMPLE,
+		LEVEL_VIRTUALIZE,
+		LEVEL_REFUSE
+	};
+
+	// the measures taken are counted in stats
+	explicit AltsoundLoadControl(AltsoundStats& stats) : stats(stats) {}
+
+	// Call while the audio thread is stopped. Disabled control (manual
+	// rendering, or a zero budget) never takes a measure
+	void configure(const LoadControlConfig& config, bool enabled, uint32_t sampleRate);
+
+	// Back to normal, logs a summary of the measures taken. Call while the
+	// audio thread is stopped
+	void reset();
+
+	// Audio thread, once per period: mix time of frameCount frames, without
+	// the host callbacks and output writes. Sheds or restores a voice when
+	// the level calls for it
+	void update(uint64_t mix_ns, uint64_t frameCount);
+
+	Level level() const { return (Level)current_level.load(std::memory_order_relaxed); }
+
+	// Command thread: false refuses a new voice of the type
+	bool admit(AltsoundSampleType type);
+
+	// Command thread: true if a new voice of the type gets the cheapest
+	// resampler
+	bool cheapResampler(AltsoundSampleType type);
+
+private: // data
+
+	AltsoundStats& stats;
+	std::atomic<uint32_t> current_level{ LEVEL_NORMAL };
+
+	LoadControlConfig config;
+	bool enabled = false;
+	float thresholds[LEVEL_REFUSE + 1] = {}; // load, 1.0 = whole period
+	uint32_t virtualize_types = 0; // bit per AltsoundSampleType
+	uint32_t sample_rate = 0;
+
+	// audio thread
+	float load = 0.0f;
+	uint32_t shed_wait = 0;
+};
+
+#endif // ALTSOUND_LOAD_CONTROL_HPP
@@ -8,8 +8,10 @@
 // ---------------------------------------------------------------------------
 
 #include "altsound_logger.hpp"
+#include "altsound_realtime.hpp"
 
 #include <algorithm>
+#include <cstdio>
 #include <map>
 
 // DAR@20230706
@@ -19,17 +21,183 @@
 //
 thread_local int AltsoundLogger::base_indent = 0;
 
+// Small per-thread index shown in the log, in order of first message
+static std::atomic<unsigned int> g_nextThreadIndex{ 0 };
+static thread_local unsigned int t_threadIndex = g_nextThreadIndex++;
+
 // ----------------------------------------------------------------------------
 // CTOR/DTOR
 // ----------------------------------------------------------------------------
 
 AltsoundLogger::AltsoundLogger()
+: ring(new Slot[ringSize]), start_time(std::chrono::steady_clock::now())
 {
+	for (size_t i = 0; i < ringSize; ++i)
+		ring[i].seq.store(i, std::memory_order_relaxed);
 }
 
 AltsoundLogger::AltsoundLogger(const string& filename)
-: log_level(Debug), console(true), out(filename)
+: log_level(Debug), console(true), out(filename), has_output(true),
+  ring(new Slot[ringSize]), start_time(std::chrono::steady_clock::now())
+{
+	for (size_t i = 0; i < ringSize; ++i)
+		ring[i].seq.store(i, std::memory_order_relaxed);
+
+	start();
+}
+
+AltsoundLogger::~AltsoundLogger()
+{
+	flush();
+}
+
+// ----------------------------------------------------------------------------
+// Pushes a formatted record into the ring buffer
+// ----------------------------------------------------------------------------
+
+void AltsoundLogger::log(int indentLevel, Level lvl, const char* format, va_list args)
+{
+	if (!has_output.load(std::memory_order_relaxed))
+		return;
+
+	// claim a slot
+	size_t pos = write_pos.load(std::memory_order_relaxed);
+	Slot* slot;
+	for (;;) {
+		slot = &ring[pos & (ringSize - 1)];
+		const size_t seq = slot->seq.load(std::memory_order_acquire);
+		const intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+		if (diff == 0) {
+			if (write_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				break;
+		}
+		else if (diff < 0) {
+			// ring is full, the writer is behind
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		else {
+			pos = write_pos.load(std::memory_order_relaxed);
+		}
+	}
+
+	Record& rec = slot->rec;
+	rec.lvl = lvl;
+	rec.indent = indentLevel;
+	rec.time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - start_time).count();
+	rec.thread = t_threadIndex;
+	vsnprintf(rec.text, sizeof(rec.text), format, args);
+
+	// publish
+	slot->seq.store(pos + 1, std::memory_order_release);
+}
+
+// ----------------------------------------------------------------------------
+// Writer thread
+// ----------------------------------------------------------------------------
+
+void AltsoundLogger::start()
+{
+	// nothing to write to, so log() drops every message
+	if (!has_output.load(std::memory_order_relaxed) || writer_running.load(std::memory_order_acquire))
+		return;
+
+	std::lock_guard<std::mutex> lock(writer_mutex);
+	if (writer_running.load(std::memory_order_relaxed))
+		return;
+
+	writer_stop = false;
+	writer = std::thread(&AltsoundLogger::writerMain, this);
+	writer_running.store(true, std::memory_order_release);
+}
+
+void AltsoundLogger::writerMain()
 {
+	// Producers never signal the writer (that could block them), so it polls
+	// the ring while idle
+	std::unique_lock<std::mutex> lock(writer_mutex);
+	while (!writer_stop) {
+		lock.unlock();
+		AltsoundRealtime::applyToWorkerThread("log writer");
+		const bool wrote = drain();
+		lock.lock();
+
+		if (!wrote)
+			writer_cv.wait_for(lock, std::chrono::milliseconds(10));
+	}
+	lock.unlock();
+
+	drain();
+}
+
+bool AltsoundLogger::drain()
+{
+	std::lock_guard<std::mutex> lock(out_mutex);
+
+	bool wrote = false;
+	char line[sizeof(Record::text) + 128];
+
+	auto write = [&](const char* text) {
+		if (out.is_open())
+			out << text;
+		if (console)
+			std::cout << text;
+	};
+
+	for (;;) {
+		Slot& slot = ring[read_pos & (ringSize - 1)];
+		if (slot.seq.load(std::memory_order_acquire) != read_pos + 1)
+			break;
+
+		const Record& rec = slot.rec;
+		snprintf(line, sizeof(line), "%10.3f %2u %*s%s: %s\n", rec.time_ns / 1e9, rec.thread,
+		         rec.indent * indentWidth, "", toString(rec.lvl), rec.text);
+		write(line);
+
+		slot.seq.store(read_pos + ringSize, std::memory_order_release);
+		++read_pos;
+		wrote = true;
+	}
+
+	const unsigned int lost = dropped.exchange(0, std::memory_order_relaxed);
+	if (lost) {
+		snprintf(line, sizeof(line), "%10.3f    %s: %u log messages dropped\n",
+		         std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count(),
+		         toString(Warning), lost);
+		write(line);
+		wrote = true;
+	}
+
+	if (wrote) {
+		if (out.is_open())
+			out.flush();
+		if (console)
+			std::cout.flush();
+	}
+	return wrote;
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundLogger::flush()
+{
+	std::thread stopping;
+	{
+		std::lock_guard<std::mutex> lock(writer_mutex);
+		if (!writer.joinable())
+			return;
+
+		writer_stop = true;
+		stopping = std::move(writer);
+	}
+	writer_cv.notify_one();
+	stopping.join();
+
+	// records published while the writer was stopping
+	std::lock_guard<std::mutex> lock(writer_mutex);
+	writer_running.store(false, std::memory_order_release);
+	drain();
 }
 
 // ----------------------------------------------------------------------------
@@ -25,19 +25,41 @@
 #include <cstdarg>
 #include <cstdlib>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 using std::string;
 
-// convenience macros
-#define ALT_INFO(indent, msg, ...) alog.info(indent, msg, ##__VA_ARGS__)
-#define ALT_ERROR(indent, msg, ...) alog.error(indent, msg, ##__VA_ARGS__)
-#define ALT_WARNING(indent, msg, ...) alog.warning(indent, msg, ##__VA_ARGS__)
-#define ALT_DEBUG(indent, msg, ...) alog.debug(indent, msg, ##__VA_ARGS__)
+// Highest log level compiled in (0 = NONE ... 4 = DEBUG, see
+// AltsoundLogger::Level).  Messages above it are removed at compile time and
+// cannot be enabled at runtime.  Set by the ALTSOUND_MAX_LOG_LEVEL CMake option
+#ifndef ALTSOUND_MAX_LOG_LEVEL
+#define ALTSOUND_MAX_LOG_LEVEL 4
+#endif
+
+// true if messages of the given level are compiled in and enabled at runtime
+#define ALT_LOG_ENABLED(lvl) (AltsoundLogger::lvl <= ALTSOUND_MAX_LOG_LEVEL && alog.isEnabled(AltsoundLogger::lvl))
+
+// convenience macros.  The level is checked before any argument is evaluated
+#define ALT_INFO(indent, msg, ...) do { if (ALT_LOG_ENABLED(Info)) alog.info(indent, msg, ##__VA_ARGS__); } while (0)
+#define ALT_ERROR(indent, msg, ...) do { if (ALT_LOG_ENABLED(Error)) alog.error(indent, msg, ##__VA_ARGS__); } while (0)
+#define ALT_WARNING(indent, msg, ...) do { if (ALT_LOG_ENABLED(Warning)) alog.warning(indent, msg, ##__VA_ARGS__); } while (0)
+#define ALT_DEBUG(indent, msg, ...) do { if (ALT_LOG_ENABLED(Debug)) alog.debug(indent, msg, ##__VA_ARGS__); } while (0)
 //#define ALT_INDENT alog.indent()
 #define ALT_INDENT
 //#define ALT_OUTDENT alog.outdent()
 #define ALT_OUTDENT
-#define ALT_CALL(func) ([&]() { alog.indent(); auto ret = func; alog.outdent(); return ret; }())
+#if ALTSOUND_MAX_LOG_LEVEL > 0
+// indents the messages logged by func; the indent lasts until the end of the
+// full expression
+#define ALT_CALL(func) (AltsoundLogger::ScopedIndent(), func)
+#else
+#define ALT_CALL(func) (func)
+#endif
 #define ALT_RETURN(retval) do { alog.outdent(); return retval; } while (0)
 
 class AltsoundLogger
@@ -55,7 +77,20 @@ public:
 	explicit AltsoundLogger();
 	explicit AltsoundLogger(const string& filename);
 
-	~AltsoundLogger() = default;
+	~AltsoundLogger();
+
+	// Starts the writer thread if it is not running and there is an output
+	// to write to.  Messages logged while
+	// it is stopped wait in the ring buffer.  log() never starts it, so
+	// logging never blocks, not even the first message of a thread
+	void start();
+
+	// Writes all pending messages and stops the writer thread until the
+	// next start()
+	void flush();
+
+	// true while the writer thread runs
+	bool isRunning() const { return writer_running.load(std::memory_order_acquire); }
 
 	// DAR@20230706
 	// Because these are variadic template functions, their definitions must
@@ -64,7 +99,7 @@ public:
 	// Log INFO level messages
 	void info(int rel_indent, const char* format, ...)
 	{
-		if (log_level >= Level::Info) {
+		if (logLevel() >= Level::Info) {
 			va_list args;
 			va_start(args, format);
 			log(base_indent + rel_indent, Level::Info, format, args);
@@ -75,7 +110,7 @@ public:
 	// Log ERROR level messages
 	void error(int rel_indent, const char* format, ...)
 	{
-		if (log_level >= Level::Error) {
+		if (logLevel() >= Level::Error) {
 			va_list args;
 			va_start(args, format);
 			log(base_indent + rel_indent, Level::Error, format, args);
@@ -86,7 +121,7 @@ public:
 	// Log WARNING level messages
 	void warning(int rel_indent, const char* format, ...)
 	{
-		if (log_level >= Level::Warning) {
+		if (logLevel() >= Level::Warning) {
 			va_list args;
 			va_start(args, format);
 			log(base_indent + rel_indent, Level::Warning, format, args);
@@ -97,7 +132,7 @@ public:
 	// Log DEBUG level messages
 	void debug(int rel_indent, const char* format, ...)
 	{
-		if (log_level >= Level::Debug) {
+		if (logLevel() >= Level::Debug) {
 			va_list args;
 			va_start(args, format);
 			log(base_indent + rel_indent, Level::Debug, format, args);
@@ -109,6 +144,15 @@ public:
 	void setLogLevel(Level level);
 	void enableConsole(const bool enable);
 
+	// true if messages of the given level are logged
+	bool isEnabled(Level lvl) const { return logLevel() >= lvl; }
+
+	// Increases the base indent for its lifetime
+	struct ScopedIndent {
+		ScopedIndent() { indent(); }
+		~ScopedIndent() { outdent(); }
+	};
+
 	// increase base indent
 	static void indent();
 
@@ -120,47 +164,23 @@ public:
 
 private:  // methods
 
-	// DAR@20230706
-	// Because this is a variadic template function, it must remain in the header
-	//
-	// main logging method
-	void log(int indentLevel, Level lvl, const char* format, va_list args) {
-		va_list args_copy;
-		va_copy(args_copy, args);
-		int size = vsnprintf(nullptr, 0, format, args_copy);
-		va_end(args_copy);
-
-		if (size >= 0) {
-			char* buffer = nullptr;
-			if (size > 0) {
-				buffer = static_cast<char*>(malloc(size + 1));
-				vsnprintf(buffer, size + 1, format, args);
-			}
-
-			std::stringstream message;
-			message << string(indentLevel * indentWidth, ' ')
-				<< toString(lvl) << ": " << (buffer ? buffer : "") << "\n";
-			const string finalMessage = message.str();
-
-			if (out.is_open()) {
-				out << finalMessage;
-				out.flush();
-			}
-
-			if (console)
-				std::cout << finalMessage;
-
-			if (buffer)
-				free(buffer);
-		}
-	}
+	// main logging method.  Formats the message into a record of the ring
+	// buffer; the writer thread outputs it.  Never blocks: if the ring is
+	// full, the message is counted as dropped
+	void log(int indentLevel, Level lvl, const char* format, va_list args);
+
+	// writer thread main loop
+	void writerMain();
+
+	// writes all published records.  Returns false if there were none
+	bool drain();
 
 	// DAR@20230706
 	// This is only used for logging message within the logger class
 	//
 	void none(int rel_indent, const char* format, ...)
 	{
-		if (log_level >= Level::None) {
+		if (logLevel() >= Level::None) {
 			va_list args;
 			va_start(args, format);
 			log(base_indent + rel_indent, Level::None, format, args);
@@ -171,14 +191,50 @@ private:  // methods
 	// convert Level enum value to a string
 	const char* toString(Level lvl);
 
+	// set by the init of every context, read by all threads
+	Level logLevel() const { return log_level.load(std::memory_order_relaxed); }
+
 private: // data
 
+	// One preformatted log message.  Longer messages are truncated
+	struct Record {
+		Level lvl;
+		int indent;
+		uint64_t time_ns;  // since logger creation
+		unsigned int thread;
+		char text[224];
+	};
+
+	// Ring slot.  seq implements a bounded MPSC queue: producers claim a
+	// position with a CAS on write_pos and publish by advancing seq
+	struct Slot {
+		std::atomic<size_t> seq;
+		Record rec;
+	};
+
+	static constexpr size_t ringSize = 1024;
+	static_assert((ringSize & (ringSize - 1)) == 0, "ringSize must be a power of two");
+
 	// Thread-local storage for the base indentation level
 	static thread_local int base_indent;
-	Level log_level = None;
+	std::atomic<Level> log_level{ None };
 	bool console = false;
 	static constexpr int indentWidth = 4;
 	std::ofstream out;
+
+	std::atomic<bool> has_output{ false }; // log file open or console enabled
+	std::unique_ptr<Slot[]> ring;
+	std::atomic<size_t> write_pos{ 0 };
+	size_t read_pos = 0;                  // writer thread only
+	std::atomic<unsigned int> dropped{ 0 };
+	std::chrono::steady_clock::time_point start_time;
+
+	std::thread writer;
+	std::atomic<bool> writer_running{ false };
+	bool writer_stop = false;
+	std::mutex writer_mutex;              // guards writer start/stop
+	std::mutex out_mutex;                 // guards out and console output
+	std::condition_variable writer_cv;
 };
 
 // ----------------------------------------------------------------------------
@@ -187,8 +243,13 @@ private: // data
 
 inline void AltsoundLogger::setLogPath(const string& logPath)
 {
+	// messages queued so far belong to the previous file
+	flush();
+
+	std::unique_lock<std::mutex> lock(out_mutex);
 	if (out.is_open())
 		out.close();
+	has_output = console;
 
 	if (logPath.empty())
 		return;
@@ -202,19 +263,28 @@ inline void AltsoundLogger::setLogPath(const string& logPath)
 	full_path += "altsound.log";
 
 	out.open(full_path.c_str());
+	has_output = out.is_open() || console;
+	lock.unlock();
 
+	start();
 	none(0, "path set: %s", full_path.c_str());
 }
 
 inline void AltsoundLogger::setLogLevel(Level level)
 {
-	log_level = level;
-	none(0, "New log level set: %s", toString(log_level));
+	log_level.store(level, std::memory_order_relaxed);
+	none(0, "New log level set: %s", toString(level));
 }
 
 inline void AltsoundLogger::enableConsole(const bool enable)
 {
-	console = enable;
+	{
+		std::lock_guard<std::mutex> lock(out_mutex);
+		console = enable;
+		has_output = out.is_open() || console;
+	}
+	if (enable)
+		start();
 }
 
 // ----------------------------------------------------------------------------
@@ -0,0 +1,369 @@
+// ---------------------------------------------------------------------------
+// altsound_output_format.cpp
+//
+// Conversion of the mixed frames to the host's sample format
+// ---------------------------------------------------------------------------
+// license:BSD-3-Clause
+// copyright-holders: Dave Roscoe
+// ---------------------------------------------------------------------------
+
+#include "altsound_output_format.hpp"
+#include "altsound_logger.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ALTSOUND_OUTPUT_SSE2 1
+#include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define ALTSOUND_OUTPUT_NEON 1
+#include <arm_neon.h>
+#endif
+
+extern AltsoundLogger alog;
+
+// Full scale is 1.0. s32 scales by 2^31, which does not fit an int32, so
+// it clips at the largest float below it
+static constexpr float S16_SCALE = 32767.0f;
+static constexpr float S16_MIN = -32768.0f;
+static constexpr float S16_MAX = 32767.0f;
+static constexpr float S32_SCALE = 2147483648.0f;
+static constexpr float S32_MIN = -2147483648.0f;
+static constexpr float S32_MAX = 2147483520.0f;
+
+// ----------------------------------------------------------------------------
+// Scalar kernels, also the tails of the SIMD ones
+// ----------------------------------------------------------------------------
+
+static inline uint32_t xorshift(uint32_t& x)
+{
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return x;
+}
+
+// [0, 1) from the top 23 bits
+static inline float uniform(uint32_t x)
+{
+	const uint32_t bits = (x >> 9) | 0x3F800000u;
+	float f;
+	memcpy(&f, &bits, sizeof(f));
+	return f - 1.0f;
+}
+
+// state: the two generators, null = no dither. The difference of two
+// uniform values has a triangular distribution over +-1 LSB
+static void toS16Scalar(const float* in, int16_t* out, size_t count, uint32_t* state)
+{
+	for (size_t i = 0; i < count; ++i) {
+		float v = in[i] * S16_SCALE;
+		if (state) {
+			const size_t lane = i & 3;
+			v += uniform(xorshift(state[lane])) - uniform(xorshift(state[4 + lane]));
+		}
+		out[i] = (int16_t)lrintf(std::min(std::max(v, S16_MIN), S16_MAX));
+	}
+}
+
+static void toS32Scalar(const float* in, int32_t* out, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+		out[i] = (int32_t)lrintf(std::min(std::max(in[i] * S32_SCALE, S32_MIN), S32_MAX));
+}
+
+static void deinterleaveScalar(const float* in, float* out, size_t frameCount, uint32_t channels, size_t stride)
+{
+	for (uint32_t c = 0; c < channels; ++c) {
+		float* plane = out + c * stride;
+		for (size_t i = 0; i < frameCount; ++i)
+			plane[i] = in[i * channels + c];
+	}
+}
+
+// ----------------------------------------------------------------------------
+// SSE2 kernels
+// ----------------------------------------------------------------------------
+
+#if defined(ALTSOUND_OUTPUT_SSE2)
+
+static inline __m128i xorshift4(__m128i& x)
+{
+	x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+	x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+	x = _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+	return x;
+}
+
+static inline __m128 uniform4(__m128i x)
+{
+	const __m128i bits = _mm_or_si128(_mm_srli_epi32(x, 9), _mm_set1_epi32(0x3F800000));
+	return _mm_sub_ps(_mm_castsi128_ps(bits), _mm_set1_ps(1.0f));
+}
+
+static void toS16(const float* in, int16_t* out, size_t count, uint32_t* state)
+{
+	const __m128 scale = _mm_set1_ps(S16_SCALE);
+	const __m128 lo = _mm_set1_ps(S16_MIN);
+	const __m128 hi = _mm_set1_ps(S16_MAX);
+	__m128i a = state ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(state)) : _mm_setzero_si128();
+	__m128i b = state ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(state + 4)) : _mm_setzero_si128();
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m128 v0 = _mm_mul_ps(_mm_loadu_ps(in + i), scale);
+		__m128 v1 = _mm_mul_ps(_mm_loadu_ps(in + i + 4), scale);
+		if (state) {
+			v0 = _mm_add_ps(v0, _mm_sub_ps(uniform4(xorshift4(a)), uniform4(xorshift4(b))));
+			v1 = _mm_add_ps(v1, _mm_sub_ps(uniform4(xorshift4(a)), uniform4(xorshift4(b))));
+		}
+		v0 = _mm_min_ps(_mm_max_ps(v0, lo), hi);
+		v1 = _mm_min_ps(_mm_max_ps(v1, lo), hi);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packs_epi32(_mm_cvtps_epi32(v0), _mm_cvtps_epi32(v1)));
+	}
+
+	if (state) {
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(state), a);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4), b);
+	}
+	toS16Scalar(in + i, out + i, count - i, state);
+}
+
+static void toS32(const float* in, int32_t* out, size_t count)
+{
+	const __m128 scale = _mm_set1_ps(S32_SCALE);
+	const __m128 lo = _mm_set1_ps(S32_MIN);
+	const __m128 hi = _mm_set1_ps(S32_MAX);
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		const __m128 v = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in + i), scale), lo), hi);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_cvtps_epi32(v));
+	}
+	toS32Scalar(in + i, out + i, count - i);
+}
+
+static void deinterleave(const float* in, float* out, size_t frameCount, uint32_t channels, size_t stride)
+{
+	if (channels != 2) {
+		deinterleaveScalar(in, out, frameCount, channels, stride);
+		return;
+	}
+
+	float* left = out;
+	float* right = out + stride;
+	size_t i = 0;
+	for (; i + 4 <= frameCount; i += 4) {
+		const __m128 v0 = _mm_loadu_ps(in + 2 * i);
+		const __m128 v1 = _mm_loadu_ps(in + 2 * i + 4);
+		_mm_storeu_ps(left + i, _mm_shuffle_ps(v0, v1, _MM_SHUFFLE(2, 0, 2, 0)));
+		_mm_storeu_ps(right + i, _mm_shuffle_ps(v0, v1, _MM_SHUFFLE(3, 1, 3, 1)));
+	}
+	for (; i < frameCount; ++i) {
+		left[i] = in[2 * i];
+		right[i] = in[2 * i + 1];
+	}
+}
+
+// ----------------------------------------------------------------------------
+// NEON kernels
+// ----------------------------------------------------------------------------
+
+#elif defined(ALTSOUND_OUTPUT_NEON)
+
+static inline uint32x4_t xorshift4(uint32x4_t& x)
+{
+	x = veorq_u32(x, vshlq_n_u32(x, 13));
+	x = veorq_u32(x, vshrq_n_u32(x, 17));
+	x = veorq_u32(x, vshlq_n_u32(x, 5));
+	return x;
+}
+
+static inline float32x4_t uniform4(uint32x4_t x)
+{
+	const uint32x4_t bits = vorrq_u32(vshrq_n_u32(x, 9), vdupq_n_u32(0x3F800000u));
+	return vsubq_f32(vreinterpretq_f32_u32(bits), vdupq_n_f32(1.0f));
+}
+
+static void toS16(const float* in, int16_t* out, size_t count, uint32_t* state)
+{
+	const float32x4_t lo = vdupq_n_f32(S16_MIN);
+	const float32x4_t hi = vdupq_n_f32(S16_MAX);
+	uint32x4_t a = state ? vld1q_u32(state) : vdupq_n_u32(0);
+	uint32x4_t b = state ? vld1q_u32(state + 4) : vdupq_n_u32(0);
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		float32x4_t v0 = vmulq_n_f32(vld1q_f32(in + i), S16_SCALE);
+		float32x4_t v1 = vmulq_n_f32(vld1q_f32(in + i + 4), S16_SCALE);
+		if (state) {
+			v0 = vaddq_f32(v0, vsubq_f32(uniform4(xorshift4(a)), uniform4(xorshift4(b))));
+			v1 = vaddq_f32(v1, vsubq_f32(uniform4(xorshift4(a)), uniform4(xorshift4(b))));
+		}
+		v0 = vminq_f32(vmaxq_f32(v0, lo), hi);
+		v1 = vminq_f32(vmaxq_f32(v1, lo), hi);
+		vst1q_s16(out + i, vcombine_s16(vqmovn_s32(vcvtnq_s32_f32(v0)), vqmovn_s32(vcvtnq_s32_f32(v1))));
+	}
+
+	if (state) {
+		vst1q_u32(state, a);
+		vst1q_u32(state + 4, b);
+	}
+	toS16Scalar(in + i, out + i, count - i, state);
+}
+
+static void toS32(const float* in, int32_t* out, size_t count)
+{
+	const float32x4_t lo = vdupq_n_f32(S32_MIN);
+	const float32x4_t hi = vdupq_n_f32(S32_MAX);
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		const float32x4_t v = vminq_f32(vmaxq_f32(vmulq_n_f32(vld1q_f32(in + i), S32_SCALE), lo), hi);
+		vst1q_s32(out + i, vcvtnq_s32_f32(v));
+	}
+	toS32Scalar(in + i, out + i, count - i);
+}
+
+static void deinterleave(const float* in, float* out, size_t frameCount, uint32_t channels, size_t stride)
+{
+	if (channels != 2) {
+		deinterleaveScalar(in, out, frameCount, channels, stride);
+		return;
+	}
+
+	float* left = out;
+	float* right = out + stride;
+	size_t i = 0;
+	for (; i + 4 <= frameCount; i += 4) {
+		const float32x4x2_t v = vld2q_f32(in + 2 * i);
+		vst1q_f32(left + i, v.val[0]);
+		vst1q_f32(right + i, v.val[1]);
+	}
+	for (; i < frameCount; ++i) {
+		left[i] = in[2 * i];
+		right[i] = in[2 * i + 1];
+	}
+}
+
+#else
+
+static void toS16(const float* in, int16_t* out, size_t count, uint32_t* state)
+{
+	toS16Scalar(in, out, count, state);
+}
+
+static void toS32(const float* in, int32_t* out, size_t count)
+{
+	toS32Scalar(in, out, count);
+}
+
+static void deinterleave(const float* in, float* out, size_t frameCount, uint32_t channels, size_t stride)
+{
+	deinterleaveScalar(in, out, frameCount, channels, stride);
+}
+
+#endif
+
+// ----------------------------------------------------------------------------
+
+const char* AltsoundOutputFormat::kernelName()
+{
+#if defined(ALTSOUND_OUTPUT_SSE2)
+	return "SSE2";
+#elif defined(ALTSOUND_OUTPUT_NEON)
+	return "NEON";
+#else
+	return "scalar";
+#endif
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundOutputFormat::init(ALTSOUND_SAMPLE_FORMAT format_in, bool planar_in, bool dither_in, uint32_t channels_in,
+                                uint32_t maxFrames)
+{
+	format = format_in;
+	planar = planar_in && channels_in > 1;
+	dither = dither_in && format == ALTSOUND_SAMPLE_FORMAT_S16;
+	channels = channels_in;
+	converting = format != ALTSOUND_SAMPLE_FORMAT_F32 || planar;
+	sample_bytes = format == ALTSOUND_SAMPLE_FORMAT_S16 ? sizeof(int16_t)
+	             : format == ALTSOUND_SAMPLE_FORMAT_S32 ? sizeof(int32_t) : sizeof(float);
+	max_frames = std::max<size_t>(maxFrames, 1);
+	scratch.assign(planar && format != ALTSOUND_SAMPLE_FORMAT_F32 ? max_frames * channels : 0, 0.0f);
+
+	// fixed seeds keep manual renders reproducible; xorshift needs nonzero
+	for (uint32_t i = 0; i < 8; ++i)
+		dither_state[i] = 0x9E3779B9u * (i + 1);
+
+	static const char* const names[] = { "f32", "s16", "s32" };
+	ALT_INFO(0, "Output format: %s%s, %s (%s)", names[format], dither ? " with TPDF dither" : "",
+	         planar ? "planar" : "interleaved", kernelName());
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundOutputFormat::convertSamples(const float* in, void* out, size_t count)
+{
+	switch (format) {
+	case ALTSOUND_SAMPLE_FORMAT_S16:
+		(scalar ? toS16Scalar : toS16)(in, static_cast<int16_t*>(out), count, dither ? dither_state : nullptr);
+		break;
+	case ALTSOUND_SAMPLE_FORMAT_S32:
+		(scalar ? toS32Scalar : toS32)(in, static_cast<int32_t*>(out), count);
+		break;
+	default:
+		memcpy(out, in, count * sizeof(float));
+		break;
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundOutputFormat::convert(const float* frames, size_t frameCount, void* out, size_t planeFrames,
+                                   size_t firstFrame)
+{
+	uint8_t* const base = static_cast<uint8_t*>(out);
+	if (!planeFrames)
+		planeFrames = frameCount;
+
+	if (!planar) {
+		convertSamples(frames, base + firstFrame * bytesPerFrame(), frameCount * channels);
+		return;
+	}
+
+	const auto split = scalar ? deinterleaveScalar : deinterleave;
+	if (format == ALTSOUND_SAMPLE_FORMAT_F32) {
+		split(frames, reinterpret_cast<float*>(out) + firstFrame, frameCount, channels, planeFrames);
+		return;
+	}
+
+	// integer planes go through the scratch buffer, a piece at a time
+	for (size_t done = 0; done < frameCount;) {
+		const size_t n = std::min(frameCount - done, max_frames);
+		split(frames + done * channels, scratch.data(), n, channels, n);
+		for (uint32_t c = 0; c < channels; ++c)
+			convertSamples(scratch.data() + c * n, base + (c * planeFrames + firstFrame + done) * sample_bytes, n);
+		done += n;
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundOutputFormat::silence(void* out, size_t frameCount, size_t planeFrames, size_t firstFrame)
+{
+	uint8_t* const base = static_cast<uint8_t*>(out);
+	if (!planeFrames)
+		planeFrames = frameCount;
+
+	if (!planar) {
+		memset(base + firstFrame * bytesPerFrame(), 0, frameCount * bytesPerFrame());
+		return;
+	}
+
+	for (uint32_t c = 0; c < channels; ++c)
+		memset(base + (c * planeFrames + firstFrame) * sample_bytes, 0, frameCount * sample_bytes);
+}
@@ -0,0 +1,77 @@
+// ---------------------------------------------------------------------------
+// altsound_output_format.hpp
+//
+// Conversion of the mixed frames to the host's sample format.  The mixer
+// works in interleaved f32; hosts that want s16 (optionally with TPDF
+// dither), s32 or planar buffers get them converted once, on the audio
+// thread, by SIMD kernels: SSE2 on x86, NEON on ARM64, scalar elsewhere.
+// ---------------------------------------------------------------------------
+// license:BSD-3-Clause
+// copyright-holders: Dave Roscoe
+// ---------------------------------------------------------------------------
+
+#ifndef ALTSOUND_OUTPUT_FORMAT_HPP
+#define ALTSOUND_OUTPUT_FORMAT_HPP
+#if !defined(__GNUC__) || (__GNUC__ == 3 && __GNUC_MINOR__ >= 4) || (__GNUC__ >= 4)	// GCC supports "pragma once" correctly since 3.4
+#pragma once
+#endif
+
+#include "altsound.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class AltsoundOutputFormat {
+public:
+
+	// Sets the output format. maxFrames sizes the scratch buffer of planar
+	// integer output; longer buffers are converted in pieces. Call while the
+	// audio thread is stopped
+	void init(ALTSOUND_SAMPLE_FORMAT format, bool planar, bool dither, uint32_t channels, uint32_t maxFrames);
+
+	// false for interleaved f32, the mixer's own format
+	bool isConverting() const { return converting; }
+
+	size_t bytesPerFrame() const { return sample_bytes * channels; }
+
+	// Converts frameCount interleaved f32 frames into out.  Planar output
+	// puts frame i of channel c at sample c * planeFrames + firstFrame + i,
+	// interleaved output puts frame i at frame firstFrame + i.  planeFrames
+	// 0 = frameCount
+	void convert(const float* frames, size_t frameCount, void* out, size_t planeFrames = 0, size_t firstFrame = 0);
+
+	// Writes frameCount frames of digital silence, undithered, the same way
+	void silence(void* out, size_t frameCount, size_t planeFrames = 0, size_t firstFrame = 0);
+
+	// name of the SIMD kernels compiled in
+	static const char* kernelName();
+
+	// Uses the scalar kernels, the reference the SIMD ones are tested
+	// against
+	void setScalarKernels(bool enable) { scalar = enable; }
+
+private: // functions
+
+	// converts count contiguous samples
+	void convertSamples(const float* in, void* out, size_t count);
+
+private: // data
+
+	ALTSOUND_SAMPLE_FORMAT format = ALTSOUND_SAMPLE_FORMAT_F32;
+	bool planar = false;
+	bool dither = false;
+	bool converting = false;
+	bool scalar = false;
+	uint32_t channels = 0;
+	size_t sample_bytes = sizeof(float);
+	size_t max_frames = 0;
+
+	// planar integer output is deinterleaved here first
+	std::vector<float> scratch;
+
+	// xorshift32 states of the two dither generators, one per SIMD lane
+	uint32_t dither_state[8] = {};
+};
+
+#endif // ALTSOUND_OUTPUT_FORMAT_HPP
@@ -11,27 +11,18 @@
 #define NOMINMAX
 
 #include "altsound_processor.hpp"
+#include "altsound_context.hpp"
 #include "altsound_csv_parser.hpp"
 #include "altsound_file_parser.hpp"
 #include "altsound_logger.hpp"
+#include "altsound_rt_check.hpp"
+#include "altsound_stats.hpp"
+#include "altsound_trace.hpp"
 #include "miniaudio_bass_compat.hpp"
 
+#include <cmath>
 #include <limits>
 
-// NOTE:
-// - SFX streams don't require tracking since multiple can play,
-//   simultaneously, and other than adjusting ducking, have no other
-//   impacts on active streams
-//
-static AltsoundStreamInfo* cur_mus_stream = nullptr;
-static AltsoundStreamInfo* cur_jin_stream = nullptr;
-
-// Instance of global thread synchronization mutex
-extern std::mutex io_mutex;
-
-// Instance of global array of miniaudio channels
-extern StreamArray channel_stream;
-
 // Reference to global logger instance
 extern AltsoundLogger alog;
 
@@ -76,7 +67,7 @@ bool AltsoundProcessor::handleCmd(const unsigned int cmd_combined_in)
 	ALT_INDENT;
 
 	ALT_DEBUG(0, "Acquiring mutex");
-	std::lock_guard<std::mutex> guard(io_mutex);
+	std::lock_guard<std::recursive_mutex> guard(io_mutex);
 
 	// Pass command to base class for processing
 	AltsoundProcessorBase::handleCmd(cmd_combined_in);
@@ -99,6 +90,7 @@ bool AltsoundProcessor::handleCmd(const unsigned int cmd_combined_in)
 	if (skip_count > 0) {
 		--skip_count;
 		AltsoundProcessorBase::setSkipCount(skip_count);
+		AltsoundStats::add(context.stats.skipped);
 		ALT_DEBUG(0, "Sound command skipped, (%d) remaining", skip_count);
 		ALT_DEBUG(0, "END AltsoundProcessor::handleCmd()");
 		return true;
@@ -109,6 +101,7 @@ bool AltsoundProcessor::handleCmd(const unsigned int cmd_combined_in)
 
 	if (sample_idx == UNSET_IDX) {
 		// No matching command.  Clean up and exit
+		AltsoundStats::add(context.stats.unmatched);
 		ALT_ERROR(0, "FAILED AltsoundProcessor::get_sample(%u)", cmd_combined_in);
 
 		ALT_OUTDENT;
@@ -116,6 +109,21 @@ bool AltsoundProcessor::handleCmd(const unsigned int cmd_combined_in)
 		return false;
 	}
 
+	if (AltsoundTrace::enabled()) {
+		AltsoundTrace::instant("processor", "sample", { { "cmd", (double)cmd_combined_in } },
+		                       getShortPath(samples[sample_idx].fname).c_str());
+	}
+
+	const int sample_channel = samples[sample_idx].channel;
+	const AltsoundSampleType sample_type = sample_channel == 0 ? MUSIC : sample_channel == 1 ? JINGLE : SFX;
+
+	// Repeats of a playing sample may be coalesced, restarted or dropped
+	if (!ALT_CALL(admitTrigger(cmd_combined_in, samples[sample_idx].fname, sample_type))) {
+		ALT_OUTDENT;
+		ALT_DEBUG(0, "END AltsoundProcessor::handleCmd()");
+		return true;
+	}
+
 	bool play_music = false;
 	bool play_jingle = false;
 	bool play_sfx = false;
@@ -130,8 +138,6 @@ bool AltsoundProcessor::handleCmd(const unsigned int cmd_combined_in)
 	new_stream->loop        = samples[sample_idx].loop;
 	new_stream->gain        = samples[sample_idx].gain;
 
-	const int sample_channel = samples[sample_idx].channel;
-
 	if (sample_channel == 1) {
 		// Command is for playing Jingle/Single
 		new_stream->stream_type = JINGLE;
@@ -193,33 +199,24 @@ bool AltsoundProcessor::handleCmd(const unsigned int cmd_combined_in)
 
 	if (!play_music && !play_jingle && !play_sfx) {
 		ALT_ERROR(0, "FAILED AltsoundProcessor::alt_sound_handle()");
+		discardStream(new_stream);
 
 		ALT_OUTDENT;
 		ALT_DEBUG(0, "END AltsoundProcessor::process_cmd()");
 		return false;
 	}
 
-	// Get lowest ducking value from all channels (including music, jingle)
-	const float min_ducking = getMinDucking();
-	ALT_INFO(0, "Min ducking value: %.02f", min_ducking);
-
-	// set new music volume
-	if (cur_mus_stream) {
-		// calculate ducked volume for music
-		const float adj_mus_vol = cur_mus_stream->gain * min_ducking;
-		setStreamVolume(cur_mus_stream->hstream, adj_mus_vol);
-	}
-	else {
-		// No music is currently playing.  If a music file starts later,
-		// the code above will ensure the volume will be set correctly
-		ALT_INFO(0, "No music stream. Skipping.");
-	}
+	// When batching, ducking is recomputed once at the end of the batch
+	if (!isBatching())
+		updateStreamVolumes();
 
 	// Play pending sound determined above, if any
 	if (new_stream->hstream != MINIAUDIO_NO_STREAM) {
-		if (!MiniAudio_ChannelPlay(stream, false)) {
+		if (!playStream(stream)) {
 			// Sound playback failed
 			ALT_ERROR(0, "FAILED MiniAudio_ChannelPlay(%u): %s", new_stream->hstream, get_miniaudio_err());
+			releaseFailedStream(stream);
+			updateStreamVolumes();
 		}
 		else {
 			ALT_INFO(0, "SUCCESS MiniAudio_ChannelPlay(%u): CH(%d) CMD(%04X) SAMPLE(%s)", \
@@ -273,7 +270,11 @@ void AltsoundProcessorBase::setGlobalVol(const float vol_in)
 	for (size_t index = 0; index < channel_stream.size(); ++index) {
 		const auto stream = channel_stream[index];
 		if (stream) {
-			vol[index] = getStreamVolume(stream->hstream);
+			// At a zero (or underflowed) global or master volume, the stream
+			// volume no longer carries the sample volume, and dividing it
+			// back out yields inf/NaN.  Fall back to the sample gain
+			const float stream_vol = getStreamVolume(stream->hstream);
+			vol[index] = std::isfinite(stream_vol) ? stream_vol : stream->gain;
 		}
 	}
 
@@ -356,7 +357,7 @@ unsigned int AltsoundProcessor::getSample(const unsigned int cmd_combined_in)
 
 			// num_samples now contains the number of samples with the same ID
 			// pick one to play at random
-			sample_idx = static_cast<unsigned int>(i) + rand() % num_samples;
+			sample_idx = static_cast<unsigned int>(i) + randomIndex(num_samples);
 			break;
 		}
 	}
@@ -569,6 +570,14 @@ bool AltsoundProcessor::stopJingleStream()
 // ---------------------------------------------------------------------------
 
 void ALTSOUNDCALLBACK AltsoundProcessor::jingle_callback(unsigned int handle, unsigned int channel, unsigned int data, void* user)
+{
+	// SYNCPROCs run on the thread the context of their stream is bound to
+	static_cast<AltsoundProcessor*>(AltsoundContext::current().processor)->jingleEnded(handle, channel, user);
+}
+
+// ---------------------------------------------------------------------------
+
+void AltsoundProcessor::jingleEnded(unsigned int handle, unsigned int channel, void* user)
 {
 	// All SYNCPROC functions run on the same thread, and will block other
 	// sync processes, so these should be fast.  The SYNCPROC thread is
@@ -578,7 +587,8 @@ void ALTSOUNDCALLBACK AltsoundProcessor::jingle_callback(unsigned int handle, un
 
 	ALT_INFO(0, "HSYNC: %u  HSTREAM: %u", handle, channel);
 	ALT_DEBUG(0, "Acquiring mutex");
-	std::lock_guard<std::mutex> guard(io_mutex);
+	// the SYNCPROC runs on the audio thread, which holds io_mutex already
+	const auto guard = AltsoundRtCheck::lock(io_mutex, "io_mutex lock");
 
 	unsigned int hstream_in = channel;
 	const AltsoundStreamInfo* stream_inst = static_cast<AltsoundStreamInfo*>(user);
@@ -598,6 +608,8 @@ void ALTSOUNDCALLBACK AltsoundProcessor::jingle_callback(unsigned int handle, un
 
 	unsigned int inst_hstream = stream_inst->hstream;
 	const unsigned int inst_ch_idx = stream_inst->channel_idx;
+	// freeStream() deletes the instance
+	const float inst_ducking = stream_inst->ducking;
 
 	ALT_INFO(0, "JINGLE stream(%u) finished on ch(%02d)", inst_hstream, inst_ch_idx);
 
@@ -626,7 +638,7 @@ void ALTSOUNDCALLBACK AltsoundProcessor::jingle_callback(unsigned int handle, un
 		// DAR@20230622
 		// This is a kludgy way to make sure we only resume paused playback
 		// when the stream that paused it ends
-		if (stream_inst->ducking < 0.0f && MiniAudio_ChannelIsActive(mus_hstream) == MINIAUDIO_ACTIVE_PAUSED) {
+		if (inst_ducking < 0.0f && MiniAudio_ChannelIsActive(mus_hstream) == MINIAUDIO_ACTIVE_PAUSED) {
 			ALT_INFO(0, "Resuming MUSIC playback");
 
 			if (!MiniAudio_ChannelPlay(mus_hstream, false)) {
@@ -642,6 +654,14 @@ void ALTSOUNDCALLBACK AltsoundProcessor::jingle_callback(unsigned int handle, un
 // ---------------------------------------------------------------------------
 
 void ALTSOUNDCALLBACK AltsoundProcessor::sfx_callback(unsigned int handle, unsigned int channel, unsigned int data, void* user)
+{
+	// SYNCPROCs run on the thread the context of their stream is bound to
+	static_cast<AltsoundProcessor*>(AltsoundContext::current().processor)->sfxEnded(handle, channel, user);
+}
+
+// ---------------------------------------------------------------------------
+
+void AltsoundProcessor::sfxEnded(unsigned int handle, unsigned int channel, void* user)
 {
 	// All SYNCPROC functions run on the same thread, and will block other
 	// sync processes, so these should be fast.  The SYNCPROC thread is
@@ -651,7 +671,8 @@ void ALTSOUNDCALLBACK AltsoundProcessor::sfx_callback(unsigned int handle, unsig
 
 	ALT_INFO(0, "HSYNC: %u  HSTREAM: %u", handle, channel);
 	ALT_DEBUG(0, "Acquiring mutex");
-	std::lock_guard<std::mutex> guard(io_mutex);
+	// the SYNCPROC runs on the audio thread, which holds io_mutex already
+	const auto guard = AltsoundRtCheck::lock(io_mutex, "io_mutex lock");
 
 	unsigned int hstream_in = channel;
 	const AltsoundStreamInfo* stream_inst = static_cast<AltsoundStreamInfo*>(user);
@@ -700,6 +721,14 @@ void ALTSOUNDCALLBACK AltsoundProcessor::sfx_callback(unsigned int handle, unsig
 // ---------------------------------------------------------------------------
 
 void ALTSOUNDCALLBACK AltsoundProcessor::music_callback(unsigned int handle, unsigned int channel, unsigned int data, void* user)
+{
+	// SYNCPROCs run on the thread the context of their stream is bound to
+	static_cast<AltsoundProcessor*>(AltsoundContext::current().processor)->musicEnded(handle, channel, user);
+}
+
+// ---------------------------------------------------------------------------
+
+void AltsoundProcessor::musicEnded(unsigned int handle, unsigned int channel, void* user)
 {
 	// All SYNCPROC functions run on the same thread, and will block other
 	// sync processes, so these should be fast.  The SYNCPROC thread is
@@ -709,7 +738,8 @@ void ALTSOUNDCALLBACK AltsoundProcessor::music_callback(unsigned int handle, uns
 
 	ALT_INFO(0, "HSYNC: %u  HSTREAM: %u", handle, channel);
 	ALT_DEBUG(0, "Acquiring mutex");
-	std::lock_guard<std::mutex> guard(io_mutex);
+	// the SYNCPROC runs on the audio thread, which holds io_mutex already
+	const auto guard = AltsoundRtCheck::lock(io_mutex, "io_mutex lock");
 
 	unsigned int hstream_in = channel;
 	const AltsoundStreamInfo* stream_inst = static_cast<AltsoundStreamInfo*>(user);
@@ -748,6 +778,58 @@ void ALTSOUNDCALLBACK AltsoundProcessor::music_callback(unsigned int handle, uns
 
 // ---------------------------------------------------------------------------
 
+bool AltsoundProcessor::updateStreamVolumes()
+{
+	ALT_DEBUG(0, "BEGIN AltsoundProcessor::updateStreamVolumes()");
+	ALT_INDENT;
+
+	bool success = true;
+
+	// Get lowest ducking value from all channels (including music, jingle)
+	const float min_ducking = getMinDucking();
+	ALT_INFO(0, "Min ducking value: %.02f", min_ducking);
+
+	// set new music volume
+	if (cur_mus_stream) {
+		// calculate ducked volume for music
+		const float adj_mus_vol = cur_mus_stream->gain * min_ducking;
+		success = setStreamVolume(cur_mus_stream->hstream, adj_mus_vol);
+	}
+	else {
+		// No music is currently playing.  If a music file starts later,
+		// the code above will ensure the volume will be set correctly
+		ALT_INFO(0, "No music stream. Skipping.");
+	}
+
+	ALT_OUTDENT;
+	ALT_DEBUG(0, "END AltsoundProcessor::updateStreamVolumes()");
+	return success;
+}
+
+// ---------------------------------------------------------------------------
+
+void AltsoundProcessor::forgetStream(const AltsoundStreamInfo& stream)
+{
+	if (&stream == cur_mus_stream)
+		cur_mus_stream = nullptr;
+
+	if (&stream == cur_jin_stream) {
+		cur_jin_stream = nullptr;
+
+		// a jingle that paused the music never ends, so resume it here
+		if (stream.ducking < 0.0f && cur_mus_stream &&
+		    MiniAudio_ChannelIsActive(cur_mus_stream->hstream) == MINIAUDIO_ACTIVE_PAUSED) {
+			ALT_INFO(0, "Resuming MUSIC playback");
+
+			if (!MiniAudio_ChannelPlay(cur_mus_stream->hstream, false)) {
+				ALT_ERROR(0, "FAILED MiniAudio_ChannelPlay(%u): %s", cur_mus_stream->hstream, get_miniaudio_err());
+			}
+		}
+	}
+}
+
+// ---------------------------------------------------------------------------
+
 float AltsoundProcessor::getMinDucking()
 {
 	ALT_DEBUG(0, "BEGIN: AltsoundProcessor::getMinDucking()");
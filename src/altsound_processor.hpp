@@ -59,6 +59,12 @@ public:
 	// miniaudio SYNCPROC callback when music samples end
 	static void ALTSOUNDCALLBACK music_callback(unsigned int handle, unsigned int channel, unsigned int data, void *user);
 
+	// SYNCPROC handlers, called by the callbacks above on the processor of
+	// the context whose stream ended
+	void jingleEnded(unsigned int handle, unsigned int channel, void* user);
+	void sfxEnded(unsigned int handle, unsigned int channel, void* user);
+	void musicEnded(unsigned int handle, unsigned int channel, void* user);
+
 protected:
 
 private: // functions
@@ -79,7 +85,13 @@ private: // functions
 	bool stopJingleStream();
 
 	// get lowest ducking value of all active streams
-	static float getMinDucking();
+	float getMinDucking();
+
+	// re-apply ducking to the current music stream
+	bool updateStreamVolumes() override;
+
+	// clear the music/jingle tracking of a released stream
+	void forgetStream(const AltsoundStreamInfo& stream) override;
 
 	// process music commands
 	bool process_music(AltsoundStreamInfo* stream_out);
@@ -96,6 +108,14 @@ private: // data
 	bool is_initialized;
 	bool is_stable; // future use
 	std::vector<AltsoundSampleInfo> samples;
+
+	// NOTE:
+	// - SFX streams don't require tracking since multiple can play,
+	//   simultaneously, and other than adjusting ducking, have no other
+	//   impacts on active streams
+	//
+	AltsoundStreamInfo* cur_mus_stream = nullptr;
+	AltsoundStreamInfo* cur_jin_stream = nullptr;
 };
 
 // ---------------------------------------------------------------------------
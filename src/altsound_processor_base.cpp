@@ -9,34 +9,15 @@
 // ---------------------------------------------------------------------------
 
 #include "altsound_processor_base.hpp"
+#include "altsound_context.hpp"
+#include "altsound_load_control.hpp"
 #include "altsound_logger.hpp"
+#include "altsound_stats.hpp"
 #include "miniaudio_bass_compat.hpp"
 
-#include <iomanip>
-#include <chrono>
 #include <cfloat>
-#include <fstream>
 
 extern AltsoundLogger alog;
-extern StreamArray channel_stream;
-
-// initialize static data members
-float AltsoundProcessorBase::global_vol = 1.0f;
-float AltsoundProcessorBase::master_vol = 1.0f;
-
-// reference to sound command recording status
-extern bool rec_snd_cmds;
-
-// DAR@20230721
-// ALTSOUND_STANDALONE is a compile-time flag set only when building the
-// altsound processor as an executable.  It prevents the executable from
-// trying to record a cmdlog.txt during playback, corrupting the source
-// file
-//
-#ifndef ALTSOUND_STANDALONE
-	std::ofstream logFile;
-	std::chrono::high_resolution_clock::time_point lastCmdTime;
-#endif
 
 // ---------------------------------------------------------------------------
 // CTOR/DTOR
@@ -46,7 +27,11 @@ AltsoundProcessorBase::AltsoundProcessorBase(const std::string& _game_name,
 	                                         const std::string& _vpm_path)
 : game_name(_game_name),
   vpm_path(_vpm_path),
-  skip_count(0)
+  context(AltsoundContext::current()),
+  channel_stream(context.channel_stream),
+  io_mutex(context.io_mutex),
+  skip_count(0),
+  random_engine(std::random_device()()) // seed random number generator
 {
 	if (!vpm_path.empty() && vpm_path.back() != '/')
 		vpm_path += '/';
@@ -54,11 +39,11 @@ AltsoundProcessorBase::AltsoundProcessorBase(const std::string& _game_name,
 
 AltsoundProcessorBase::~AltsoundProcessorBase()
 {
-#ifndef ALTSOUND_STANDALONE
-	// close sound command recording log
-	if (logFile.is_open())
-		logFile.close();
-#endif
+	ALT_INFO(0, "Retrigger: %llu coalesced, %llu restarted, %llu ignored, %llu limited",
+	         (unsigned long long)context.stats.retrigger_coalesced.load(std::memory_order_relaxed),
+	         (unsigned long long)context.stats.retrigger_restarted.load(std::memory_order_relaxed),
+	         (unsigned long long)context.stats.retrigger_ignored.load(std::memory_order_relaxed),
+	         (unsigned long long)context.stats.retrigger_limited.load(std::memory_order_relaxed));
 
 	// clean up stored steam objects
 	for (auto& stream : channel_stream) {
@@ -69,87 +54,188 @@ AltsoundProcessorBase::~AltsoundProcessorBase()
 
 // ---------------------------------------------------------------------------
 
-bool AltsoundProcessorBase::handleCmd(const unsigned int cmd_in)
+bool AltsoundProcessorBase::handleCmd(const unsigned int /*cmd_in*/)
 {
-#ifndef ALTSOUND_STANDALONE
-	if (rec_snd_cmds) {
-		// sound command recording is enabled
+	return true;
+}
 
-		// Get the current time.
-		const auto currentTime = std::chrono::high_resolution_clock::now();
+// ---------------------------------------------------------------------------
 
-		// Compute the difference from the last command time.
-		const auto deltaTime = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime - lastCmdTime).count();
+void AltsoundProcessorBase::beginBatch()
+{
+	ALT_DEBUG(0, "BEGIN AltsoundProcessorBase::beginBatch()");
 
-		// Log the time and command.
-		logFile << std::setw(10) << std::setfill('0') << std::dec << deltaTime;
-		logFile << ", 0x" << std::setw(4) << std::setfill('0') << std::hex << cmd_in;
-		logFile << ", " << "<user comments here>" << std::endl;
+	batching = true;
+	batch_streams.clear();
 
-		// Store the current time for the next command.
-		lastCmdTime = currentTime;
-	}
-#endif
-	return true;
+	ALT_DEBUG(0, "END AltsoundProcessorBase::beginBatch()");
 }
 
 // ---------------------------------------------------------------------------
 
-void AltsoundProcessorBase::init()
+bool AltsoundProcessorBase::endBatch()
 {
-#ifndef ALTSOUND_STANDALONE
-	// If recording sound commands, initialize output file
-	if (rec_snd_cmds) {
-		if (!ALT_CALL(startLogging(AltsoundProcessorBase::getGameName()))) {
-			ALT_ERROR(0, "FAILED startLogging()");
+	ALT_DEBUG(0, "BEGIN AltsoundProcessorBase::endBatch()");
+	ALT_INDENT;
+
+	batching = false;
+
+	// one volume/ducking pass for the whole batch
+	bool success = updateStreamVolumes();
+	bool released = false;
+
+	// Streams created earlier in the batch may already have been stopped
+	// (and freed) or paused by later commands of the same batch.  Only start
+	// streams that are still waiting for their first play.
+	for (const unsigned int hstream : batch_streams) {
+		const auto it = std::find_if(channel_stream.begin(), channel_stream.end(),
+			[hstream](const AltsoundStreamInfo* stream) { return stream && stream->hstream == hstream; });
+
+		if (it == channel_stream.end() || MiniAudio_ChannelIsActive(hstream) != MINIAUDIO_ACTIVE_STOPPED)
+			continue;
+
+		if (!MiniAudio_ChannelPlay(hstream, false)) {
+			ALT_ERROR(0, "FAILED MiniAudio_ChannelPlay(%u): %s", hstream, get_miniaudio_err());
+			releaseFailedStream(hstream);
+			released = true;
+			success = false;
 		}
 		else {
-			ALT_INFO(1, "SUCCESS startLogging()");
+			ALT_INFO(0, "SUCCESS MiniAudio_ChannelPlay(%u)", hstream);
 		}
 	}
-#endif
+	ALT_INFO(0, "Started %zu batched stream(s)", batch_streams.size());
+	batch_streams.clear();
+
+	// the ducking of the released streams is gone
+	if (released)
+		updateStreamVolumes();
+
+	ALT_OUTDENT;
+	ALT_DEBUG(0, "END AltsoundProcessorBase::endBatch()");
+	return success;
+}
+
+// ---------------------------------------------------------------------------
+
+bool AltsoundProcessorBase::playStream(unsigned int hstream)
+{
+	if (batching) {
+		batch_streams.push_back(hstream);
+		return true;
+	}
+
+	return MiniAudio_ChannelPlay(hstream, false);
+}
+
+// ---------------------------------------------------------------------------
+
+void AltsoundProcessorBase::releaseFailedStream(unsigned int hstream)
+{
+	const auto it = std::find_if(channel_stream.begin(), channel_stream.end(),
+		[hstream](const AltsoundStreamInfo* stream) { return stream && stream->hstream == hstream; });
+	if (it == channel_stream.end())
+		return;
+
+	ALT_INFO(0, "Releasing stream(%u) on CH(%02d)", hstream, (*it)->channel_idx);
+	forgetStream(**it);
+
+	// also deletes its channel_stream[] entry
+	freeStream(hstream);
 }
 
 // ---------------------------------------------------------------------------
 
-bool AltsoundProcessorBase::startLogging(const std::string& gameName) {
-#ifndef ALTSOUND_STANDALONE
-	ALT_DEBUG(0, "BEGIN startLogging()");
+bool AltsoundProcessorBase::admitTrigger(unsigned int cmd_in, const string& sample_path,
+                                         AltsoundSampleType type)
+{
+	ALT_DEBUG(0, "BEGIN AltsoundProcessorBase::admitTrigger()");
+	ALT_INDENT;
+
+	// over the mixer's budget, voices of low-priority types wait until it
+	// recovers
+	if (!context.load_control.admit(type)) {
+		ALT_INFO(0, "Command %04X refused, mixer over budget", cmd_in);
 
-	// Check if gameName is not empty
-	if (gameName.empty()) {
-		ALT_ERROR(1, "Game name is empty. Cannot start logging.");
-		ALT_DEBUG(0, "END startLogging()");
+		ALT_OUTDENT;
+		ALT_DEBUG(0, "END AltsoundProcessorBase::admitTrigger()");
 		return false;
 	}
 
-	std::string recording_fname = vpm_path + "altsound/cmdlog.txt";
-	logFile.open(recording_fname);
-	if (!logFile.is_open()) {
-		ALT_ERROR(1, "Failed to open log file: %s", recording_fname.c_str());
-		ALT_DEBUG(0, "END startLogging()");
-		return false;
+	const RetriggerPolicy policy = retrigger_config.resolve(cmd_in, type);
+	const uint64_t now = command_time_ns;
+
+	// Coalesce repeats within the dedup window.  The window starts at the
+	// last command that was let through, so a continuous storm still
+	// triggers once per window
+	if (*policy.dedup_ms > 0) {
+		const auto it = last_trigger_time.find(cmd_in);
+		if (it != last_trigger_time.end() && now - it->second < (uint64_t)*policy.dedup_ms * 1000000ull) {
+			AltsoundStats::add(context.stats.retrigger_coalesced);
+			ALT_INFO(0, "Command %04X coalesced (%u ms window)", cmd_in, *policy.dedup_ms);
+
+			ALT_OUTDENT;
+			ALT_DEBUG(0, "END AltsoundProcessorBase::admitTrigger()");
+			return false;
+		}
 	}
 
-	ALT_INFO(1, "Creating sound command log: %s", recording_fname.c_str());
+	// Count live instances of the sample.  Stopped streams that are not
+	// waiting for a batched start have ended and are about to be freed
+	unsigned int instances = 0;
+	unsigned int newest = MINIAUDIO_NO_STREAM;
 
-	std::string game_altsound_path = vpm_path + "altsound/" + gameName + '/';
+	for (const auto stream : channel_stream) {
+		if (!stream || stream->sample_path != sample_path)
+			continue;
 
-	// Check if game_altsound_path is valid
-	if (!dir_exists(game_altsound_path)) {
-		ALT_ERROR(1, "Altsound path does not exist: %s", game_altsound_path.c_str());
-		ALT_DEBUG(0, "END startLogging()");
-		return false;
+		if (MiniAudio_ChannelIsActive(stream->hstream) == MINIAUDIO_ACTIVE_STOPPED &&
+		    std::find(batch_streams.begin(), batch_streams.end(), stream->hstream) == batch_streams.end())
+			continue;
+
+		++instances;
+		newest = std::max(newest, stream->hstream); // handles are allocated in increasing order
 	}
 
-	logFile << "altsound_path: " << game_altsound_path << std::endl;
-	logFile << "hardware_gen: 0x" << 0 << std::endl;
+	bool admit = true;
 
-	lastCmdTime = std::chrono::high_resolution_clock::now();
+	if (instances > 0 && *policy.mode == RetriggerMode::Ignore) {
+		AltsoundStats::add(context.stats.retrigger_ignored);
+		ALT_INFO(0, "Command %04X ignored, sample already playing", cmd_in);
+		admit = false;
+	}
+	else if (instances > 0 && *policy.mode == RetriggerMode::Restart) {
+		// a paused instance stays paused, it just rewinds
+		const bool success = MiniAudio_ChannelIsActive(newest) == MINIAUDIO_ACTIVE_PLAYING
+		                   ? MiniAudio_ChannelPlay(newest, true)
+		                   : MiniAudio_ChannelSetPosition(newest, 0);
+		if (!success) {
+			ALT_ERROR(0, "FAILED to restart stream(%u): %s", newest, get_miniaudio_err());
+		}
 
-	ALT_DEBUG(0, "END startLogging()");
-#endif
-	return true;
+		AltsoundStats::add(context.stats.retrigger_restarted);
+		ALT_INFO(0, "Command %04X restarted stream(%u)", cmd_in, newest);
+		last_trigger_time[cmd_in] = now;
+		admit = false;
+	}
+	else if (*policy.max_instances > 0 && instances >= *policy.max_instances) {
+		AltsoundStats::add(context.stats.retrigger_limited);
+		ALT_INFO(0, "Command %04X dropped, %u instance(s) playing", cmd_in, instances);
+		admit = false;
+	}
+	else {
+		last_trigger_time[cmd_in] = now;
+	}
+
+	ALT_OUTDENT;
+	ALT_DEBUG(0, "END AltsoundProcessorBase::admitTrigger()");
+	return admit;
+}
+
+// ---------------------------------------------------------------------------
+
+void AltsoundProcessorBase::init()
+{
 }
 
 // ---------------------------------------------------------------------------
@@ -228,6 +314,7 @@ bool AltsoundProcessorBase::createStream(void* syncproc_in, AltsoundStreamInfo*
 	unsigned int ch_idx;
 
 	if (!ALT_CALL(findFreeChannel(ch_idx))) {
+		AltsoundStats::add(context.stats.channel_full);
 		ALT_ERROR(1, "FAILED AltsoundProcessorBase::findFreeChannel()");
 
 		ALT_OUTDENT;
@@ -238,7 +325,17 @@ bool AltsoundProcessorBase::createStream(void* syncproc_in, AltsoundStreamInfo*
 	stream_out->channel_idx = ch_idx; // store channel assignment
 	const bool loop = stream_out->loop;
 
-	// Create playback stream
+	// Create playback stream with the resampler of its type.  Under mixer
+	// load, some types get the cheapest one
+	if (context.load_control.cheapResampler(stream_out->stream_type)) {
+		MiniAudio_SetResampler(MINIAUDIO_RESAMPLER_LINEAR, 0);
+	}
+	else {
+		const ResamplerSetting resampler = resampler_config.resolve(stream_out->stream_type);
+		MiniAudio_SetResampler(*resampler.algorithm == ResamplerAlgorithm::Cubic ? MINIAUDIO_RESAMPLER_CUBIC
+		                                                                         : MINIAUDIO_RESAMPLER_LINEAR,
+		                       *resampler.order);
+	}
 	unsigned int hstream = MiniAudio_StreamCreateFile(false, stream_out->sample_path, 0, loop);
 
 	if (hstream == MINIAUDIO_NO_STREAM) {
@@ -299,6 +396,16 @@ bool AltsoundProcessorBase::freeStream(const unsigned int hstream_in)
 
 // ----------------------------------------------------------------------------
 
+void AltsoundProcessorBase::discardStream(AltsoundStreamInfo* stream)
+{
+	if (stream->hstream != MINIAUDIO_NO_STREAM)
+		freeStream(stream->hstream);
+
+	delete stream;
+}
+
+// ----------------------------------------------------------------------------
+
 bool AltsoundProcessorBase::stopStream(unsigned int hstream_in)
 {
 	ALT_DEBUG(0, "BEGIN: AltsoundProcessorBase::stopStream()");
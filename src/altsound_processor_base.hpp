@@ -24,10 +24,15 @@
 
 #include "miniaudio_private.h"
 
+#include <cstdint>
 #include <mutex>
+#include <random>
+#include <vector>
 
 using std::string;
 
+struct AltsoundContext;
+
 // ---------------------------------------------------------------------------
 // AltsoundProcessorBase class definition
 // ---------------------------------------------------------------------------
@@ -41,7 +46,8 @@ public:
 	// Copy constructor
 	AltsoundProcessorBase(AltsoundProcessorBase&) = delete;
 
-	// Standard constructor
+	// Standard constructor. The processor belongs to the calling thread's
+	// context, see AltsoundContext
 	AltsoundProcessorBase(const string& game_name, const string& vpm_path);
 
 	// Destructor
@@ -57,24 +63,41 @@ public:
 	void romControlsVol(const bool use_rom_vol);
 	bool romControlsVol();
 
-	// command recording flag mutator
-	void recordSoundCmds(const bool rec_sound_cmds);
-
 	// initialize processing state
 	virtual void init();
 
 	// master volume accessor/mutator
 	void setMasterVol(const float vol_in);
-	static float getMasterVol();
+	float getMasterVol() const;
 
 	// global accessor/mutator
 	void setGlobalVol(const float vol_in);
-	static float getGlobalVol();
+	float getGlobalVol() const;
 
 	// command skip count accessor/mutator
 	void setSkipCount(const unsigned int skip_count_in);
 	unsigned int getSkipCount() const;
 
+	// retrigger policy mutator
+	void setRetriggerConfig(const RetriggerConfig& config_in);
+
+	// resampler settings mutator
+	void setResamplerConfig(const ResamplerConfig& config_in);
+
+	// Seed sample selection. The same seed picks the same samples for the
+	// same command sequence
+	void setRandomSeed(const uint32_t seed);
+
+	// time of the command being handled, in ns. Drives retrigger windows
+	void setCommandTime(const uint64_t time_ns);
+
+	// Begin a batch of commands. Until endBatch(), playback of new streams
+	// and volume/ducking updates are deferred
+	void beginBatch();
+
+	// Start all streams created during the batch, with a single volume update
+	bool endBatch();
+
 public: // data
 
 protected: // functions
@@ -95,19 +118,46 @@ protected: // functions
 	bool stopAllStreams();
 
 	// stop playback of provided stream handle
-	static bool stopStream(unsigned int hstream);
+	bool stopStream(unsigned int hstream);
 
 	// free miniaudio resources of provided stream handle
-	static bool freeStream(unsigned int hstream);
+	bool freeStream(unsigned int hstream);
+
+	// release stream info that never made it into channel_stream[], along
+	// with its stream, if one was created
+	void discardStream(AltsoundStreamInfo* stream);
 
 	// find available sound channel for sample playback
-	static bool findFreeChannel(unsigned int& channel_out);
+	bool findFreeChannel(unsigned int& channel_out);
 
 	// set volume on provided stream
-	static bool setStreamVolume(unsigned int hstream, const float vol_in);
+	bool setStreamVolume(unsigned int hstream, const float vol_in);
 
 	// get volume on provided stream, -FLT_MAX on error
-	static float getStreamVolume(unsigned int hstream);
+	float getStreamVolume(unsigned int hstream);
+
+	// re-apply ducking and group volumes to all active streams
+	virtual bool updateStreamVolumes() = 0;
+
+	// start playback of a new stream. Deferred to endBatch() while batching
+	bool playStream(unsigned int hstream);
+
+	// release a stream of channel_stream[] that failed to start, along with
+	// its channel and the processor's references to it
+	void releaseFailedStream(unsigned int hstream);
+
+	// drop the processor's references to a stream about to be released
+	virtual void forgetStream(const AltsoundStreamInfo& stream) = 0;
+
+	// true while a command batch is being processed
+	bool isBatching() const;
+
+	// Apply the retrigger policy of a command that matched the provided
+	// sample. Returns false if no new stream should be created for it
+	bool admitTrigger(unsigned int cmd_in, const string& sample_path, AltsoundSampleType type);
+
+	// random index in [0, count) for sample selection
+	unsigned int randomIndex(const unsigned int count);
 
 	// Return ROM shortname
 	const string& getGameName();
@@ -115,23 +165,34 @@ protected: // functions
 	// Return path to VPinMAME
 	const string& getVpmPath();
 
-	// Initialize log file
-	bool startLogging(const string& gameName);
-
 protected: // data
 
 	string game_name;
 	string vpm_path;
 
+	// state of the context the processor belongs to
+	AltsoundContext& context;
+	StreamArray& channel_stream;
+	std::recursive_mutex& io_mutex;
+
 private: // functions
 
 private: // data
 
-	bool rec_snd_cmds = false;
 	bool use_rom_ctrl = true;
-	static float global_vol;
-	static float master_vol;
+	float global_vol = 1.0f;
+	float master_vol = 1.0f;
 	unsigned int skip_count;
+	bool batching = false;
+	std::vector<unsigned int> batch_streams;
+	RetriggerConfig retrigger_config;
+	ResamplerConfig resampler_config;
+	std::unordered_map<unsigned int, uint64_t> last_trigger_time;
+	uint64_t command_time_ns = 0;
+
+	// mt19937 output is fully specified, so seeded selections are the same
+	// on every platform
+	std::mt19937 random_engine;
 };
 
 // ----------------------------------------------------------------------------
@@ -162,25 +223,19 @@ inline bool AltsoundProcessorBase::romControlsVol() {
 
 // ----------------------------------------------------------------------------
 
-inline void AltsoundProcessorBase::recordSoundCmds(const bool rec_sound_cmds) {
-	rec_snd_cmds = rec_sound_cmds;
-}
-
-// ----------------------------------------------------------------------------
-
 inline void AltsoundProcessorBase::setMasterVol(const float vol_in) {
 	master_vol = vol_in;
 }
 
 // ----------------------------------------------------------------------------
 
-inline float AltsoundProcessorBase::getMasterVol() {
+inline float AltsoundProcessorBase::getMasterVol() const {
 	return master_vol;
 }
 
 // ----------------------------------------------------------------------------
 
-inline float AltsoundProcessorBase::getGlobalVol() {
+inline float AltsoundProcessorBase::getGlobalVol() const {
 	return global_vol;
 }
 
@@ -196,4 +251,40 @@ inline void AltsoundProcessorBase::setSkipCount(const unsigned int skip_count_in
 	skip_count = skip_count_in;
 }
 
+// ----------------------------------------------------------------------------
+
+inline bool AltsoundProcessorBase::isBatching() const {
+	return batching;
+}
+
+// ----------------------------------------------------------------------------
+
+inline void AltsoundProcessorBase::setRetriggerConfig(const RetriggerConfig& config_in) {
+	retrigger_config = config_in;
+}
+
+// ----------------------------------------------------------------------------
+
+inline void AltsoundProcessorBase::setResamplerConfig(const ResamplerConfig& config_in) {
+	resampler_config = config_in;
+}
+
+// ----------------------------------------------------------------------------
+
+inline void AltsoundProcessorBase::setRandomSeed(const uint32_t seed) {
+	random_engine.seed(seed);
+}
+
+// ----------------------------------------------------------------------------
+
+inline void AltsoundProcessorBase::setCommandTime(const uint64_t time_ns) {
+	command_time_ns = time_ns;
+}
+
+// ----------------------------------------------------------------------------
+
+inline unsigned int AltsoundProcessorBase::randomIndex(const unsigned int count) {
+	return count > 1 ? static_cast<unsigned int>(random_engine() % count) : 0;
+}
+
 #endif // ALTSOUND_PROCESSOR_BASE_HPP
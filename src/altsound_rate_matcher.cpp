@@ -0,0 +1,204 @@
+// ---------------------------------------------------------------------------
+// altsound_rate_matcher.cpp
+//
+// Drift compensation between the mixer and the host device
+// ---------------------------------------------------------------------------
+// license:BSD-3-Clause
+// copyright-holders: Dave Roscoe
+// ---------------------------------------------------------------------------
+
+#include "altsound_rate_matcher.hpp"
+#include "altsound_logger.hpp"
+
+#include <algorithm>
+
+extern AltsoundLogger alog;
+
+// The ring's fill level jumps by a host period on every read, so the
+// controller works on its average over about a second.  Against that lag,
+// the gains give a critically damped loop settling in about a minute:
+// 1 ms of fill error corrects by 100 ppm right away, and the integral
+// learns the drift between the two clocks
+static constexpr double FILL_TIME_CONSTANT_S = 1.0;
+static constexpr double KP = 0.1;      // ratio offset per second of error
+static constexpr double KI = 0.0025;   // per second of error and second
+static constexpr double MAX_OFFSET = 0.002;
+
+// ----------------------------------------------------------------------------
+
+bool AltsoundRateMatcher::init(AltsoundRing& outputRing, uint32_t sampleRate, uint32_t channelCount,
+                               uint32_t maxPeriodFrames, uint32_t targetFrames)
+{
+	shutdown();
+
+	const uint32_t capacity = outputRing.getCapacity();
+	if (capacity == 0 || sampleRate == 0 || channelCount == 0) {
+		ALT_ERROR(0, "Drift compensation requires an output ring");
+		return false;
+	}
+
+	ring = &outputRing;
+	sample_rate = sampleRate;
+	channels = channelCount;
+	target = targetFrames && targetFrames < capacity ? targetFrames : capacity / 2;
+
+	// room for a period stretched by MAX_OFFSET, plus the carried-over
+	// fraction
+	max_period = std::max(maxPeriodFrames, 1u);
+	scratch_frames = (size_t)max_period + max_period / 100 + 16;
+	scratch.assign(scratch_frames * channels, 0.0f);
+	history.assign(3 * channels, 0.0f);
+	pos = 1.0;
+	step = 1.0;
+	draining = false;
+
+	fill_avg = target;
+	integral = 0.0;
+	last_underruns = ring->underrunCount();
+	ratio.store(1.0f, std::memory_order_relaxed);
+	resyncs.store(0, std::memory_order_relaxed);
+
+	enabled = true;
+	ALT_INFO(0, "Drift compensation: target fill %u frames", target);
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundRateMatcher::shutdown()
+{
+	if (!enabled)
+		return;
+
+	enabled = false;
+	ring = nullptr;
+	ratio.store(1.0f, std::memory_order_relaxed);
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundRateMatcher::write(const float* frames, size_t frameCount)
+{
+	// The host read more than there was: refill to the target at once, as
+	// the controller would need minutes to win back a whole buffer
+	const uint64_t underruns = ring->underrunCount();
+	if (underruns != last_underruns && ring->framesRead() > 0) {
+		last_underruns = underruns;
+		const size_t fill = ring->fill();
+		if (fill < target) {
+			ring->writeSilence(target - fill);
+			fill_avg = target;
+			resyncs.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	for (size_t done = 0; done < frameCount; ) {
+		const size_t n = std::min(frameCount - done, (size_t)max_period);
+		put(scratch.data(), resample(frames + done * channels, n));
+		done += n;
+	}
+
+	updateRatio(frameCount);
+}
+
+// ----------------------------------------------------------------------------
+
+size_t AltsoundRateMatcher::resample(const float* frames, size_t frameCount)
+{
+	// frame k of the input sequence: the 3 history frames, then frames
+	auto input = [&](size_t k) {
+		return k < 3 ? &history[k * channels] : &frames[(k - 3) * channels];
+	};
+
+	// Catmull-Rom between frames i and i+1; the last usable i is the one
+	// whose i+2 is the last input frame
+	size_t out = 0;
+	while (pos < (double)frameCount + 1.0) {
+		const size_t i = (size_t)pos;
+		const float t = (float)(pos - (double)i);
+		const float* x0 = input(i - 1);
+		const float* x1 = input(i);
+		const float* x2 = input(i + 1);
+		const float* x3 = input(i + 2);
+		float* y = &scratch[out * channels];
+		for (uint32_t c = 0; c < channels; ++c)
+			y[c] = x1[c] + 0.5f * t * (x2[c] - x0[c] + t * (2.0f * x0[c] - 5.0f * x1[c] + 4.0f * x2[c] - x3[c]
+			       + t * (3.0f * (x1[c] - x2[c]) + x3[c] - x0[c])));
+		++out;
+		pos += step;
+	}
+	pos -= (double)frameCount;
+
+	// the last 3 frames of the sequence become the history
+	const size_t keep = 3 - std::min(frameCount, (size_t)3);
+	std::copy(history.end() - keep * channels, history.end(), history.begin());
+	std::copy(frames + (frameCount - (3 - keep)) * channels, frames + frameCount * channels,
+	          history.begin() + keep * channels);
+
+	return out;
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundRateMatcher::put(const float* frames, size_t frameCount)
+{
+	const size_t fill = ring->fill();
+	const size_t room_to_target = fill < target ? target - fill : 0;
+
+	// until the host starts reading, keep no more than the target, so it
+	// starts at the intended latency
+	if (ring->framesRead() == 0) {
+		ring->write(frames, std::min(frameCount, room_to_target));
+		return;
+	}
+
+	// The host stalled and the ring is full. The frames in it are the
+	// host's to read, so drop new ones until it has read back down to the
+	// target, instead of keeping the extra latency
+	if (!draining && frameCount > ring->getCapacity() - fill) {
+		draining = true;
+		resyncs.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	if (draining) {
+		const size_t n = std::min(frameCount, room_to_target);
+		ring->countOverrun(frameCount - n);
+		ring->write(frames, n);
+		if (n > 0) {
+			draining = false;
+			fill_avg = target;
+		}
+		return;
+	}
+
+	ring->write(frames, frameCount);
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundRateMatcher::updateRatio(size_t frameCount)
+{
+	// nothing to track before the host reads or while draining
+	if (ring->framesRead() == 0 || draining)
+		return;
+
+	const double dt = (double)frameCount / sample_rate;
+	fill_avg += ((double)ring->fill() - fill_avg) * std::min(1.0, dt / FILL_TIME_CONSTANT_S);
+
+	// below the target, the host is faster: produce more frames
+	const double error = ((double)target - fill_avg) / sample_rate;
+	integral = std::clamp(integral + KI * error * dt, -MAX_OFFSET, MAX_OFFSET);
+	const double offset = std::clamp(KP * error + integral, -MAX_OFFSET, MAX_OFFSET);
+
+	step = 1.0 / (1.0 + offset);
+	ratio.store((float)(1.0 + offset), std::memory_order_relaxed);
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundRateMatcher::snapshot(AltSoundRingStats& out) const
+{
+	out.target_frames = enabled ? target : 0;
+	out.rate_ratio = ratio.load(std::memory_order_relaxed);
+	out.resyncs = resyncs.load(std::memory_order_relaxed);
+}
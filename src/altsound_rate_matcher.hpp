@@ -0,0 +1,85 @@
+// ---------------------------------------------------------------------------
+// altsound_rate_matcher.hpp
+//
+// Drift compensation between the mixer and the host device.  The mixer is
+// paced by the null device's timer, the host reads the output ring on its
+// own clock.  A PI controller on the ring's fill level steers a cubic
+// resampler by a few ppm, so the fill level, and with it the latency,
+// stays at a target.
+// ---------------------------------------------------------------------------
+// license:BSD-3-Clause
+// copyright-holders: Dave Roscoe
+// ---------------------------------------------------------------------------
+
+#ifndef ALTSOUND_RATE_MATCHER_HPP
+#define ALTSOUND_RATE_MATCHER_HPP
+#if !defined(__GNUC__) || (__GNUC__ == 3 && __GNUC_MINOR__ >= 4) || (__GNUC__ >= 4)	// GCC supports "pragma once" correctly since 3.4
+#pragma once
+#endif
+
+#include "altsound_ring.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+class AltsoundRateMatcher {
+public:
+
+	~AltsoundRateMatcher() { shutdown(); }
+
+	// Starts compensating into ring, holding it at targetFrames (0 = half
+	// the ring). maxPeriodFrames sizes the scratch buffer; longer periods
+	// are resampled in pieces
+	bool init(AltsoundRing& ring, uint32_t sampleRate, uint32_t channels, uint32_t maxPeriodFrames,
+	          uint32_t targetFrames);
+
+	void shutdown();
+
+	bool isEnabled() const { return enabled; }
+
+	// Audio thread: resamples one mixed period into the ring and updates
+	// the ratio for the next one
+	void write(const float* frames, size_t frameCount);
+
+	// adds the controller state to a ring snapshot
+	void snapshot(AltSoundRingStats& out) const;
+
+private: // functions
+
+	// resamples frameCount frames into scratch, returns the frames output
+	size_t resample(const float* frames, size_t frameCount);
+
+	// writes resampled frames, resyncing instead of overrunning
+	void put(const float* frames, size_t frameCount);
+
+	void updateRatio(size_t frameCount);
+
+private: // data
+
+	AltsoundRing* ring = nullptr;
+	bool enabled = false;
+	std::vector<float> scratch;
+	size_t scratch_frames = 0;
+	uint32_t max_period = 0;   // longest piece resampled at once
+	uint32_t sample_rate = 0;
+	uint32_t channels = 0;
+	uint32_t target = 0;
+
+	// Resampler state, audio thread only. The last 3 input frames precede
+	// the next period; pos is the next output's position in that sequence
+	std::vector<float> history;
+	double pos = 1.0;
+	double step = 1.0;   // input frames per output frame
+
+	// controller state, audio thread only
+	double fill_avg = 0.0;
+	double integral = 0.0;
+	uint64_t last_underruns = 0;
+	bool draining = false;     // dropping frames after an overrun
+
+	std::atomic<float> ratio{ 1.0f };
+	std::atomic<uint64_t> resyncs{ 0 };
+};
+
+#endif // ALTSOUND_RATE_MATCHER_HPP
@@ -0,0 +1,268 @@
+// ---------------------------------------------------------------------------
+// altsound_realtime.cpp
+//
+// Realtime configuration of the library's threads
+// ---------------------------------------------------------------------------
+// license:BSD-3-Clause
+// copyright-holders: Dave Roscoe
+// ---------------------------------------------------------------------------
+
+#include "altsound_realtime.hpp"
+#include "altsound_logger.hpp"
+#include "miniaudio_bass_compat.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+extern AltsoundLogger alog;
+
+std::atomic<uint32_t> AltsoundRealtime::generation{ 0 };
+thread_local uint32_t AltsoundRealtime::applied_generation = 0;
+thread_local bool AltsoundRealtime::modified = false;
+
+static std::mutex g_configMutex;
+static AltsoundRealtimeConfig g_config;
+static bool g_memoryLocked = false;
+static std::atomic<bool> g_bufferLockFailed{ false };
+
+// well within the smallest default thread stack (512 KB on macOS)
+static constexpr size_t STACK_PREFAULT_BYTES = 64 * 1024;
+
+// ----------------------------------------------------------------------------
+
+static const char* toString(ALTSOUND_SCHED_POLICY policy)
+{
+	switch (policy) {
+	case ALTSOUND_SCHED_FIFO: return "SCHED_FIFO";
+	case ALTSOUND_SCHED_RR: return "SCHED_RR";
+	default: return "default scheduling";
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+static void prefaultStack()
+{
+	volatile char stack[STACK_PREFAULT_BYTES];
+	for (size_t i = 0; i < sizeof(stack); i += 4096)
+		stack[i] = 0;
+}
+
+// ----------------------------------------------------------------------------
+
+static void applyScheduling(const char* name, const AltSoundThreadConfig& config)
+{
+#ifdef _WIN32
+	const bool realtime = config.policy != ALTSOUND_SCHED_DEFAULT;
+	if (SetThreadPriority(GetCurrentThread(), realtime ? THREAD_PRIORITY_TIME_CRITICAL : THREAD_PRIORITY_NORMAL))
+		ALT_INFO(0, "Realtime: %s thread priority %s applied", name, realtime ? "time critical" : "normal");
+	else
+		ALT_ERROR(0, "FAILED to set %s thread priority: error %lu", name, GetLastError());
+#else
+	const int policy = config.policy == ALTSOUND_SCHED_FIFO ? SCHED_FIFO
+	                 : config.policy == ALTSOUND_SCHED_RR ? SCHED_RR : SCHED_OTHER;
+	sched_param param = {};
+	if (policy != SCHED_OTHER)
+		param.sched_priority = std::clamp(config.priority, sched_get_priority_min(policy), sched_get_priority_max(policy));
+
+	const int err = pthread_setschedparam(pthread_self(), policy, &param);
+	if (err == 0)
+		ALT_INFO(0, "Realtime: %s thread %s priority %d applied", name, toString(config.policy), param.sched_priority);
+	else
+		ALT_ERROR(0, "FAILED to apply %s priority %d to %s thread: %s", toString(config.policy),
+		          param.sched_priority, name, strerror(err));
+#endif
+}
+
+// ----------------------------------------------------------------------------
+
+static void applyAffinity(const char* name, uint64_t mask)
+{
+#if defined(_WIN32)
+	DWORD_PTR process_mask = 0;
+	DWORD_PTR system_mask = 0;
+	GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask);
+	if (SetThreadAffinityMask(GetCurrentThread(), mask ? (DWORD_PTR)mask : process_mask))
+		ALT_INFO(0, "Realtime: %s thread CPU affinity 0x%llx applied", name, (unsigned long long)mask);
+	else
+		ALT_ERROR(0, "FAILED to apply CPU affinity 0x%llx to %s thread: error %lu", (unsigned long long)mask,
+		          name, GetLastError());
+#elif defined(__linux__)
+	// 0 restores every CPU
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (unsigned int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+		if (!mask || (cpu < 64 && ((mask >> cpu) & 1)))
+			CPU_SET(cpu, &set);
+	}
+
+	// pid 0 is the calling thread
+	if (sched_setaffinity(0, sizeof(set), &set) == 0)
+		ALT_INFO(0, "Realtime: %s thread CPU affinity 0x%llx applied", name, (unsigned long long)mask);
+	else
+		ALT_ERROR(0, "FAILED to apply CPU affinity 0x%llx to %s thread: %s", (unsigned long long)mask, name,
+		          strerror(errno));
+#else
+	if (mask)
+		ALT_ERROR(0, "FAILED to apply CPU affinity to %s thread: not supported on this platform", name);
+#endif
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundRealtime::configure(const AltsoundRealtimeConfig& config)
+{
+	std::lock_guard<std::mutex> lock(g_configMutex);
+	g_config = config;
+
+	// What is mapped now: code, the engine and the samples already loaded.
+	// Samples loaded later are locked one by one, see MiniAudio_SetLoadToMemory();
+	// locking all future mappings would make allocations fail once
+	// RLIMIT_MEMLOCK is reached
+	if (config.lock_memory && !g_memoryLocked) {
+#ifdef _WIN32
+		ALT_ERROR(0, "FAILED to lock process memory: not supported on this platform");
+#else
+		if (mlockall(MCL_CURRENT) == 0) {
+			g_memoryLocked = true;
+			ALT_INFO(0, "Realtime: process memory locked");
+		}
+		else {
+			ALT_ERROR(0, "FAILED to lock process memory: %s", strerror(errno));
+		}
+#endif
+	}
+	else if (!config.lock_memory && g_memoryLocked) {
+#ifndef _WIN32
+		munlockall();
+#endif
+		g_memoryLocked = false;
+	}
+
+	g_bufferLockFailed.store(false, std::memory_order_relaxed);
+	MiniAudio_SetLoadToMemory(config.lock_memory);
+	if (config.lock_memory)
+		ALT_INFO(0, "Realtime: samples are loaded into locked memory");
+
+	generation.fetch_add(1, std::memory_order_release);
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundRealtime::reset()
+{
+	configure(AltsoundRealtimeConfig());
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundRealtime::apply(const char* name, bool audio)
+{
+	AltsoundRealtimeConfig config;
+	{
+		std::lock_guard<std::mutex> lock(g_configMutex);
+		config = g_config;
+		applied_generation = generation.load(std::memory_order_relaxed);
+	}
+
+	const AltSoundThreadConfig& thread = audio ? config.audio : config.workers;
+	const bool wanted = thread.policy != ALTSOUND_SCHED_DEFAULT || thread.cpu_mask != 0;
+
+	// a thread that was changed before is restored to its defaults
+	if (wanted || modified) {
+		applyScheduling(name, thread);
+		applyAffinity(name, thread.cpu_mask);
+		modified = wanted;
+	}
+
+	if (config.lock_memory) {
+		prefaultStack();
+		ALT_INFO(0, "Realtime: %s thread stack prefaulted (%zu KB)", name, STACK_PREFAULT_BYTES / 1024);
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundRealtime::lockBuffer(const void* data, size_t size)
+{
+#ifndef _WIN32
+	if (size && mlock(data, size) != 0 && !g_bufferLockFailed.exchange(true))
+		ALT_ERROR(0, "FAILED to lock sample memory: %s", strerror(errno));
+#endif
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundRealtime::unlockBuffer(const void* data, size_t size)
+{
+#ifndef _WIN32
+	if (size)
+		munlock(data, size);
+#endif
+}
+
+// ----------------------------------------------------------------------------
+
+bool AltsoundRealtime::parseCpuList(const std::string& list, uint64_t& mask)
+{
+	// a CPU number, the whole string
+	auto parseCpu = [](const std::string& str, unsigned long& cpu) {
+		try {
+			size_t end = 0;
+			cpu = std::stoul(str, &end);
+			return end == str.size() && cpu < 64;
+		}
+		catch (const std::exception&) {
+			return false;
+		}
+	};
+
+	uint64_t parsed = 0;
+	std::istringstream stream(list);
+	std::string range;
+
+	while (std::getline(stream, range, ',')) {
+		const size_t dash = range.find('-');
+		unsigned long first = 0;
+		unsigned long last = 0;
+		if (!parseCpu(range.substr(0, dash), first))
+			return false;
+		if (dash == std::string::npos)
+			last = first;
+		else if (!parseCpu(range.substr(dash + 1), last) || last < first)
+			return false;
+
+		for (unsigned long cpu = first; cpu <= last; ++cpu)
+			parsed |= (uint64_t)1 << cpu;
+	}
+
+	mask = parsed;
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+
+bool AltsoundRealtime::parsePolicy(const std::string& name, ALTSOUND_SCHED_POLICY& policy)
+{
+	if (name == "default" || name == "other")
+		policy = ALTSOUND_SCHED_DEFAULT;
+	else if (name == "fifo")
+		policy = ALTSOUND_SCHED_FIFO;
+	else if (name == "rr")
+		policy = ALTSOUND_SCHED_RR;
+	else
+		return false;
+
+	return true;
+}
@@ -0,0 +1,76 @@
+// ---------------------------------------------------------------------------
+// altsound_realtime.hpp
+//
+// Realtime configuration of the library's threads: scheduling policy,
+// priority and CPU affinity of the audio thread and the worker threads, and
+// locking the process in memory.  Threads the library does not create
+// (miniAudio's device thread) can only be configured from the inside, so
+// every thread applies the configuration to itself, at a point where it
+// checks for changes with a single atomic load.
+// ---------------------------------------------------------------------------
+// license:BSD-3-Clause
+// copyright-holders: Dave Roscoe
+// ---------------------------------------------------------------------------
+
+#ifndef ALTSOUND_REALTIME_HPP
+#define ALTSOUND_REALTIME_HPP
+#if !defined(__GNUC__) || (__GNUC__ == 3 && __GNUC_MINOR__ >= 4) || (__GNUC__ >= 4)	// GCC supports "pragma once" correctly since 3.4
+#pragma once
+#endif
+
+#include "altsound.h"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+struct AltsoundRealtimeConfig {
+	AltSoundThreadConfig audio = { ALTSOUND_SCHED_DEFAULT, 0, 0 };
+	AltSoundThreadConfig workers = { ALTSOUND_SCHED_DEFAULT, 0, 0 };
+	bool lock_memory = false;
+};
+
+class AltsoundRealtime {
+public:
+
+	// Takes effect in each thread at its next apply call. Locks memory
+	// right away when requested
+	static void configure(const AltsoundRealtimeConfig& config);
+
+	// Back to the threads' defaults; unlocks memory
+	static void reset();
+
+	// called by the audio thread before each mix
+	static void applyToAudioThread() {
+		if (generation.load(std::memory_order_acquire) != applied_generation)
+			apply("audio", true);
+	}
+
+	// called by worker threads from their loops
+	static void applyToWorkerThread(const char* name) {
+		if (generation.load(std::memory_order_acquire) != applied_generation)
+			apply(name, false);
+	}
+
+	// Locks a buffer loaded for the audio thread into memory; failures are
+	// logged once
+	static void lockBuffer(const void* data, size_t size);
+	static void unlockBuffer(const void* data, size_t size);
+
+	// "2,3" or "0-2,5" to a mask; false on a malformed list
+	static bool parseCpuList(const std::string& list, uint64_t& mask);
+
+	static bool parsePolicy(const std::string& name, ALTSOUND_SCHED_POLICY& policy);
+
+private: // functions
+
+	static void apply(const char* name, bool audio);
+
+private: // data
+
+	static std::atomic<uint32_t> generation;
+	static thread_local uint32_t applied_generation;
+	static thread_local bool modified;  // changed from its defaults
+};
+
+#endif // ALTSOUND_REALTIME_HPP
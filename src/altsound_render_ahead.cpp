@@ -0,0 +1,120 @@
+// ---------------------------------------------------------------------------
+// altsound_render_ahead.cpp
+//
+// Render-ahead mixer thread
+// ---------------------------------------------------------------------------
+// license:BSD-3-Clause
+// copyright-holders: Dave Roscoe
+// ---------------------------------------------------------------------------
+
+#include "altsound_render_ahead.hpp"
+#include "altsound_logger.hpp"
+#include "altsound_realtime.hpp"
+#include "altsound_stats.hpp"
+#include "altsound_trace.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+extern AltsoundLogger alog;
+
+// ----------------------------------------------------------------------------
+
+bool AltsoundRenderAhead::start(AltsoundRing& ring_in, uint32_t depthPeriods, uint32_t batchPeriods,
+                                uint32_t periodFrames, uint32_t sampleRate, uint32_t channels, MixFunc mix_in,
+                                void* user)
+{
+	stop();
+
+	if (!depthPeriods || !periodFrames || !sampleRate || !mix_in)
+		return false;
+
+	const uint32_t batch_periods = std::clamp(batchPeriods ? batchPeriods : depthPeriods / 2, 1u, depthPeriods);
+	ring = &ring_in;
+	mix = mix_in;
+	mix_user = user;
+	period_frames = periodFrames;
+	sample_rate = sampleRate;
+	depth = (size_t)depthPeriods * periodFrames;
+	batch = (size_t)batch_periods * periodFrames;
+	if (ring->getCapacity() < depth) {
+		ALT_ERROR(0, "Render-ahead: the output ring holds %u of %zu frames", ring->getCapacity(), depth);
+		return false;
+	}
+
+	period.assign((size_t)periodFrames * channels, 0.0f);
+	batches.store(0, std::memory_order_relaxed);
+	stopping = false;
+	running = true;
+	thread = std::thread(&AltsoundRenderAhead::threadMain, this);
+
+	ALT_INFO(0, "Render-ahead: %u periods (%.1f ms) mixed ahead, topped up %u at a time", depthPeriods,
+	         depth * 1000.0 / sample_rate, batch_periods);
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundRenderAhead::stop()
+{
+	if (!running)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_one();
+	thread.join();
+	running = false;
+
+	ALT_INFO(0, "Render-ahead: %llu batch(es) mixed", (unsigned long long)batches.load(std::memory_order_relaxed));
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundRenderAhead::snapshot(AltSoundRingStats& out) const
+{
+	out.render_ahead_frames = running ? (uint32_t)depth : 0;
+	out.render_batches = batches.load(std::memory_order_relaxed);
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundRenderAhead::threadMain()
+{
+	// a top-up mixes at most the whole depth, so stop() never waits longer,
+	// even while the host keeps reading
+	const size_t max_periods = depth / period_frames;
+
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!stopping) {
+		lock.unlock();
+
+		size_t fill = ring->fill();
+		if (fill + batch <= depth) {
+			AltsoundRealtime::applyToAudioThread();
+
+			const uint64_t start = AltsoundStats::now();
+			size_t periods = 0;
+			for (; periods < max_periods && fill + period_frames <= depth; ++periods) {
+				mix(mix_user, period.data(), period_frames);
+				fill = ring->fill();
+			}
+			batches.fetch_add(1, std::memory_order_relaxed);
+
+			if (AltsoundTrace::enabled())
+				AltsoundTrace::complete("audio", "render-ahead", start, AltsoundStats::now(),
+				                        { { "periods", (double)periods }, { "fill", (double)fill } });
+		}
+
+		// the next top-up is due once the host has read batch more frames
+		const size_t due = depth - batch;
+		const size_t wait_frames = fill > due ? fill - due : 0;
+
+		lock.lock();
+		if (wait_frames > 0)
+			wake.wait_for(lock, std::chrono::nanoseconds((uint64_t)wait_frames * 1000000000ull / sample_rate),
+			              [this] { return stopping; });
+	}
+}
@@ -0,0 +1,76 @@
+// ---------------------------------------------------------------------------
+// altsound_render_ahead.hpp
+//
+// Render-ahead mixing.  Instead of the null device's timer mixing one period
+// per tick, a mixer thread keeps a configured number of periods mixed in the
+// output ring and tops it up in batches of several periods once the host has
+// read that many.  The host's reads pace the mixer, so the jitter of a slow
+// period is absorbed by the frames already mixed instead of reaching the
+// host.
+// ---------------------------------------------------------------------------
+// license:BSD-3-Clause
+// copyright-holders: Dave Roscoe
+// ---------------------------------------------------------------------------
+
+#ifndef ALTSOUND_RENDER_AHEAD_HPP
+#define ALTSOUND_RENDER_AHEAD_HPP
+#if !defined(__GNUC__) || (__GNUC__ == 3 && __GNUC_MINOR__ >= 4) || (__GNUC__ >= 4)	// GCC supports "pragma once" correctly since 3.4
+#pragma once
+#endif
+
+#include "altsound_ring.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class AltsoundRenderAhead {
+public:
+
+	// mixes frameCount frames into frames and hands them on to the ring
+	typedef void (*MixFunc)(void* user, float* frames, size_t frameCount);
+
+	~AltsoundRenderAhead() { stop(); }
+
+	// Starts the mixer thread, which keeps depthPeriods periods of
+	// periodFrames mixed in ring and mixes batchPeriods of them at a time,
+	// calling mix with user. The ring must hold the whole depth
+	bool start(AltsoundRing& ring, uint32_t depthPeriods, uint32_t batchPeriods, uint32_t periodFrames,
+	           uint32_t sampleRate, uint32_t channels, MixFunc mix, void* user);
+
+	// Stops the mixer thread after the period it is mixing
+	void stop();
+
+	bool isRunning() const { return running; }
+
+	// adds the render-ahead state to a ring snapshot
+	void snapshot(AltSoundRingStats& out) const;
+
+private: // functions
+
+	void threadMain();
+
+private: // data
+
+	AltsoundRing* ring = nullptr;
+	MixFunc mix = nullptr;
+	void* mix_user = nullptr;
+	std::vector<float> period;
+	uint32_t period_frames = 0;
+	uint32_t sample_rate = 0;
+	size_t depth = 0;   // frames kept mixed
+	size_t batch = 0;   // frames read before a top-up
+
+	bool running = false;
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping = false;   // under mutex
+
+	std::atomic<uint64_t> batches{ 0 };
+};
+
+#endif // ALTSOUND_RENDER_AHEAD_HPP
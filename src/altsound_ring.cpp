@@ -0,0 +1,148 @@
+// ---------------------------------------------------------------------------
+// altsound_ring.cpp
+//
+// Lock-free output ring behind AltSoundRingRead()/AltSoundRingCommit()
+// ---------------------------------------------------------------------------
+// license:BSD-3-Clause
+// copyright-holders: Dave Roscoe
+// ---------------------------------------------------------------------------
+
+#include "altsound_ring.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+// ----------------------------------------------------------------------------
+
+void AltsoundRing::init(uint32_t capacityFrames, uint32_t channelCount)
+{
+	enabled.store(false, std::memory_order_release);
+
+	capacity = capacityFrames;
+	channels = channelCount;
+	buffer.assign((size_t)capacity * channels, 0.0f);
+	write_pos.store(0, std::memory_order_relaxed);
+	read_pos.store(0, std::memory_order_relaxed);
+	resetCounters();
+
+	enabled.store(capacity > 0 && channels > 0, std::memory_order_release);
+}
+
+// ----------------------------------------------------------------------------
+
+size_t AltsoundRing::write(const float* frames, size_t frameCount)
+{
+	if (!isEnabled())
+		return 0;
+
+	// only this side moves write_pos; read_pos is acquired so the frames the
+	// consumer released are no longer being read
+	const uint64_t wpos = write_pos.load(std::memory_order_relaxed);
+	const uint64_t fill = wpos - read_pos.load(std::memory_order_acquire);
+	const size_t n = std::min(frameCount, (size_t)(capacity - fill));
+
+	countOverrun(frameCount - n);
+
+	const size_t start = (size_t)(wpos % capacity);
+	const size_t first = std::min(n, (size_t)capacity - start);
+	memcpy(&buffer[start * channels], frames, first * channels * sizeof(float));
+	if (n > first)
+		memcpy(&buffer[0], frames + first * channels, (n - first) * channels * sizeof(float));
+
+	write_pos.store(wpos + n, std::memory_order_release);
+	return n;
+}
+
+// ----------------------------------------------------------------------------
+
+size_t AltsoundRing::writeSilence(size_t frameCount)
+{
+	if (!isEnabled())
+		return 0;
+
+	const uint64_t wpos = write_pos.load(std::memory_order_relaxed);
+	const uint64_t fill = wpos - read_pos.load(std::memory_order_acquire);
+	const size_t n = std::min(frameCount, (size_t)(capacity - fill));
+
+	const size_t start = (size_t)(wpos % capacity);
+	const size_t first = std::min(n, (size_t)capacity - start);
+	std::fill_n(&buffer[start * channels], first * channels, 0.0f);
+	std::fill_n(&buffer[0], (n - first) * channels, 0.0f);
+
+	write_pos.store(wpos + n, std::memory_order_release);
+	return n;
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundRing::countOverrun(size_t frameCount)
+{
+	if (frameCount == 0)
+		return;
+
+	overruns.fetch_add(1, std::memory_order_relaxed);
+	overrun_frames.fetch_add(frameCount, std::memory_order_relaxed);
+}
+
+// ----------------------------------------------------------------------------
+
+size_t AltsoundRing::read(const float** samples, size_t maxFrames)
+{
+	*samples = nullptr;
+	if (!isEnabled())
+		return 0;
+
+	const uint64_t rpos = read_pos.load(std::memory_order_relaxed);
+	const uint64_t fill = write_pos.load(std::memory_order_acquire) - rpos;
+
+	// only missing frames are an underrun, not a span cut short by the wrap
+	if (fill < maxFrames) {
+		underruns.fetch_add(1, std::memory_order_relaxed);
+		underrun_frames.fetch_add(maxFrames - fill, std::memory_order_relaxed);
+	}
+
+	const size_t start = (size_t)(rpos % capacity);
+	const size_t n = std::min({ maxFrames, (size_t)fill, (size_t)capacity - start });
+	if (n)
+		*samples = &buffer[start * channels];
+	return n;
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundRing::commit(size_t frameCount)
+{
+	if (!isEnabled())
+		return;
+
+	const uint64_t rpos = read_pos.load(std::memory_order_relaxed);
+	const uint64_t fill = write_pos.load(std::memory_order_acquire) - rpos;
+	read_pos.store(rpos + std::min((uint64_t)frameCount, fill), std::memory_order_release);
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundRing::snapshot(AltSoundRingStats& out) const
+{
+	const uint64_t rpos = read_pos.load(std::memory_order_acquire);
+	const uint64_t wpos = write_pos.load(std::memory_order_acquire);
+
+	out.capacity_frames = isEnabled() ? capacity : 0;
+	out.fill_frames = (uint32_t)std::min(wpos - std::min(rpos, wpos), (uint64_t)capacity);
+	out.written_frames = wpos;
+	out.read_frames = rpos;
+	out.overruns = overruns.load(std::memory_order_relaxed);
+	out.overrun_frames = overrun_frames.load(std::memory_order_relaxed);
+	out.underruns = underruns.load(std::memory_order_relaxed);
+	out.underrun_frames = underrun_frames.load(std::memory_order_relaxed);
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundRing::resetCounters()
+{
+	overruns.store(0, std::memory_order_relaxed);
+	overrun_frames.store(0, std::memory_order_relaxed);
+	underruns.store(0, std::memory_order_relaxed);
+	underrun_frames.store(0, std::memory_order_relaxed);
+}
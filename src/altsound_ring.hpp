@@ -0,0 +1,88 @@
+// ---------------------------------------------------------------------------
+// altsound_ring.hpp
+//
+// Lock-free single-producer/single-consumer ring of mixed frames behind
+// AltSoundRingRead()/AltSoundRingCommit().  The audio thread writes every
+// mixed period; the host reads contiguous spans straight out of the ring
+// from its own device callback.
+// ---------------------------------------------------------------------------
+// license:BSD-3-Clause
+// copyright-holders: Dave Roscoe
+// ---------------------------------------------------------------------------
+
+#ifndef ALTSOUND_RING_HPP
+#define ALTSOUND_RING_HPP
+#if !defined(__GNUC__) || (__GNUC__ == 3 && __GNUC_MINOR__ >= 4) || (__GNUC__ >= 4)	// GCC supports "pragma once" correctly since 3.4
+#pragma once
+#endif
+
+#include "altsound.h"
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+class AltsoundRing {
+public:
+
+	// Allocates capacityFrames frames of channels samples and enables the
+	// ring. Neither side may run concurrently
+	void init(uint32_t capacityFrames, uint32_t channels);
+
+	// Stops both sides without releasing the buffer, so a host still
+	// reading a span stays safe until the next init()
+	void disable() { enabled.store(false, std::memory_order_release); }
+
+	bool isEnabled() const { return enabled.load(std::memory_order_acquire); }
+
+	// Producer: copies up to frameCount frames in, dropping what does not
+	// fit. Returns the number of frames written
+	size_t write(const float* frames, size_t frameCount);
+
+	// Producer: appends frameCount frames of silence
+	size_t writeSilence(size_t frameCount);
+
+	// Producer: counts frames it dropped itself as an overrun
+	void countOverrun(size_t frameCount);
+
+	// Producer: frames written but not yet committed by the consumer
+	size_t fill() const { return (size_t)(write_pos.load(std::memory_order_relaxed) - read_pos.load(std::memory_order_acquire)); }
+
+	// frames the consumer committed since init()
+	uint64_t framesRead() const { return read_pos.load(std::memory_order_acquire); }
+
+	uint64_t underrunCount() const { return underruns.load(std::memory_order_relaxed); }
+
+	uint32_t getCapacity() const { return capacity; }
+
+	// Consumer: points samples at the oldest unread frames and returns how
+	// many of them are contiguous, at most maxFrames. The frames stay valid
+	// until commit()
+	size_t read(const float** samples, size_t maxFrames);
+
+	// Consumer: releases frames returned by read() to the producer
+	void commit(size_t frameCount);
+
+	void snapshot(AltSoundRingStats& out) const;
+
+	void resetCounters();
+
+private: // data
+
+	std::vector<float> buffer;
+	uint32_t capacity = 0;
+	uint32_t channels = 0;
+	std::atomic<bool> enabled{ false };
+
+	// frame positions since init(), on separate cache lines so the two
+	// sides do not contend
+	alignas(64) std::atomic<uint64_t> write_pos{ 0 };
+	alignas(64) std::atomic<uint64_t> read_pos{ 0 };
+
+	alignas(64) std::atomic<uint64_t> overruns{ 0 };
+	std::atomic<uint64_t> overrun_frames{ 0 };
+	std::atomic<uint64_t> underruns{ 0 };
+	std::atomic<uint64_t> underrun_frames{ 0 };
+};
+
+#endif // ALTSOUND_RING_HPP
@@ -0,0 +1,406 @@
+// ---------------------------------------------------------------------------
+// altsound_rt_check.cpp
+//
+// Realtime-safety checker for the audio thread
+// ---------------------------------------------------------------------------
+// license:BSD-3-Clause
+// copyright-holders: Dave Roscoe
+// ---------------------------------------------------------------------------
+
+// the interposers replace libc's functions, not its fortified wrappers
+#undef _FORTIFY_SOURCE
+
+#include "altsound_rt_check.hpp"
+
+#ifdef ALTSOUND_RT_CHECK_ACTIVE
+
+#include "altsound_logger.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+extern AltsoundLogger alog;
+
+// glibc's allocator behind malloc() and friends
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* ptr);
+}
+
+#define RT_INTERPOSE extern "C" __attribute__((visibility("default")))
+
+// Initial-exec TLS never allocates, which matters inside malloc()
+#define RT_TLS static thread_local __attribute__((tls_model("initial-exec")))
+
+RT_TLS int t_audio = 0;    // AudioScope depth
+RT_TLS const char* t_allow = nullptr;
+RT_TLS bool t_inHook = false;
+
+static std::atomic<uint64_t> g_violations{ 0 };
+static std::atomic<uint64_t> g_allowed{ 0 };
+
+// call sites already reported, by backtrace hash
+static constexpr size_t REPORTED_SLOTS = 1024;
+static std::atomic<uint64_t> g_reported[REPORTED_SLOTS] = {};
+
+// allowed violations by reason
+struct AllowedReason {
+	std::atomic<const char*> reason{ nullptr };
+	std::atomic<uint64_t> count{ 0 };
+};
+static constexpr size_t ALLOWED_REASONS = 32;
+static AllowedReason g_allowedReasons[ALLOWED_REASONS];
+
+static constexpr int MAX_FRAMES = 32;
+
+// ----------------------------------------------------------------------------
+
+namespace {
+
+// keeps the checker's own work out of the checks
+class HookGuard {
+public:
+	HookGuard() : outer(t_inHook) { t_inHook = true; }
+	~HookGuard() { t_inHook = outer; }
+
+private:
+	bool outer;
+};
+
+// backtrace() loads libgcc on first use, which must not happen on the
+// audio thread
+struct Prewarm {
+	Prewarm() {
+		HookGuard guard;
+		void* frames[1];
+		backtrace(frames, 1);
+	}
+} g_prewarm;
+
+} // namespace
+
+// ----------------------------------------------------------------------------
+
+// true the first time this call site is seen
+static bool firstReport(void* const* frames, int count)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (int i = 0; i < count; ++i)
+		hash = (hash ^ (uint64_t)(uintptr_t)frames[i]) * 1099511628211ull;
+	hash |= 1;
+
+	for (size_t i = 0; i < REPORTED_SLOTS; ++i) {
+		std::atomic<uint64_t>& slot = g_reported[(hash + i) % REPORTED_SLOTS];
+		uint64_t seen = slot.load(std::memory_order_relaxed);
+		if (seen == hash)
+			return false;
+		if (seen == 0 && slot.compare_exchange_strong(seen, hash, std::memory_order_relaxed))
+			return true;
+		if (seen == hash)
+			return false;
+	}
+	return false; // table full, stop reporting
+}
+
+// ----------------------------------------------------------------------------
+
+static void countAllowed(const char* reason)
+{
+	g_allowed.fetch_add(1, std::memory_order_relaxed);
+	for (AllowedReason& entry : g_allowedReasons) {
+		const char* current = entry.reason.load(std::memory_order_acquire);
+		if (!current && entry.reason.compare_exchange_strong(current, reason, std::memory_order_acq_rel))
+			current = reason;
+		if (current == reason) {
+			entry.count.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+static void check(const char* what)
+{
+	if (!t_audio || t_inHook)
+		return;
+
+	HookGuard guard;
+	if (t_allow) {
+		countAllowed(t_allow);
+		return;
+	}
+	g_violations.fetch_add(1, std::memory_order_relaxed);
+
+	// skips check() and the interposer
+	void* frames[MAX_FRAMES];
+	const int count = backtrace(frames, MAX_FRAMES);
+	if (count <= 2 || !firstReport(frames + 2, count - 2))
+		return;
+
+	char line[128];
+	const int len = snprintf(line, sizeof(line), "altsound: realtime-safety violation: %s on the audio thread\n", what);
+	write(STDERR_FILENO, line, (size_t)std::min(len, (int)sizeof(line) - 1));
+	backtrace_symbols_fd(frames + 2, count - 2, STDERR_FILENO);
+}
+
+// ----------------------------------------------------------------------------
+
+// next definition of a libc function, resolved on first use
+static void* next(std::atomic<void*>& cache, const char* name)
+{
+	void* fn = cache.load(std::memory_order_relaxed);
+	if (!fn) {
+		HookGuard guard;
+		fn = dlsym(RTLD_NEXT, name);
+		cache.store(fn, std::memory_order_relaxed);
+	}
+	return fn;
+}
+
+#define RT_NEXT(name) \
+	static std::atomic<void*> real_##name{ nullptr }; \
+	const auto real = reinterpret_cast<decltype(&::name)>(next(real_##name, #name))
+
+// ----------------------------------------------------------------------------
+
+AltsoundRtCheck::AudioScope::AudioScope()
+{
+	++t_audio;
+}
+
+AltsoundRtCheck::AudioScope::~AudioScope()
+{
+	--t_audio;
+}
+
+AltsoundRtCheck::Allow::Allow(const char* reason) : outer(t_allow)
+{
+	t_allow = reason;
+}
+
+AltsoundRtCheck::Allow::~Allow()
+{
+	t_allow = outer;
+}
+
+// ----------------------------------------------------------------------------
+
+uint64_t AltsoundRtCheck::violationCount()
+{
+	return g_violations.load(std::memory_order_relaxed);
+}
+
+uint64_t AltsoundRtCheck::allowedCount()
+{
+	return g_allowed.load(std::memory_order_relaxed);
+}
+
+void AltsoundRtCheck::resetCounters()
+{
+	g_violations.store(0, std::memory_order_relaxed);
+	g_allowed.store(0, std::memory_order_relaxed);
+	for (AllowedReason& entry : g_allowedReasons)
+		entry.count.store(0, std::memory_order_relaxed);
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundRtCheck::logSummary()
+{
+	ALT_INFO(0, "Realtime check: %llu violation(s), %llu allowed", (unsigned long long)violationCount(),
+	         (unsigned long long)allowedCount());
+	for (const AllowedReason& entry : g_allowedReasons) {
+		const char* reason = entry.reason.load(std::memory_order_acquire);
+		const uint64_t count = entry.count.load(std::memory_order_relaxed);
+		if (reason && count)
+			ALT_INFO(1, "allowed: %s: %llu", reason, (unsigned long long)count);
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Allocation
+// ----------------------------------------------------------------------------
+
+RT_INTERPOSE void* malloc(size_t size)
+{
+	check("malloc");
+	return __libc_malloc(size);
+}
+
+RT_INTERPOSE void* calloc(size_t count, size_t size)
+{
+	check("calloc");
+	return __libc_calloc(count, size);
+}
+
+RT_INTERPOSE void* realloc(void* ptr, size_t size)
+{
+	check("realloc");
+	return __libc_realloc(ptr, size);
+}
+
+RT_INTERPOSE void free(void* ptr)
+{
+	if (ptr)
+		check("free");
+	__libc_free(ptr);
+}
+
+RT_INTERPOSE void* aligned_alloc(size_t alignment, size_t size)
+{
+	check("aligned_alloc");
+	return __libc_memalign(alignment, size);
+}
+
+RT_INTERPOSE int posix_memalign(void** ptr, size_t alignment, size_t size)
+{
+	check("posix_memalign");
+	if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0)
+		return EINVAL;
+	*ptr = __libc_memalign(alignment, size);
+	return *ptr || !size ? 0 : ENOMEM;
+}
+
+// ----------------------------------------------------------------------------
+// Locks.  try-locks never block and are not reported
+// ----------------------------------------------------------------------------
+
+RT_INTERPOSE int pthread_mutex_lock(pthread_mutex_t* mutex)
+{
+	check("pthread_mutex_lock");
+	RT_NEXT(pthread_mutex_lock);
+	return real(mutex);
+}
+
+RT_INTERPOSE int pthread_rwlock_rdlock(pthread_rwlock_t* lock)
+{
+	check("pthread_rwlock_rdlock");
+	RT_NEXT(pthread_rwlock_rdlock);
+	return real(lock);
+}
+
+RT_INTERPOSE int pthread_rwlock_wrlock(pthread_rwlock_t* lock)
+{
+	check("pthread_rwlock_wrlock");
+	RT_NEXT(pthread_rwlock_wrlock);
+	return real(lock);
+}
+
+// ----------------------------------------------------------------------------
+// File I/O
+// ----------------------------------------------------------------------------
+
+RT_INTERPOSE int open(const char* path, int flags, ...)
+{
+	check("open");
+	mode_t mode = 0;
+	if (flags & (O_CREAT | O_TMPFILE)) {
+		va_list args;
+		va_start(args, flags);
+		mode = va_arg(args, mode_t);
+		va_end(args);
+	}
+	RT_NEXT(open);
+	return real(path, flags, mode);
+}
+
+RT_INTERPOSE int open64(const char* path, int flags, ...)
+{
+	check("open64");
+	mode_t mode = 0;
+	if (flags & (O_CREAT | O_TMPFILE)) {
+		va_list args;
+		va_start(args, flags);
+		mode = va_arg(args, mode_t);
+		va_end(args);
+	}
+	RT_NEXT(open64);
+	return real(path, flags, mode);
+}
+
+RT_INTERPOSE int close(int fd)
+{
+	check("close");
+	RT_NEXT(close);
+	return real(fd);
+}
+
+RT_INTERPOSE ssize_t read(int fd, void* buffer, size_t size)
+{
+	check("read");
+	RT_NEXT(read);
+	return real(fd, buffer, size);
+}
+
+RT_INTERPOSE ssize_t write(int fd, const void* buffer, size_t size)
+{
+	check("write");
+	RT_NEXT(write);
+	return real(fd, buffer, size);
+}
+
+RT_INTERPOSE FILE* fopen(const char* path, const char* mode)
+{
+	check("fopen");
+	RT_NEXT(fopen);
+	return real(path, mode);
+}
+
+RT_INTERPOSE FILE* fopen64(const char* path, const char* mode)
+{
+	check("fopen64");
+	RT_NEXT(fopen64);
+	return real(path, mode);
+}
+
+RT_INTERPOSE int fclose(FILE* file)
+{
+	check("fclose");
+	RT_NEXT(fclose);
+	return real(file);
+}
+
+RT_INTERPOSE size_t fread(void* buffer, size_t size, size_t count, FILE* file)
+{
+	check("fread");
+	RT_NEXT(fread);
+	return real(buffer, size, count, file);
+}
+
+RT_INTERPOSE size_t fwrite(const void* buffer, size_t size, size_t count, FILE* file)
+{
+	check("fwrite");
+	RT_NEXT(fwrite);
+	return real(buffer, size, count, file);
+}
+
+RT_INTERPOSE int fflush(FILE* file)
+{
+	check("fflush");
+	RT_NEXT(fflush);
+	return real(file);
+}
+
+RT_INTERPOSE int fseek(FILE* file, long offset, int whence)
+{
+	check("fseek");
+	RT_NEXT(fseek);
+	return real(file, offset, whence);
+}
+
+#endif // ALTSOUND_RT_CHECK_ACTIVE
@@ -0,0 +1,89 @@
+// ---------------------------------------------------------------------------
+// altsound_rt_check.hpp
+//
+// Realtime-safety checker for the audio thread.  Builds configured with
+// -DENABLE_RT_CHECK=ON interpose malloc/free, mutex locks and file I/O
+// (Linux/glibc).  While a thread is marked as the audio thread, every such
+// call is counted and reported once per call site, with a backtrace, on
+// stderr.  Known violations that are not fixed yet are wrapped in an Allow
+// scope, so only new ones count.  In other builds everything here compiles
+// to nothing.
+// ---------------------------------------------------------------------------
+// license:BSD-3-Clause
+// copyright-holders: Dave Roscoe
+// ---------------------------------------------------------------------------
+
+#ifndef ALTSOUND_RT_CHECK_HPP
+#define ALTSOUND_RT_CHECK_HPP
+#if !defined(__GNUC__) || (__GNUC__ == 3 && __GNUC_MINOR__ >= 4) || (__GNUC__ >= 4)	// GCC supports "pragma once" correctly since 3.4
+#pragma once
+#endif
+
+#include <cstdint>
+#include <mutex>
+
+#if defined(ALTSOUND_RT_CHECK) && defined(__linux__) && defined(__GLIBC__)
+#define ALTSOUND_RT_CHECK_ACTIVE 1
+#endif
+
+class AltsoundRtCheck {
+public:
+
+#ifdef ALTSOUND_RT_CHECK_ACTIVE
+	// Marks the calling thread as the audio thread for its lifetime
+	class AudioScope {
+	public:
+		AudioScope();
+		~AudioScope();
+	};
+
+	// Counts the violations within as allowed instead of reporting them.
+	// reason is a string literal naming the known violation
+	class Allow {
+	public:
+		explicit Allow(const char* reason);
+		~Allow();
+
+	private:
+		const char* outer;
+	};
+
+	static constexpr bool compiledIn() { return true; }
+
+	static uint64_t violationCount();
+	static uint64_t allowedCount();
+	static void resetCounters();
+
+	// logs the counts, allowed violations by reason
+	static void logSummary();
+#else
+	// user-provided, so an unused scope is no warning
+	class AudioScope {
+	public:
+		AudioScope() {}
+		~AudioScope() {}
+	};
+
+	class Allow {
+	public:
+		explicit Allow(const char*) {}
+	};
+
+	static constexpr bool compiledIn() { return false; }
+
+	static uint64_t violationCount() { return 0; }
+	static uint64_t allowedCount() { return 0; }
+	static void resetCounters() {}
+	static void logSummary() {}
+#endif
+
+	// Locks a mutex the audio thread shares with other threads, a known
+	// violation named by reason
+	template <typename Mutex>
+	static std::unique_lock<Mutex> lock(Mutex& mutex, const char* reason) {
+		Allow allow(reason);
+		return std::unique_lock<Mutex>(mutex);
+	}
+};
+
+#endif // ALTSOUND_RT_CHECK_HPP
@@ -0,0 +1,210 @@
+// ---------------------------------------------------------------------------
+// altsound_stats.cpp
+//
+// Runtime statistics behind AltSoundGetStats()
+// ---------------------------------------------------------------------------
+// license:BSD-3-Clause
+// copyright-holders: Dave Roscoe
+// ---------------------------------------------------------------------------
+
+#include "altsound_stats.hpp"
+#include "altsound_data.hpp"
+#include "altsound_rt_check.hpp"
+
+#include <algorithm>
+#include <bit>
+
+static_assert(OVERLAY + 1 == ALTSOUND_SAMPLE_TYPE_COUNT, "ALTSOUND_SAMPLE_TYPE must mirror AltsoundSampleType");
+
+thread_local uint64_t AltsoundStats::command_start_ns = 0;
+
+// ----------------------------------------------------------------------------
+// AltsoundHistogramCounter
+// ----------------------------------------------------------------------------
+
+unsigned int AltsoundHistogramCounter::bucketOf(uint64_t ns)
+{
+	if (ns < 4)
+		return (unsigned int)ns;
+
+	const unsigned int msb = (unsigned int)std::bit_width(ns) - 1;
+	const unsigned int sub = (unsigned int)(ns >> (msb - 2)) & 3;
+	return std::min((msb - 1) * 4 + sub, (unsigned int)ALTSOUND_HISTOGRAM_BUCKETS - 1);
+}
+
+// ----------------------------------------------------------------------------
+
+uint64_t AltsoundHistogramCounter::bucketLimit(unsigned int bucket)
+{
+	if (bucket < 4)
+		return bucket;
+	if (bucket >= ALTSOUND_HISTOGRAM_BUCKETS - 1)
+		return UINT64_MAX;
+
+	const unsigned int msb = bucket / 4 + 1;
+	const uint64_t lower = (uint64_t)(4 + bucket % 4) << (msb - 2);
+	return lower + ((uint64_t)1 << (msb - 2)) - 1;
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundHistogramCounter::record(uint64_t ns)
+{
+	count.fetch_add(1, std::memory_order_relaxed);
+	total_ns.fetch_add(ns, std::memory_order_relaxed);
+	buckets[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+
+	uint64_t cur_max = max_ns.load(std::memory_order_relaxed);
+	while (ns > cur_max && !max_ns.compare_exchange_weak(cur_max, ns, std::memory_order_relaxed)) {
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundHistogramCounter::snapshot(AltSoundHistogram& out) const
+{
+	out.count = count.load(std::memory_order_relaxed);
+	out.total_ns = total_ns.load(std::memory_order_relaxed);
+	out.max_ns = max_ns.load(std::memory_order_relaxed);
+	for (unsigned int i = 0; i < ALTSOUND_HISTOGRAM_BUCKETS; ++i)
+		out.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundHistogramCounter::reset()
+{
+	count.store(0, std::memory_order_relaxed);
+	total_ns.store(0, std::memory_order_relaxed);
+	max_ns.store(0, std::memory_order_relaxed);
+	for (auto& bucket : buckets)
+		bucket.store(0, std::memory_order_relaxed);
+}
+
+// ----------------------------------------------------------------------------
+// AltsoundStats
+// ----------------------------------------------------------------------------
+
+AltsoundStats::CommandScope::CommandScope(AltsoundStats& stats_in)
+: stats(stats_in)
+, start_ns(now())
+{
+	command_start_ns = start_ns;
+	add(stats.commands);
+}
+
+AltsoundStats::CommandScope::~CommandScope()
+{
+	stats.process_command.record(now() - start_ns);
+	command_start_ns = 0;
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundStats::voiceStarted(unsigned int type)
+{
+	if (type >= ALTSOUND_SAMPLE_TYPE_COUNT)
+		return;
+
+	const uint32_t active = voices[type].fetch_add(1, std::memory_order_relaxed) + 1;
+	uint32_t peak = peak_voices[type].load(std::memory_order_relaxed);
+	while (active > peak && !peak_voices[type].compare_exchange_weak(peak, active, std::memory_order_relaxed)) {
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundStats::voiceStopped(unsigned int type)
+{
+	if (type < ALTSOUND_SAMPLE_TYPE_COUNT)
+		voices[type].fetch_sub(1, std::memory_order_relaxed);
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundStats::loadLevelChanged(uint32_t level)
+{
+	load_level.store(level, std::memory_order_relaxed);
+	uint32_t peak = peak_load_level.load(std::memory_order_relaxed);
+	while (level > peak && !peak_load_level.compare_exchange_weak(peak, level, std::memory_order_relaxed)) {
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundStats::snapshot(AltSoundStats& out) const
+{
+	process_command.snapshot(out.process_command);
+	command_to_audio.snapshot(out.command_to_audio);
+	stream_create.snapshot(out.stream_create);
+	mix.snapshot(out.mix);
+
+	out.mix_budget_ns = mix_budget_ns.load(std::memory_order_relaxed);
+	out.mix_load = 0.0f;
+	out.mix_load_peak = 0.0f;
+	if (out.mix_budget_ns && out.mix.count) {
+		out.mix_load = (float)((double)out.mix.total_ns / out.mix.count / out.mix_budget_ns);
+		out.mix_load_peak = (float)((double)out.mix.max_ns / out.mix_budget_ns);
+	}
+
+	for (unsigned int i = 0; i < ALTSOUND_SAMPLE_TYPE_COUNT; ++i) {
+		out.voices[i] = voices[i].load(std::memory_order_relaxed);
+		out.peak_voices[i] = peak_voices[i].load(std::memory_order_relaxed);
+	}
+	out.virtual_voices = virtual_voices.load(std::memory_order_relaxed);
+	out.shed_voices = shed_voices.load(std::memory_order_relaxed);
+
+	out.commands = commands.load(std::memory_order_relaxed);
+	out.filtered = filtered.load(std::memory_order_relaxed);
+	out.incomplete = incomplete.load(std::memory_order_relaxed);
+	out.unmatched = unmatched.load(std::memory_order_relaxed);
+	out.skipped = skipped.load(std::memory_order_relaxed);
+	out.channel_full = channel_full.load(std::memory_order_relaxed);
+	out.idle_periods = idle_periods.load(std::memory_order_relaxed);
+	out.retrigger_coalesced = retrigger_coalesced.load(std::memory_order_relaxed);
+	out.retrigger_restarted = retrigger_restarted.load(std::memory_order_relaxed);
+	out.retrigger_ignored = retrigger_ignored.load(std::memory_order_relaxed);
+	out.retrigger_limited = retrigger_limited.load(std::memory_order_relaxed);
+
+	out.load_level = load_level.load(std::memory_order_relaxed);
+	out.peak_load_level = peak_load_level.load(std::memory_order_relaxed);
+	out.load_resampled = load_resampled.load(std::memory_order_relaxed);
+	out.load_shed = load_shed.load(std::memory_order_relaxed);
+	out.load_refused = load_refused.load(std::memory_order_relaxed);
+
+	out.rt_violations = AltsoundRtCheck::violationCount();
+}
+
+// ----------------------------------------------------------------------------
+// Clears counters and histograms.  Gauges (active voices) keep their value;
+// peaks restart from it
+// ----------------------------------------------------------------------------
+
+void AltsoundStats::reset()
+{
+	process_command.reset();
+	command_to_audio.reset();
+	stream_create.reset();
+	mix.reset();
+
+	for (unsigned int i = 0; i < ALTSOUND_SAMPLE_TYPE_COUNT; ++i)
+		peak_voices[i].store(voices[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+	peak_load_level.store(load_level.load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+	commands.store(0, std::memory_order_relaxed);
+	filtered.store(0, std::memory_order_relaxed);
+	incomplete.store(0, std::memory_order_relaxed);
+	unmatched.store(0, std::memory_order_relaxed);
+	skipped.store(0, std::memory_order_relaxed);
+	channel_full.store(0, std::memory_order_relaxed);
+	idle_periods.store(0, std::memory_order_relaxed);
+	retrigger_coalesced.store(0, std::memory_order_relaxed);
+	retrigger_restarted.store(0, std::memory_order_relaxed);
+	retrigger_ignored.store(0, std::memory_order_relaxed);
+	retrigger_limited.store(0, std::memory_order_relaxed);
+	load_resampled.store(0, std::memory_order_relaxed);
+	load_shed.store(0, std::memory_order_relaxed);
+	load_refused.store(0, std::memory_order_relaxed);
+
+	AltsoundRtCheck::resetCounters();
+}
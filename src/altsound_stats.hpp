@@ -0,0 +1,126 @@
+// ---------------------------------------------------------------------------
+// altsound_stats.hpp
+//
+// Runtime statistics behind AltSoundGetStats().  All counters are relaxed
+// atomics, so recording an event from any thread (including the audio
+// thread) costs a few atomic adds and never blocks.
+// ---------------------------------------------------------------------------
+// license:BSD-3-Clause
+// copyright-holders: Dave Roscoe
+// ---------------------------------------------------------------------------
+
+#ifndef ALTSOUND_STATS_HPP
+#define ALTSOUND_STATS_HPP
+#if !defined(__GNUC__) || (__GNUC__ == 3 && __GNUC_MINOR__ >= 4) || (__GNUC__ >= 4)	// GCC supports "pragma once" correctly since 3.4
+#pragma once
+#endif
+
+#include "altsound.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// ----------------------------------------------------------------------------
+// Duration histogram, see AltSoundHistogram for the bucket layout
+// ----------------------------------------------------------------------------
+
+class AltsoundHistogramCounter {
+public:
+
+	void record(uint64_t ns);
+
+	void snapshot(AltSoundHistogram& out) const;
+
+	void reset();
+
+	// bucket that counts the value
+	static unsigned int bucketOf(uint64_t ns);
+
+	// largest value counted by the bucket
+	static uint64_t bucketLimit(unsigned int bucket);
+
+private: // data
+
+	std::atomic<uint64_t> count{ 0 };
+	std::atomic<uint64_t> total_ns{ 0 };
+	std::atomic<uint64_t> max_ns{ 0 };
+	std::atomic<uint64_t> buckets[ALTSOUND_HISTOGRAM_BUCKETS] = {};
+};
+
+// ----------------------------------------------------------------------------
+
+class AltsoundStats {
+public:
+
+	// monotonic clock used for all measurements
+	static uint64_t now() {
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// Counts and times one received command byte.  Streams created while it
+	// is in scope measure their first-mix latency from its start
+	class CommandScope {
+	public:
+		explicit CommandScope(AltsoundStats& stats);
+		~CommandScope();
+	private:
+		AltsoundStats& stats;
+		uint64_t start_ns;
+	};
+
+	// start of the command being handled on this thread, or now
+	static uint64_t commandTime() { return command_start_ns ? command_start_ns : now(); }
+
+	void voiceStarted(unsigned int type);
+	void voiceStopped(unsigned int type);
+
+	// current load control level, see AltsoundLoadControl
+	void loadLevelChanged(uint32_t level);
+
+	void setMixBudget(uint64_t ns) { mix_budget_ns.store(ns, std::memory_order_relaxed); }
+
+	void snapshot(AltSoundStats& out) const;
+
+	void reset();
+
+	static void add(std::atomic<uint64_t>& counter) { counter.fetch_add(1, std::memory_order_relaxed); }
+
+public: // data
+
+	AltsoundHistogramCounter process_command;
+	AltsoundHistogramCounter command_to_audio;
+	AltsoundHistogramCounter stream_create;
+	AltsoundHistogramCounter mix;
+
+	std::atomic<uint64_t> commands{ 0 };
+	std::atomic<uint64_t> filtered{ 0 };
+	std::atomic<uint64_t> incomplete{ 0 };
+	std::atomic<uint64_t> unmatched{ 0 };
+	std::atomic<uint64_t> skipped{ 0 };
+	std::atomic<uint64_t> channel_full{ 0 };
+	std::atomic<uint64_t> idle_periods{ 0 };
+	std::atomic<uint64_t> retrigger_coalesced{ 0 };
+	std::atomic<uint64_t> retrigger_restarted{ 0 };
+	std::atomic<uint64_t> retrigger_ignored{ 0 };
+	std::atomic<uint64_t> retrigger_limited{ 0 };
+	std::atomic<uint64_t> load_resampled{ 0 };
+	std::atomic<uint64_t> load_shed{ 0 };
+	std::atomic<uint64_t> load_refused{ 0 };
+
+	std::atomic<uint32_t> virtual_voices{ 0 };
+	std::atomic<uint32_t> shed_voices{ 0 };
+
+private: // data
+
+	static thread_local uint64_t command_start_ns;
+
+	std::atomic<uint64_t> mix_budget_ns{ 0 };
+	std::atomic<uint32_t> voices[ALTSOUND_SAMPLE_TYPE_COUNT] = {};
+	std::atomic<uint32_t> peak_voices[ALTSOUND_SAMPLE_TYPE_COUNT] = {};
+	std::atomic<uint32_t> load_level{ 0 };
+	std::atomic<uint32_t> peak_load_level{ 0 };
+};
+
+#endif // ALTSOUND_STATS_HPP
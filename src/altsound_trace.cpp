@@ -0,0 +1,282 @@
+// ---------------------------------------------------------------------------
+// altsound_trace.cpp
+//
+// Opt-in Chrome trace-event recorder
+// ---------------------------------------------------------------------------
+// license:BSD-3-Clause
+// copyright-holders: Dave Roscoe
+// ---------------------------------------------------------------------------
+
+#include "altsound_trace.hpp"
+#include "altsound_logger.hpp"
+#include "altsound_stats.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+extern AltsoundLogger alog;
+
+std::atomic<bool> AltsoundTrace::active{ false };
+
+namespace {
+
+struct TraceEvent {
+	const char* cat;
+	const char* name;
+	char phase;        // Chrome trace phase: X = complete, i = instant, C = counter
+	uint64_t ts_ns;
+	uint64_t dur_ns;
+	AltsoundTraceArg args[AltsoundTrace::maxArgs];
+	size_t num_args;
+	char detail[AltsoundTrace::maxDetail + 1];
+};
+
+// Events of one thread.  Only the owning thread appends; the mutex is
+// uncontended except while stop() writes the file
+struct ThreadBuffer {
+	std::mutex mutex;
+	unsigned int tid = 0;
+	const char* name = nullptr;
+	std::vector<TraceEvent> events;
+	size_t dropped = 0;
+};
+
+// bounds the memory a long session can take (~180 bytes per event)
+constexpr size_t maxEventsPerThread = 256 * 1024;
+
+std::mutex g_registryMutex;
+std::vector<std::unique_ptr<ThreadBuffer>> g_buffers;
+thread_local ThreadBuffer* t_buffer = nullptr;
+
+string g_tracePath;
+std::atomic<uint64_t> g_traceStartNs{ 0 };
+
+ThreadBuffer& threadBuffer()
+{
+	if (!t_buffer) {
+		std::lock_guard<std::mutex> lock(g_registryMutex);
+		g_buffers.push_back(std::make_unique<ThreadBuffer>());
+		t_buffer = g_buffers.back().get();
+		t_buffer->tid = (unsigned int)g_buffers.size();
+	}
+	return *t_buffer;
+}
+
+void push(char phase, const char* cat, const char* name, uint64_t ts_ns, uint64_t dur_ns,
+          const AltsoundTraceArg* args, size_t num_args, const char* detail)
+{
+	ThreadBuffer& buffer = threadBuffer();
+	std::lock_guard<std::mutex> lock(buffer.mutex);
+
+	if (buffer.events.size() >= maxEventsPerThread) {
+		++buffer.dropped;
+		return;
+	}
+	if (buffer.events.capacity() == 0)
+		buffer.events.reserve(4096);
+
+	TraceEvent& ev = buffer.events.emplace_back();
+	ev.cat = cat;
+	ev.name = name;
+	ev.phase = phase;
+	ev.ts_ns = ts_ns;
+	ev.dur_ns = dur_ns;
+	ev.num_args = std::min(num_args, AltsoundTrace::maxArgs);
+	std::copy_n(args, ev.num_args, ev.args);
+	ev.detail[0] = '\0';
+	if (detail) {
+		strncpy(ev.detail, detail, AltsoundTrace::maxDetail);
+		ev.detail[AltsoundTrace::maxDetail] = '\0';
+	}
+}
+
+double toUs(uint64_t ns, uint64_t base_ns)
+{
+	return ns > base_ns ? (double)(ns - base_ns) / 1000.0 : 0.0;
+}
+
+void writeString(FILE* out, const char* str)
+{
+	fputc('"', out);
+	for (const char* c = str; *c; ++c) {
+		if (*c == '"' || *c == '\\') {
+			fputc('\\', out);
+			fputc(*c, out);
+		}
+		else if ((unsigned char)*c < 0x20) {
+			fputc(' ', out);
+		}
+		else {
+			fputc(*c, out);
+		}
+	}
+	fputc('"', out);
+}
+
+void writeEvent(FILE* out, const TraceEvent& ev, unsigned int tid, uint64_t base_ns)
+{
+	fprintf(out, ",\n{\"name\":");
+	writeString(out, ev.name);
+	fprintf(out, ",\"cat\":");
+	writeString(out, ev.cat);
+	fprintf(out, ",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%u", ev.phase, toUs(ev.ts_ns, base_ns), tid);
+	if (ev.phase == 'X')
+		fprintf(out, ",\"dur\":%.3f", (double)ev.dur_ns / 1000.0);
+	else if (ev.phase == 'i')
+		fprintf(out, ",\"s\":\"t\"");
+
+	fprintf(out, ",\"args\":{");
+	for (size_t i = 0; i < ev.num_args; ++i) {
+		if (i)
+			fputc(',', out);
+		writeString(out, ev.args[i].key);
+		fprintf(out, ":%.9g", ev.args[i].value);
+	}
+	if (ev.detail[0]) {
+		if (ev.num_args)
+			fputc(',', out);
+		fprintf(out, "\"detail\":");
+		writeString(out, ev.detail);
+	}
+	fprintf(out, "}}");
+}
+
+} // namespace
+
+// ----------------------------------------------------------------------------
+
+bool AltsoundTrace::start(const string& path)
+{
+	std::lock_guard<std::mutex> lock(g_registryMutex);
+	if (active.load(std::memory_order_relaxed)) {
+		ALT_ERROR(0, "Trace already running: %s", g_tracePath.c_str());
+		return false;
+	}
+
+	// fail now rather than after a whole session
+	FILE* out = fopen(path.c_str(), "w");
+	if (!out) {
+		ALT_ERROR(0, "Unable to create trace file: %s", path.c_str());
+		return false;
+	}
+	fclose(out);
+
+	g_tracePath = path;
+	g_traceStartNs.store(AltsoundStats::now(), std::memory_order_relaxed);
+	active.store(true, std::memory_order_release);
+
+	ALT_INFO(0, "Trace started: %s", path.c_str());
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+
+bool AltsoundTrace::stop()
+{
+	if (!active.exchange(false))
+		return false;
+
+	std::lock_guard<std::mutex> lock(g_registryMutex);
+
+	FILE* out = fopen(g_tracePath.c_str(), "w");
+	if (!out) {
+		ALT_ERROR(0, "Unable to write trace file: %s", g_tracePath.c_str());
+		return false;
+	}
+
+	const uint64_t base_ns = g_traceStartNs.load(std::memory_order_relaxed);
+	size_t num_events = 0;
+	size_t num_dropped = 0;
+
+	fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"altsound\"}}");
+
+	for (const auto& buffer : g_buffers) {
+		std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+
+		if (buffer->events.empty())
+			continue;
+
+		fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", buffer->tid);
+		char fallback[32];
+		snprintf(fallback, sizeof(fallback), "thread %u", buffer->tid);
+		writeString(out, buffer->name ? buffer->name : fallback);
+		fprintf(out, "}}");
+
+		for (const TraceEvent& ev : buffer->events)
+			writeEvent(out, ev, buffer->tid, base_ns);
+
+		num_events += buffer->events.size();
+		num_dropped += buffer->dropped;
+
+		buffer->events.clear();
+		buffer->events.shrink_to_fit();
+		buffer->dropped = 0;
+	}
+
+	fprintf(out, "\n]}\n");
+	fclose(out);
+
+	ALT_INFO(0, "Trace written: %s (%zu events, %zu dropped)", g_tracePath.c_str(), num_events, num_dropped);
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundTrace::setThreadName(const char* name)
+{
+	ThreadBuffer& buffer = threadBuffer();
+	std::lock_guard<std::mutex> lock(buffer.mutex);
+	buffer.name = name;
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundTrace::instant(const char* cat, const char* name, std::initializer_list<AltsoundTraceArg> args,
+                            const char* detail)
+{
+	if (enabled())
+		push('i', cat, name, AltsoundStats::now(), 0, args.begin(), args.size(), detail);
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundTrace::complete(const char* cat, const char* name, uint64_t start_ns, uint64_t end_ns,
+                             std::initializer_list<AltsoundTraceArg> args, const char* detail)
+{
+	if (enabled())
+		push('X', cat, name, start_ns, end_ns - start_ns, args.begin(), args.size(), detail);
+}
+
+// ----------------------------------------------------------------------------
+
+void AltsoundTrace::counter(const char* name, std::initializer_list<AltsoundTraceArg> values)
+{
+	if (enabled())
+		push('C', "counter", name, AltsoundStats::now(), 0, values.begin(), values.size(), nullptr);
+}
+
+// ----------------------------------------------------------------------------
+// Scope
+// ----------------------------------------------------------------------------
+
+AltsoundTrace::Scope::Scope(const char* cat_in, const char* name_in)
+: cat(cat_in), name(name_in), start_ns(enabled() ? AltsoundStats::now() : 0)
+{
+}
+
+AltsoundTrace::Scope::~Scope()
+{
+	if (start_ns && enabled())
+		push('X', cat, name, start_ns, AltsoundStats::now() - start_ns, args, num_args, nullptr);
+}
+
+void AltsoundTrace::Scope::arg(const char* key, double value)
+{
+	if (start_ns && num_args < maxArgs)
+		args[num_args++] = { key, value };
+}
@@ -0,0 +1,83 @@
+// ---------------------------------------------------------------------------
+// altsound_trace.hpp
+//
+// Opt-in trace recorder.  Events are appended to a per-thread buffer and
+// written as Chrome trace-event JSON (loadable in Perfetto or
+// chrome://tracing) when the trace is stopped.  While no trace is running,
+// every trace point costs a single relaxed atomic load.
+// ---------------------------------------------------------------------------
+// license:BSD-3-Clause
+// copyright-holders: Dave Roscoe
+// ---------------------------------------------------------------------------
+
+#ifndef ALTSOUND_TRACE_HPP
+#define ALTSOUND_TRACE_HPP
+#if !defined(__GNUC__) || (__GNUC__ == 3 && __GNUC_MINOR__ >= 4) || (__GNUC__ >= 4)	// GCC supports "pragma once" correctly since 3.4
+#pragma once
+#endif
+
+#include <atomic>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+
+using std::string;
+
+// Numeric event argument.  key must be a string literal
+struct AltsoundTraceArg {
+	const char* key;
+	double value;
+};
+
+class AltsoundTrace {
+public:
+
+	static constexpr size_t maxArgs = 5;
+	static constexpr size_t maxDetail = 63;
+
+	// Starts recording; the trace is written to path by stop()
+	static bool start(const string& path);
+
+	// Stops recording and writes the trace file
+	static bool stop();
+
+	static bool enabled() { return active.load(std::memory_order_relaxed); }
+
+	// Names the calling thread's track.  name must be a string literal
+	static void setThreadName(const char* name);
+
+	// Event recording.  cat and name must be string literals; detail is
+	// copied (and truncated) into the event
+	static void instant(const char* cat, const char* name,
+	                    std::initializer_list<AltsoundTraceArg> args = {}, const char* detail = nullptr);
+	static void complete(const char* cat, const char* name, uint64_t start_ns, uint64_t end_ns,
+	                     std::initializer_list<AltsoundTraceArg> args = {}, const char* detail = nullptr);
+	static void counter(const char* name, std::initializer_list<AltsoundTraceArg> values);
+
+	// Records a complete event spanning its lifetime.  Does nothing if no
+	// trace was running when it was created
+	class Scope {
+	public:
+		Scope(const char* cat, const char* name);
+		~Scope();
+
+		// sets a numeric argument, recorded when the scope ends
+		void arg(const char* key, double value);
+
+		// renames the event (e.g. once the outcome is known)
+		void rename(const char* name_in) { name = name_in; }
+
+	private:
+		const char* cat;
+		const char* name;
+		uint64_t start_ns;
+		AltsoundTraceArg args[maxArgs];
+		size_t num_args = 0;
+	};
+
+private:
+
+	static std::atomic<bool> active;
+};
+
+#endif // ALTSOUND_TRACE_HPP
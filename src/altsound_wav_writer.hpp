@@ -0,0 +1,81 @@
+// ---------------------------------------------------------------------------
+// altsound_wav_writer.hpp
+//
+// 32-bit float WAV files of mixed output, written as they are rendered.  The
+// chunk sizes are patched when the file is closed.  Used by altsound_render
+// and the golden-output test
+// ---------------------------------------------------------------------------
+// license:BSD-3-Clause
+// copyright-holders: Dave Roscoe
+// ---------------------------------------------------------------------------
+
+#ifndef ALTSOUND_WAV_WRITER_HPP
+#define ALTSOUND_WAV_WRITER_HPP
+#if !defined(__GNUC__) || (__GNUC__ == 3 && __GNUC_MINOR__ >= 4) || (__GNUC__ >= 4)	// GCC supports "pragma once" correctly since 3.4
+#pragma once
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+class AltsoundWavWriter {
+public:
+	~AltsoundWavWriter() { close(); }
+
+	bool open(const std::string& path, uint32_t rate, uint32_t channels_in)
+	{
+		out = fopen(path.c_str(), "wb");
+		channels = channels_in;
+		sample_rate = rate;
+		num_frames = 0;
+		return out && writeHeader();
+	}
+
+	bool write(const float* frames, size_t count)
+	{
+		num_frames += count;
+		return fwrite(frames, sizeof(float) * channels, count, out) == count;
+	}
+
+	// patches the chunk sizes
+	bool close()
+	{
+		if (!out)
+			return true;
+
+		const bool success = fseek(out, 0, SEEK_SET) == 0 && writeHeader();
+		const bool closed = fclose(out) == 0;
+		out = nullptr;
+		return success && closed;
+	}
+
+private:
+	bool writeHeader()
+	{
+		const uint32_t data_size = (uint32_t)std::min<uint64_t>(num_frames * channels * sizeof(float), 0xFFFFFFF0u);
+		const uint16_t block_align = (uint16_t)(channels * sizeof(float));
+
+		uint8_t header[44];
+		auto u32 = [&](size_t at, uint32_t v) { for (int i = 0; i < 4; ++i) header[at + i] = (uint8_t)(v >> (8 * i)); };
+		auto u16 = [&](size_t at, uint16_t v) { header[at] = (uint8_t)v; header[at + 1] = (uint8_t)(v >> 8); };
+
+		memcpy(header, "RIFF", 4); u32(4, 36 + data_size);
+		memcpy(header + 8, "WAVEfmt ", 8); u32(16, 16);
+		u16(20, 3); // IEEE float
+		u16(22, (uint16_t)channels); u32(24, sample_rate); u32(28, sample_rate * block_align);
+		u16(32, block_align); u16(34, 32);
+		memcpy(header + 36, "data", 4); u32(40, data_size);
+
+		return fwrite(header, 1, sizeof(header), out) == sizeof(header);
+	}
+
+	FILE* out = nullptr;
+	uint32_t channels = 2;
+	uint32_t sample_rate = 44100;
+	uint64_t num_frames = 0;
+};
+
+#endif // ALTSOUND_WAV_WRITER_HPP
@@ -0,0 +1,1001 @@
+// ---------------------------------------------------------------------------
+// bench.cpp
+//
+// Micro-benchmarks for AltSound.  Links against the static library so
+// internal components can be measured in isolation.  Needs no audio
+// hardware: sample packages are generated in the temp directory, and the
+// library mixes on its own null device.
+//
+// Decoder throughput:
+//   Replays sound command byte streams through the per-hardware-generation
+//   command decoders (preprocess/postprocess included).  Without cmdlog
+//   arguments, a synthetic capture is generated for each decoder family,
+//   modelled on the traffic its ROMs produce (volume/control sequences,
+//   16-bit prefixes, clock bytes).  Recorded cmdlog.bin or
+//   <gamename>-cmdlog.txt files can be passed on the command line; each one
+//   is replayed through the decoder of its recorded hardware generation.
+//
+// Sample lookup:
+//   Unmatched commands against AltSound and G-Sound tables of 100 to 50k
+//   samples, i.e. the cost of a full table scan.
+//
+// Command handling per processor:
+//   AltSoundProcessCommand end to end on a small AltSound and G-Sound
+//   package, for commands with and without a sample.
+//
+// Stream create/free:
+//   Opening and releasing a WAV sample.  OGG is measured on the file given
+//   with --ogg, since no encoder is available to generate one.
+//
+// G-Sound behaviors:
+//   Callouts (ducking, exclusive replacement) with 0 to 12 active streams.
+//
+// Resampling:
+//   Decoding a 48 kHz and a 22.05 kHz sample to the 44.1 kHz output with
+//   each resampler setting of altsound.ini, against a 44.1 kHz sample that
+//   is not resampled.  The difference is the resampling cost of one voice,
+//   also given as the share of a CPU core it takes in real time.
+//
+// Output format conversion:
+//   Converting mixed stereo frames to each output format and layout of
+//   AltSoundOptions, with the SIMD kernels compiled in.
+//
+// Mixing:
+//   Engine time per audio period for 0 to 16 looping voices, taken from
+//   the runtime statistics while the null device plays in real time.
+//
+// Command handling per log level:
+//   Commands with and without a sample at each runtime log level.  Shows
+//   what logging costs on the command path (see the ALTSOUND_MAX_LOG_LEVEL
+//   build option).
+//
+// --json writes all results to a file.  --baseline compares them with such
+// a file and exits with 2 if a result is slower by more than --threshold
+// percent (default 10).
+//
+// Usage: altsound_bench [--json <file>] [--baseline <file>] [--threshold <pct>]
+//                       [--ogg <file>] [<cmdlog> ...]
+// ---------------------------------------------------------------------------
+// license:BSD-3-Clause
+// copyright-holders: Dave Roscoe
+// ---------------------------------------------------------------------------
+
+#include "altsound.h"
+#include "altsound_cmd_decoder.hpp"
+#include "altsound_cmdlog.hpp"
+#include "altsound_output_format.hpp"
+#include "miniaudio_bass_compat.hpp"
+#include "miniaudio_private.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+using std::string;
+
+// ---------------------------------------------------------------------------
+// Results
+// ---------------------------------------------------------------------------
+
+// One measurement; lower is better for all of them
+struct BenchResult {
+	string name;
+	double value;
+	string unit;
+};
+
+static std::vector<BenchResult> g_results;
+
+static void record(const string& name, double value, const char* unit)
+{
+	g_results.push_back({ name, value, unit });
+}
+
+// ---------------------------------------------------------------------------
+// Byte streams
+// ---------------------------------------------------------------------------
+
+struct ByteStream {
+	string name;
+	ALTSOUND_HARDWARE_GEN gen;
+	std::vector<uint8_t> bytes;
+};
+
+// Small deterministic generator so runs are comparable
+struct Lcg {
+	uint32_t state;
+	explicit Lcg(uint32_t seed) : state(seed) {}
+	uint32_t next() { state = state * 1664525u + 1013904223u; return state >> 8; }
+	uint8_t byte() { return (uint8_t)next(); }
+	bool chance(uint32_t pct) { return (next() % 100) < pct; }
+};
+
+static const size_t SYNTH_COMMANDS = 64 * 1024;
+
+static ByteStream synthDcs()
+{
+	ByteStream s{ "synthetic DCS", ALTSOUND_HARDWARE_GEN_WPCDCS, {} };
+	Lcg rng(0xDC5);
+	for (size_t i = 0; i < SYNTH_COMMANDS; ++i) {
+		if (rng.chance(5)) { // master volume: 55 AA vol ~vol
+			const uint8_t vol = rng.byte();
+			s.bytes.insert(s.bytes.end(), { 0x55, 0xAA, vol, (uint8_t)(vol ^ 0xFF) });
+		}
+		else if (rng.chance(2)) { // channel mixing level: 55 AB..B0 lvl ~lvl
+			const uint8_t lvl = rng.byte();
+			s.bytes.insert(s.bytes.end(), { 0x55, (uint8_t)(0xAB + rng.next() % 6), lvl, (uint8_t)(lvl ^ 0xFF) });
+		}
+		else { // 16-bit sound command
+			const uint16_t cmd = (uint16_t)(rng.next() % 0x0400);
+			s.bytes.insert(s.bytes.end(), { (uint8_t)(cmd >> 8), (uint8_t)cmd });
+		}
+	}
+	return s;
+}
+
+static ByteStream synthWpc()
+{
+	ByteStream s{ "synthetic WPC", ALTSOUND_HARDWARE_GEN_WPCFLIPTRON, {} };
+	Lcg rng(0x3C);
+	for (size_t i = 0; i < SYNTH_COMMANDS; ++i) {
+		if (rng.chance(3)) { // volume: 79 vol ~vol
+			const uint8_t vol = (uint8_t)(rng.next() % 32);
+			s.bytes.insert(s.bytes.end(), { 0x79, vol, (uint8_t)(vol ^ 0xFF) });
+		}
+		else if (rng.chance(20)) // 16-bit: 7A xx
+			s.bytes.insert(s.bytes.end(), { 0x7A, rng.byte() });
+		else
+			s.bytes.push_back(rng.byte() & 0x6F);
+	}
+	return s;
+}
+
+static ByteStream synthS11()
+{
+	ByteStream s{ "synthetic S11", ALTSOUND_HARDWARE_GEN_S11C, {} };
+	Lcg rng(0x511);
+	for (size_t i = 0; i < SYNTH_COMMANDS; ++i) {
+		const uint8_t cmd = rng.byte();
+		s.bytes.push_back(cmd);
+		if (rng.chance(15)) // doubled bytes
+			s.bytes.push_back(cmd);
+	}
+	return s;
+}
+
+static ByteStream synthDe()
+{
+	ByteStream s{ "synthetic DE", ALTSOUND_HARDWARE_GEN_DEDMD32, {} };
+	Lcg rng(0xDE);
+	for (size_t i = 0; i < SYNTH_COMMANDS; ++i) {
+		if (rng.chance(10))
+			s.bytes.push_back(rng.chance(50) ? 0xFF : 0x00);
+		s.bytes.push_back((uint8_t)(1 + rng.next() % 0xFE));
+	}
+	return s;
+}
+
+static ByteStream synthWhitestar()
+{
+	ByteStream s{ "synthetic WS", ALTSOUND_HARDWARE_GEN_WS, {} };
+	Lcg rng(0x575);
+	for (size_t i = 0; i < SYNTH_COMMANDS; ++i) {
+		if (rng.chance(5)) // volume: FE 10..2F
+			s.bytes.insert(s.bytes.end(), { 0xFE, (uint8_t)(0x10 + rng.next() % 0x20) });
+		else if (rng.chance(10)) // 16-bit: FC..FF xx
+			s.bytes.insert(s.bytes.end(), { (uint8_t)(0xFC | (rng.next() & 3)), rng.byte() });
+		else
+			s.bytes.insert(s.bytes.end(), { 0x00, (uint8_t)(rng.next() % 0xFC) });
+	}
+	return s;
+}
+
+static ByteStream synthGts80()
+{
+	ByteStream s{ "synthetic GTS80", ALTSOUND_HARDWARE_GEN_GTS80, {} };
+	Lcg rng(0x680);
+	for (size_t i = 0; i < SYNTH_COMMANDS; ++i) {
+		// the board clocks 0x00 between commands
+		s.bytes.push_back(rng.chance(70) ? 0x00 : rng.byte());
+	}
+	return s;
+}
+
+// ---------------------------------------------------------------------------
+// Reads a recorded command log.  Binary logs hold the bytes the ROM sent;
+// the combined 16-bit commands of text logs are expanded back into bytes
+// ---------------------------------------------------------------------------
+
+static bool loadCmdlog(const string& path, ByteStream& s)
+{
+	AltsoundCmdLog log;
+	if (!log.load(path)) {
+		fprintf(stderr, "Unable to read %s\n", path.c_str());
+		return false;
+	}
+
+	s.name = path;
+	s.gen = log.initialHardwareGen();
+
+	for (const AltsoundCmdLogEntry& entry : log.entries) {
+		if (entry.type == AltsoundCmdLogEntry::Type::Byte)
+			s.bytes.push_back((uint8_t)entry.value);
+	}
+	return !s.bytes.empty();
+}
+
+// ---------------------------------------------------------------------------
+// Decoder throughput
+// ---------------------------------------------------------------------------
+
+// keeps the decoded commands observable so the loop is not optimized away
+static volatile unsigned int g_sink;
+
+static void benchDecoder(const ByteStream& s)
+{
+	using clock = std::chrono::steady_clock;
+
+	std::unique_ptr<AltsoundCmdDecoder> decoder = AltsoundCmdDecoder::create(s.gen);
+
+	// bytes arrive 1ms apart, so no inter-byte timeouts trigger
+	uint64_t time_ns = 1;
+	size_t complete = 0;
+	size_t filtered = 0;
+
+	auto run = [&]() {
+		for (const uint8_t b : s.bytes) {
+			unsigned int cmd;
+			time_ns += 1000000;
+			switch (decoder->decode(b, time_ns, nullptr, cmd)) {
+				case AltsoundCmdDecoder::Result::Complete:
+					++complete;
+					g_sink = cmd;
+					decoder->postprocess(cmd, nullptr);
+					break;
+				case AltsoundCmdDecoder::Result::Filtered:
+					++filtered;
+					break;
+				default:
+					break;
+			}
+		}
+	};
+
+	run(); // warm-up
+
+	size_t passes = 0;
+	complete = filtered = 0;
+	const auto start = clock::now();
+	double elapsed = 0.0;
+	do {
+		run();
+		++passes;
+		elapsed = std::chrono::duration<double>(clock::now() - start).count();
+	} while (elapsed < 0.25);
+
+	const double bytes = (double)s.bytes.size() * passes;
+	printf("%-28s %-36s %9zu bytes  %7.2f ns/byte  %8.1f MB/s  %6.1f%% complete  %6.1f%% filtered\n",
+	       s.name.c_str(), decoder->getName(), s.bytes.size(), elapsed * 1e9 / bytes,
+	       bytes / elapsed / 1e6, 100.0 * complete / bytes, 100.0 * filtered / bytes);
+	record("decode/" + s.name, elapsed * 1e9 / bytes, "ns/byte");
+}
+
+// ---------------------------------------------------------------------------
+// Sample packages
+// ---------------------------------------------------------------------------
+
+namespace fs = std::filesystem;
+
+struct WavFile {
+	const char* name;
+	uint32_t frames;
+};
+
+// Writes a silent 16-bit stereo WAV
+static bool writeWav(const fs::path& path, uint32_t frames, uint32_t rate = 44100)
+{
+	std::ofstream out(path, std::ios::binary);
+	if (!out.is_open())
+		return false;
+
+	auto u32 = [&](uint32_t v) { out.write(reinterpret_cast<const char*>(&v), 4); };
+	auto u16 = [&](uint16_t v) { out.write(reinterpret_cast<const char*>(&v), 2); };
+
+	const uint32_t data_size = frames * 4;
+	out.write("RIFF", 4); u32(36 + data_size);
+	out.write("WAVEfmt ", 8); u32(16); u16(1); u16(2); u32(rate); u32(rate * 4); u16(4); u16(16);
+	out.write("data", 4); u32(data_size);
+	const std::vector<char> silence(data_size, 0);
+	out.write(silence.data(), silence.size());
+	return out.good();
+}
+
+// Creates <root>/altsound/<game> with the CSV rows and the WAV files they
+// reference.  The library creates the altsound.ini on the first init
+static bool createPackage(const fs::path& root, const string& game, bool gsound,
+                          const std::vector<string>& rows, std::initializer_list<WavFile> wavs)
+{
+	const fs::path dir = root / "altsound" / game;
+	std::error_code ec;
+	fs::create_directories(dir, ec);
+	if (ec) {
+		fprintf(stderr, "Unable to create sample package in %s\n", dir.string().c_str());
+		return false;
+	}
+
+	std::ofstream csv(dir / (gsound ? "g-sound.csv" : "altsound.csv"));
+	csv << (gsound ? "ID,TYPE,GAIN,DUCKING_PROFILE,FNAME\n"
+	               : "ID,CHANNEL,DUCK,GAIN,LOOP,STOP,NAME,FNAME,GROUP,SHAKER,SERIAL,PRELOAD,STOPCMD\n");
+	for (const string& row : rows)
+		csv << row << '\n';
+
+	bool success = csv.good();
+	for (const WavFile& wav : wavs)
+		success = success && writeWav(dir / wav.name, wav.frames);
+
+	if (!success)
+		fprintf(stderr, "Unable to write sample package in %s\n", dir.string().c_str());
+	return success;
+}
+
+static bool openPackage(const fs::path& root, const string& game)
+{
+	if (!AltSoundInit(root.string(), game)) {
+		fprintf(stderr, "AltSoundInit failed for %s\n", game.c_str());
+		return false;
+	}
+	AltSoundSetHardwareGen(ALTSOUND_HARDWARE_GEN_WPCDCS);
+	return true;
+}
+
+static string hexId(unsigned int id)
+{
+	char buf[8];
+	snprintf(buf, sizeof(buf), "0x%04X", id);
+	return buf;
+}
+
+// Average cost of one AltSoundProcessCommand call.  Commands are two DCS
+// bytes; only the second one reaches handleCmd
+static double timeCommands(const std::vector<unsigned int>& cmds)
+{
+	using clock = std::chrono::steady_clock;
+
+	const auto start = clock::now();
+	for (const unsigned int cmd : cmds) {
+		AltSoundProcessCommand(cmd >> 8, 0);
+		AltSoundProcessCommand(cmd & 0xFF, 0);
+	}
+	return std::chrono::duration<double>(clock::now() - start).count() * 1e9 / cmds.size();
+}
+
+static uint32_t activeVoices()
+{
+	AltSoundStats stats;
+	AltSoundGetStats(&stats);
+
+	uint32_t voices = 0;
+	for (const uint32_t v : stats.voices)
+		voices += v;
+	return voices;
+}
+
+// commands above every table ID; none of them has a sample
+static std::vector<unsigned int> unmatchedCommands()
+{
+	std::vector<unsigned int> cmds;
+	for (unsigned int i = 0; i < 2000; ++i)
+		cmds.push_back(0xF000 + i % 0x100);
+	return cmds;
+}
+
+// ---------------------------------------------------------------------------
+// Sample lookup over table sizes
+// ---------------------------------------------------------------------------
+
+static bool benchSampleLookup(const fs::path& root)
+{
+	static const size_t sizes[] = { 100, 1000, 10000, 50000 };
+	const std::vector<unsigned int> misses = unmatchedCommands();
+
+	printf("\nSample lookup (unmatched commands scan the whole table)\n");
+	for (const bool gsound : { false, true }) {
+		const char* format = gsound ? "gsound" : "altsound";
+
+		for (const size_t n : sizes) {
+			std::vector<string> rows;
+			for (size_t i = 0; i < n; ++i) {
+				rows.push_back(gsound ? hexId((unsigned int)i + 1) + ",sfx,80,0,sfx.wav"
+				                      : hexId((unsigned int)i + 1) + ",,80,80,0,0,sfx,sfx.wav");
+			}
+
+			const string game = string("bench_lookup_") + format + '_' + std::to_string(n);
+			if (!createPackage(root, game, gsound, rows, { { "sfx.wav", 4410 } }) || !openPackage(root, game))
+				return false;
+
+			timeCommands(misses); // warm-up
+			const double ns = timeCommands(misses);
+			AltSoundShutdown();
+
+			printf("%-8s %6zu samples  %10.0f ns/cmd\n", format, n, ns);
+			record(string("lookup/") + format + '/' + std::to_string(n), ns, "ns/cmd");
+		}
+	}
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+// Command handling end to end, per processor
+// ---------------------------------------------------------------------------
+
+static bool benchProcessors(const fs::path& root)
+{
+	const std::vector<unsigned int> misses = unmatchedCommands();
+
+	printf("\nCommand handling per processor\n");
+	for (const bool gsound : { false, true }) {
+		const char* format = gsound ? "gsound" : "altsound";
+
+		std::vector<string> rows;
+		if (gsound) {
+			rows = { "0x0001,music,80,1,music.wav", "0x0002,callout,80,1,callout.wav",
+			         "0x0003,sfx,80,1,sfx.wav", "0x0004,solo,80,1,callout.wav",
+			         "0x0005,overlay,80,1,sfx.wav" };
+		}
+		else {
+			rows = { "0x0001,0,100,80,0,0,music,music.wav", "0x0002,1,50,80,0,0,jingle,callout.wav",
+			         "0x0003,,80,80,0,0,sfx,sfx.wav" };
+		}
+
+		const string game = string("bench_") + format;
+		if (!createPackage(root, game, gsound, rows,
+		                   { { "music.wav", 44100 }, { "callout.wav", 22050 }, { "sfx.wav", 4410 } })
+		    || !openPackage(root, game))
+			return false;
+
+		const unsigned int num_ids = gsound ? 5 : 3;
+		std::vector<unsigned int> matched;
+		for (unsigned int i = 0; i < 2000; ++i)
+			matched.push_back(1 + i % num_ids);
+
+		timeCommands(matched); // warm-up
+		const double matched_ns = timeCommands(matched);
+		const double unmatched_ns = timeCommands(misses);
+		AltSoundShutdown();
+
+		printf("%-8s %10.0f ns/cmd with sample  %8.0f ns/cmd without sample\n", format, matched_ns, unmatched_ns);
+		record(string("command/") + format + "/matched", matched_ns, "ns/cmd");
+		record(string("command/") + format + "/unmatched", unmatched_ns, "ns/cmd");
+	}
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+// Stream create/free per file format
+// ---------------------------------------------------------------------------
+
+static double timeStreamCreate(const string& path)
+{
+	using clock = std::chrono::steady_clock;
+	const int passes = 200;
+
+	// warm-up, and checks the file can be opened at all
+	const unsigned int probe = MiniAudio_StreamCreateFile(false, path, 0, false);
+	if (probe == MINIAUDIO_NO_STREAM)
+		return -1.0;
+	MiniAudio_StreamFree(probe);
+
+	const auto start = clock::now();
+	for (int i = 0; i < passes; ++i)
+		MiniAudio_StreamFree(MiniAudio_StreamCreateFile(false, path, 0, false));
+	return std::chrono::duration<double>(clock::now() - start).count() * 1e9 / passes;
+}
+
+static bool benchStreams(const fs::path& root, const string& ogg_path)
+{
+	if (!openPackage(root, "bench_altsound"))
+		return false;
+
+	printf("\nStream create/free\n");
+
+	const fs::path dir = root / "altsound" / "bench_altsound";
+	const struct {
+		const char* format;
+		string path;
+	} files[] = {
+		{ "wav", (dir / "music.wav").string() },
+		{ "ogg", ogg_path }
+	};
+
+	bool success = true;
+	for (const auto& f : files) {
+		if (f.path.empty()) {
+			printf("%-4s skipped (pass an OGG file with --ogg)\n", f.format);
+			continue;
+		}
+
+		const double ns = timeStreamCreate(f.path);
+		if (ns < 0.0) {
+			fprintf(stderr, "Unable to create a stream from %s\n", f.path.c_str());
+			success = false;
+			continue;
+		}
+
+		printf("%-4s %10.1f us  %s\n", f.format, ns / 1000.0, f.path.c_str());
+		record(string("stream/create_free/") + f.format, ns, "ns");
+	}
+
+	AltSoundShutdown();
+	return success;
+}
+
+// ---------------------------------------------------------------------------
+// G-Sound behavior processing over the number of active streams
+// ---------------------------------------------------------------------------
+
+static bool benchGSoundBehaviors(const fs::path& root)
+{
+	static const unsigned int stream_counts[] = { 0, 4, 8, 12 };
+
+	// long sfx stay active for the whole measurement; every callout ducks
+	// them and replaces the previous callout
+	std::vector<string> rows = { "0x0001,music,80,1,long.wav", "0x0002,callout,80,1,callout.wav" };
+	for (unsigned int i = 0; i < 12; ++i)
+		rows.push_back(hexId(0x0100 + i) + ",sfx,80,1,long.wav");
+
+	if (!createPackage(root, "bench_gsound_behaviors", true, rows,
+	                   { { "long.wav", 10 * 44100 }, { "callout.wav", 22050 } }))
+		return false;
+
+	const std::vector<unsigned int> callouts(500, 0x0002);
+
+	printf("\nG-Sound behavior processing (callout with N active sfx streams and music)\n");
+	for (const unsigned int n : stream_counts) {
+		if (!openPackage(root, "bench_gsound_behaviors"))
+			return false;
+
+		std::vector<unsigned int> setup = { 0x0001 };
+		for (unsigned int i = 0; i < n; ++i)
+			setup.push_back(0x0100 + i);
+		timeCommands(setup);
+
+		timeCommands({ callouts.begin(), callouts.begin() + 50 }); // warm-up
+		const double ns = timeCommands(callouts);
+		const uint32_t voices = activeVoices();
+		AltSoundShutdown();
+
+		printf("%2u sfx  %10.0f ns/callout  (%u voices active)\n", n, ns, voices);
+		record("gsound_behaviors/" + std::to_string(n), ns, "ns/cmd");
+	}
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+// Resampling cost per resampler setting
+// ---------------------------------------------------------------------------
+
+// Decoding time of one output frame in the fastest of several passes, or a
+// negative value on error.  The file is decoded from memory so only the
+// conversion is measured
+static double timeDecode(const std::vector<char>& file, altsound_resampler algorithm, ma_uint32 order)
+{
+	using clock = std::chrono::steady_clock;
+	const int passes = 30;
+	const ma_uint64 chunk = 512;
+
+	ma_decoder_config config = altsound_ma_decoder_config_init(ma_format_f32, 2, 44100);
+	altsound_ma_decoder_config_set_resampler(&config, algorithm, order);
+
+	std::vector<float> out(chunk * 2);
+	double best_ns = -1.0;
+	for (int pass = 0; pass < passes; ++pass) {
+		ma_decoder decoder;
+		if (altsound_ma_decoder_init_memory(file.data(), file.size(), &config, &decoder) != MA_SUCCESS)
+			return -1.0;
+
+		uint64_t frames = 0;
+		ma_uint64 read = 0;
+		const auto start = clock::now();
+		while (altsound_ma_decoder_read_pcm_frames(&decoder, out.data(), chunk, &read) == MA_SUCCESS && read > 0)
+			frames += read;
+		const double ns = std::chrono::duration<double>(clock::now() - start).count() * 1e9 / std::max<uint64_t>(frames, 1);
+		altsound_ma_decoder_uninit(&decoder);
+
+		if (best_ns < 0.0 || ns < best_ns)
+			best_ns = ns;
+	}
+	return best_ns;
+}
+
+static bool benchResampling(const fs::path& root)
+{
+	const struct {
+		const char* name;
+		uint32_t rate;
+	} sources[] = { { "48000", 48000 }, { "22050", 22050 } };
+
+	const struct {
+		const char* name;
+		altsound_resampler algorithm;
+		ma_uint32 order;
+	} settings[] = {
+		{ "linear/0", altsound_resampler_linear, 0 },
+		{ "linear/2", altsound_resampler_linear, 2 },
+		{ "linear/4", altsound_resampler_linear, 4 },
+		{ "linear/8", altsound_resampler_linear, 8 },
+		{ "cubic/0", altsound_resampler_cubic, 0 },
+		{ "cubic/2", altsound_resampler_cubic, 2 },
+		{ "cubic/4", altsound_resampler_cubic, 4 },
+		{ "cubic/8", altsound_resampler_cubic, 8 }
+	};
+
+	const fs::path dir = root / "resample";
+	std::error_code ec;
+	fs::create_directories(dir, ec);
+
+	auto load = [&](uint32_t rate, std::vector<char>& file) {
+		const fs::path path = dir / ("sample" + std::to_string(rate) + ".wav");
+		if (!writeWav(path, 5 * rate, rate)) {
+			fprintf(stderr, "Unable to write %s\n", path.string().c_str());
+			return false;
+		}
+		std::ifstream in(path, std::ios::binary);
+		file.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+		return !file.empty();
+	};
+
+	std::vector<char> file;
+	if (!load(44100, file))
+		return false;
+	const double base_ns = timeDecode(file, altsound_resampler_linear, 0);
+	if (base_ns < 0.0) {
+		fprintf(stderr, "Unable to decode the resampling benchmark sample\n");
+		return false;
+	}
+
+	printf("\nResampling to 44100 Hz stereo (not resampled: %.2f ns/frame)\n", base_ns);
+	record("resample/none", base_ns, "ns/frame");
+
+	for (const auto& source : sources) {
+		if (!load(source.rate, file))
+			return false;
+
+		for (const auto& setting : settings) {
+			const double ns = timeDecode(file, setting.algorithm, setting.order);
+			if (ns < 0.0) {
+				fprintf(stderr, "Unable to decode the resampling benchmark sample\n");
+				return false;
+			}
+
+			// resampling only, in real time
+			const double cost_ns = std::max(ns - base_ns, 0.0);
+			printf("%s %-9s %7.2f ns/frame  resampling %7.2f ns/frame  %6.3f%% CPU per voice\n", source.name,
+			       setting.name, ns, cost_ns, cost_ns * 44100.0 / 1e9 * 100.0);
+			record(string("resample/") + source.name + '/' + setting.name, ns, "ns/frame");
+		}
+	}
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+// Output format conversion cost
+// ---------------------------------------------------------------------------
+
+static void benchOutputFormats()
+{
+	using clock = std::chrono::steady_clock;
+	const size_t frames = 256;
+	const int passes = 20000;
+
+	const struct {
+		const char* name;
+		ALTSOUND_SAMPLE_FORMAT format;
+		bool planar;
+		bool dither;
+	} formats[] = {
+		{ "f32/planar", ALTSOUND_SAMPLE_FORMAT_F32, true, false },
+		{ "s16", ALTSOUND_SAMPLE_FORMAT_S16, false, false },
+		{ "s16/dither", ALTSOUND_SAMPLE_FORMAT_S16, false, true },
+		{ "s16/planar", ALTSOUND_SAMPLE_FORMAT_S16, true, false },
+		{ "s32", ALTSOUND_SAMPLE_FORMAT_S32, false, false },
+		{ "s32/planar", ALTSOUND_SAMPLE_FORMAT_S32, true, false }
+	};
+
+	std::vector<float> in(frames * 2);
+	for (size_t i = 0; i < in.size(); ++i)
+		in[i] = (float)((i * 7919) % 2001) / 1000.0f - 1.0f;
+	std::vector<uint8_t> out(frames * 2 * sizeof(float));
+
+	printf("\nOutput format conversion, stereo (%s kernels)\n", AltsoundOutputFormat::kernelName());
+	for (const auto& f : formats) {
+		AltsoundOutputFormat converter;
+		converter.init(f.format, f.planar, f.dither, 2, (uint32_t)frames);
+
+		double best_ns = -1.0;
+		for (int round = 0; round < 5; ++round) {
+			const auto start = clock::now();
+			for (int pass = 0; pass < passes; ++pass)
+				converter.convert(in.data(), frames, out.data());
+			const double ns = std::chrono::duration<double>(clock::now() - start).count() * 1e9 / ((double)passes * frames);
+			if (best_ns < 0.0 || ns < best_ns)
+				best_ns = ns;
+		}
+		g_sink = out[frames];
+
+		printf("%-11s %6.3f ns/frame\n", f.name, best_ns);
+		record(string("output/") + f.name, best_ns, "ns/frame");
+	}
+}
+
+// ---------------------------------------------------------------------------
+// Mixing cost per voice count
+// ---------------------------------------------------------------------------
+
+static bool benchMixing(const fs::path& root)
+{
+	static const unsigned int voice_counts[] = { 0, 1, 2, 4, 8, 16 };
+
+	std::vector<string> rows;
+	for (unsigned int i = 0; i < 16; ++i)
+		rows.push_back(hexId(0x0100 + i) + ",,100,80,100,0,sfx,long.wav");
+
+	if (!createPackage(root, "bench_mix", false, rows, { { "long.wav", 10 * 44100 } })
+	    || !openPackage(root, "bench_mix"))
+		return false;
+
+	printf("\nMixing (engine period of the null device, measured in real time)\n");
+	unsigned int started = 0;
+	for (const unsigned int n : voice_counts) {
+		std::vector<unsigned int> cmds;
+		for (; started < n; ++started)
+			cmds.push_back(0x0100 + started);
+		if (!cmds.empty())
+			timeCommands(cmds);
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		AltSoundResetStats();
+		std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+		AltSoundStats stats;
+		AltSoundGetStats(&stats);
+		const double mean_ns = stats.mix.count ? (double)stats.mix.total_ns / stats.mix.count : 0.0;
+		const uint64_t p99_ns = AltSoundHistogramPercentile(&stats.mix, 99.0);
+
+		printf("%2u voices (%2u active)  %8.1f us/period  p99 %8.1f us  load %5.2f%%\n", n, activeVoices(),
+		       mean_ns / 1000.0, p99_ns / 1000.0, stats.mix_load * 100.0f);
+		record("mix/" + std::to_string(n), mean_ns, "ns/period");
+	}
+
+	AltSoundShutdown();
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+// Command handling per log level
+// ---------------------------------------------------------------------------
+
+static bool benchLogLevels(const fs::path& root)
+{
+	if (!openPackage(root, "bench_altsound"))
+		return false;
+
+	std::vector<unsigned int> matched;
+	for (unsigned int i = 0; i < 2000; ++i)
+		matched.push_back(1 + i % 3);
+	const std::vector<unsigned int> unmatched = unmatchedCommands();
+
+	static const struct {
+		ALTSOUND_LOG_LEVEL level;
+		const char* name;
+	} levels[] = {
+		{ ALTSOUND_LOG_LEVEL_NONE,    "NONE" },
+		{ ALTSOUND_LOG_LEVEL_INFO,    "INFO" },
+		{ ALTSOUND_LOG_LEVEL_ERROR,   "ERROR" },
+		{ ALTSOUND_LOG_LEVEL_WARNING, "WARNING" },
+		{ ALTSOUND_LOG_LEVEL_DEBUG,   "DEBUG" }
+	};
+
+	printf("\nCommand handling per log level (compiled up to level %d)\n", ALTSOUND_MAX_LOG_LEVEL);
+	for (const auto& l : levels) {
+		AltSoundSetLogger(root.string(), l.level, false);
+		timeCommands(matched); // warm-up
+
+		const double matched_ns = timeCommands(matched);
+		const double unmatched_ns = timeCommands(unmatched);
+		printf("%-8s %10.0f ns/cmd with sample  %8.0f ns/cmd without sample\n",
+		       l.name, matched_ns, unmatched_ns);
+		record(string("log_level/") + l.name + "/matched", matched_ns, "ns/cmd");
+		record(string("log_level/") + l.name + "/unmatched", unmatched_ns, "ns/cmd");
+	}
+
+	AltSoundSetLogger("", ALTSOUND_LOG_LEVEL_NONE, false);
+	AltSoundShutdown();
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+// JSON results and baseline comparison
+// ---------------------------------------------------------------------------
+
+static void writeJsonString(FILE* out, const string& str)
+{
+	fputc('"', out);
+	for (const char c : str) {
+		if (c == '"' || c == '\\')
+			fputc('\\', out);
+		fputc(c, out);
+	}
+	fputc('"', out);
+}
+
+static bool writeJson(const string& path)
+{
+	FILE* out = fopen(path.c_str(), "w");
+	if (!out) {
+		fprintf(stderr, "Unable to create %s\n", path.c_str());
+		return false;
+	}
+
+	fprintf(out, "{\n  \"version\": \"%d.%d.%d\",\n  \"max_log_level\": %d,\n  \"results\": [",
+	        ALTSOUND_VERSION_MAJOR, ALTSOUND_VERSION_MINOR, ALTSOUND_VERSION_PATCH, ALTSOUND_MAX_LOG_LEVEL);
+	for (size_t i = 0; i < g_results.size(); ++i) {
+		fprintf(out, "%s\n    { \"name\": ", i ? "," : "");
+		writeJsonString(out, g_results[i].name);
+		fprintf(out, ", \"value\": %.3f, \"unit\": ", g_results[i].value);
+		writeJsonString(out, g_results[i].unit);
+		fprintf(out, " }");
+	}
+	fprintf(out, "\n  ]\n}\n");
+
+	const bool success = fclose(out) == 0;
+	if (success)
+		printf("\nResults written to %s\n", path.c_str());
+	return success;
+}
+
+// Reads the name/value pairs of a file written by writeJson()
+static bool readBaseline(const string& path, std::map<string, double>& baseline)
+{
+	std::ifstream in(path);
+	if (!in.is_open()) {
+		fprintf(stderr, "Unable to open baseline %s\n", path.c_str());
+		return false;
+	}
+	const string json((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+	size_t pos = 0;
+	while ((pos = json.find("\"name\"", pos)) != string::npos) {
+		size_t quote = json.find('"', json.find(':', pos) + 1);
+		if (quote == string::npos)
+			break;
+
+		string name;
+		size_t i = quote + 1;
+		for (; i < json.size() && json[i] != '"'; ++i) {
+			if (json[i] == '\\' && i + 1 < json.size())
+				++i;
+			name += json[i];
+		}
+
+		pos = json.find("\"value\"", i);
+		if (pos == string::npos)
+			break;
+		baseline[name] = std::strtod(json.c_str() + json.find(':', pos) + 1, nullptr);
+	}
+
+	if (baseline.empty()) {
+		fprintf(stderr, "No results in baseline %s\n", path.c_str());
+		return false;
+	}
+	return true;
+}
+
+// Returns the number of results slower than the baseline by more than
+// threshold_pct, or -1 if the baseline cannot be read
+static int compareBaseline(const string& path, double threshold_pct)
+{
+	std::map<string, double> baseline;
+	if (!readBaseline(path, baseline))
+		return -1;
+
+	printf("\nComparison with %s (regression above +%.1f%%)\n", path.c_str(), threshold_pct);
+
+	int regressions = 0;
+	for (const BenchResult& r : g_results) {
+		const auto it = baseline.find(r.name);
+		if (it == baseline.end()) {
+			printf("%-36s %12.1f %-10s (not in baseline)\n", r.name.c_str(), r.value, r.unit.c_str());
+			continue;
+		}
+
+		const double change_pct = it->second > 0.0 ? (r.value - it->second) * 100.0 / it->second : 0.0;
+		const bool regressed = change_pct > threshold_pct;
+		regressions += regressed;
+
+		printf("%-36s %12.1f %-10s %12.1f  %+7.1f%%%s\n", r.name.c_str(), r.value, r.unit.c_str(),
+		       it->second, change_pct, regressed ? "  REGRESSION" : "");
+	}
+
+	printf("%d regression(s)\n", regressions);
+	return regressions;
+}
+
+// ---------------------------------------------------------------------------
+
+int main(int argc, const char* argv[])
+{
+	AltSoundSetLogger("", ALTSOUND_LOG_LEVEL_NONE, false);
+
+	string json_path;
+	string baseline_path;
+	string ogg_path;
+	double threshold_pct = 10.0;
+
+	std::vector<ByteStream> streams;
+	for (int i = 1; i < argc; ++i) {
+		const string arg = argv[i];
+		const bool has_value = i + 1 < argc;
+
+		if (arg == "--json" && has_value)
+			json_path = argv[++i];
+		else if (arg == "--baseline" && has_value)
+			baseline_path = argv[++i];
+		else if (arg == "--threshold" && has_value)
+			threshold_pct = std::atof(argv[++i]);
+		else if (arg == "--ogg" && has_value)
+			ogg_path = argv[++i];
+		else if (arg.rfind("--", 0) == 0) {
+			printf("Usage: %s [--json <file>] [--baseline <file>] [--threshold <pct>] [--ogg <file>] [<cmdlog> ...]\n",
+			       argv[0]);
+			return 1;
+		}
+		else {
+			ByteStream s;
+			if (!loadCmdlog(arg, s))
+				return 1;
+			streams.push_back(std::move(s));
+		}
+	}
+
+	if (streams.empty()) {
+		streams.push_back(synthDcs());
+		streams.push_back(synthWpc());
+		streams.push_back(synthS11());
+		streams.push_back(synthDe());
+		streams.push_back(synthWhitestar());
+		streams.push_back(synthGts80());
+	}
+
+	printf("Decoder throughput\n");
+	for (const ByteStream& s : streams)
+		benchDecoder(s);
+
+	const fs::path root = fs::temp_directory_path() / "altsound_bench";
+	if (!benchSampleLookup(root) || !benchProcessors(root) || !benchStreams(root, ogg_path)
+	    || !benchGSoundBehaviors(root) || !benchResampling(root))
+		return 1;
+
+	benchOutputFormats();
+
+	if (!benchMixing(root) || !benchLogLevels(root))
+		return 1;
+
+	if (!json_path.empty() && !writeJson(json_path))
+		return 1;
+
+	if (!baseline_path.empty()) {
+		const int regressions = compareBaseline(baseline_path, threshold_pct);
+		if (regressions < 0)
+			return 1;
+		return regressions > 0 ? 2 : 0;
+	}
+	return 0;
+}
@@ -0,0 +1,76 @@
+// ---------------------------------------------------------------------------
+// cmdlog.cpp
+//
+// Converts sound command logs between the binary cmdlog.bin written by
+// record_sound_cmds and the cmdlog.txt text format replayed by
+// altsound_test.  The direction follows the input: a binary log is written
+// as text, a text log as binary.  Without an output file, the entries of
+// the log are listed instead.
+//
+// Text logs hold the commands assembled by the decoder, with millisecond
+// timing.  Converting a binary log to text drops the filtered bytes
+// (volume and control sequences) and the attenuation.
+//
+// Usage: altsound_cmdlog <input> [<output>]
+// ---------------------------------------------------------------------------
+// license:BSD-3-Clause
+// copyright-holders: Dave Roscoe
+// ---------------------------------------------------------------------------
+
+#include "altsound_cmdlog.hpp"
+
+#include <cstdio>
+#include <string>
+
+using std::string;
+
+// ---------------------------------------------------------------------------
+
+static void listEntries(const AltsoundCmdLog& log)
+{
+	printf("altsound_path: %s\n", log.altsound_path.c_str());
+	printf("hardware_gen: 0x%013llx\n", (unsigned long long)log.hardware_gen);
+
+	for (const AltsoundCmdLogEntry& entry : log.entries) {
+		const double ms = (double)entry.time_ns / 1000000.0;
+		if (entry.type == AltsoundCmdLogEntry::Type::HardwareGen)
+			printf("%12.3f  hardware_gen 0x%013llx\n", ms, (unsigned long long)entry.value);
+		else
+			printf("%12.3f  0x%02llx  %d dB\n", ms, (unsigned long long)entry.value, entry.attenuation);
+	}
+}
+
+// ---------------------------------------------------------------------------
+
+int main(int argc, const char* argv[])
+{
+	if (argc < 2 || argc > 3) {
+		printf("Usage: %s <input> [<output>]\n", argv[0]);
+		printf("Converts cmdlog.bin to cmdlog.txt and back; lists the log without <output>\n");
+		return 1;
+	}
+
+	const string input = argv[1];
+	const bool binary = AltsoundCmdLog::isBinary(input);
+
+	AltsoundCmdLog log;
+	if (!log.load(input)) {
+		fprintf(stderr, "Unable to read %s\n", input.c_str());
+		return 1;
+	}
+
+	if (argc == 2) {
+		listEntries(log);
+		return 0;
+	}
+
+	const string output = argv[2];
+	if (!(binary ? log.saveText(output) : log.saveBinary(output))) {
+		fprintf(stderr, "Unable to write %s\n", output.c_str());
+		return 1;
+	}
+
+	printf("%s -> %s (%zu entries, %s)\n", input.c_str(), output.c_str(), log.entries.size(),
+	       binary ? "binary to text" : "text to binary");
+	return 0;
+}
@@ -163,14 +163,16 @@ bool GSoundCsvParser::parse(std::vector<GSoundSampleInfo>& samples_out)
 
 			samples_out.push_back(entry);
 
-			std::ostringstream debug_stream;
-			debug_stream << "ID = 0x" << std::setfill('0') << std::setw(4) << std::hex << entry.id << std::dec
-				<< ", TYPE = " << entry.type
-				<< ", GAIN = " << std::fixed << std::setprecision(2) << entry.gain
-				<< ", DUCK_PRF = " << entry.ducking_profile
-				<< ", FNAME = " << entry.fname;
-
-			ALT_DEBUG(0, debug_stream.str().c_str());
+			if (ALT_LOG_ENABLED(Debug)) {
+				std::ostringstream debug_stream;
+				debug_stream << "ID = 0x" << std::setfill('0') << std::setw(4) << std::hex << entry.id << std::dec
+					<< ", TYPE = " << entry.type
+					<< ", GAIN = " << std::fixed << std::setprecision(2) << entry.gain
+					<< ", DUCK_PRF = " << entry.ducking_profile
+					<< ", FNAME = " << entry.fname;
+
+				ALT_DEBUG(0, debug_stream.str().c_str());
+			}
 		}
 	}
 	catch (const std::exception& e) {
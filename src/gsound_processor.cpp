@@ -11,6 +11,10 @@
 #define NOMINMAX
 #include "gsound_processor.hpp"
 #include "gsound_csv_parser.hpp"
+#include "altsound_context.hpp"
+#include "altsound_rt_check.hpp"
+#include "altsound_stats.hpp"
+#include "altsound_trace.hpp"
 #include "miniaudio_bass_compat.hpp"
 
 #include <map>
@@ -18,40 +22,10 @@
 
 extern AltsoundLogger alog;
 
-// DAR@20230721
-// This is necessary because miniaudio callback streams run on a separate
-// thread from the main application, and both need to access/modify
-// common memory
-//
-// thread synchonization mutex.
-extern std::mutex io_mutex;
-
-// Reference to the global channel stream array
-extern StreamArray channel_stream;
-
 // ----------------------------------------------------------------------------
 // Behavior Management Support Globals
 // ----------------------------------------------------------------------------
 
-constexpr unsigned int UNSET_IDX = std::numeric_limits<unsigned int>::max();
-
-// NOTE:
-// SFX streams don't require tracking since multiple can play simultaneously.
-// Other than adjusting ducking, they have no other impacts on active streams
-//
-// Single-play stream tracking
-static unsigned int cur_mus_stream_idx = UNSET_IDX;
-static unsigned int cur_callout_stream_idx = UNSET_IDX;
-static unsigned int cur_solo_stream_idx = UNSET_IDX;
-static unsigned int cur_overlay_stream_idx = UNSET_IDX;
-
-std::map<AltsoundSampleType, unsigned int*> tracked_stream_idx_map = {
-	{AltsoundSampleType::MUSIC, &cur_mus_stream_idx},
-	{AltsoundSampleType::CALLOUT, &cur_callout_stream_idx},
-	{AltsoundSampleType::SOLO, &cur_solo_stream_idx},
-	{AltsoundSampleType::OVERLAY, &cur_overlay_stream_idx}
-};
-
 // DAR@20230628
 // Because the stream.stream_type enumeration values may not match the bitset
 // values below, we need to map the AltsoundSampleType constants to the
@@ -59,8 +33,9 @@ std::map<AltsoundSampleType, unsigned int*> tracked_stream_idx_map = {
 // correct index into the bookkeeping arrays to manage aggregate ducking
 // and pausing behaviors.
 //
-// Map stream sample types to configuration bitset values
-static std::unordered_map<AltsoundSampleType, int> streamTypeToIndex = {
+// Map stream sample types to configuration bitset values.  Shared by every
+// context, so it is read-only: look up with find() or at(), which never insert
+static const std::unordered_map<AltsoundSampleType, int> streamTypeToIndex = {
 	{AltsoundSampleType::MUSIC,   0},
 	{AltsoundSampleType::CALLOUT, 1},
 	{AltsoundSampleType::SFX,     2},
@@ -68,95 +43,6 @@ static std::unordered_map<AltsoundSampleType, int> streamTypeToIndex = {
 	{AltsoundSampleType::OVERLAY, 4}
 };
 
-// DAR@20230719
-// The maps below contain the ducking and pausing behavior impacts of sample
-// types on other sample types.  For example, the music_duck_vol map contains
-// the impacts on MUSIC volume from the behaviors of the other sample types.
-// Similarly, the music_paused map contains the paused status of MUSIC
-// streams based on the behavior of the other streams.
-//
-// The map key is the stream ID (HSTREAM) of the stream that is setting the
-// duck value.  This allows the correct entry to be removed when the
-// affecting stream ends
-//
-// Streams can have overlapping impacts on other streams.  When an affecting
-// stream ends, it can't be assumed its safe to remove the behavior impact from
-// the affected sample type.  The map key ensures ALL the behavior impacts are
-// captured for each sample type.  Only when the map is cleared, can the impact
-// be removed
-//
-// globals to manage stream ducking
-std::unordered_map<unsigned int, float> music_duck_vol;
-std::unordered_map<unsigned int, float> callout_duck_vol;
-std::unordered_map<unsigned int, float> sfx_duck_vol;
-std::unordered_map<unsigned int, float> solo_duck_vol;
-std::unordered_map<unsigned int, float> overlay_duck_vol;
-
-// convenience structure for working with ducking maps
-std::unordered_map<AltsoundSampleType, std::unordered_map<unsigned int, float>*> duck_vol_map = {
-	{MUSIC, &music_duck_vol},
-	{CALLOUT, &callout_duck_vol},
-	{SFX, &sfx_duck_vol},
-	{SOLO, &solo_duck_vol},
-	{OVERLAY, &overlay_duck_vol}
-};
-
-// globals to manage stream pausing
-std::unordered_map<unsigned int, bool> music_paused;
-std::unordered_map<unsigned int, bool> callout_paused;
-std::unordered_map<unsigned int, bool> sfx_paused;
-std::unordered_map<unsigned int, bool> solo_paused;
-std::unordered_map<unsigned int, bool> overlay_paused;
-
-// convenience structure for working with paused maps
-std::unordered_map<AltsoundSampleType, std::unordered_map<unsigned int, bool>*> paused_status_map = {
-	{MUSIC, &music_paused},
-	{CALLOUT, &callout_paused},
-	{SFX, &sfx_paused},
-	{SOLO, &solo_paused},
-	{OVERLAY, &overlay_paused}
-};
-
-
-// DAR@20230712
-// A common mixing board function is to set gain levels for individual tracks
-// and then apply a group volume to change volume for a group of tracks. while
-// maintaining relative individual volumes.  For example, if we have 3 MUSIC
-// tracks with 90, 60, 55 gain levels individually, setting the group volume
-// to 90 will duck all MUSIC tracks by 10% while maintaining the volume
-// relationships between the individual tracks.  Each index into the array
-// represents the sample type they apply to.  For example, index 0 is MUSIC
-// group volume.  Index 1 is CALLOUT These values can be set in
-// the configuration file
-//
-// Group volumes for sample types
-std::array<float, NUM_STREAM_TYPES> group_vol = { 1.0f, 1.0f, 1.0f, 1.0f, 1.0f };
-
-// ----------------------------------------------------------------------------
-
-// DAR@20230719
-// Sample type behaviors determine what impacts they will have on other sample
-// types.  For example, music_behavior defines what impacts MUSIC samples have
-// on other non-MUSIC sample types.
-//
-// NOTE: With the exception of STOP, self-impacting behaviors are not supported.
-//
-// external reference to stream behaviors
-extern BehaviorInfo music_behavior;
-extern BehaviorInfo callout_behavior;
-extern BehaviorInfo sfx_behavior;
-extern BehaviorInfo solo_behavior;
-extern BehaviorInfo overlay_behavior;
-
-// convenience structure for working with behaviors
-std::unordered_map<AltsoundSampleType, BehaviorInfo*> behavior_map = {
-	{MUSIC, &music_behavior},
-	{CALLOUT, &callout_behavior},
-	{SFX, &sfx_behavior},
-	{SOLO, &solo_behavior},
-	{OVERLAY, &overlay_behavior}
-};
-
 // ---------------------------------------------------------------------------
 // CTOR/DTOR
 // ---------------------------------------------------------------------------
@@ -165,7 +51,13 @@ GSoundProcessor::GSoundProcessor(const string& _game_name, const string& _vpm_pa
 : AltsoundProcessorBase(_game_name, _vpm_path),
   is_initialized(false),
   is_stable(true), // future use
-  generator(std::random_device()()) // seed random number generator
+  behavior_map({
+	{MUSIC, &context.music_behavior},
+	{CALLOUT, &context.callout_behavior},
+	{SFX, &context.sfx_behavior},
+	{SOLO, &context.solo_behavior},
+	{OVERLAY, &context.overlay_behavior}
+  })
 {
 }
 
@@ -190,7 +82,7 @@ bool GSoundProcessor::handleCmd(const unsigned int cmd_combined_in)
 	ALT_INDENT;
 
 	ALT_DEBUG(1, "Acquiring mutex");
-	std::lock_guard<std::mutex> guard(io_mutex);
+	std::lock_guard<std::recursive_mutex> guard(io_mutex);
 
 	// Pass command to base class for processing
 	AltsoundProcessorBase::handleCmd(cmd_combined_in);
@@ -219,6 +111,7 @@ bool GSoundProcessor::handleCmd(const unsigned int cmd_combined_in)
 	if (skip_count > 0) {
 		--skip_count;
 		AltsoundProcessorBase::setSkipCount(skip_count);
+		AltsoundStats::add(context.stats.skipped);
 		ALT_DEBUG(0, "Sound command skipped, (%d) remaining", skip_count);
 		ALT_DEBUG(0, "END GSoundProcessor::handleCmd()");
 		return true;
@@ -229,6 +122,7 @@ bool GSoundProcessor::handleCmd(const unsigned int cmd_combined_in)
 
 	if (sample_idx == -1) {
 		// No matching command.  Clean up and exit
+		AltsoundStats::add(context.stats.unmatched);
 		ALT_ERROR(1, "FAILED GSoundProcessor::get_sample()", cmd_combined_in);
 
 		ALT_OUTDENT;
@@ -236,6 +130,20 @@ bool GSoundProcessor::handleCmd(const unsigned int cmd_combined_in)
 		return false;
 	}
 
+	if (AltsoundTrace::enabled()) {
+		AltsoundTrace::instant("processor", "sample", { { "cmd", (double)cmd_combined_in } },
+		                       getShortPath(samples[sample_idx].fname).c_str());
+	}
+
+	const AltsoundSampleType sample_type = toSampleType(samples[sample_idx].type);
+
+	// Repeats of a playing sample may be coalesced, restarted or dropped
+	if (!ALT_CALL(admitTrigger(cmd_combined_in, samples[sample_idx].fname, sample_type))) {
+		ALT_OUTDENT;
+		ALT_DEBUG(0, "END GSoundProcessor::handleCmd()");
+		return true;
+	}
+
 	AltsoundStreamInfo* new_stream = new AltsoundStreamInfo();
 
 	// pre-populate stream info
@@ -244,17 +152,16 @@ bool GSoundProcessor::handleCmd(const unsigned int cmd_combined_in)
 	new_stream->loop = samples[sample_idx].loop;
 	new_stream->ducking_profile = samples[sample_idx].ducking_profile;
 
-	const AltsoundSampleType sample_type = toSampleType(samples[sample_idx].type);
-
 	switch (sample_type) {
 	case MUSIC:
 		new_stream->stream_type = MUSIC;
-		if (ALT_CALL(processStream(music_behavior, new_stream))) {
+		if (ALT_CALL(processStream(context.music_behavior, new_stream))) {
 			channel_stream[new_stream->channel_idx] = new_stream;
 			cur_mus_stream_idx = new_stream->channel_idx;
 		}
 		else {
 			ALT_ERROR(1, "FAILED GSoundProcessor::processMusic()");
+			discardStream(new_stream);
 
 			ALT_OUTDENT;
 			ALT_DEBUG(0, "END GSoundProcessor::handleCmd()");
@@ -263,11 +170,12 @@ bool GSoundProcessor::handleCmd(const unsigned int cmd_combined_in)
 		break;
 	case SFX:
 		new_stream->stream_type = SFX;
-		if (ALT_CALL(processStream(sfx_behavior, new_stream))) {
+		if (ALT_CALL(processStream(context.sfx_behavior, new_stream))) {
 			channel_stream[new_stream->channel_idx] = new_stream;
 		}
 		else {
 			ALT_ERROR(1, "FAILED GSoundProcessor::processSfx()");
+			discardStream(new_stream);
 
 			ALT_OUTDENT;
 			ALT_DEBUG(0, "END GSoundProcessor::handleCmd()");
@@ -276,12 +184,13 @@ bool GSoundProcessor::handleCmd(const unsigned int cmd_combined_in)
 		break;
 	case CALLOUT:
 		new_stream->stream_type = CALLOUT;
-		if (ALT_CALL(processStream(callout_behavior, new_stream))) {
+		if (ALT_CALL(processStream(context.callout_behavior, new_stream))) {
 			channel_stream[new_stream->channel_idx] = new_stream;
 			cur_callout_stream_idx = new_stream->channel_idx;
 		}
 		else {
 			ALT_ERROR(1, "FAILED GSoundProcessor::processCallout()");
+			discardStream(new_stream);
 
 			ALT_OUTDENT;
 			ALT_DEBUG(0, "END GSoundProcessor::handleCmd()");
@@ -290,12 +199,13 @@ bool GSoundProcessor::handleCmd(const unsigned int cmd_combined_in)
 		break;
 	case SOLO:
 		new_stream->stream_type = SOLO;
-		if (ALT_CALL(processStream(solo_behavior, new_stream))) {
+		if (ALT_CALL(processStream(context.solo_behavior, new_stream))) {
 			channel_stream[new_stream->channel_idx] = new_stream;
 			cur_solo_stream_idx = new_stream->channel_idx;
 		}
 		else {
 			ALT_ERROR(1,"FAILED GSoundProcessor::processSolo()");
+			discardStream(new_stream);
 
 			ALT_OUTDENT;
 			ALT_DEBUG(0, "END GSoundProcessor::handleCmd()");
@@ -304,12 +214,13 @@ bool GSoundProcessor::handleCmd(const unsigned int cmd_combined_in)
 		break;
 	case OVERLAY:
 		new_stream->stream_type = OVERLAY;
-		if (ALT_CALL(processStream(overlay_behavior, new_stream))) {
+		if (ALT_CALL(processStream(context.overlay_behavior, new_stream))) {
 			channel_stream[new_stream->channel_idx] = new_stream;
 			cur_overlay_stream_idx = new_stream->channel_idx;
 		}
 		else {
 			ALT_ERROR(1, "FAILED GSoundProcessor::processOverlay()");
+			discardStream(new_stream);
 
 			ALT_OUTDENT;
 			ALT_DEBUG(0, "END GSoundProcessor::handleCmd()");
@@ -317,11 +228,18 @@ bool GSoundProcessor::handleCmd(const unsigned int cmd_combined_in)
 		}
 		break;
 	default:
-		break;
+		ALT_ERROR(1, "Unknown sample type");
+		discardStream(new_stream);
+
+		ALT_OUTDENT;
+		ALT_DEBUG(0, "END GSoundProcessor::handleCmd()");
+		return false;
 	}
 
-	// set volume for active streams
-	ALT_CALL(adjustStreamVolumes());
+	// set volume for active streams.  When batching, this is done once at
+	// the end of the batch
+	if (!isBatching())
+		ALT_CALL(adjustStreamVolumes());
 
 	// Play pending sound determined above, if any
 	const string shortPathStr = getShortPath(new_stream->sample_path);
@@ -333,9 +251,11 @@ bool GSoundProcessor::handleCmd(const unsigned int cmd_combined_in)
 		ALT_DEBUG(1, "HSTREAM(%u)  CH(%02d)  CMD(%04X)  SAMPLE(%s)", new_stream->hstream,
 			      new_stream->channel_idx, cmd_combined_in, sample_short_path);
 
-		if (!MiniAudio_ChannelPlay(new_stream->hstream, false)) {
+		if (!playStream(new_stream->hstream)) {
 			// Sound playback failed
 			ALT_ERROR(2, "FAILED %s stream playback: %s", stream_type_str, get_miniaudio_err());
+			releaseFailedStream(new_stream->hstream);
+			adjustStreamVolumes();
 
 			ALT_OUTDENT;
 			ALT_DEBUG(0, "END GSoundProcessor::handleCmd()");
@@ -370,11 +290,11 @@ void GSoundProcessor::init()
 	ALT_INFO(1, "SUCCESS: GSoundProcessor::loadSamples()");
 
 	// populate group volumes
-	group_vol[streamTypeToIndex[MUSIC]]   = music_behavior.group_vol;
-	group_vol[streamTypeToIndex[CALLOUT]] = callout_behavior.group_vol;
-	group_vol[streamTypeToIndex[SFX]]     = sfx_behavior.group_vol;
-	group_vol[streamTypeToIndex[OVERLAY]] = overlay_behavior.group_vol;
-	group_vol[streamTypeToIndex[SOLO]]    = solo_behavior.group_vol;
+	group_vol[streamTypeToIndex.at(MUSIC)]   = context.music_behavior.group_vol;
+	group_vol[streamTypeToIndex.at(CALLOUT)] = context.callout_behavior.group_vol;
+	group_vol[streamTypeToIndex.at(SFX)]     = context.sfx_behavior.group_vol;
+	group_vol[streamTypeToIndex.at(OVERLAY)] = context.overlay_behavior.group_vol;
+	group_vol[streamTypeToIndex.at(SOLO)]    = context.solo_behavior.group_vol;
 
 	// if we are here, initialization succeeded
 	is_initialized = true;
@@ -426,8 +346,6 @@ unsigned int GSoundProcessor::getSample(const unsigned int cmd_combined_in)
 	int matching_sample_count = 0;
 	unsigned int sample_idx = UNSET_IDX;
 
-	std::uniform_int_distribution<int> distribution(0, std::numeric_limits<int>::max());
-
 	for (size_t i = 0; i < samples.size(); ++i) {
 		if (samples[i].id == cmd_combined_in) {
 			matching_sample_count++;
@@ -435,7 +353,7 @@ unsigned int GSoundProcessor::getSample(const unsigned int cmd_combined_in)
 			// reservoir sampling approach
 			// Each matching sample has equal chance (1/matching_sample_count) to
 			// become the selected one.
-			if (distribution(generator) % matching_sample_count == 0) {
+			if (randomIndex(static_cast<unsigned int>(matching_sample_count)) == 0) {
 				sample_idx = static_cast<unsigned int>(i);
 			}
 		}
@@ -637,6 +555,7 @@ bool GSoundProcessor::postProcessBehaviors(const BehaviorInfo& behavior,
 				auto it = map.find(stream_id);
 				if (it != map.end()) {
 					ALT_DEBUG(1, "Erasing pausing impact from %s stream: %u", toString(finished_stream.stream_type), finished_stream.hstream);
+					AltsoundRtCheck::Allow allow("behavior map erase");
 					map.erase(it);
 				}
 			}
@@ -653,6 +572,7 @@ bool GSoundProcessor::postProcessBehaviors(const BehaviorInfo& behavior,
 				auto it = map.find(stream_id);
 				if (it != map.end()) {
 					ALT_DEBUG(1, "Erasing ducking impact from %s stream: %u", toString(finished_stream.stream_type), finished_stream.hstream);
+					AltsoundRtCheck::Allow allow("behavior map erase");
 					map.erase(it);
 				}
 			}
@@ -756,13 +676,22 @@ bool GSoundProcessor::stopExclusiveStream(const AltsoundSampleType stream_type)
 // ----------------------------------------------------------------------------
 
 void ALTSOUNDCALLBACK GSoundProcessor::common_callback(unsigned int handle, unsigned int channel, unsigned int data, void* user)
+{
+	// SYNCPROCs run on the thread the context of their stream is bound to
+	static_cast<GSoundProcessor*>(AltsoundContext::current().processor)->streamEnded(handle, channel, user);
+}
+
+// ----------------------------------------------------------------------------
+
+void GSoundProcessor::streamEnded(unsigned int handle, unsigned int channel, void* user)
 {
 	ALT_DEBUG(0, "\nBEGIN: GSoundProcessor::common_callback()");
 	ALT_INDENT;
 
 	ALT_INFO(1, "HSYNC: %u  HSTREAM: %u", handle, channel);
 	ALT_DEBUG(1, "Acquiring mutex");
-	std::lock_guard<std::mutex> guard(io_mutex);
+	// the SYNCPROC runs on the audio thread, which holds io_mutex already
+	const auto guard = AltsoundRtCheck::lock(io_mutex, "io_mutex lock");
 
 	unsigned int hstream_in = channel;
 	const AltsoundStreamInfo* stream_inst = static_cast<AltsoundStreamInfo*>(user);
@@ -779,15 +708,16 @@ void ALTSOUNDCALLBACK GSoundProcessor::common_callback(unsigned int handle, unsi
 	const unsigned int inst_ch_idx = stream_inst->channel_idx;
 	const AltsoundSampleType stream_type = stream_inst->stream_type;
 
-	BehaviorInfo behavior;
+	// not copied: BehaviorInfo holds maps, and this runs on the audio thread
+	const BehaviorInfo* behavior = nullptr;
 	switch (stream_type) {
 	case SOLO:
-		behavior = solo_behavior;
+		behavior = &context.solo_behavior;
 		cur_solo_stream_idx = UNSET_IDX;
 		break;
 
 	case MUSIC:
-		behavior = music_behavior;
+		behavior = &context.music_behavior;
 		// DAR@20230706
 		// This callback gets hit when the sample ends even if it's set to loop.
 		// If it's cleaned up here, it will not loop. This is not desirable.  A future
@@ -797,16 +727,16 @@ void ALTSOUNDCALLBACK GSoundProcessor::common_callback(unsigned int handle, unsi
 		break;
 
 	case SFX:
-		behavior = sfx_behavior;
+		behavior = &context.sfx_behavior;
 		break;
 
 	case CALLOUT:
-		behavior = callout_behavior;
+		behavior = &context.callout_behavior;
 		cur_callout_stream_idx = UNSET_IDX;
 		break;
 
 	case OVERLAY:
-		behavior = overlay_behavior;
+		behavior = &context.overlay_behavior;
 		cur_overlay_stream_idx = UNSET_IDX;
 		break;
 
@@ -819,7 +749,7 @@ void ALTSOUNDCALLBACK GSoundProcessor::common_callback(unsigned int handle, unsi
 	}
 
 	// update ducking behavior tracking
-	postProcessBehaviors(behavior, *stream_inst);
+	postProcessBehaviors(*behavior, *stream_inst);
 
 	if (stream_type != MUSIC) {
 		// free stream resources
@@ -898,12 +828,42 @@ bool GSoundProcessor::adjustStreamVolumes()
 
 	ALT_INFO(1, "Num active streams: %d", num_x_streams);
 
+	if (AltsoundTrace::enabled()) {
+		AltsoundTrace::counter("ducking", {
+			{ "music", findLowestDuckVolume(MUSIC) },
+			{ "callout", findLowestDuckVolume(CALLOUT) },
+			{ "sfx", findLowestDuckVolume(SFX) },
+			{ "solo", findLowestDuckVolume(SOLO) },
+			{ "overlay", findLowestDuckVolume(OVERLAY) } });
+	}
+
 	ALT_OUTDENT;
 	ALT_DEBUG(0, "END GSoundProcessor::adjustStreamVolumes()");
 	return success;
 }
 
 
+// ----------------------------------------------------------------------------
+
+bool GSoundProcessor::updateStreamVolumes()
+{
+	return adjustStreamVolumes();
+}
+
+// ----------------------------------------------------------------------------
+
+void GSoundProcessor::forgetStream(const AltsoundStreamInfo& stream)
+{
+	postProcessBehaviors(*behavior_map[stream.stream_type], stream);
+
+	const auto it = tracked_stream_idx_map.find(stream.stream_type);
+	if (it != tracked_stream_idx_map.end() && *it->second == stream.channel_idx)
+		*it->second = UNSET_IDX;
+
+	// streams paused by it resume
+	processPausedStreams();
+}
+
 // ----------------------------------------------------------------------------
 
 bool GSoundProcessor::processPausedStreams()
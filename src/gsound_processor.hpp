@@ -23,7 +23,10 @@
 #include "altsound_processor_base.hpp"
 #include "altsound_logger.hpp"
 
-#include <random>
+#include <array>
+#include <limits>
+#include <map>
+#include <unordered_map>
 
 constexpr int NUM_STREAM_TYPES = 5;
 
@@ -54,7 +57,7 @@ public:
 	bool handleCmd(const unsigned int cmd_combined_in) override;
 
 	// DEBUG helper fns to print all behavior data
-	static void printBehaviorData();
+	void printBehaviorData();
 
 protected:
 
@@ -76,7 +79,7 @@ private: // functions
 	bool processBehaviors(const BehaviorInfo& behavior, const AltsoundStreamInfo* stream);
 
 	// Update behavior impacts when streams end
-	static bool postProcessBehaviors(const BehaviorInfo& behavior, const AltsoundStreamInfo& finished_stream);
+	bool postProcessBehaviors(const BehaviorInfo& behavior, const AltsoundStreamInfo& finished_stream);
 
 	// Stop the exclusive stream referenced by stream_ptr
 	bool stopExclusiveStream(const AltsoundSampleType stream_type);
@@ -84,24 +87,125 @@ private: // functions
 	// BASS SYNCPROC callback whan a stream ends
 	static void ALTSOUNDCALLBACK common_callback(unsigned int handle, unsigned int channel, unsigned int data, void* user);
 
+	// SYNCPROC handler, called by common_callback() on the processor of the
+	// context whose stream ended
+	void streamEnded(unsigned int handle, unsigned int channel, void* user);
+
 	// adjust volume of active streams to accommodate current ducking impacts
-	static bool adjustStreamVolumes();
+	bool adjustStreamVolumes();
+
+	// re-apply ducking and group volumes to all active streams
+	bool updateStreamVolumes() override;
+
+	// remove the behavior impacts and tracking of a released stream
+	void forgetStream(const AltsoundStreamInfo& stream) override;
 
 	// determine lowest ducking volume impacts on stream_type
-	static float findLowestDuckVolume(AltsoundSampleType stream_type);
+	float findLowestDuckVolume(AltsoundSampleType stream_type);
 
 	// process PAUSED behavior impacts for all streams
-	static bool processPausedStreams();
+	bool processPausedStreams();
 
 	// resume paused playback on streams that no longer need to be paused
-	static bool tryResumeStream(const AltsoundStreamInfo& stream);
+	bool tryResumeStream(const AltsoundStreamInfo& stream);
 
 private: // data
 
+	static constexpr unsigned int UNSET_IDX = std::numeric_limits<unsigned int>::max();
+
 	bool is_initialized;
 	bool is_stable; // future use
 	std::vector<GSoundSampleInfo> samples;
-	std::mt19937 generator; // mersenne twister
+
+	// NOTE:
+	// SFX streams don't require tracking since multiple can play simultaneously.
+	// Other than adjusting ducking, they have no other impacts on active streams
+	//
+	// Single-play stream tracking
+	unsigned int cur_mus_stream_idx = UNSET_IDX;
+	unsigned int cur_callout_stream_idx = UNSET_IDX;
+	unsigned int cur_solo_stream_idx = UNSET_IDX;
+	unsigned int cur_overlay_stream_idx = UNSET_IDX;
+
+	std::map<AltsoundSampleType, unsigned int*> tracked_stream_idx_map = {
+		{AltsoundSampleType::MUSIC, &cur_mus_stream_idx},
+		{AltsoundSampleType::CALLOUT, &cur_callout_stream_idx},
+		{AltsoundSampleType::SOLO, &cur_solo_stream_idx},
+		{AltsoundSampleType::OVERLAY, &cur_overlay_stream_idx}
+	};
+
+	// DAR@20230719
+	// The maps below contain the ducking and pausing behavior impacts of sample
+	// types on other sample types.  For example, the music_duck_vol map contains
+	// the impacts on MUSIC volume from the behaviors of the other sample types.
+	// Similarly, the music_paused map contains the paused status of MUSIC
+	// streams based on the behavior of the other streams.
+	//
+	// The map key is the stream ID (HSTREAM) of the stream that is setting the
+	// duck value.  This allows the correct entry to be removed when the
+	// affecting stream ends
+	//
+	// Streams can have overlapping impacts on other streams.  When an affecting
+	// stream ends, it can't be assumed its safe to remove the behavior impact from
+	// the affected sample type.  The map key ensures ALL the behavior impacts are
+	// captured for each sample type.  Only when the map is cleared, can the impact
+	// be removed
+	//
+	// stream ducking
+	std::unordered_map<unsigned int, float> music_duck_vol;
+	std::unordered_map<unsigned int, float> callout_duck_vol;
+	std::unordered_map<unsigned int, float> sfx_duck_vol;
+	std::unordered_map<unsigned int, float> solo_duck_vol;
+	std::unordered_map<unsigned int, float> overlay_duck_vol;
+
+	// convenience structure for working with ducking maps
+	std::unordered_map<AltsoundSampleType, std::unordered_map<unsigned int, float>*> duck_vol_map = {
+		{MUSIC, &music_duck_vol},
+		{CALLOUT, &callout_duck_vol},
+		{SFX, &sfx_duck_vol},
+		{SOLO, &solo_duck_vol},
+		{OVERLAY, &overlay_duck_vol}
+	};
+
+	// stream pausing
+	std::unordered_map<unsigned int, bool> music_paused;
+	std::unordered_map<unsigned int, bool> callout_paused;
+	std::unordered_map<unsigned int, bool> sfx_paused;
+	std::unordered_map<unsigned int, bool> solo_paused;
+	std::unordered_map<unsigned int, bool> overlay_paused;
+
+	// convenience structure for working with paused maps
+	std::unordered_map<AltsoundSampleType, std::unordered_map<unsigned int, bool>*> paused_status_map = {
+		{MUSIC, &music_paused},
+		{CALLOUT, &callout_paused},
+		{SFX, &sfx_paused},
+		{SOLO, &solo_paused},
+		{OVERLAY, &overlay_paused}
+	};
+
+	// DAR@20230712
+	// A common mixing board function is to set gain levels for individual tracks
+	// and then apply a group volume to change volume for a group of tracks. while
+	// maintaining relative individual volumes.  For example, if we have 3 MUSIC
+	// tracks with 90, 60, 55 gain levels individually, setting the group volume
+	// to 90 will duck all MUSIC tracks by 10% while maintaining the volume
+	// relationships between the individual tracks.  Each index into the array
+	// represents the sample type they apply to.  For example, index 0 is MUSIC
+	// group volume.  Index 1 is CALLOUT These values can be set in
+	// the configuration file
+	//
+	// Group volumes for sample types
+	std::array<float, NUM_STREAM_TYPES> group_vol = { 1.0f, 1.0f, 1.0f, 1.0f, 1.0f };
+
+	// DAR@20230719
+	// Sample type behaviors determine what impacts they will have on other sample
+	// types.  For example, music_behavior defines what impacts MUSIC samples have
+	// on other non-MUSIC sample types.
+	//
+	// NOTE: With the exception of STOP, self-impacting behaviors are not supported.
+	//
+	// convenience structure for working with the context's behaviors
+	std::unordered_map<AltsoundSampleType, BehaviorInfo*> behavior_map;
 };
 
 // ---------------------------------------------------------------------------
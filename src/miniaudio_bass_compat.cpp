@@ -10,22 +10,61 @@
 
 #include "miniaudio_bass_compat.hpp"
 #include "miniaudio_private.h"
+#include "altsound_context.hpp"
 #include "altsound_data.hpp"
 #include "altsound_logger.hpp"
-
+#include "altsound_realtime.hpp"
+#include "altsound_rt_check.hpp"
+#include "altsound_stats.hpp"
+#include "altsound_trace.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
 #include <unordered_map>
 #include <mutex>
 
-extern StreamArray channel_stream;
-extern std::unordered_map<unsigned int, _internal_stream_data> g_streamMap;
-extern std::mutex g_streamMapMutex;
-extern uint32_t g_nextStreamId;
-extern uint32_t g_channels;
-extern uint32_t g_sampleRate;
-extern ma_engine* g_engine;
+static void MiniAudio_StreamEvent(MiniAudioStreamEvent event, unsigned int hstream, float value = 0.0f,
+                                  const char* file = nullptr)
+{
+	MiniAudioState& state = AltsoundContext::current().miniaudio;
+	if (state.event_proc)
+		state.event_proc(event, hstream, MiniAudio_GetEngineTime(), value, file, state.event_user);
+}
 
-std::vector<EndedStream> g_endedStreams;
-std::mutex g_endedMutex;
+// Updates a stream's play state and the active stream count.
+// The stream map mutex must be held
+static void MiniAudio_SetPlayState(_internal_stream_data& data, bool playing, bool paused)
+{
+	MiniAudioState& state = AltsoundContext::current().miniaudio;
+	const bool was_active = data.playing && !data.paused;
+	data.playing = playing;
+	data.paused = paused;
+	if (was_active != (playing && !paused)) {
+		if (was_active)
+			state.active.fetch_sub(1, std::memory_order_release);
+		else
+			state.active.fetch_add(1, std::memory_order_release);
+	}
+}
+
+// Marks a stream as ended and queues its SYNCPROC. The stream map mutex must be held
+static void MiniAudio_StreamEnded(unsigned int hstream, _internal_stream_data& data)
+{
+	MiniAudioState& state = AltsoundContext::current().miniaudio;
+	AltsoundTrace::instant("stream", "end", { { "stream", (double)hstream } });
+	MiniAudio_StreamEvent(MiniAudioStreamEvent::End, hstream);
+	if (data.sync_callback) {
+		const auto endLock = AltsoundRtCheck::lock(state.ended_mutex, "ended stream queue lock");
+		state.ended.push_back({ data.sync_callback, data.hsync, hstream, data.sync_userdata });
+		if (!state.ended_queued) {
+			state.ended_queued = true;
+			state.active.fetch_add(1, std::memory_order_release);
+		}
+	}
+	// after queuing, so the engine never looks idle in between
+	MiniAudio_SetPlayState(data, false, data.paused);
+}
 
 // Fired by miniAudio (audio thread) the moment a non-looping sound reaches its
 // end. We only mark the stream and queue its SYNCPROC here; the actual firing
@@ -33,41 +72,397 @@ std::mutex g_endedMutex;
 // sound must not be uninitialized from within this callback
 static void MiniAudio_StreamEndCallback(void* pUserData, ma_sound* pSound)
 {
+	MiniAudioState& state = AltsoundContext::current().miniaudio;
 	const unsigned int hstream = static_cast<unsigned int>(reinterpret_cast<uintptr_t>(pUserData));
 
-	std::lock_guard<std::mutex> lock(g_streamMapMutex);
-	auto it = g_streamMap.find(hstream);
-	if (it == g_streamMap.end())
+	const auto lock = AltsoundRtCheck::lock(state.map_mutex, "stream map lock");
+	auto it = state.map.find(hstream);
+	if (it == state.map.end())
 		return;
 
-	it->second.playing = false;
-	if (it->second.sync_callback) {
-		std::lock_guard<std::mutex> endLock(g_endedMutex);
-		g_endedStreams.push_back({ it->second.sync_callback, it->second.hsync, hstream, it->second.sync_userdata });
+	MiniAudio_StreamEnded(hstream, it->second);
+}
+
+// ---------------------------------------------------------------------------
+// Virtual voices
+//
+// All helpers below require the stream map mutex to be held
+// ---------------------------------------------------------------------------
+
+static uint64_t VirtualVoicePosition(const _internal_stream_data& data, uint64_t now)
+{
+	return data.virtual_cursor + (now > data.virtual_time ? now - data.virtual_time : 0);
+}
+
+// Leaves virtual mode without touching the sound
+static void VirtualVoiceClear(_internal_stream_data& data)
+{
+	AltsoundContext& ctx = AltsoundContext::current();
+	if (data.virtualized) {
+		data.virtualized = false;
+		ctx.stats.virtual_voices.fetch_sub(1, std::memory_order_relaxed);
+	}
+	if (data.shed) {
+		data.shed = false;
+		ctx.stats.shed_voices.fetch_sub(1, std::memory_order_relaxed);
+	}
+}
+
+// Stops mixing a stream, keeping its timeline running.  Reads the cursor, so
+// this must run on the audio thread unless the sound was never started
+static void VirtualVoiceEnter(_internal_stream_data& data)
+{
+	AltsoundContext& ctx = AltsoundContext::current();
+	ma_uint64 cursor = 0;
+	altsound_ma_sound_get_cursor_in_pcm_frames(data.sound, &cursor);
+	altsound_ma_sound_stop(data.sound);
+
+	const uint64_t now = MiniAudio_GetEngineTime();
+	data.virtual_cursor = cursor;
+	data.virtual_time = std::max(now, data.start_frame); // a scheduled start has not begun yet
+	data.virtualized = true;
+	data.virtual_pending = false;
+	data.mixed = true; // no first-mix latency for a stream that went silent first
+	ctx.stats.virtual_voices.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Moves the sound to the position its timeline has reached and leaves
+// virtual mode without starting it. Returns false if a non-looping stream
+// ran past its end, in which case it is ended
+static bool VirtualVoiceSettle(unsigned int hstream, _internal_stream_data& data)
+{
+	VirtualVoiceClear(data);
+
+	uint64_t pos = VirtualVoicePosition(data, MiniAudio_GetEngineTime());
+	if (data.looping) {
+		pos %= data.length;
+	}
+	else if (pos >= data.length) {
+		MiniAudio_StreamEnded(hstream, data);
+		return false;
+	}
+
+	altsound_ma_sound_seek_to_pcm_frame(data.sound, pos);
+	return true;
+}
+
+// Virtualizes or resumes a stream after a volume or state change
+static void VirtualVoiceUpdate(unsigned int hstream, _internal_stream_data& data)
+{
+	MiniAudioState& state = AltsoundContext::current().miniaudio;
+	// a shed voice waits for MiniAudio_RestoreShedVoice()
+	const bool audible = data.volume >= state.virtual_threshold && !data.shed;
+	data.virtual_pending = false;
+
+	if (data.virtualized) {
+		if (audible && VirtualVoiceSettle(hstream, data))
+			altsound_ma_sound_start(data.sound);
+	}
+	else if (!audible && data.playing && !data.paused && data.length > 0) {
+		// the audio thread may be decoding it: MiniAudio_UpdateStreams()
+		// virtualizes it after the next mix
+		data.virtual_pending = true;
+	}
+}
+
+void MiniAudio_SetVirtualVoiceThreshold(float volume)
+{
+	MiniAudioState& state = AltsoundContext::current().miniaudio;
+	state.virtual_threshold = volume;
+}
+
+bool MiniAudio_ShedQuietestVoice(uint32_t type_mask)
+{
+	AltsoundContext& ctx = AltsoundContext::current();
+	MiniAudioState& state = ctx.miniaudio;
+	const auto lock = AltsoundRtCheck::lock(state.map_mutex, "stream map lock");
+
+	// streams of unknown length could not end on time while virtual
+	_internal_stream_data* quietest = nullptr;
+	for (auto& entry : state.map) {
+		_internal_stream_data& data = entry.second;
+		if (!data.started || !data.playing || data.paused || data.virtualized || data.length == 0 ||
+		    !(type_mask & (1u << data.voice_type)))
+			continue;
+		if (!quietest || data.volume < quietest->volume)
+			quietest = &data;
+	}
+	if (!quietest)
+		return false;
+
+	VirtualVoiceEnter(*quietest);
+	quietest->shed = true;
+	ctx.stats.shed_voices.fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
+
+bool MiniAudio_RestoreShedVoice()
+{
+	AltsoundContext& ctx = AltsoundContext::current();
+	MiniAudioState& state = ctx.miniaudio;
+	if (ctx.stats.shed_voices.load(std::memory_order_relaxed) == 0)
+		return false;
+
+	const auto lock = AltsoundRtCheck::lock(state.map_mutex, "stream map lock");
+
+	unsigned int hstream = MINIAUDIO_NO_STREAM;
+	_internal_stream_data* loudest = nullptr;
+	for (auto& entry : state.map) {
+		if (entry.second.shed && (!loudest || entry.second.volume > loudest->volume)) {
+			hstream = entry.first;
+			loudest = &entry.second;
+		}
+	}
+	if (!loudest)
+		return false;
+
+	loudest->shed = false;
+	ctx.stats.shed_voices.fetch_sub(1, std::memory_order_relaxed);
+	VirtualVoiceUpdate(hstream, *loudest);
+	return true;
+}
+
+void MiniAudio_SetResampler(MiniAudioResampler algorithm, uint32_t lpf_order)
+{
+	MiniAudioState& state = AltsoundContext::current().miniaudio;
+	state.resampler = algorithm;
+	state.resampler_lpf_order = std::min<uint32_t>(lpf_order, MINIAUDIO_MAX_LPF_ORDER);
+}
+
+void MiniAudio_UpdateStreams()
+{
+	AltsoundContext& ctx = AltsoundContext::current();
+	MiniAudioState& state = ctx.miniaudio;
+	const auto lock = AltsoundRtCheck::lock(state.map_mutex, "stream map lock");
+	const uint64_t now = MiniAudio_GetEngineTime();
+
+	for (auto& entry : state.map) {
+		_internal_stream_data& data = entry.second;
+		if (data.virtual_pending) {
+			// still inaudible and mixed, unless paused or stopped since
+			if (data.playing && !data.paused && !data.virtualized && data.sound)
+				VirtualVoiceEnter(data);
+			data.virtual_pending = false;
+		}
+
+		if (data.virtualized && !data.looping && VirtualVoicePosition(data, now) >= data.length) {
+			VirtualVoiceClear(data);
+			MiniAudio_StreamEnded(entry.first, data);
+		}
+
+		// the first period that advanced the sound has just been mixed
+		if (!data.mixed && data.started && data.playing && !data.paused) {
+			ma_uint64 cursor = 0;
+			if (altsound_ma_sound_get_cursor_in_pcm_frames(data.sound, &cursor) == MA_SUCCESS && cursor > 0) {
+				data.mixed = true;
+				ctx.stats.command_to_audio.record(AltsoundStats::now() - data.command_ns);
+			}
+		}
+	}
+}
+
+void MiniAudio_TakeEndedStreams(std::vector<EndedStream>& out)
+{
+	MiniAudioState& state = AltsoundContext::current().miniaudio;
+	out.clear();
+	const auto lock = AltsoundRtCheck::lock(state.ended_mutex, "ended stream queue lock");
+	out.swap(state.ended);
+	if (state.ended_queued) {
+		state.ended_queued = false;
+		state.active.fetch_sub(1, std::memory_order_release);
+	}
+}
+
+void MiniAudio_ReserveEndedStreams(size_t count)
+{
+	MiniAudioState& state = AltsoundContext::current().miniaudio;
+	std::lock_guard<std::mutex> lock(state.ended_mutex);
+	state.ended.reserve(count);
+}
+
+void MiniAudio_ClearEndedStreams()
+{
+	MiniAudioState& state = AltsoundContext::current().miniaudio;
+	std::lock_guard<std::mutex> lock(state.ended_mutex);
+	state.ended.clear();
+	if (state.ended_queued) {
+		state.ended_queued = false;
+		state.active.fetch_sub(1, std::memory_order_release);
+	}
+}
+
+bool MiniAudio_IsIdle()
+{
+	MiniAudioState& state = AltsoundContext::current().miniaudio;
+	return state.active.load(std::memory_order_acquire) == 0;
+}
+
+// ---------------------------------------------------------------------------
+
+void MiniAudio_SetScheduledStart(uint64_t start_frame)
+{
+	MiniAudioState& state = AltsoundContext::current().miniaudio;
+	state.scheduled_start_frame = start_frame;
+}
+
+uint64_t MiniAudio_GetEngineTime()
+{
+	AltsoundContext& ctx = AltsoundContext::current();
+	return ctx.engine ? altsound_ma_engine_get_time_in_pcm_frames(ctx.engine) : 0;
+}
+
+void MiniAudio_SetStreamEventProc(MiniAudioStreamEventProc proc, void* user)
+{
+	MiniAudioState& state = AltsoundContext::current().miniaudio;
+	state.event_proc = proc;
+	state.event_user = user;
+}
+
+const char* toString(MiniAudioStreamEvent event)
+{
+	switch (event) {
+		case MiniAudioStreamEvent::Create:  return "create";
+		case MiniAudioStreamEvent::Play:    return "play";
+		case MiniAudioStreamEvent::Restart: return "restart";
+		case MiniAudioStreamEvent::Pause:   return "pause";
+		case MiniAudioStreamEvent::Stop:    return "stop";
+		case MiniAudioStreamEvent::Volume:  return "volume";
+		case MiniAudioStreamEvent::End:     return "end";
+		case MiniAudioStreamEvent::Free:    return "free";
+	}
+	return "unknown";
+}
+
+void MiniAudio_SetLoadToMemory(bool load)
+{
+	MiniAudioState& state = AltsoundContext::current().miniaudio;
+	state.load_to_memory.store(load, std::memory_order_relaxed);
+}
+
+static std::vector<char>* MiniAudio_LoadFile(const std::string& file)
+{
+	std::ifstream in(file, std::ios::binary | std::ios::ate);
+	if (!in.is_open())
+		return nullptr;
+
+	const std::streamsize size = in.tellg();
+	std::vector<char>* data = new std::vector<char>((size_t)std::max<std::streamsize>(size, 0));
+	in.seekg(0);
+	if (!in.read(data->data(), size)) {
+		delete data;
+		return nullptr;
+	}
+
+	AltsoundRealtime::lockBuffer(data->data(), data->size());
+	return data;
+}
+
+static void MiniAudio_FreeSource(std::vector<char>* data, FILE* file)
+{
+	if (data) {
+		AltsoundRealtime::unlockBuffer(data->data(), data->size());
+		delete data;
 	}
+	if (file)
+		fclose(file);
+}
+
+// Decoder callbacks for samples streamed from their file.  miniAudio reads
+// them as it mixes, so this file I/O runs on the audio thread
+static ma_result MiniAudio_FileRead(ma_decoder* pDecoder, void* pBufferOut, size_t bytesToRead, size_t* pBytesRead)
+{
+	AltsoundRtCheck::Allow allow("sample file read, see MiniAudio_SetLoadToMemory()");
+	FILE* file = static_cast<FILE*>(pDecoder->pUserData);
+	const size_t read = fread(pBufferOut, 1, bytesToRead, file);
+	if (pBytesRead)
+		*pBytesRead = read;
+
+	if (read == bytesToRead)
+		return MA_SUCCESS;
+	if (ferror(file))
+		return MA_IO_ERROR;
+	return read == 0 ? MA_AT_END : MA_SUCCESS;
+}
+
+static ma_result MiniAudio_FileSeek(ma_decoder* pDecoder, ma_int64 byteOffset, ma_seek_origin origin)
+{
+	AltsoundRtCheck::Allow allow("sample file read, see MiniAudio_SetLoadToMemory()");
+	FILE* file = static_cast<FILE*>(pDecoder->pUserData);
+	const int whence = origin == ma_seek_origin_start ? SEEK_SET : origin == ma_seek_origin_end ? SEEK_END : SEEK_CUR;
+#ifdef _WIN32
+	return _fseeki64(file, byteOffset, whence) == 0 ? MA_SUCCESS : MA_IO_ERROR;
+#else
+	return fseeko(file, (off_t)byteOffset, whence) == 0 ? MA_SUCCESS : MA_IO_ERROR;
+#endif
+}
+
+int MiniAudio_ErrorGetCode()
+{
+	return AltsoundContext::current().miniaudio.last_error;
+}
+
+void MiniAudio_ErrorSetCode(int ma_err)
+{
+	AltsoundContext::current().miniaudio.last_error = ma_err;
+}
+
+size_t MiniAudio_GetStreamCount()
+{
+	MiniAudioState& state = AltsoundContext::current().miniaudio;
+	const auto lock = AltsoundRtCheck::lock(state.map_mutex, "stream map lock");
+	return state.map.size();
+}
+
+bool MiniAudio_ChannelHasSync(unsigned int hstream, unsigned int hsync)
+{
+	MiniAudioState& state = AltsoundContext::current().miniaudio;
+	const auto lock = AltsoundRtCheck::lock(state.map_mutex, "stream map lock");
+	auto it = state.map.find(hstream);
+	return it != state.map.end() && it->second.sync_callback && it->second.hsync == hsync;
 }
 
 unsigned int MiniAudio_StreamCreateFile(bool mem, const std::string& file, unsigned long long length, bool loop)
 {
+	AltsoundContext& ctx = AltsoundContext::current();
+	MiniAudioState& state = ctx.miniaudio;
 	if (file.empty()) {
 		MiniAudio_ErrorSetCode(MA_INVALID_ARGS);
 		return MINIAUDIO_NO_STREAM;
 	}
 
-	ma_decoder_config config = altsound_ma_decoder_config_init(ma_format_f32, g_channels, g_sampleRate);
+	const uint64_t create_start = AltsoundStats::now();
+
+	ma_decoder_config config = altsound_ma_decoder_config_init(ma_format_f32, ctx.channels, ctx.sample_rate);
+	altsound_ma_decoder_config_set_resampler(&config, state.resampler == MINIAUDIO_RESAMPLER_CUBIC ? altsound_resampler_cubic
+	                                                                                           : altsound_resampler_linear,
+	                                         state.resampler_lpf_order);
 	ma_decoder* decoder = new ma_decoder();
-	ma_result result = altsound_ma_decoder_init_file(file.c_str(), &config, decoder);
+	std::vector<char>* file_data = nullptr;
+	FILE* stream_file = nullptr;
+	ma_result result;
+	if (state.load_to_memory.load(std::memory_order_relaxed)) {
+		file_data = MiniAudio_LoadFile(file);
+		result = file_data ? altsound_ma_decoder_init_memory(file_data->data(), file_data->size(), &config, decoder)
+		                   : MA_DOES_NOT_EXIST;
+	}
+	else {
+		stream_file = fopen(file.c_str(), "rb");
+		result = stream_file ? altsound_ma_decoder_init(MiniAudio_FileRead, MiniAudio_FileSeek, stream_file, &config, decoder)
+		                     : MA_DOES_NOT_EXIST;
+	}
 	if (result != MA_SUCCESS) {
 		MiniAudio_ErrorSetCode(result);
+		MiniAudio_FreeSource(file_data, stream_file);
 		delete decoder;
 		return MINIAUDIO_NO_STREAM;
 	}
 
 	ma_sound* sound = new ma_sound();
-	result = altsound_ma_sound_init_from_decoder(g_engine, decoder, MA_SOUND_FLAG_NO_SPATIALIZATION | MA_SOUND_FLAG_NO_PITCH, sound);
+	result = altsound_ma_sound_init_from_decoder(ctx.engine, decoder, MA_SOUND_FLAG_NO_SPATIALIZATION | MA_SOUND_FLAG_NO_PITCH, sound);
 	if (result != MA_SUCCESS) {
 		MiniAudio_ErrorSetCode(result);
 		altsound_ma_decoder_uninit(decoder);
+		MiniAudio_FreeSource(file_data, stream_file);
 		delete decoder;
 		delete sound;
 		return MINIAUDIO_NO_STREAM;
@@ -75,12 +470,27 @@ unsigned int MiniAudio_StreamCreateFile(bool mem, const std::string& file, unsig
 
 	altsound_ma_sound_set_looping(sound, loop ? MA_TRUE : MA_FALSE);
 
-	unsigned int hstream = g_nextStreamId++;
+	// the decoder outputs at the engine rate, so this is in engine frames
+	ma_uint64 frames = 0;
+	if (altsound_ma_decoder_get_length_in_pcm_frames(decoder, &frames) != MA_SUCCESS)
+		frames = 0;
+
+	const uint64_t create_end = AltsoundStats::now();
+	ctx.stats.stream_create.record(create_end - create_start);
+
+	unsigned int hstream = state.next_stream_id++;
+
+	if (AltsoundTrace::enabled()) {
+		const size_t slash = file.find_last_of("/\\");
+		AltsoundTrace::complete("stream", "create", create_start, create_end, { { "stream", (double)hstream } },
+		                        file.c_str() + (slash == std::string::npos ? 0 : slash + 1));
+	}
+	MiniAudio_StreamEvent(MiniAudioStreamEvent::Create, hstream, 0.0f, file.c_str());
 
 	altsound_ma_sound_set_end_callback(sound, MiniAudio_StreamEndCallback, reinterpret_cast<void*>(static_cast<uintptr_t>(hstream)));
 
-	std::lock_guard<std::mutex> lock(g_streamMapMutex);
-	g_streamMap[hstream] = {
+	const auto lock = AltsoundRtCheck::lock(state.map_mutex, "stream map lock");
+	state.map[hstream] = {
 		.decoder = decoder,
 		.sound = sound,
 		.playing = false,
@@ -89,7 +499,12 @@ unsigned int MiniAudio_StreamCreateFile(bool mem, const std::string& file, unsig
 		.sample_rate = decoder->outputSampleRate,
 		.channels = decoder->outputChannels,
 		.sync_callback = nullptr,
-		.sync_userdata = nullptr
+		.sync_userdata = nullptr,
+		.start_frame = state.scheduled_start_frame,
+		.length = frames,
+		.file_data = file_data,
+		.file = stream_file,
+		.command_ns = AltsoundStats::commandTime()
 	};
 
 	MiniAudio_ErrorSetCode(MA_SUCCESS);
@@ -98,35 +513,42 @@ unsigned int MiniAudio_StreamCreateFile(bool mem, const std::string& file, unsig
 
 bool MiniAudio_ChannelSetVolume(unsigned int hstream, float value)
 {
+	MiniAudioState& state = AltsoundContext::current().miniaudio;
 	if (hstream == MINIAUDIO_NO_STREAM) {
 		MiniAudio_ErrorSetCode(MA_INVALID_ARGS);
 		return false;
 	}
 
-	std::lock_guard<std::mutex> lock(g_streamMapMutex);
-	auto it = g_streamMap.find(hstream);
-	if (it == g_streamMap.end()) {
+	const auto lock = AltsoundRtCheck::lock(state.map_mutex, "stream map lock");
+	auto it = state.map.find(hstream);
+	if (it == state.map.end()) {
 		MiniAudio_ErrorSetCode(MA_INVALID_ARGS);
 		return false;
 	}
 
+	AltsoundTrace::instant("stream", "volume", { { "stream", (double)hstream }, { "volume", value } });
+	MiniAudio_StreamEvent(MiniAudioStreamEvent::Volume, hstream, value);
+
 	it->second.volume = value;
-	if (it->second.sound)
+	if (it->second.sound) {
 		altsound_ma_sound_set_volume(it->second.sound, value);
+		VirtualVoiceUpdate(hstream, it->second);
+	}
 	MiniAudio_ErrorSetCode(MA_SUCCESS);
 	return true;
 }
 
 bool MiniAudio_ChannelGetVolume(unsigned int hstream, float& value)
 {
+	MiniAudioState& state = AltsoundContext::current().miniaudio;
 	if (hstream == MINIAUDIO_NO_STREAM) {
 		MiniAudio_ErrorSetCode(MA_INVALID_ARGS);
 		return false;
 	}
 
-	std::lock_guard<std::mutex> lock(g_streamMapMutex);
-	const auto it = g_streamMap.find(hstream);
-	if (it == g_streamMap.end()) {
+	const auto lock = AltsoundRtCheck::lock(state.map_mutex, "stream map lock");
+	const auto it = state.map.find(hstream);
+	if (it == state.map.end()) {
 		MiniAudio_ErrorSetCode(MA_INVALID_ARGS);
 		return false;
 	}
@@ -138,14 +560,15 @@ bool MiniAudio_ChannelGetVolume(unsigned int hstream, float& value)
 
 unsigned int MiniAudio_ChannelSetSync(unsigned int hstream, unsigned int type, void* proc, void* user)
 {
+	MiniAudioState& state = AltsoundContext::current().miniaudio;
 	if (hstream == MINIAUDIO_NO_STREAM || !proc) {
 		MiniAudio_ErrorSetCode(MA_INVALID_ARGS);
 		return 0;
 	}
 
-	std::lock_guard<std::mutex> lock(g_streamMapMutex);
-	auto it = g_streamMap.find(hstream);
-	if (it == g_streamMap.end()) {
+	const auto lock = AltsoundRtCheck::lock(state.map_mutex, "stream map lock");
+	auto it = state.map.find(hstream);
+	if (it == state.map.end()) {
 		MiniAudio_ErrorSetCode(MA_INVALID_ARGS);
 		return 0;
 	}
@@ -154,8 +577,7 @@ unsigned int MiniAudio_ChannelSetSync(unsigned int hstream, unsigned int type, v
 		it->second.sync_callback = reinterpret_cast<SYNCPROC>(proc);
 		it->second.sync_userdata = user;
 
-		static unsigned int sync_id = 1;
-		unsigned int hsync = sync_id++;
+		unsigned int hsync = state.next_sync_id++;
 		it->second.hsync = hsync;
 		MiniAudio_ErrorSetCode(MA_SUCCESS);
 		return hsync;
@@ -166,94 +588,189 @@ unsigned int MiniAudio_ChannelSetSync(unsigned int hstream, unsigned int type, v
 
 bool MiniAudio_ChannelPlay(unsigned int hstream, bool restart)
 {
+	AltsoundContext& ctx = AltsoundContext::current();
+	MiniAudioState& state = ctx.miniaudio;
 	if (hstream == MINIAUDIO_NO_STREAM) {
 		MiniAudio_ErrorSetCode(MA_INVALID_ARGS);
 		return false;
 	}
 
-	std::lock_guard<std::mutex> lock(g_streamMapMutex);
-	auto it = g_streamMap.find(hstream);
-	if (it == g_streamMap.end()) {
+	const auto lock = AltsoundRtCheck::lock(state.map_mutex, "stream map lock");
+	auto it = state.map.find(hstream);
+	if (it == state.map.end()) {
 		MiniAudio_ErrorSetCode(MA_INVALID_ARGS);
 		return false;
 	}
 
-	if (restart && it->second.sound) {
-		altsound_ma_sound_seek_to_pcm_frame(it->second.sound, 0);
+	AltsoundTrace::instant("stream", restart ? "restart" : "play", { { "stream", (double)hstream } });
+	MiniAudio_StreamEvent(restart ? MiniAudioStreamEvent::Restart : MiniAudioStreamEvent::Play, hstream);
+
+	_internal_stream_data& data = it->second;
+
+	if (restart && data.sound) {
+		altsound_ma_sound_seek_to_pcm_frame(data.sound, 0);
+		if (data.virtualized) {
+			data.virtual_cursor = 0;
+			data.virtual_time = MiniAudio_GetEngineTime();
+		}
 	}
 
-	if (it->second.sound) {
-		altsound_ma_sound_set_volume(it->second.sound, it->second.volume);
-		altsound_ma_sound_start(it->second.sound);
+	if (data.sound) {
+		// A scheduled start only applies to the first play; resumes and
+		// restarts always take effect immediately
+		if (!data.started && data.start_frame != 0)
+			altsound_ma_sound_set_start_time_in_pcm_frames(data.sound, data.start_frame);
+
+		altsound_ma_sound_set_volume(data.sound, data.volume);
+
+		// a stream that is inaudible from the start is never mixed
+		if (data.virtualized) {
+			// already running virtually
+		}
+		else if (data.volume < state.virtual_threshold && data.length > 0 && !data.started) {
+			// the audio thread has never read it, so its cursor is safe to
+			// read here
+			VirtualVoiceEnter(data);
+		}
+		else {
+			altsound_ma_sound_start(data.sound);
+			// resumed or restarted inaudible: the audio thread may still be
+			// reading it, and virtualizes it after the next mix
+			data.virtual_pending = data.volume < state.virtual_threshold && data.length > 0;
+		}
+	}
+
+	if (!data.started) {
+		// count the voice under the sample type its channel was assigned
+		data.voice_type = UNDEFINED;
+		for (const AltsoundStreamInfo* stream : ctx.channel_stream) {
+			if (stream && stream->hstream == hstream) {
+				data.voice_type = stream->stream_type;
+				break;
+			}
+		}
+		ctx.stats.voiceStarted(data.voice_type);
 	}
 
-	it->second.playing = true;
-	it->second.paused = false;
+	data.started = true;
+	MiniAudio_SetPlayState(data, true, false);
 	MiniAudio_ErrorSetCode(MA_SUCCESS);
 	return true;
 }
 
+bool MiniAudio_ChannelSetPosition(unsigned int hstream, uint64_t frame)
+{
+	MiniAudioState& state = AltsoundContext::current().miniaudio;
+	if (hstream == MINIAUDIO_NO_STREAM) {
+		MiniAudio_ErrorSetCode(MA_INVALID_ARGS);
+		return false;
+	}
+
+	const auto lock = AltsoundRtCheck::lock(state.map_mutex, "stream map lock");
+	auto it = state.map.find(hstream);
+	if (it == state.map.end() || !it->second.sound) {
+		MiniAudio_ErrorSetCode(MA_INVALID_ARGS);
+		return false;
+	}
+
+	const ma_result result = altsound_ma_sound_seek_to_pcm_frame(it->second.sound, frame);
+	if (it->second.virtualized) {
+		it->second.virtual_cursor = frame;
+		it->second.virtual_time = MiniAudio_GetEngineTime();
+	}
+	MiniAudio_ErrorSetCode(result);
+	return result == MA_SUCCESS;
+}
+
 bool MiniAudio_ChannelPause(unsigned int hstream)
 {
+	MiniAudioState& state = AltsoundContext::current().miniaudio;
 	if (hstream == MINIAUDIO_NO_STREAM) {
 		MiniAudio_ErrorSetCode(MA_INVALID_ARGS);
 		return false;
 	}
 
-	std::lock_guard<std::mutex> lock(g_streamMapMutex);
-	auto it = g_streamMap.find(hstream);
-	if (it == g_streamMap.end()) {
+	const auto lock = AltsoundRtCheck::lock(state.map_mutex, "stream map lock");
+	auto it = state.map.find(hstream);
+	if (it == state.map.end()) {
 		MiniAudio_ErrorSetCode(MA_INVALID_ARGS);
 		return false;
 	}
 
+	AltsoundTrace::instant("stream", "pause", { { "stream", (double)hstream } });
+	MiniAudio_StreamEvent(MiniAudioStreamEvent::Pause, hstream);
+
+	// a virtual voice freezes at the position its timeline has reached
+	if (it->second.virtualized && !VirtualVoiceSettle(hstream, it->second)) {
+		MiniAudio_ErrorSetCode(MA_SUCCESS);
+		return true;
+	}
+
 	if (it->second.sound)
 		altsound_ma_sound_stop(it->second.sound);
 
-	it->second.paused = true;
+	MiniAudio_SetPlayState(it->second, it->second.playing, true);
 	MiniAudio_ErrorSetCode(MA_SUCCESS);
 	return true;
 }
 
 bool MiniAudio_ChannelStop(unsigned int hstream)
 {
+	MiniAudioState& state = AltsoundContext::current().miniaudio;
 	if (hstream == MINIAUDIO_NO_STREAM) {
 		MiniAudio_ErrorSetCode(MA_INVALID_ARGS);
 		return false;
 	}
 
-	std::lock_guard<std::mutex> lock(g_streamMapMutex);
-	auto it = g_streamMap.find(hstream);
-	if (it == g_streamMap.end()) {
+	const auto lock = AltsoundRtCheck::lock(state.map_mutex, "stream map lock");
+	auto it = state.map.find(hstream);
+	if (it == state.map.end()) {
 		MiniAudio_ErrorSetCode(MA_INVALID_ARGS);
 		return false;
 	}
 
+	AltsoundTrace::instant("stream", "stop", { { "stream", (double)hstream } });
+	MiniAudio_StreamEvent(MiniAudioStreamEvent::Stop, hstream);
+
 	if (it->second.sound) {
 		altsound_ma_sound_stop(it->second.sound);
 		altsound_ma_sound_seek_to_pcm_frame(it->second.sound, 0);
 	}
 
-	it->second.playing = false;
-	it->second.paused = false;
+	MiniAudio_SetPlayState(it->second, false, false);
+	VirtualVoiceClear(it->second);
 	MiniAudio_ErrorSetCode(MA_SUCCESS);
 	return true;
 }
 
 bool MiniAudio_StreamFree(unsigned int hstream)
 {
+	AltsoundContext& ctx = AltsoundContext::current();
+	MiniAudioState& state = ctx.miniaudio;
 	if (hstream == MINIAUDIO_NO_STREAM) {
 		MiniAudio_ErrorSetCode(MA_INVALID_ARGS);
 		return false;
 	}
 
-	std::lock_guard<std::mutex> lock(g_streamMapMutex);
-	auto it = g_streamMap.find(hstream);
-	if (it == g_streamMap.end()) {
+	// SYNCPROCs free their stream on the audio thread: the sound, its
+	// decoder, file and stream info are released here
+	AltsoundRtCheck::Allow allow("stream free");
+
+	const auto lock = AltsoundRtCheck::lock(state.map_mutex, "stream map lock");
+	auto it = state.map.find(hstream);
+	if (it == state.map.end()) {
 		MiniAudio_ErrorSetCode(MA_INVALID_ARGS);
 		return false;
 	}
 
+	AltsoundTrace::instant("stream", "free", { { "stream", (double)hstream } });
+	MiniAudio_StreamEvent(MiniAudioStreamEvent::Free, hstream);
+
+	if (it->second.started)
+		ctx.stats.voiceStopped(it->second.voice_type);
+	MiniAudio_SetPlayState(it->second, false, false);
+	VirtualVoiceClear(it->second);
+
 	if (it->second.sound) {
 		altsound_ma_sound_uninit(it->second.sound);
 		delete it->second.sound;
@@ -263,13 +780,14 @@ bool MiniAudio_StreamFree(unsigned int hstream)
 		altsound_ma_decoder_uninit(it->second.decoder);
 		delete it->second.decoder;
 	}
+	MiniAudio_FreeSource(it->second.file_data, it->second.file);
 
-	g_streamMap.erase(it);
+	state.map.erase(it);
 
 	for (int i = 0; i < ALT_MAX_CHANNELS; ++i) {
-		if (channel_stream[i] && channel_stream[i]->hstream == hstream) {
-			delete channel_stream[i];
-			channel_stream[i] = nullptr;
+		if (ctx.channel_stream[i] && ctx.channel_stream[i]->hstream == hstream) {
+			delete ctx.channel_stream[i];
+			ctx.channel_stream[i] = nullptr;
 			break;
 		}
 	}
@@ -280,14 +798,15 @@ bool MiniAudio_StreamFree(unsigned int hstream)
 
 unsigned int MiniAudio_ChannelIsActive(unsigned int hstream)
 {
+	MiniAudioState& state = AltsoundContext::current().miniaudio;
 	if (hstream == MINIAUDIO_NO_STREAM) {
 		MiniAudio_ErrorSetCode(MA_INVALID_ARGS);
 		return MINIAUDIO_ACTIVE_STOPPED;
 	}
 
-	std::lock_guard<std::mutex> lock(g_streamMapMutex);
-	auto it = g_streamMap.find(hstream);
-	if (it != g_streamMap.end()) {
+	const auto lock = AltsoundRtCheck::lock(state.map_mutex, "stream map lock");
+	auto it = state.map.find(hstream);
+	if (it != state.map.end()) {
 		const _internal_stream_data& internal = it->second;
 		if (internal.paused) {
 			MiniAudio_ErrorSetCode(MA_SUCCESS);
@@ -7,10 +7,13 @@
 // ---------------------------------------------------------------------------
 #pragma once
 
+#include <atomic>
 #include <cstdint>
+#include <cstdio>
 #include <vector>
 #include <mutex>
 #include <string>
+#include <unordered_map>
 #include "altsound_data.hpp"
 
 #define MINIAUDIO_SYNC_END 2
@@ -36,6 +39,27 @@ struct _internal_stream_data {
 	SYNCPROC sync_callback = nullptr;
 	void* sync_userdata = nullptr;
 	unsigned int hsync = 0;
+	uint64_t start_frame = 0; // engine PCM frame of a scheduled start, 0 = immediate
+	bool started = false;
+	uint64_t length = 0; // in engine PCM frames, 0 = unknown
+	std::vector<char>* file_data = nullptr; // decoded from, see MiniAudio_SetLoadToMemory()
+	FILE* file = nullptr;                   // streamed from otherwise
+
+	// Virtual voice: a playing stream too quiet to hear is stopped in
+	// miniAudio but keeps its timeline. Its position is virtual_cursor plus
+	// the engine time elapsed since virtual_time
+	bool virtualized = false;
+	bool shed = false; // virtualized for mixer load, see MiniAudio_ShedQuietestVoice()
+	// turned inaudible while mixed; the audio thread virtualizes it, as only
+	// it may read the cursor of a sound it is decoding
+	bool virtual_pending = false;
+	uint64_t virtual_cursor = 0;
+	uint64_t virtual_time = 0;
+
+	// statistics
+	uint64_t command_ns = 0;         // start of the command that created the stream
+	bool mixed = false;              // first-mix latency recorded
+	unsigned int voice_type = 0;     // AltsoundSampleType counted while started
 };
 
 // An ended (non-looping) stream queued by the miniAudio end callback (audio
@@ -49,22 +73,109 @@ struct EndedStream {
 	void* userdata;
 };
 
-extern std::vector<EndedStream> g_endedStreams;
-extern std::mutex g_endedMutex;
+// miniAudio result of the last call on the calling thread's context
+int MiniAudio_ErrorGetCode();
+void MiniAudio_ErrorSetCode(int ma_err);
+
+// Engine PCM frame at which streams created from now on will start playing
+// when first played, 0 = start immediately
+void MiniAudio_SetScheduledStart(uint64_t start_frame);
+uint64_t MiniAudio_GetEngineTime();
+
+// Playing streams with a volume below this are virtualized (not decoded or
+// mixed) until they become audible again, 0 = never
+void MiniAudio_SetVirtualVoiceThreshold(float volume);
+
+// Mixer load control, audio thread: virtualizes the quietest playing stream
+// whose voice type bit (1 << AltsoundSampleType) is in type_mask. It stays
+// virtual whatever its volume until restored. False if there is none
+bool MiniAudio_ShedQuietestVoice(uint32_t type_mask);
+
+// Lets the loudest shed stream play again, false if there is none
+bool MiniAudio_RestoreShedVoice();
+
+// Resampler of streams created from now on, and the order of its low-pass
+// filter, 0 = none.  Linear without a filter is the cheapest.  Only samples
+// not at the engine rate are resampled
+enum MiniAudioResampler : uint8_t {
+	MINIAUDIO_RESAMPLER_LINEAR = 0,
+	MINIAUDIO_RESAMPLER_CUBIC
+};
+#define MINIAUDIO_DEFAULT_LPF_ORDER 4
+#define MINIAUDIO_MAX_LPF_ORDER 8
+void MiniAudio_SetResampler(MiniAudioResampler algorithm, uint32_t lpf_order);
+
+// Audio thread, once per period after mixing: virtualizes voices that turned
+// inaudible, ends non-looping virtual voices whose timeline has run out and
+// records first-mix latencies
+void MiniAudio_UpdateStreams();
+
+// Audio thread: moves the queued SYNCPROCs into out, leaving it the
+// previous buffer of out, so neither reallocates once reserved
+void MiniAudio_TakeEndedStreams(std::vector<EndedStream>& out);
+void MiniAudio_ReserveEndedStreams(size_t count);
+void MiniAudio_ClearEndedStreams();
+
+// True while no stream is playing (paused ones are silent) and no SYNCPROC
+// is queued: the mix is silence and nothing needs the audio thread.  A
+// single atomic load
+bool MiniAudio_IsIdle();
+
+// Stream lifecycle notifications, see MiniAudio_SetStreamEventProc()
+enum class MiniAudioStreamEvent { Create, Play, Restart, Pause, Stop, Volume, End, Free };
+
+// frame is the engine time of the event, value the new volume (Volume) and
+// file the sample path (Create, otherwise nullptr).  The handler may be
+// called with the stream map locked and must not call the stream API
+typedef void (*MiniAudioStreamEventProc)(MiniAudioStreamEvent event, unsigned int hstream, uint64_t frame,
+                                         float value, const char* file, void* user);
+
+// Streams of one engine and the settings they are created with.  Each
+// AltsoundContext has its own; the functions here work on the one of the
+// calling thread's context
+struct MiniAudioState {
+	std::unordered_map<unsigned int, _internal_stream_data> map;
+	std::mutex map_mutex;
+	uint32_t next_stream_id = 1;
+	unsigned int next_sync_id = 1;
+
+	// SYNCPROCs queued by the end callback, see MiniAudio_TakeEndedStreams()
+	std::vector<EndedStream> ended;
+	std::mutex ended_mutex;
+	bool ended_queued = false; // ended_mutex
+
+	// Streams playing and not paused, plus one while SYNCPROCs are queued,
+	// see MiniAudio_IsIdle()
+	std::atomic<uint32_t> active{ 0 };
+
+	uint64_t scheduled_start_frame = 0;       // see MiniAudio_SetScheduledStart()
+	std::atomic<bool> load_to_memory{ false }; // see MiniAudio_SetLoadToMemory()
+	float virtual_threshold = 0.0f;           // 0 = never virtualize
+	MiniAudioResampler resampler = MINIAUDIO_RESAMPLER_LINEAR;
+	uint32_t resampler_lpf_order = MINIAUDIO_DEFAULT_LPF_ORDER;
+	MiniAudioStreamEventProc event_proc = nullptr;
+	void* event_user = nullptr;
+	int last_error = 0;
+};
+
+// Installs a stream event handler, nullptr removes it.  Not synchronized
+// with the streams; set it while no streams exist
+void MiniAudio_SetStreamEventProc(MiniAudioStreamEventProc proc, void* user);
+
+// lower-case event name, as written to event logs
+const char* toString(MiniAudioStreamEvent event);
 
-extern uint32_t g_sampleRate;
-extern uint32_t g_channels;
-extern int g_last_ma_err;
+// Streams created from now on read their whole file into locked memory
+// first, so decoding on the audio thread never touches the file system
+void MiniAudio_SetLoadToMemory(bool load);
 
-inline int MiniAudio_ErrorGetCode()
-{
-	return g_last_ma_err;
-}
+// Number of streams not freed yet
+size_t MiniAudio_GetStreamCount();
 
-inline void MiniAudio_ErrorSetCode(int ma_err)
-{
-	g_last_ma_err = ma_err;
-}
+// True while the stream exists and its end SYNCPROC is still hsync.  Queued
+// SYNCPROCs are checked with this before they fire, since the stream may
+// have been freed (or ended twice) in the meantime
+bool MiniAudio_ChannelHasSync(unsigned int hstream, unsigned int hsync);
 
 unsigned int MiniAudio_StreamCreateFile(bool mem, const std::string& file, unsigned long long length, bool loop);
 bool MiniAudio_ChannelSetVolume(unsigned int hstream, float value);
@@ -72,6 +183,7 @@ bool MiniAudio_ChannelGetVolume(unsigned int hstream, float& value);
 unsigned int MiniAudio_ChannelSetSync(unsigned int hstream, unsigned int type, void* proc, void* user);
 bool MiniAudio_ChannelPlay(unsigned int hstream, bool restart);
 bool MiniAudio_ChannelPause(unsigned int hstream);
+bool MiniAudio_ChannelSetPosition(unsigned int hstream, uint64_t frame);
 bool MiniAudio_ChannelStop(unsigned int hstream);
 unsigned int MiniAudio_ChannelIsActive(unsigned int hstream);
 bool MiniAudio_StreamFree(unsigned int hstream);
@@ -12,6 +12,13 @@
 #undef STB_VORBIS_HEADER_ONLY
 #include <miniaudio/extras/stb_vorbis_static.c>
 
+#include "miniaudio_private.h"
+
+ma_result altsound_ma_decoder_init(ma_decoder_read_proc onRead, ma_decoder_seek_proc onSeek, void* pUserData, const ma_decoder_config* pConfig, ma_decoder* pDecoder)
+{
+    return ma_decoder_init(onRead, onSeek, pUserData, pConfig, pDecoder);
+}
+
 ma_result altsound_ma_decoder_init_file(const char* pFilePath, const ma_decoder_config* pConfig, ma_decoder* pDecoder)
 {
     return ma_decoder_init_file(pFilePath, pConfig, pDecoder);
@@ -47,8 +54,298 @@ ma_decoder_config altsound_ma_decoder_config_init(ma_format outputFormat, ma_uin
     return ma_decoder_config_init(outputFormat, outputChannels, outputSampleRate);
 }
 
+// ----------------------------------------------------------------------------
+// Cubic resampler: a custom miniaudio resampling backend interpolating
+// between the two middle frames of a 4-frame window with a Catmull-Rom
+// (4-point Hermite) spline.  It loads input exactly like miniaudio's linear
+// resampler, so both produce the same frame counts and a stream ends on the
+// length the decoder reports; the lookahead frame costs one more frame of
+// delay (2 instead of 1).  Like the linear one, the optional
+// low-pass filter runs on the input when downsampling and on the output when
+// upsampling, and is bypassed when the rates match.  f32 only, which
+// miniaudio always uses as the mid format of custom backends.
+// ----------------------------------------------------------------------------
+
+typedef struct
+{
+    ma_uint32 channels;
+    ma_uint32 sampleRateIn;     // reduced by their GCF
+    ma_uint32 sampleRateOut;
+    ma_uint32 lpfOrder;
+    ma_uint32 inAdvanceInt;
+    ma_uint32 inAdvanceFrac;
+    ma_uint32 inTimeInt;
+    ma_uint32 inTimeFrac;
+    float* pWindow;             // 4 frames, oldest first, planar by frame
+    ma_lpf lpf;
+} altsound_cubic_resampler;
+
+typedef struct
+{
+    size_t windowOffset;
+    size_t lpfOffset;
+    size_t sizeInBytes;
+} altsound_cubic_heap_layout;
+
+static ma_lpf_config altsound_cubic_lpf_config(ma_uint32 channels, ma_uint32 sampleRateIn, ma_uint32 sampleRateOut, ma_uint32 lpfOrder)
+{
+    return ma_lpf_config_init(ma_format_f32, channels, ma_max(sampleRateIn, sampleRateOut),
+                              ma_min(sampleRateIn, sampleRateOut) * 0.5, lpfOrder);
+}
+
+static ma_result altsound_cubic_get_heap_layout(const ma_resampler_config* pConfig, altsound_cubic_heap_layout* pLayout)
+{
+    if (pConfig->format != ma_format_f32 || pConfig->channels == 0 || pConfig->sampleRateIn == 0 ||
+        pConfig->sampleRateOut == 0 || pConfig->linear.lpfOrder > MA_MAX_FILTER_ORDER)
+        return MA_INVALID_ARGS;
+
+    const ma_uint32 gcf = ma_gcf_u32(pConfig->sampleRateIn, pConfig->sampleRateOut);
+    ma_lpf_config lpfConfig = altsound_cubic_lpf_config(pConfig->channels, pConfig->sampleRateIn / gcf,
+                                                        pConfig->sampleRateOut / gcf, pConfig->linear.lpfOrder);
+    size_t lpfSize;
+    ma_result result = ma_lpf_get_heap_size(&lpfConfig, &lpfSize);
+    if (result != MA_SUCCESS)
+        return result;
+
+    pLayout->windowOffset = ma_align_64(sizeof(altsound_cubic_resampler));
+    pLayout->lpfOffset = pLayout->windowOffset + ma_align_64(sizeof(float) * 4 * pConfig->channels);
+    pLayout->sizeInBytes = pLayout->lpfOffset + ma_align_64(lpfSize);
+    return MA_SUCCESS;
+}
+
+static ma_result altsound_cubic_set_rate(altsound_cubic_resampler* pResampler, void* pLpfHeap, ma_uint32 sampleRateIn, ma_uint32 sampleRateOut)
+{
+    if (sampleRateIn == 0 || sampleRateOut == 0)
+        return MA_INVALID_ARGS;
+
+    const ma_uint32 oldSampleRateOut = pResampler->sampleRateOut;
+    const ma_uint32 gcf = ma_gcf_u32(sampleRateIn, sampleRateOut);
+    pResampler->sampleRateIn = sampleRateIn / gcf;
+    pResampler->sampleRateOut = sampleRateOut / gcf;
+
+    // reinitializing keeps the filter history
+    ma_lpf_config lpfConfig = altsound_cubic_lpf_config(pResampler->channels, pResampler->sampleRateIn,
+                                                        pResampler->sampleRateOut, pResampler->lpfOrder);
+    ma_result result = pLpfHeap ? ma_lpf_init_preallocated(&lpfConfig, pLpfHeap, &pResampler->lpf)
+                                : ma_lpf_reinit(&lpfConfig, &pResampler->lpf);
+    if (result != MA_SUCCESS)
+        return result;
+
+    pResampler->inAdvanceInt = pResampler->sampleRateIn / pResampler->sampleRateOut;
+    pResampler->inAdvanceFrac = pResampler->sampleRateIn % pResampler->sampleRateOut;
+
+    // the fractional time was in units of the old output rate
+    if (oldSampleRateOut != 0) {
+        pResampler->inTimeFrac = (ma_uint32)(((ma_uint64)pResampler->inTimeFrac * pResampler->sampleRateOut) / oldSampleRateOut);
+        pResampler->inTimeInt += pResampler->inTimeFrac / pResampler->sampleRateOut;
+        pResampler->inTimeFrac %= pResampler->sampleRateOut;
+    }
+    return MA_SUCCESS;
+}
+
+static ma_result altsound_cubic_get_heap_size(void* pUserData, const ma_resampler_config* pConfig, size_t* pHeapSizeInBytes)
+{
+    (void)pUserData;
+
+    altsound_cubic_heap_layout layout;
+    ma_result result = altsound_cubic_get_heap_layout(pConfig, &layout);
+    if (result != MA_SUCCESS)
+        return result;
+
+    *pHeapSizeInBytes = layout.sizeInBytes;
+    return MA_SUCCESS;
+}
+
+static ma_result altsound_cubic_reset(void* pUserData, ma_resampling_backend* pBackend);
+
+static ma_result altsound_cubic_init(void* pUserData, const ma_resampler_config* pConfig, void* pHeap, ma_resampling_backend** ppBackend)
+{
+    altsound_cubic_heap_layout layout;
+    ma_result result = altsound_cubic_get_heap_layout(pConfig, &layout);
+    if (result != MA_SUCCESS)
+        return result;
+
+    MA_ZERO_MEMORY(pHeap, layout.sizeInBytes);
+    altsound_cubic_resampler* pResampler = (altsound_cubic_resampler*)pHeap;
+    pResampler->channels = pConfig->channels;
+    pResampler->lpfOrder = pConfig->linear.lpfOrder;
+    pResampler->pWindow = (float*)ma_offset_ptr(pHeap, layout.windowOffset);
+
+    result = altsound_cubic_set_rate(pResampler, ma_offset_ptr(pHeap, layout.lpfOffset), pConfig->sampleRateIn, pConfig->sampleRateOut);
+    if (result != MA_SUCCESS)
+        return result;
+
+    altsound_cubic_reset(pUserData, pResampler);
+    *ppBackend = pResampler;
+    return MA_SUCCESS;
+}
+
+static void altsound_cubic_uninit(void* pUserData, ma_resampling_backend* pBackend, const ma_allocation_callbacks* pAllocationCallbacks)
+{
+    // the backend lives in the heap owned by the ma_resampler
+    (void)pUserData;
+    ma_lpf_uninit(&((altsound_cubic_resampler*)pBackend)->lpf, pAllocationCallbacks);
+}
+
+static ma_result altsound_cubic_process(void* pUserData, ma_resampling_backend* pBackend, const void* pFramesIn, ma_uint64* pFrameCountIn, void* pFramesOut, ma_uint64* pFrameCountOut)
+{
+    (void)pUserData;
+
+    altsound_cubic_resampler* pResampler = (altsound_cubic_resampler*)pBackend;
+    const ma_uint32 channels = pResampler->channels;
+    const ma_bool32 filter = pResampler->sampleRateIn != pResampler->sampleRateOut;
+    const ma_bool32 downsample = pResampler->sampleRateIn > pResampler->sampleRateOut;
+    const float* pIn = (const float*)pFramesIn;
+    float* pOut = (float*)pFramesOut;
+    float* xm1 = pResampler->pWindow;
+    float* x0 = xm1 + channels;
+    float* x1 = x0 + channels;
+    float* x2 = x1 + channels;
+    ma_uint64 framesIn = 0;
+    ma_uint64 framesOut = 0;
+
+    while (framesOut < *pFrameCountOut) {
+        // slide the window until the next output frame lies between x0 and x1
+        while (pResampler->inTimeInt > 0 && framesIn < *pFrameCountIn) {
+            for (ma_uint32 c = 0; c < channels; ++c) {
+                xm1[c] = x0[c];
+                x0[c] = x1[c];
+                x1[c] = x2[c];
+                x2[c] = pIn ? pIn[c] : 0.0f;
+            }
+            if (filter && downsample)
+                ma_lpf_process_pcm_frame_f32(&pResampler->lpf, x2, x2);
+            if (pIn)
+                pIn += channels;
+            ++framesIn;
+            --pResampler->inTimeInt;
+        }
+        if (pResampler->inTimeInt > 0)
+            break; // out of input
+
+        if (pOut) {
+            const float t = (float)pResampler->inTimeFrac / pResampler->sampleRateOut;
+            for (ma_uint32 c = 0; c < channels; ++c) {
+                const float a = 0.5f * (x2[c] - xm1[c]) + 1.5f * (x0[c] - x1[c]);
+                const float b = xm1[c] - 2.5f * x0[c] + 2.0f * x1[c] - 0.5f * x2[c];
+                const float d = 0.5f * (x1[c] - xm1[c]);
+                pOut[c] = ((a * t + b) * t + d) * t + x0[c];
+            }
+            if (filter && !downsample)
+                ma_lpf_process_pcm_frame_f32(&pResampler->lpf, pOut, pOut);
+            pOut += channels;
+        }
+        ++framesOut;
+
+        pResampler->inTimeInt += pResampler->inAdvanceInt;
+        pResampler->inTimeFrac += pResampler->inAdvanceFrac;
+        if (pResampler->inTimeFrac >= pResampler->sampleRateOut) {
+            pResampler->inTimeFrac -= pResampler->sampleRateOut;
+            ++pResampler->inTimeInt;
+        }
+    }
+
+    *pFrameCountIn = framesIn;
+    *pFrameCountOut = framesOut;
+    return MA_SUCCESS;
+}
+
+static ma_result altsound_cubic_set_rate_backend(void* pUserData, ma_resampling_backend* pBackend, ma_uint32 sampleRateIn, ma_uint32 sampleRateOut)
+{
+    (void)pUserData;
+    return altsound_cubic_set_rate((altsound_cubic_resampler*)pBackend, NULL, sampleRateIn, sampleRateOut);
+}
+
+static ma_uint64 altsound_cubic_get_input_latency(void* pUserData, const ma_resampling_backend* pBackend)
+{
+    (void)pUserData;
+    return 2 + ma_lpf_get_latency(&((const altsound_cubic_resampler*)pBackend)->lpf);
+}
+
+static ma_uint64 altsound_cubic_get_output_latency(void* pUserData, const ma_resampling_backend* pBackend)
+{
+    const altsound_cubic_resampler* pResampler = (const altsound_cubic_resampler*)pBackend;
+    return altsound_cubic_get_input_latency(pUserData, pBackend) * pResampler->sampleRateOut / pResampler->sampleRateIn;
+}
+
+// same arithmetic as ma_linear_resampler_get_required_input_frame_count()
+static ma_result altsound_cubic_get_required_input_frame_count(void* pUserData, const ma_resampling_backend* pBackend, ma_uint64 outputFrameCount, ma_uint64* pInputFrameCount)
+{
+    (void)pUserData;
+
+    const altsound_cubic_resampler* pResampler = (const altsound_cubic_resampler*)pBackend;
+    *pInputFrameCount = 0;
+    if (outputFrameCount == 0)
+        return MA_SUCCESS;
+
+    outputFrameCount -= 1;
+    *pInputFrameCount = pResampler->inTimeInt + outputFrameCount * pResampler->inAdvanceInt +
+                        (pResampler->inTimeFrac + outputFrameCount * pResampler->inAdvanceFrac) / pResampler->sampleRateOut;
+    return MA_SUCCESS;
+}
+
+// same arithmetic as ma_linear_resampler_get_expected_output_frame_count()
+static ma_result altsound_cubic_get_expected_output_frame_count(void* pUserData, const ma_resampling_backend* pBackend, ma_uint64 inputFrameCount, ma_uint64* pOutputFrameCount)
+{
+    (void)pUserData;
+
+    const altsound_cubic_resampler* pResampler = (const altsound_cubic_resampler*)pBackend;
+    ma_uint64 outputFrameCount = (inputFrameCount * pResampler->sampleRateOut) / pResampler->sampleRateIn;
+    const ma_uint64 consumed = pResampler->inTimeInt + outputFrameCount * pResampler->inAdvanceInt +
+                               (pResampler->inTimeFrac + outputFrameCount * pResampler->inAdvanceFrac) / pResampler->sampleRateOut;
+    if (consumed <= inputFrameCount)
+        outputFrameCount += 1;
+
+    *pOutputFrameCount = outputFrameCount;
+    return MA_SUCCESS;
+}
+
+static ma_result altsound_cubic_reset(void* pUserData, ma_resampling_backend* pBackend)
+{
+    (void)pUserData;
+
+    altsound_cubic_resampler* pResampler = (altsound_cubic_resampler*)pBackend;
+
+    // one frame is loaded before the first output frame, which then lies on
+    // a silent frame, as with linear
+    pResampler->inTimeInt = 1;
+    pResampler->inTimeFrac = 0;
+    MA_ZERO_MEMORY(pResampler->pWindow, sizeof(float) * 4 * pResampler->channels);
+    return ma_lpf_clear_cache(&pResampler->lpf);
+}
+
+static ma_resampling_backend_vtable g_altsound_cubic_vtable =
+{
+    altsound_cubic_get_heap_size,
+    altsound_cubic_init,
+    altsound_cubic_uninit,
+    altsound_cubic_process,
+    altsound_cubic_set_rate_backend,
+    altsound_cubic_get_input_latency,
+    altsound_cubic_get_output_latency,
+    altsound_cubic_get_required_input_frame_count,
+    altsound_cubic_get_expected_output_frame_count,
+    altsound_cubic_reset
+};
+
+void altsound_ma_decoder_config_set_resampler(ma_decoder_config* pConfig, altsound_resampler algorithm, ma_uint32 lpfOrder)
+{
+    pConfig->resampling.linear.lpfOrder = ma_min(lpfOrder, MA_MAX_FILTER_ORDER);
+    if (algorithm == altsound_resampler_cubic) {
+        pConfig->resampling.algorithm = ma_resample_algorithm_custom;
+        pConfig->resampling.pBackendVTable = &g_altsound_cubic_vtable;
+        pConfig->resampling.pBackendUserData = NULL;
+    }
+    else {
+        pConfig->resampling.algorithm = ma_resample_algorithm_linear;
+        pConfig->resampling.pBackendVTable = NULL;
+        pConfig->resampling.pBackendUserData = NULL;
+    }
+}
+
 ma_result altsound_ma_engine_init_null_device(ma_uint32 channels, ma_uint32 sampleRate, ma_uint32 periodSizeInFrames,
-    ma_engine_process_proc onProcess, void* pProcessUserData, ma_context* pContext, ma_engine* pEngine)
+    ma_device_data_proc dataCallback, ma_engine_process_proc onProcess, void* pProcessUserData,
+    ma_context* pContext, ma_device* pDevice, ma_engine* pEngine)
 {
     // A null device gives us miniAudio's own realtime-paced audio thread (timing,
     // throttling and buffering) without ever touching the hardware. The mixed
@@ -59,10 +356,25 @@ ma_result altsound_ma_engine_init_null_device(ma_uint32 channels, ma_uint32 samp
     if (result != MA_SUCCESS)
         return result;
 
+    // We own the device so its data callback can wrap the engine read
+    // (dataCallback must call altsound_ma_engine_read_pcm_frames() with the
+    // engine in pDevice->pUserData)
+    ma_device_config deviceConfig = ma_device_config_init(ma_device_type_playback);
+    deviceConfig.playback.format = ma_format_f32;
+    deviceConfig.playback.channels = channels;
+    deviceConfig.sampleRate = sampleRate;
+    deviceConfig.periodSizeInFrames = periodSizeInFrames;
+    deviceConfig.dataCallback = dataCallback;
+    deviceConfig.pUserData = pEngine;
+
+    result = ma_device_init(pContext, &deviceConfig, pDevice);
+    if (result != MA_SUCCESS) {
+        ma_context_uninit(pContext);
+        return result;
+    }
+
     ma_engine_config config = ma_engine_config_init();
-    config.pContext = pContext;
-    config.channels = channels;
-    config.sampleRate = sampleRate;
+    config.pDevice = pDevice;
     config.periodSizeInFrames = periodSizeInFrames;
     config.onProcess = onProcess;
     config.pProcessUserData = pProcessUserData;
@@ -70,12 +382,40 @@ ma_result altsound_ma_engine_init_null_device(ma_uint32 channels, ma_uint32 samp
 
     result = ma_engine_init(&config, pEngine);
     if (result != MA_SUCCESS) {
+        ma_device_uninit(pDevice);
         ma_context_uninit(pContext);
         return result;
     }
     return MA_SUCCESS;
 }
 
+ma_result altsound_ma_engine_init_no_device(ma_uint32 channels, ma_uint32 sampleRate,
+    ma_engine_process_proc onProcess, void* pProcessUserData, ma_engine* pEngine)
+{
+    // No device and no audio thread: the engine only mixes when
+    // altsound_ma_engine_read_pcm_frames() is called. Without a period size
+    // the node graph mixes exactly the frames requested instead of whole
+    // periods ahead, so the engine time always equals the frames read
+    ma_engine_config config = ma_engine_config_init();
+    config.noDevice = MA_TRUE;
+    config.channels = channels;
+    config.sampleRate = sampleRate;
+    config.onProcess = onProcess;
+    config.pProcessUserData = pProcessUserData;
+
+    return ma_engine_init(&config, pEngine);
+}
+
+ma_result altsound_ma_engine_read_pcm_frames(ma_engine* pEngine, void* pFramesOut, ma_uint64 frameCount)
+{
+    return ma_engine_read_pcm_frames(pEngine, pFramesOut, frameCount, NULL);
+}
+
+void altsound_ma_device_uninit(ma_device* pDevice)
+{
+    ma_device_uninit(pDevice);
+}
+
 void altsound_ma_engine_uninit(ma_engine* pEngine)
 {
     ma_engine_uninit(pEngine);
@@ -96,6 +436,16 @@ ma_result altsound_ma_engine_stop(ma_engine* pEngine)
     return ma_engine_stop(pEngine);
 }
 
+ma_uint64 altsound_ma_engine_get_time_in_pcm_frames(const ma_engine* pEngine)
+{
+    return ma_engine_get_time_in_pcm_frames(pEngine);
+}
+
+ma_result altsound_ma_engine_set_time_in_pcm_frames(ma_engine* pEngine, ma_uint64 globalTime)
+{
+    return ma_engine_set_time_in_pcm_frames(pEngine, globalTime);
+}
+
 ma_result altsound_ma_sound_init_from_decoder(ma_engine* pEngine, ma_decoder* pDecoder, ma_uint32 flags, ma_sound* pSound)
 {
     return ma_sound_init_from_data_source(pEngine, (ma_data_source*)pDecoder, flags, NULL, pSound);
@@ -131,7 +481,17 @@ ma_result altsound_ma_sound_seek_to_pcm_frame(ma_sound* pSound, ma_uint64 frameI
     return ma_sound_seek_to_pcm_frame(pSound, frameIndex);
 }
 
+ma_result altsound_ma_sound_get_cursor_in_pcm_frames(ma_sound* pSound, ma_uint64* pCursor)
+{
+    return ma_sound_get_cursor_in_pcm_frames(pSound, pCursor);
+}
+
 void altsound_ma_sound_set_end_callback(ma_sound* pSound, ma_sound_end_proc callback, void* pUserData)
 {
     ma_sound_set_end_callback(pSound, callback, pUserData);
 }
+
+void altsound_ma_sound_set_start_time_in_pcm_frames(ma_sound* pSound, ma_uint64 absoluteGlobalTimeInFrames)
+{
+    ma_sound_set_start_time_in_pcm_frames(pSound, absoluteGlobalTimeInFrames);
+}
@@ -6,6 +6,7 @@
 extern "C" {
 #endif
 
+ma_result altsound_ma_decoder_init(ma_decoder_read_proc onRead, ma_decoder_seek_proc onSeek, void* pUserData, const ma_decoder_config* pConfig, ma_decoder* pDecoder);
 ma_result altsound_ma_decoder_init_file(const char* pFilePath, const ma_decoder_config* pConfig, ma_decoder* pDecoder);
 ma_result altsound_ma_decoder_init_memory(const void* pData, size_t dataSize, const ma_decoder_config* pConfig, ma_decoder* pDecoder);
 ma_result altsound_ma_decoder_read_pcm_frames(ma_decoder* pDecoder, void* pFramesOut, ma_uint64 frameCount, ma_uint64* pFramesRead);
@@ -14,12 +15,30 @@ ma_result altsound_ma_decoder_get_length_in_pcm_frames(ma_decoder* pDecoder, ma_
 void altsound_ma_decoder_uninit(ma_decoder* pDecoder);
 ma_decoder_config altsound_ma_decoder_config_init(ma_format outputFormat, ma_uint32 outputChannels, ma_uint32 outputSampleRate);
 
+// Resampler used when the decoder's sample rate differs from the output's.
+// lpfOrder is the order of the anti-aliasing low-pass filter, 0 = none, up
+// to MA_MAX_FILTER_ORDER
+typedef enum
+{
+    altsound_resampler_linear = 0, // miniaudio's own
+    altsound_resampler_cubic       // 4-point Catmull-Rom
+} altsound_resampler;
+
+void altsound_ma_decoder_config_set_resampler(ma_decoder_config* pConfig, altsound_resampler algorithm, ma_uint32 lpfOrder);
+
 ma_result altsound_ma_engine_init_null_device(ma_uint32 channels, ma_uint32 sampleRate, ma_uint32 periodSizeInFrames,
-    ma_engine_process_proc onProcess, void* pProcessUserData, ma_context* pContext, ma_engine* pEngine);
+    ma_device_data_proc dataCallback, ma_engine_process_proc onProcess, void* pProcessUserData,
+    ma_context* pContext, ma_device* pDevice, ma_engine* pEngine);
+ma_result altsound_ma_engine_init_no_device(ma_uint32 channels, ma_uint32 sampleRate,
+    ma_engine_process_proc onProcess, void* pProcessUserData, ma_engine* pEngine);
+ma_result altsound_ma_engine_read_pcm_frames(ma_engine* pEngine, void* pFramesOut, ma_uint64 frameCount);
+void altsound_ma_device_uninit(ma_device* pDevice);
 void altsound_ma_engine_uninit(ma_engine* pEngine);
 void altsound_ma_context_uninit(ma_context* pContext);
 ma_result altsound_ma_engine_start(ma_engine* pEngine);
 ma_result altsound_ma_engine_stop(ma_engine* pEngine);
+ma_uint64 altsound_ma_engine_get_time_in_pcm_frames(const ma_engine* pEngine);
+ma_result altsound_ma_engine_set_time_in_pcm_frames(ma_engine* pEngine, ma_uint64 globalTime);
 
 ma_result altsound_ma_sound_init_from_decoder(ma_engine* pEngine, ma_decoder* pDecoder, ma_uint32 flags, ma_sound* pSound);
 void altsound_ma_sound_uninit(ma_sound* pSound);
@@ -28,7 +47,9 @@ ma_result altsound_ma_sound_stop(ma_sound* pSound);
 void altsound_ma_sound_set_volume(ma_sound* pSound, float volume);
 void altsound_ma_sound_set_looping(ma_sound* pSound, ma_bool32 loop);
 ma_result altsound_ma_sound_seek_to_pcm_frame(ma_sound* pSound, ma_uint64 frameIndex);
+ma_result altsound_ma_sound_get_cursor_in_pcm_frames(ma_sound* pSound, ma_uint64* pCursor);
 void altsound_ma_sound_set_end_callback(ma_sound* pSound, ma_sound_end_proc callback, void* pUserData);
+void altsound_ma_sound_set_start_time_in_pcm_frames(ma_sound* pSound, ma_uint64 absoluteGlobalTimeInFrames);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,294 @@
+// ---------------------------------------------------------------------------
+// render.cpp
+//
+// Offline renderer for recorded sound command logs.  Instead of replaying a
+// cmdlog in real time through an audio device (see test.cpp), the engine is
+// initialized without an audio thread and driven by a virtual clock: every
+// command byte is fed at the exact engine frame of its timestamp, and frames
+// are pulled from the engine as fast as the CPU allows.
+//
+// Produces:
+//   - a 32-bit float WAV of the mixed output
+//   - a CSV log of every stream event (create, play, volume, pause, stop,
+//     end, free) with its engine frame
+//
+// and reports the realtime factor achieved.  Runs without audio hardware.
+//
+// Usage: altsound_render [options] <cmdlog> <output.wav>
+//   --package <dir>   altsound package directory, overrides the path
+//                     recorded in the log
+//   --events <file>   stream event log (default <output>.events.csv)
+//   --rate <hz>       sample rate (default 44100)
+//   --period <frames> mixing period (default 256)
+//   --tail <seconds>  rendered after the last command (default 5)
+//   --seed <n>        seeds sample selection (default 1, 0 = random). With
+//                     a fixed seed, the output is the same on every run
+// ---------------------------------------------------------------------------
+// license:BSD-3-Clause
+// copyright-holders: Dave Roscoe
+// ---------------------------------------------------------------------------
+
+#include "altsound.h"
+#include "altsound_cmdlog.hpp"
+#include "altsound_wav_writer.hpp"
+#include "miniaudio_bass_compat.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using std::string;
+
+// ---------------------------------------------------------------------------
+// Stream events
+// ---------------------------------------------------------------------------
+
+struct StreamEvent {
+	MiniAudioStreamEvent event;
+	unsigned int hstream;
+	uint64_t frame;
+	float value;
+};
+
+struct EventLog {
+	std::vector<StreamEvent> events;
+	std::unordered_map<unsigned int, string> files;
+};
+
+// Called with the stream map locked, so it only stores the event
+static void onStreamEvent(MiniAudioStreamEvent event, unsigned int hstream, uint64_t frame, float value,
+                          const char* file, void* user)
+{
+	EventLog* log = static_cast<EventLog*>(user);
+	log->events.push_back({ event, hstream, frame, value });
+
+	if (file) {
+		const string path = file;
+		const size_t slash = path.find_last_of("/\\");
+		log->files[hstream] = slash == string::npos ? path : path.substr(slash + 1);
+	}
+}
+
+static bool writeEvents(const string& path, const EventLog& log, uint32_t sample_rate)
+{
+	FILE* out = fopen(path.c_str(), "w");
+	if (!out)
+		return false;
+
+	fprintf(out, "time_s,frame,event,stream,volume,sample\n");
+	for (const StreamEvent& e : log.events) {
+		const auto file = log.files.find(e.hstream);
+		fprintf(out, "%.6f,%llu,%s,%u,", (double)e.frame / sample_rate, (unsigned long long)e.frame,
+		        toString(e.event), e.hstream);
+		if (e.event == MiniAudioStreamEvent::Volume)
+			fprintf(out, "%.4f", e.value);
+		fprintf(out, ",%s\n", file != log.files.end() ? file->second.c_str() : "");
+	}
+	return fclose(out) == 0;
+}
+
+// ---------------------------------------------------------------------------
+// Rendering
+// ---------------------------------------------------------------------------
+
+struct Renderer {
+	AltsoundWavWriter wav;
+	std::vector<float> buffer;
+	uint32_t period = 256;
+	uint32_t channels = 2;
+	uint64_t frame = 0;
+	float peak = 0.0f;
+
+	// renders up to (not including) the target frame
+	bool renderTo(uint64_t target)
+	{
+		while (frame < target) {
+			const size_t count = (size_t)std::min<uint64_t>(period, target - frame);
+			if (AltSoundRender(buffer.data(), count) != count || !wav.write(buffer.data(), count))
+				return false;
+
+			for (size_t i = 0; i < count * channels; ++i)
+				peak = std::max(peak, std::abs(buffer[i]));
+			frame += count;
+		}
+		return true;
+	}
+};
+
+// engine frame of a log timestamp, computed like the library's scheduling
+// so commands land on exactly the frame AltSoundProcessCommandAt() expects
+static uint64_t toFrame(uint64_t time_ns, uint32_t rate)
+{
+	return (time_ns / 1000000000ull) * rate + (time_ns % 1000000000ull) * rate / 1000000000ull;
+}
+
+// Splits <vpm>/altsound/<game>/ into the VPinMAME path and game name
+static bool splitPackagePath(string path, string& vpm_path, string& game)
+{
+	std::replace(path.begin(), path.end(), '\\', '/');
+	while (!path.empty() && path.back() == '/')
+		path.pop_back();
+
+	const size_t slash = path.find_last_of('/');
+	if (slash == string::npos)
+		return false;
+	game = path.substr(slash + 1);
+
+	const string parent = path.substr(0, slash);
+	const size_t altsound = parent.find_last_of('/');
+	if (parent.substr(altsound == string::npos ? 0 : altsound + 1) != "altsound")
+		return false;
+	vpm_path = altsound == string::npos ? "./" : parent.substr(0, altsound + 1);
+	return !game.empty();
+}
+
+// ---------------------------------------------------------------------------
+
+int main(int argc, const char* argv[])
+{
+	string package;
+	string events_path;
+	uint32_t rate = 44100;
+	uint32_t period = 256;
+	double tail_s = 5.0;
+	uint32_t seed = 1;
+	std::vector<string> files;
+	bool usage = false;
+
+	for (int i = 1; i < argc && !usage; ++i) {
+		const string arg = argv[i];
+		const bool has_value = i + 1 < argc;
+
+		if (arg == "--package" && has_value)
+			package = argv[++i];
+		else if (arg == "--events" && has_value)
+			events_path = argv[++i];
+		else if (arg == "--rate" && has_value)
+			rate = (uint32_t)std::strtoul(argv[++i], nullptr, 10);
+		else if (arg == "--period" && has_value)
+			period = (uint32_t)std::strtoul(argv[++i], nullptr, 10);
+		else if (arg == "--tail" && has_value)
+			tail_s = std::atof(argv[++i]);
+		else if (arg == "--seed" && has_value)
+			seed = (uint32_t)std::strtoul(argv[++i], nullptr, 10);
+		else if (arg.rfind("--", 0) == 0)
+			usage = true;
+		else
+			files.push_back(arg);
+	}
+
+	if (usage || files.size() != 2 || rate == 0 || period == 0) {
+		printf("Usage: %s [--package <dir>] [--events <file>] [--rate <hz>] [--period <frames>] [--tail <seconds>]\n"
+		       "       [--seed <n>] <cmdlog> <output.wav>\n", argv[0]);
+		return 1;
+	}
+
+	const string& log_path = files[0];
+	const string& wav_path = files[1];
+	if (events_path.empty())
+		events_path = wav_path + ".events.csv";
+
+	AltsoundCmdLog log;
+	if (!log.load(log_path)) {
+		fprintf(stderr, "Unable to read %s\n", log_path.c_str());
+		return 1;
+	}
+
+	string vpm_path;
+	string game;
+	if (!splitPackagePath(package.empty() ? log.altsound_path : package, vpm_path, game)) {
+		fprintf(stderr, "Not an altsound package path: %s\n", (package.empty() ? log.altsound_path : package).c_str());
+		return 1;
+	}
+
+	// the library logs next to the output
+	const size_t slash = wav_path.find_last_of("/\\");
+	AltSoundSetLogger(slash == string::npos ? "./" : wav_path.substr(0, slash + 1), ALTSOUND_LOG_LEVEL_ERROR, false);
+
+	EventLog events;
+	MiniAudio_SetStreamEventProc(onStreamEvent, &events);
+
+	AltSoundOptions options;
+	options.sampleRate = rate;
+	options.bufferSizeFrames = period;
+	options.manualRender = true;
+	options.randomSeed = seed;
+
+	if (!AltSoundInitWithOptions(vpm_path, game, options)) {
+		fprintf(stderr, "AltSoundInit failed for %s in %s\n", game.c_str(), vpm_path.c_str());
+		return 1;
+	}
+	AltSoundSetHardwareGen(log.initialHardwareGen());
+
+	// commands take effect on the frame they are fed at
+	AltSoundSetCommandLookahead(0);
+
+	Renderer renderer;
+	renderer.period = period;
+	renderer.channels = options.channels;
+	renderer.buffer.resize((size_t)period * options.channels);
+	if (!renderer.wav.open(wav_path, rate, options.channels)) {
+		fprintf(stderr, "Unable to create %s\n", wav_path.c_str());
+		AltSoundShutdown();
+		return 1;
+	}
+
+	printf("Rendering %s (%s) to %s\n", log_path.c_str(), game.c_str(), wav_path.c_str());
+
+	const auto start = std::chrono::steady_clock::now();
+	bool success = true;
+	size_t num_bytes = 0;
+
+	for (const AltsoundCmdLogEntry& entry : log.entries) {
+		if (!(success = renderer.renderTo(toFrame(entry.time_ns, rate))))
+			break;
+
+		if (entry.type == AltsoundCmdLogEntry::Type::HardwareGen) {
+			AltSoundSetHardwareGen((ALTSOUND_HARDWARE_GEN)entry.value);
+			continue;
+		}
+
+		// the log time also drives the decoder's inter-byte timeouts
+		AltSoundProcessCommandAt((unsigned int)entry.value, entry.attenuation, entry.time_ns);
+		++num_bytes;
+	}
+
+	if (success)
+		success = renderer.renderTo(renderer.frame + (uint64_t)(tail_s * rate));
+
+	const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	AltSoundStats stats;
+	AltSoundGetStats(&stats);
+	AltSoundShutdown();
+	MiniAudio_SetStreamEventProc(nullptr, nullptr);
+
+	success = renderer.wav.close() && success;
+	if (!success) {
+		fprintf(stderr, "Rendering to %s failed\n", wav_path.c_str());
+		return 1;
+	}
+
+	if (!writeEvents(events_path, events, rate)) {
+		fprintf(stderr, "Unable to write %s\n", events_path.c_str());
+		return 1;
+	}
+
+	uint32_t peak_voices = 0;
+	for (const uint32_t v : stats.peak_voices)
+		peak_voices += v;
+
+	const double audio_s = (double)renderer.frame / rate;
+	printf("%zu command bytes, %zu stream events, %u peak voices, %llu without free channel\n", num_bytes,
+	       events.events.size(), peak_voices, (unsigned long long)stats.channel_full);
+	printf("Peak level %.1f dBFS\n", renderer.peak > 0.0f ? 20.0 * std::log10(renderer.peak) : -INFINITY);
+	printf("Rendered %.1f s of audio in %.2f s: %.1fx realtime\n", audio_s, elapsed,
+	       elapsed > 0.0 ? audio_s / elapsed : 0.0);
+	printf("Events written to %s\n", events_path.c_str());
+	return 0;
+}
@@ -35,6 +35,7 @@
 #include <thread>
 #include <vector>
 #include <algorithm>
+#include <cstring>
 #include <chrono>
 #include <iostream>
 #include <fstream>
@@ -70,99 +71,37 @@ struct InitData {
 static ma_device g_device;
 static ma_device_config g_deviceConfig;
 
-#include <mutex>
-#include <queue>
-#include <vector>
-
-struct AltsoundAudioBuffer {
-	std::vector<float> data;
-	size_t frameCount;
-	uint32_t sampleRate;
-	uint32_t channels;
-};
-
-static std::queue<AltsoundAudioBuffer> g_audioQueue;
-static std::mutex g_audioQueueMutex;
-static const size_t MAX_QUEUE_SIZE = 10;
-
 void data_callback(ma_device* pDevice, void* pOutput, const void* pInput, ma_uint32 frameCount)
 {
-	(void)pDevice;
 	(void)pInput;
 
 	float* output = (float*)pOutput;
 	const uint32_t channels = pDevice->playback.channels;
 	static uint32_t underrun_count = 0;
 
-	std::unique_lock<std::mutex> lock(g_audioQueueMutex);
+	// mixed frames are read in place from the output ring; at its end, the
+	// rest comes from a second span
+	size_t framesDone = 0;
+	while (framesDone < frameCount) {
+		const float* samples;
+		const size_t n = AltSoundRingRead(&samples, frameCount - framesDone);
+		if (n == 0)
+			break;
+
+		memcpy(&output[framesDone * channels], samples, n * channels * sizeof(float));
+		AltSoundRingCommit(n);
+		framesDone += n;
+	}
 
-	if (g_audioQueue.empty()) {
+	if (framesDone < frameCount) {
 		++underrun_count;
 		if (underrun_count == 1 || (underrun_count % 100) == 0) {
-			std::cout << "Audio queue underrun (count=" << std::dec << underrun_count << ")" << std::endl;
-		}
-		memset(output, 0, frameCount * channels * sizeof(float));
-		return;
-	}
-
-	size_t outIndex = 0;
-	size_t framesRemaining = frameCount;
-
-	while (framesRemaining > 0 && !g_audioQueue.empty()) {
-		AltsoundAudioBuffer& buffer = g_audioQueue.front();
-
-		if (buffer.data.empty()) {
-			g_audioQueue.pop();
-			continue;
-		}
-
-		const size_t bufferFrames = buffer.data.size() / channels;
-		const size_t framesToCopy = std::min(framesRemaining, bufferFrames);
-		const size_t samplesToCopy = framesToCopy * channels;
-
-		memcpy(&output[outIndex], buffer.data.data(), samplesToCopy * sizeof(float));
-
-		outIndex += samplesToCopy;
-		framesRemaining -= framesToCopy;
-
-		if (framesToCopy >= bufferFrames) {
-			g_audioQueue.pop();
-		} else {
-			buffer.data.erase(buffer.data.begin(), buffer.data.begin() + samplesToCopy);
+			std::cout << "Audio ring underrun (count=" << std::dec << underrun_count << ")" << std::endl;
 		}
-	}
-
-	if (framesRemaining > 0) {
-		memset(&output[outIndex], 0, framesRemaining * channels * sizeof(float));
+		memset(&output[framesDone * channels], 0, (frameCount - framesDone) * channels * sizeof(float));
 	}
 }
 
-void audio_callback_bridge(const float* samples, size_t frameCount, uint32_t sampleRate, uint32_t channels, void* userData)
-{
-	(void)userData;
-
-	if (!samples || frameCount == 0 || channels == 0)
-		return;
-
-	std::lock_guard<std::mutex> lock(g_audioQueueMutex);
-
-	if (g_audioQueue.size() >= MAX_QUEUE_SIZE) {
-		std::cout << "Audio queue full; dropping buffer" << std::endl;
-		return;
-	}
-
-	AltsoundAudioBuffer buffer;
-	buffer.frameCount = frameCount;
-	buffer.sampleRate = sampleRate;
-	buffer.channels = channels;
-
-	const size_t totalSamples = frameCount * channels;
-	buffer.data.reserve(totalSamples);
-	buffer.data.assign(samples, samples + totalSamples);
-
-	g_audioQueue.emplace(std::move(buffer));
-}
-
 // ----------------------------------------------------------------------------
 
 string extractValue(const string& line) {
@@ -337,8 +276,14 @@ std::pair<bool, InitData> init(const string& log_path)
 
         const uint32_t bufferSize = g_device.playback.internalPeriodSizeInFrames;
 
-		const bool init_ok = AltSoundInit(init_data.vpm_path, init_data.game_name,
-										  g_device.sampleRate, g_device.playback.channels, bufferSize);
+		AltSoundOptions options;
+		options.sampleRate = g_device.sampleRate;
+		options.channels = g_device.playback.channels;
+		options.bufferSizeFrames = bufferSize;
+		options.outputRingFrames = 4 * bufferSize;
+		options.driftCompensation = true;
+
+		const bool init_ok = AltSoundInitWithOptions(init_data.vpm_path, init_data.game_name, options);
 		if (!init_ok) {
 			std::cout << "AltSoundInit failed." << std::endl;
 			throw std::runtime_error("AltSoundInit failed");
@@ -352,8 +297,6 @@ std::pair<bool, InitData> init(const string& log_path)
             throw std::runtime_error("Failed to start miniaudio device");
         }
 
-        AltSoundSetAudioCallback(audio_callback_bridge, nullptr);
-
         std::this_thread::sleep_for(std::chrono::milliseconds(100));
 
 		std::cout << "END init()" << std::endl;
@@ -0,0 +1,542 @@
+// ---------------------------------------------------------------------------
+// golden.cpp
+//
+// Golden-output regression test for the mixer and the sample processors.
+// Each case builds a synthetic sample package, renders a command log from
+// tests/golden/<case>.txt offline with a fixed random seed, and compares
+// the result with tests/golden/<case>.golden:
+//
+//   - the stream events (create, play, volume, pause, stop, end, free) and
+//     the frame they happen on must match exactly;
+//   - the output must hash to the same value, or failing that (e.g. other
+//     compiler or CPU), every 50 ms window must have the same RMS level
+//     within a small tolerance.
+//
+// The rendered output is kept in <work dir>/<case>.wav for inspection.
+//
+// With --contexts, the case is also rendered in that many contexts at once,
+// each on a thread of its own.  Every one must produce the same events and
+// the same output, bit for bit, as the render in the default context.
+//
+// Usage: altsound_golden [--update] [--contexts <n>] <case> <data dir> <work dir>
+//   --update    rewrites the golden file from the current output
+//   --contexts  renders in <n> contexts in parallel as well
+// ---------------------------------------------------------------------------
+// license:BSD-3-Clause
+// copyright-holders: Dave Roscoe
+// ---------------------------------------------------------------------------
+
+#include "altsound.h"
+#include "altsound_cmdlog.hpp"
+#include "altsound_context.hpp"
+#include "altsound_wav_writer.hpp"
+#include "miniaudio_bass_compat.hpp"
+#include "test_package.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace fs = std::filesystem;
+using std::string;
+
+// ---------------------------------------------------------------------------
+// Test cases
+// ---------------------------------------------------------------------------
+
+struct GoldenCase {
+	const char* name;
+	TestPackage package;
+	double tail_s; // rendered after the last command
+};
+
+static const char* const gsoundIniHeader =
+	"[system]\n"
+	"record_sound_cmds = 0\n"
+	"rom_volume_ctrl = 1\n"
+	"cmd_skip_count = 0\n"
+	"virtual_voice_db = -60\n"
+	"\n"
+	"[format]\n"
+	"format = g-sound\n"
+	"\n"
+	"[logging]\n"
+	"logging_level = Error\n"
+	"\n";
+
+static const std::vector<GoldenCase>& goldenCases()
+{
+	static const std::vector<GoldenCase> cases = {
+		// PinSound-style folders: looping music, jingle ducking the music,
+		// sfx and voice on free channels, a single, stop music (0x03E3)
+		{ "legacy", { "", "", "",
+		  { { "music/000001-theme/theme.wav", 66150, 200, 6000 },
+		    { "jingle/000002-jingle/jingle.wav", 22050, 90, 8000 },
+		    { "sfx/000003-sfx/sfx.wav", 8820, 40, 5000 },
+		    { "voice/000004-voice/voice.wav", 26460, 150, 7000 },
+		    { "single/000005-single/single.wav", 17640, 60, 6000 } } },
+		  1.5 },
+
+		// altsound.csv: music change, jingle and sfx ducking, two samples
+		// for one command picked at random, looping sfx
+		{ "altsound", { "", "altsound.csv",
+		  "ID,CHANNEL,DUCK,GAIN,LOOP,STOP,NAME,FNAME,GROUP,SHAKER,SERIAL,PRELOAD,STOPCMD\n"
+		  "0x0010,0,100,60,100,0,music1,music1.wav,1,,,0,\n"
+		  "0x0011,0,100,50,100,0,music2,music2.wav,1,,,0,\n"
+		  "0x0020,1,30,80,0,0,jingle,jingle.wav,2,,,0,\n"
+		  "0x0030,,80,70,0,0,hit_a,hit_a.wav,3,,,0,\n"
+		  "0x0030,,80,70,0,0,hit_b,hit_b.wav,3,,,0,\n"
+		  "0x0031,,50,90,0,0,boom,boom.wav,3,,,0,\n"
+		  "0x0040,,100,40,100,0,motor,motor.wav,3,,,0,\n",
+		  { { "music1.wav", 88200, 180, 6000 },
+		    { "music2.wav", 88200, 250, 6000 },
+		    { "jingle.wav", 26460, 70, 8000 },
+		    { "hit_a.wav", 4410, 30, 9000 },
+		    { "hit_b.wav", 6615, 45, 9000 },
+		    { "boom.wav", 17640, 120, 10000 },
+		    { "motor.wav", 11025, 20, 4000 } } },
+		  1.5 },
+
+		// g-sound.csv with ducking profiles: callouts duck music and sfx,
+		// sfx duck music, overlays duck both with their own profile
+		{ "gsound_ducking", { string(gsoundIniHeader) +
+		  "[callout]\n"
+		  "ducks = sfx, music, overlay\n"
+		  "group_vol = 100\n"
+		  "\n"
+		  "[callout_ducking_profiles]\n"
+		  "ducking_profile1 = sfx:65, music:50, overlay:50\n"
+		  "ducking_profile2 = sfx:20, music:10, overlay:30\n"
+		  "\n"
+		  "[sfx]\n"
+		  "ducks = music\n"
+		  "group_vol = 80\n"
+		  "\n"
+		  "[sfx_ducking_profiles]\n"
+		  "ducking_profile1 = music:70\n"
+		  "\n"
+		  "[overlay]\n"
+		  "ducks = music, sfx\n"
+		  "group_vol = 100\n"
+		  "\n"
+		  "[overlay_ducking_profiles]\n"
+		  "ducking_profile1 = sfx:65, music:65\n",
+		  "g-sound.csv",
+		  "ID,TYPE,GAIN,DUCKING_PROFILE,FNAME\n"
+		  "0x0001,music,70,0,music.wav\n"
+		  "0x0002,callout,90,1,callout_a.wav\n"
+		  "0x0002,callout,90,1,callout_b.wav\n"
+		  "0x0002,callout,90,1,callout_c.wav\n"
+		  "0x0003,callout,90,2,callout_loud.wav\n"
+		  "0x0004,sfx,80,1,sfx.wav\n"
+		  "0x0005,overlay,60,1,overlay.wav\n",
+		  { { "music.wav", 132300, 220, 6000 },
+		    { "callout_a.wav", 17640, 80, 8000 },
+		    { "callout_b.wav", 22050, 95, 8000 },
+		    { "callout_c.wav", 13230, 110, 8000 },
+		    { "callout_loud.wav", 26460, 65, 9000 },
+		    { "sfx.wav", 8820, 35, 7000 },
+		    { "overlay.wav", 30870, 140, 5000 } } },
+		  1.5 },
+
+		// g-sound.csv with pausing and stopping: callouts pause the music,
+		// which resumes when the last callout ends; a solo stops everything
+		{ "gsound_pause", { string(gsoundIniHeader) +
+		  "[callout]\n"
+		  "pauses = music\n"
+		  "group_vol = 100\n"
+		  "\n"
+		  "[sfx]\n"
+		  "group_vol = 100\n"
+		  "\n"
+		  "[solo]\n"
+		  "stops = music, overlay, callout\n"
+		  "group_vol = 100\n",
+		  "g-sound.csv",
+		  "ID,TYPE,GAIN,DUCKING_PROFILE,FNAME\n"
+		  "0x0001,music,70,0,music.wav\n"
+		  "0x0002,callout,90,0,callout.wav\n"
+		  "0x0003,callout,90,0,callout_long.wav\n"
+		  "0x0004,sfx,80,0,sfx.wav\n"
+		  "0x0005,solo,100,0,solo.wav\n",
+		  { { "music.wav", 132300, 220, 6000 },
+		    { "callout.wav", 17640, 80, 8000 },
+		    { "callout_long.wav", 39690, 100, 8000 },
+		    { "sfx.wav", 8820, 35, 7000 },
+		    { "solo.wav", 44100, 160, 9000 } } },
+		  1.5 },
+	};
+	return cases;
+}
+
+// ---------------------------------------------------------------------------
+// Rendering
+// ---------------------------------------------------------------------------
+
+constexpr uint32_t sampleRate = 44100;
+constexpr uint32_t numChannels = 2;
+constexpr uint32_t periodFrames = 256;
+constexpr uint32_t randomSeed = 1;
+constexpr uint32_t windowFrames = sampleRate / 20; // 50 ms
+
+struct RenderResult {
+	std::vector<float> frames;
+	std::vector<string> events;
+};
+
+struct EventRecorder {
+	std::vector<string>* events = nullptr;
+	std::unordered_map<unsigned int, unsigned int> streams; // handle -> creation order
+	std::unordered_map<unsigned int, string> files;
+};
+
+// Stream handles are replaced by their creation order, so the events do not
+// depend on how handles are allocated
+static void onStreamEvent(MiniAudioStreamEvent event, unsigned int hstream, uint64_t frame, float value,
+                          const char* file, void* user)
+{
+	EventRecorder* rec = static_cast<EventRecorder*>(user);
+
+	const auto stream = rec->streams.emplace(hstream, (unsigned int)rec->streams.size() + 1).first;
+	if (file) {
+		const string path = file;
+		rec->files[hstream] = path.substr(path.find_last_of("/\\") + 1);
+	}
+
+	char line[256];
+	if (event == MiniAudioStreamEvent::Volume)
+		snprintf(line, sizeof(line), "%llu %s %u %s %.4f", (unsigned long long)frame, toString(event),
+		         stream->second, rec->files[hstream].c_str(), value);
+	else
+		snprintf(line, sizeof(line), "%llu %s %u %s", (unsigned long long)frame, toString(event),
+		         stream->second, rec->files[hstream].c_str());
+	rec->events->push_back(line);
+}
+
+// Renders in the given context, nullptr for the default one
+static bool render(const fs::path& work, const GoldenCase& test, const AltsoundCmdLog& log, AltSoundContext* context,
+                   RenderResult& result)
+{
+	// the stream event callback is per context
+	const AltsoundContext::Scope scope(context);
+
+	EventRecorder recorder;
+	recorder.events = &result.events;
+	MiniAudio_SetStreamEventProc(onStreamEvent, &recorder);
+
+	AltSoundOptions options;
+	options.sampleRate = sampleRate;
+	options.channels = numChannels;
+	options.bufferSizeFrames = periodFrames;
+	options.manualRender = true;
+	options.randomSeed = randomSeed;
+
+	if (!AltSoundCtxInitWithOptions(context, work.string(), test.name, options)) {
+		fprintf(stderr, "AltSoundInit failed for %s\n", test.name);
+		MiniAudio_SetStreamEventProc(nullptr, nullptr);
+		return false;
+	}
+	AltSoundCtxSetHardwareGen(context, log.initialHardwareGen());
+	AltSoundCtxSetCommandLookahead(context, 0);
+
+	bool success = true;
+	auto renderTo = [&](uint64_t target) {
+		while (success && result.frames.size() / numChannels < target) {
+			const size_t rendered = result.frames.size() / numChannels;
+			const size_t count = (size_t)std::min<uint64_t>(periodFrames, target - rendered);
+			result.frames.resize((rendered + count) * numChannels);
+			success = AltSoundCtxRender(context, &result.frames[rendered * numChannels], count) == count;
+		}
+	};
+
+	for (const AltsoundCmdLogEntry& entry : log.entries) {
+		renderTo((entry.time_ns / 1000000000ull) * sampleRate + (entry.time_ns % 1000000000ull) * sampleRate / 1000000000ull);
+
+		if (entry.type == AltsoundCmdLogEntry::Type::HardwareGen)
+			AltSoundCtxSetHardwareGen(context, (ALTSOUND_HARDWARE_GEN)entry.value);
+		else
+			AltSoundCtxProcessCommandAt(context, (unsigned int)entry.value, entry.attenuation, entry.time_ns);
+	}
+	renderTo(result.frames.size() / numChannels + (uint64_t)(test.tail_s * sampleRate));
+
+	AltSoundCtxShutdown(context);
+	MiniAudio_SetStreamEventProc(nullptr, nullptr);
+
+	if (!success)
+		fprintf(stderr, "AltSoundRender failed for %s\n", test.name);
+	return success;
+}
+
+static bool writeWav(const fs::path& path, const std::vector<float>& frames)
+{
+	AltsoundWavWriter wav;
+	return wav.open(path.string(), sampleRate, numChannels) && wav.write(frames.data(), frames.size() / numChannels) &&
+	       wav.close();
+}
+
+// ---------------------------------------------------------------------------
+// Golden files
+// ---------------------------------------------------------------------------
+
+struct Golden {
+	uint64_t frames = 0;
+	uint64_t hash = 0;
+	std::vector<double> rms;
+	std::vector<string> events;
+};
+
+// FNV-1a over the bit patterns of the samples
+static uint64_t hashFrames(const std::vector<float>& frames)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (const float f : frames) {
+		uint32_t bits;
+		memcpy(&bits, &f, sizeof(bits));
+		for (int i = 0; i < 4; ++i) {
+			hash ^= (bits >> (8 * i)) & 0xFF;
+			hash *= 0x100000001b3ull;
+		}
+	}
+	return hash;
+}
+
+static Golden summarize(const RenderResult& result)
+{
+	Golden golden;
+	golden.frames = result.frames.size() / numChannels;
+	golden.hash = hashFrames(result.frames);
+	golden.events = result.events;
+
+	for (uint64_t start = 0; start < golden.frames; start += windowFrames) {
+		const uint64_t end = std::min<uint64_t>(start + windowFrames, golden.frames);
+		double sum = 0.0;
+		for (uint64_t i = start * numChannels; i < end * numChannels; ++i)
+			sum += (double)result.frames[i] * result.frames[i];
+		golden.rms.push_back(std::sqrt(sum / (double)((end - start) * numChannels)));
+	}
+	return golden;
+}
+
+static bool saveGolden(const fs::path& path, const string& name, const Golden& golden)
+{
+	std::ofstream out(path);
+	out << "# altsound golden output for " << name << ", rewrite with altsound_golden --update\n";
+	out << "frames " << golden.frames << '\n';
+
+	char hex[17];
+	snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)golden.hash);
+	out << "hash " << hex << '\n';
+
+	char value[32];
+	for (const double rms : golden.rms) {
+		snprintf(value, sizeof(value), "%.6f", rms);
+		out << "rms " << value << '\n';
+	}
+	for (const string& event : golden.events)
+		out << "event " << event << '\n';
+	return out.good();
+}
+
+static bool loadGolden(const fs::path& path, Golden& golden)
+{
+	std::ifstream in(path);
+	if (!in.is_open())
+		return false;
+
+	string line;
+	while (std::getline(in, line)) {
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+
+		const size_t space = line.find(' ');
+		if (line.empty() || line[0] == '#' || space == string::npos)
+			continue;
+
+		const string key = line.substr(0, space);
+		const string value = line.substr(space + 1);
+		if (key == "frames")
+			golden.frames = std::strtoull(value.c_str(), nullptr, 10);
+		else if (key == "hash")
+			golden.hash = std::strtoull(value.c_str(), nullptr, 16);
+		else if (key == "rms")
+			golden.rms.push_back(std::atof(value.c_str()));
+		else if (key == "event")
+			golden.events.push_back(value);
+	}
+	return true;
+}
+
+static bool compare(const Golden& expected, const Golden& actual)
+{
+	bool success = true;
+
+	if (expected.frames != actual.frames) {
+		fprintf(stderr, "Length differs: %llu frames, expected %llu\n", (unsigned long long)actual.frames,
+		        (unsigned long long)expected.frames);
+		success = false;
+	}
+
+	const size_t num_events = std::min(expected.events.size(), actual.events.size());
+	for (size_t i = 0; i < num_events; ++i) {
+		if (expected.events[i] != actual.events[i]) {
+			fprintf(stderr, "Event %zu differs:\n  expected: %s\n  actual:   %s\n", i + 1,
+			        expected.events[i].c_str(), actual.events[i].c_str());
+			success = false;
+			break;
+		}
+	}
+	if (success && expected.events.size() != actual.events.size()) {
+		fprintf(stderr, "%zu stream events, expected %zu\n", actual.events.size(), expected.events.size());
+		success = false;
+	}
+
+	if (!success)
+		return false;
+
+	if (expected.hash == actual.hash) {
+		printf("Output matches bit for bit\n");
+		return true;
+	}
+
+	// Same events, other samples: accept rounding differences of another
+	// compiler or instruction set, not audible changes
+	size_t num_failed = 0;
+	for (size_t i = 0; i < expected.rms.size() && i < actual.rms.size(); ++i) {
+		const double tolerance = std::max(1e-5, expected.rms[i] * 1e-3);
+		if (std::abs(expected.rms[i] - actual.rms[i]) > tolerance) {
+			if (num_failed++ < 10)
+				fprintf(stderr, "RMS at %.2f s: %.6f, expected %.6f\n", (double)(i * windowFrames) / sampleRate,
+				        actual.rms[i], expected.rms[i]);
+		}
+	}
+	if (num_failed) {
+		fprintf(stderr, "%zu of %zu windows differ\n", num_failed, expected.rms.size());
+		return false;
+	}
+
+	printf("Output hash differs, RMS of all %zu windows within tolerance\n", expected.rms.size());
+	return true;
+}
+
+// Renders the case in num_contexts contexts at once, one thread each, and
+// compares every render with the single-context one
+static bool compareContexts(const fs::path& work, const GoldenCase& test, const AltsoundCmdLog& log,
+                            unsigned int num_contexts, const RenderResult& expected)
+{
+	std::vector<AltSoundContext*> contexts;
+	for (unsigned int i = 0; i < num_contexts; ++i)
+		contexts.push_back(AltSoundCreateContext());
+
+	std::vector<RenderResult> results(num_contexts);
+	std::vector<char> rendered(num_contexts, 0);
+	std::vector<std::thread> threads;
+	for (unsigned int i = 0; i < num_contexts; ++i)
+		threads.emplace_back([&, i] { rendered[i] = render(work, test, log, contexts[i], results[i]); });
+	for (std::thread& thread : threads)
+		thread.join();
+
+	for (AltSoundContext* context : contexts)
+		AltSoundDestroyContext(context);
+
+	unsigned int num_failed = 0;
+	for (unsigned int i = 0; i < num_contexts; ++i) {
+		if (!rendered[i])
+			fprintf(stderr, "Context %u: render failed\n", i + 1);
+		else if (results[i].events != expected.events)
+			fprintf(stderr, "Context %u: stream events differ\n", i + 1);
+		else if (results[i].frames != expected.frames)
+			fprintf(stderr, "Context %u: output differs\n", i + 1);
+		else
+			continue;
+		++num_failed;
+	}
+	if (num_failed)
+		return false;
+
+	printf("%u parallel contexts match bit for bit\n", num_contexts);
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+
+int main(int argc, const char* argv[])
+{
+	std::vector<string> args(argv + 1, argv + argc);
+	const auto update = std::find(args.begin(), args.end(), "--update");
+	const bool updating = update != args.end();
+	if (updating)
+		args.erase(update);
+
+	unsigned int num_contexts = 0;
+	const auto contexts = std::find(args.begin(), args.end(), "--contexts");
+	if (contexts != args.end() && contexts + 1 != args.end()) {
+		num_contexts = (unsigned int)std::atoi((contexts + 1)->c_str());
+		args.erase(contexts, contexts + 2);
+	}
+
+	if (args.size() != 3) {
+		printf("Usage: %s [--update] [--contexts <n>] <case> <data dir> <work dir>\n", argv[0]);
+		printf("Cases:");
+		for (const GoldenCase& test : goldenCases())
+			printf(" %s", test.name);
+		printf("\n");
+		return 1;
+	}
+
+	const auto& cases = goldenCases();
+	const auto test = std::find_if(cases.begin(), cases.end(), [&](const GoldenCase& c) { return args[0] == c.name; });
+	if (test == cases.end()) {
+		fprintf(stderr, "Unknown case: %s\n", args[0].c_str());
+		return 1;
+	}
+
+	const fs::path data = args[1];
+	const fs::path work = fs::path(args[2]) / test->name;
+	std::error_code ec;
+	fs::create_directories(work, ec);
+
+	AltSoundSetLogger(work.string() + '/', ALTSOUND_LOG_LEVEL_ERROR, false);
+
+	AltsoundCmdLog log;
+	if (!log.load((data / (string(test->name) + ".txt")).string())) {
+		fprintf(stderr, "Unable to read command log for %s\n", test->name);
+		return 1;
+	}
+
+	RenderResult result;
+	if (!createTestPackage(work, test->name, test->package) || !render(work, *test, log, nullptr, result))
+		return 1;
+
+	writeWav(work / (string(test->name) + ".wav"), result.frames);
+	const Golden actual = summarize(result);
+	const fs::path golden_path = data / (string(test->name) + ".golden");
+
+	if (updating) {
+		if (!saveGolden(golden_path, test->name, actual)) {
+			fprintf(stderr, "Unable to write %s\n", golden_path.string().c_str());
+			return 1;
+		}
+		printf("Updated %s (%zu events, %zu windows)\n", golden_path.string().c_str(), actual.events.size(),
+		       actual.rms.size());
+		return 0;
+	}
+
+	Golden expected;
+	if (!loadGolden(golden_path, expected)) {
+		fprintf(stderr, "Unable to read %s\n", golden_path.string().c_str());
+		return 1;
+	}
+
+	bool success = compare(expected, actual);
+	if (num_contexts)
+		success = compareContexts(work, *test, log, num_contexts, result) && success;
+	return success ? 0 : 1;
+}
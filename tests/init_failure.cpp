@@ -0,0 +1,104 @@
+// ---------------------------------------------------------------------------
+// init_failure.cpp
+//
+// Failed init test.  Initializes a context with a package that fails after
+// the engine is up, then with a good one, and shuts it down.  The test
+// fails if
+//
+//   - the bad package initializes;
+//   - the good package does not initialize after the failure;
+//   - the log writer still runs after the shutdown, which it does when the
+//     failed init left its engine behind, as the context then never
+//     counts as the last one shut down.
+//
+// Usage: altsound_init_failure <work dir>
+// ---------------------------------------------------------------------------
+// license:BSD-3-Clause
+// copyright-holders: Dave Roscoe
+// ---------------------------------------------------------------------------
+
+#include "altsound.h"
+#include "altsound_logger.hpp"
+#include "test_package.hpp"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+using std::string;
+
+extern AltsoundLogger alog;
+
+struct FailureCase {
+	const char* name;
+	const char* ini;
+};
+
+static const std::vector<FailureCase>& failureCases()
+{
+	static const std::vector<FailureCase> cases = {
+		{ "unknown_format", "[format]\nformat = bogus\n" },
+		{ "bad_ini",        "[format]\nformat = altsound\n\n[load_control]\nbogus = 1\n" },
+	};
+	return cases;
+}
+
+static bool run(const fs::path& work, const FailureCase& test)
+{
+	TestPackage bad = CLICK_PACKAGE;
+	bad.ini = test.ini;
+	const string bad_game = string("init_failure_") + test.name;
+	const string good_game = "init_failure";
+	if (!createTestPackage(work, bad_game, bad) || !createTestPackage(work, good_game, CLICK_PACKAGE))
+		return false;
+
+	AltSoundContext* context = AltSoundCreateContext();
+	AltSoundOptions options;
+	options.sampleRate = 44100;
+	options.channels = 2;
+	options.bufferSizeFrames = 256;
+
+	const unsigned int failures = g_failures;
+	if (AltSoundCtxInitWithOptions(context, work.string(), bad_game, options)) {
+		fail("a bad package initialized");
+		AltSoundCtxShutdown(context);
+	}
+	else if (alog.isRunning())
+		fail("the log writer still runs after a failed init");
+
+	if (!AltSoundCtxInitWithOptions(context, work.string(), good_game, options))
+		fail("init failed after a failed init");
+	else if (!alog.isRunning())
+		fail("the log writer does not run");
+	AltSoundCtxShutdown(context);
+	AltSoundDestroyContext(context);
+
+	if (alog.isRunning())
+		fail("the log writer still runs after the shutdown");
+
+	printf("%-16s %s\n", test.name, g_failures == failures ? "ok" : "FAILED");
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+
+int main(int argc, const char* argv[])
+{
+	if (argc != 2) {
+		printf("Usage: %s <work dir>\n", argv[0]);
+		return 1;
+	}
+
+	const fs::path work = argv[1];
+	std::error_code ec;
+	fs::create_directories(work, ec);
+
+	for (const FailureCase& test : failureCases()) {
+		// a log file, so the writer runs until the last context shuts down
+		AltSoundSetLogger(work.string() + '/', ALTSOUND_LOG_LEVEL_NONE, false);
+		if (!run(work, test))
+			return 1;
+	}
+	return g_failures ? 1 : 0;
+}
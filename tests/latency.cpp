@@ -0,0 +1,319 @@
+// ---------------------------------------------------------------------------
+// latency.cpp
+//
+// End-to-end latency harness.  Builds sample packages holding a single
+// click (a short burst followed by silence), fires the click command through
+// the public API at known instants and finds the click onset in the output
+// handed to the audio callback.  The latency of a command is the time from
+// the API call to the moment its first audible frame plays.
+//
+// Output frames play on a steady frame clock: frame n plays at anchor + n /
+// rate.  The anchor is the earliest time that still plays every period after
+// the callback delivered it, so late or bursty callbacks (the null device
+// wakes every few ms, whatever the period) count as the buffering they
+// require.  The output latency of the audio device and driver comes on top.
+//
+// Every processor is measured at every period size, with commands sent
+//
+//   immediate    AltSoundProcessCommand(): the sample starts with the next
+//                mixed period
+//   timestamped  AltSoundProcessCommandAt(): the sample is scheduled at the
+//                emulator time plus the command lookahead, trading a fixed
+//                delay for jitter-free timing
+//
+// and min/p50/p99/max are reported per run.  Commands are spaced randomly,
+// so they land anywhere in the period.  The test fails if a command is
+// never heard.
+//
+// Usage: altsound_latency [options] <work dir>
+//   --count <n>          commands per run (default 50)
+//   --periods <list>     comma-separated period sizes in frames
+//                        (default 64,128,256,512,1024)
+//   --lookahead <ms>     command lookahead for timestamped commands
+//                        (default 20)
+//   --csv <file>         writes every measured latency, for plotting
+// ---------------------------------------------------------------------------
+// license:BSD-3-Clause
+// copyright-holders: Dave Roscoe
+// ---------------------------------------------------------------------------
+
+#include "altsound.h"
+#include "test_package.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+using std::string;
+
+constexpr uint32_t SAMPLE_RATE = 44100;
+
+// ---------------------------------------------------------------------------
+// Processors
+// ---------------------------------------------------------------------------
+
+struct ProcessorCase {
+	const char* name;
+	TestPackage package;
+};
+
+static const std::vector<ProcessorCase>& processorCases()
+{
+	static const std::vector<ProcessorCase> cases = {
+		{ "altsound", CLICK_PACKAGE },
+
+		{ "gsound", {
+		  "[system]\n"
+		  "record_sound_cmds = 0\n"
+		  "rom_volume_ctrl = 1\n"
+		  "cmd_skip_count = 0\n"
+		  "\n"
+		  "[format]\n"
+		  "format = g-sound\n"
+		  "\n"
+		  "[logging]\n"
+		  "logging_level = None\n",
+		  "g-sound.csv",
+		  "ID,TYPE,GAIN,DUCKING_PROFILE,FNAME\n"
+		  "0x0001,sfx,100,0,click.wav\n",
+		  { CLICK_TONE } } }
+	};
+	return cases;
+}
+
+// ---------------------------------------------------------------------------
+// Onset detection
+// ---------------------------------------------------------------------------
+
+static uint64_t nowNs()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Written by the audio thread only, and read after AltSoundShutdown()
+struct PlayedOnsets {
+	OnsetDetector detector;
+	int64_t anchor_ns = INT64_MIN;           // when output frame 0 plays
+
+	uint64_t playTime(uint64_t frame) const
+	{
+		return (uint64_t)(anchor_ns + (int64_t)(frame * 1000000000ull / SAMPLE_RATE));
+	}
+};
+
+static void detectOnsets(const float* samples, size_t frameCount, uint32_t sampleRate, uint32_t channels,
+                         void* userData)
+{
+	PlayedOnsets& played = *static_cast<PlayedOnsets*>(userData);
+
+	// the frames of this period cannot play before they were delivered
+	const int64_t delivered = (int64_t)nowNs() - (int64_t)(played.detector.frames * 1000000000ull / sampleRate);
+	played.anchor_ns = std::max(played.anchor_ns, delivered);
+	played.detector.feed(samples, frameCount, channels);
+}
+
+// ---------------------------------------------------------------------------
+// Measurement
+// ---------------------------------------------------------------------------
+
+enum class CommandMode { Immediate, Timestamped };
+
+static const char* toString(CommandMode mode)
+{
+	return mode == CommandMode::Immediate ? "immediate" : "timestamped";
+}
+
+struct RunResult {
+	std::vector<double> latencies_ms;
+	unsigned int lost = 0;
+};
+
+static bool measure(const fs::path& work, const string& game, uint32_t period, CommandMode mode,
+                    unsigned int count, uint32_t lookahead_ms, uint32_t seed, RunResult& result)
+{
+	if (!AltSoundInit(work.string(), game, SAMPLE_RATE, 2, period)) {
+		fprintf(stderr, "AltSoundInit failed for %s\n", game.c_str());
+		return false;
+	}
+	AltSoundSetHardwareGen(ALTSOUND_HARDWARE_GEN_WPCDCS);
+	AltSoundSetCommandLookahead(lookahead_ms);
+
+	PlayedOnsets played;
+	AltSoundSetAudioCallback(detectOnsets, &played);
+
+	// spacing well above the worst latency, so each onset belongs to the
+	// command before it
+	const double period_ms = 1000.0 * period / SAMPLE_RATE;
+	const double spacing_ms = 60.0 + 4.0 * period_ms + lookahead_ms;
+	std::mt19937 random(seed);
+	std::uniform_real_distribution<double> jitter(0.0, spacing_ms / 2.0);
+
+	// let the device settle
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+	std::vector<uint64_t> sent;
+	for (unsigned int i = 0; i < count; ++i) {
+		std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(spacing_ms + jitter(random)));
+
+		// a 16-bit command is complete with its second byte
+		if (mode == CommandMode::Immediate) {
+			AltSoundProcessCommand(0x00, 0);
+			sent.push_back(nowNs());
+			AltSoundProcessCommand(0x01, 0);
+		}
+		else {
+			const uint64_t t = nowNs();
+			AltSoundProcessCommandAt(0x00, 0, t);
+			sent.push_back(t);
+			AltSoundProcessCommandAt(0x01, 0, t);
+		}
+	}
+	std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(spacing_ms));
+
+	AltSoundSetAudioCallback(nullptr, nullptr);
+	AltSoundShutdown();
+
+	std::vector<uint64_t> onsets;
+	for (size_t j = 0; j < played.detector.count; ++j)
+		onsets.push_back(played.playTime(played.detector.onsets[j]));
+
+	size_t j = 0;
+	for (size_t i = 0; i < sent.size(); ++i) {
+		const uint64_t next = i + 1 < sent.size() ? sent[i + 1] : UINT64_MAX;
+		while (j < onsets.size() && onsets[j] < sent[i])
+			++j;
+
+		if (j < onsets.size() && onsets[j] < next)
+			result.latencies_ms.push_back((double)(onsets[j++] - sent[i]) / 1000000.0);
+		else
+			++result.lost;
+	}
+	return true;
+}
+
+// nearest rank
+static double percentile(const std::vector<double>& sorted, double p)
+{
+	if (sorted.empty())
+		return 0.0;
+
+	const size_t rank = (size_t)std::ceil(p / 100.0 * (double)sorted.size());
+	return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+}
+
+// ---------------------------------------------------------------------------
+
+static void usage(const char* name)
+{
+	printf("Usage: %s [options] <work dir>\n", name);
+	printf("  --count <n>        commands per run (default 50)\n");
+	printf("  --periods <list>   period sizes in frames (default 64,128,256,512,1024)\n");
+	printf("  --lookahead <ms>   lookahead for timestamped commands (default 20)\n");
+	printf("  --csv <file>       writes every measured latency\n");
+}
+
+int main(int argc, const char* argv[])
+{
+	unsigned int count = 50;
+	std::vector<uint32_t> periods = { 64, 128, 256, 512, 1024 };
+	uint32_t lookahead_ms = 20;
+	string csv_path;
+	string work;
+
+	for (int i = 1; i < argc; ++i) {
+		const string arg = argv[i];
+		const bool has_value = i + 1 < argc;
+
+		if (arg == "--count" && has_value)
+			count = (unsigned int)std::atoi(argv[++i]);
+		else if (arg == "--periods" && has_value) {
+			periods.clear();
+			string list = argv[++i];
+			for (size_t pos = 0; pos <= list.size();) {
+				const size_t end = std::min(list.find(',', pos), list.size());
+				const int period = std::atoi(list.substr(pos, end - pos).c_str());
+				if (period > 0)
+					periods.push_back((uint32_t)period);
+				pos = end + 1;
+			}
+		}
+		else if (arg == "--lookahead" && has_value)
+			lookahead_ms = (uint32_t)std::atoi(argv[++i]);
+		else if (arg == "--csv" && has_value)
+			csv_path = argv[++i];
+		else if (work.empty() && arg.rfind("--", 0) != 0)
+			work = arg;
+		else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (work.empty() || count == 0 || periods.empty()) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	std::error_code ec;
+	fs::create_directories(work, ec);
+	AltSoundSetLogger(fs::path(work).string() + '/', ALTSOUND_LOG_LEVEL_NONE, false);
+
+	std::ofstream csv;
+	if (!csv_path.empty()) {
+		csv.open(csv_path);
+		if (!csv.is_open()) {
+			fprintf(stderr, "Unable to write %s\n", csv_path.c_str());
+			return 1;
+		}
+		csv << "processor,period,mode,latency_ms\n";
+	}
+
+	printf("Command-to-sound latency, %u Hz, %u commands per run\n", SAMPLE_RATE, count);
+	printf("%-10s %6s %8s  %-11s %8s %8s %8s %8s %5s\n", "processor", "period", "(ms)", "mode", "min",
+	       "p50", "p99", "max", "lost");
+
+	bool success = true;
+	uint32_t seed = 1;
+	for (const ProcessorCase& processor : processorCases()) {
+		const string game = string("latency_") + processor.name;
+		if (!createTestPackage(work, game, processor.package))
+			return 1;
+
+		for (const uint32_t period : periods) {
+			for (const CommandMode mode : { CommandMode::Immediate, CommandMode::Timestamped }) {
+				RunResult result;
+				if (!measure(work, game, period, mode, count, lookahead_ms, seed++, result))
+					return 1;
+
+				std::vector<double> sorted = result.latencies_ms;
+				std::sort(sorted.begin(), sorted.end());
+
+				printf("%-10s %6u %8.2f  %-11s %8.2f %8.2f %8.2f %8.2f %5u\n", processor.name, period,
+				       1000.0 * period / SAMPLE_RATE, toString(mode), sorted.empty() ? 0.0 : sorted.front(),
+				       percentile(sorted, 50), percentile(sorted, 99), sorted.empty() ? 0.0 : sorted.back(),
+				       result.lost);
+				fflush(stdout);
+
+				for (const double latency : result.latencies_ms)
+					csv << processor.name << ',' << period << ',' << toString(mode) << ',' << latency << '\n';
+
+				success &= result.lost == 0;
+			}
+		}
+	}
+
+	if (!success) {
+		fprintf(stderr, "Some commands were never heard\n");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,159 @@
+// ---------------------------------------------------------------------------
+// load_control.cpp
+//
+// Mixer load control test.  Renders a G-Sound package offline with load
+// control forced on and a budget of 1% of the period, overloads the mixer,
+// then lifts the load.  The test fails if
+//
+//   - the load level does not climb to refusing new voices;
+//   - no playing voice is virtualized, or a new voice is not refused, while
+//     the load is over budget;
+//   - the level does not drop back to normal, and the shed voices do not
+//     resume, once the load is gone.
+//
+// The load is the mix time the audio thread measures.  While overloaded, a
+// mix time of a whole period follows every rendered period, so the result
+// does not depend on how fast the machine mixes.  While recovering, the
+// test reports periods that took no time.
+//
+// Usage: altsound_load_control <work dir>
+// ---------------------------------------------------------------------------
+// license:BSD-3-Clause
+// copyright-holders: Dave Roscoe
+// ---------------------------------------------------------------------------
+
+#include "altsound.h"
+#include "altsound_context.hpp"
+#include "test_package.hpp"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+using std::string;
+
+constexpr uint32_t SAMPLE_RATE = 44100;
+constexpr uint32_t CHANNELS = 2;
+constexpr uint32_t PERIOD_FRAMES = 256;
+constexpr uint64_t PERIOD_NS = 1000000000ull * PERIOD_FRAMES / SAMPLE_RATE;
+constexpr unsigned int VOICES = 4;
+
+// 3 s sfx samples, so every voice plays throughout
+static const TestPackage package = {
+	"[system]\n"
+	"record_sound_cmds = 0\n"
+	"rom_volume_ctrl = 1\n"
+	"cmd_skip_count = 0\n"
+	"\n"
+	"[format]\n"
+	"format = g-sound\n"
+	"\n"
+	"[logging]\n"
+	"logging_level = None\n"
+	"\n"
+	"[sfx]\n"
+	"group_vol = 100\n",
+	"g-sound.csv",
+	"ID,TYPE,GAIN,DUCKING_PROFILE,FNAME\n"
+	"0x0001,sfx,40,0,sfx_1.wav\n"
+	"0x0002,sfx,60,0,sfx_2.wav\n"
+	"0x0003,sfx,80,0,sfx_3.wav\n"
+	"0x0004,sfx,100,0,sfx_4.wav\n"
+	"0x0005,sfx,100,0,sfx_5.wav\n",
+	{ { "sfx_1.wav", 3 * SAMPLE_RATE, 40, 6000 },
+	  { "sfx_2.wav", 3 * SAMPLE_RATE, 50, 6000 },
+	  { "sfx_3.wav", 3 * SAMPLE_RATE, 60, 6000 },
+	  { "sfx_4.wav", 3 * SAMPLE_RATE, 70, 6000 },
+	  { "sfx_5.wav", 3 * SAMPLE_RATE, 80, 6000 } } };
+
+static void check(bool ok, const char* what)
+{
+	if (!ok)
+		fail(what);
+}
+
+// a 16-bit command is complete with its second byte
+static void sendCommand(unsigned int cmd)
+{
+	AltSoundProcessCommand(cmd >> 8, 0);
+	AltSoundProcessCommand(cmd & 0xFF, 0);
+}
+
+// ---------------------------------------------------------------------------
+
+int main(int argc, const char* argv[])
+{
+	if (argc != 2) {
+		printf("Usage: %s <work dir>\n", argv[0]);
+		return 1;
+	}
+
+	const fs::path work = argv[1];
+	std::error_code ec;
+	fs::create_directories(work, ec);
+	AltSoundSetLogger(work.string() + '/', ALTSOUND_LOG_LEVEL_NONE, false);
+
+	const string game = "load_control";
+	if (!createTestPackage(work, game, package))
+		return 1;
+
+	AltSoundOptions options;
+	options.sampleRate = SAMPLE_RATE;
+	options.channels = CHANNELS;
+	options.bufferSizeFrames = PERIOD_FRAMES;
+	options.manualRender = true;
+	if (!AltSoundInitWithOptions(work.string(), game, options)) {
+		fprintf(stderr, "AltSoundInitWithOptions failed\n");
+		return 1;
+	}
+	AltSoundSetHardwareGen(ALTSOUND_HARDWARE_GEN_WPCDCS);
+	AltSoundSetCommandLookahead(0);
+
+	// manual rendering turns load control off; this thread renders, so it
+	// is the audio thread load control runs on
+	AltsoundContext& ctx = AltsoundContext::current();
+	LoadControlConfig config;
+	config.budget = 1;
+	ctx.load_control.configure(config, true, SAMPLE_RATE);
+	// the counters outlive a shutdown
+	AltSoundResetStats();
+
+	std::vector<float> period(PERIOD_FRAMES * CHANNELS);
+	for (unsigned int cmd = 1; cmd <= VOICES; ++cmd)
+		sendCommand(cmd);
+
+	// overloaded: one voice virtualized every few periods, down to the last
+	for (int i = 0; i < 64; ++i) {
+		AltSoundRender(period.data(), PERIOD_FRAMES);
+		ctx.load_control.update(PERIOD_NS, PERIOD_FRAMES);
+	}
+	sendCommand(VOICES + 1);
+	AltSoundRender(period.data(), PERIOD_FRAMES);
+
+	AltSoundStats overloaded;
+	AltSoundGetStats(&overloaded);
+
+	// recovering: the shed voices resume one at a time
+	for (int i = 0; i < 256; ++i)
+		ctx.load_control.update(0, PERIOD_FRAMES);
+
+	AltSoundStats recovered;
+	AltSoundGetStats(&recovered);
+	AltSoundShutdown();
+
+	printf("overloaded: level %u, peak %u, %llu shed, %llu refused, %u voices virtualized\n",
+	       overloaded.load_level, overloaded.peak_load_level, (unsigned long long)overloaded.load_shed,
+	       (unsigned long long)overloaded.load_refused, overloaded.shed_voices);
+	printf("recovered:  level %u, %u voices virtualized\n", recovered.load_level, recovered.shed_voices);
+
+	check(overloaded.load_level == AltsoundLoadControl::LEVEL_REFUSE, "the load level did not reach refusing");
+	check(overloaded.peak_load_level == AltsoundLoadControl::LEVEL_REFUSE, "peak load level not reported");
+	check(overloaded.load_shed == VOICES, "playing voices not virtualized");
+	check(overloaded.load_refused == 1, "the new voice was not refused");
+	check(recovered.load_level == AltsoundLoadControl::LEVEL_NORMAL, "the load level did not recover");
+	check(recovered.shed_voices == 0, "shed voices did not resume");
+	check(recovered.peak_load_level == AltsoundLoadControl::LEVEL_REFUSE, "peak load level lost");
+
+	return g_failures ? 1 : 0;
+}
@@ -0,0 +1,260 @@
+// ---------------------------------------------------------------------------
+// output_format.cpp
+//
+// Output format test.  Converts the same frames with the SIMD kernels and
+// with the scalar ones, for every format, layout and channel count, and
+// fails if
+//
+//   - the two differ in any byte, dithered or not, at any length up to a
+//     few SIMD blocks plus every tail;
+//   - full scale and beyond do not clip to the expected integers;
+//   - planar output written a piece at a time, at firstFrame offsets into
+//     planes of planeFrames, differs from converting the whole buffer, or
+//     writes outside its planes;
+//   - silence, with dither on, is not exact zero, on its own or in
+//     AltSoundRender() output while nothing plays.
+//
+// Usage: altsound_output_format <work dir>
+// ---------------------------------------------------------------------------
+// license:BSD-3-Clause
+// copyright-holders: Dave Roscoe
+// ---------------------------------------------------------------------------
+
+#include "altsound.h"
+#include "altsound_output_format.hpp"
+#include "test_package.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+using std::string;
+
+constexpr size_t MAX_FRAMES = 67;        // several SIMD blocks and a tail
+constexpr size_t PIECE_FRAMES = 13;      // planar pieces, not a block multiple
+constexpr uint8_t GUARD = 0xA5;          // bytes around the output
+
+struct FormatCase {
+	const char* name;
+	ALTSOUND_SAMPLE_FORMAT format;
+	bool planar;
+	bool dither;
+	uint32_t channels;
+};
+
+static const std::vector<FormatCase>& formatCases()
+{
+	static const std::vector<FormatCase> cases = {
+		{ "s16",              ALTSOUND_SAMPLE_FORMAT_S16, false, false, 2 },
+		{ "s16_dither",       ALTSOUND_SAMPLE_FORMAT_S16, false, true,  2 },
+		{ "s32",              ALTSOUND_SAMPLE_FORMAT_S32, false, false, 2 },
+		{ "f32_planar",       ALTSOUND_SAMPLE_FORMAT_F32, true,  false, 2 },
+		{ "s16_planar",       ALTSOUND_SAMPLE_FORMAT_S16, true,  false, 2 },
+		{ "s16_planar_dither",ALTSOUND_SAMPLE_FORMAT_S16, true,  true,  2 },
+		{ "s32_planar",       ALTSOUND_SAMPLE_FORMAT_S32, true,  false, 2 },
+		{ "s16_mono",         ALTSOUND_SAMPLE_FORMAT_S16, false, true,  1 },
+		{ "s32_planar_3ch",   ALTSOUND_SAMPLE_FORMAT_S32, true,  false, 3 },
+	};
+	return cases;
+}
+
+// full scale, just beyond and far beyond, then noise a little over full
+// scale, so the clipping lands in the SIMD blocks and in the tails
+static std::vector<float> testFrames(uint32_t channels)
+{
+	static const float edges[] = { 1.0f, -1.0f, 1.0001f, -1.0001f, 4.0f, -4.0f, 0.0f, 0.5f };
+
+	std::vector<float> frames(MAX_FRAMES * channels);
+	std::mt19937 random(1);
+	std::uniform_real_distribution<float> noise(-1.25f, 1.25f);
+	for (size_t i = 0; i < frames.size(); ++i)
+		frames[i] = i < sizeof(edges) / sizeof(edges[0]) ? edges[i] : noise(random);
+	return frames;
+}
+
+// output buffer with guard bytes on both sides
+struct Buffer {
+	std::vector<uint8_t> bytes;
+	size_t size;
+
+	explicit Buffer(size_t size) : bytes(size + 2 * 16, GUARD), size(size) {}
+	uint8_t* data() { return bytes.data() + 16; }
+	bool guarded() const
+	{
+		for (size_t i = 0; i < 16; ++i)
+			if (bytes[i] != GUARD || bytes[16 + size + i] != GUARD)
+				return false;
+		return true;
+	}
+};
+
+static void check(bool ok, const FormatCase& test, const char* what, size_t frames = 0)
+{
+	if (!ok)
+		fail((string(test.name) + ": " + what + " (" + std::to_string(frames) + " frames)").c_str());
+}
+
+// ---------------------------------------------------------------------------
+
+static void compareKernels(const FormatCase& test, const std::vector<float>& frames)
+{
+	for (size_t count = 1; count <= MAX_FRAMES; ++count) {
+		AltsoundOutputFormat simd, scalar;
+		simd.init(test.format, test.planar, test.dither, test.channels, (uint32_t)MAX_FRAMES);
+		scalar.init(test.format, test.planar, test.dither, test.channels, (uint32_t)MAX_FRAMES);
+		scalar.setScalarKernels(true);
+
+		// twice, so the dither state carries over from one call to the next
+		const size_t size = count * simd.bytesPerFrame();
+		for (int pass = 0; pass < 2; ++pass) {
+			Buffer a(size), b(size);
+			simd.convert(frames.data(), count, a.data());
+			scalar.convert(frames.data(), count, b.data());
+			check(a.bytes == b.bytes, test, "SIMD and scalar output differ", count);
+			check(a.guarded(), test, "conversion wrote outside the buffer", count);
+		}
+	}
+}
+
+static void checkClipping(const FormatCase& test, const std::vector<float>& frames)
+{
+	if (test.format == ALTSOUND_SAMPLE_FORMAT_F32 || test.dither || test.planar)
+		return;
+
+	AltsoundOutputFormat format;
+	format.init(test.format, false, false, test.channels, (uint32_t)MAX_FRAMES);
+	Buffer out(MAX_FRAMES * format.bytesPerFrame());
+	format.convert(frames.data(), MAX_FRAMES, out.data());
+
+	// the edges, in the order testFrames() puts them
+	if (test.format == ALTSOUND_SAMPLE_FORMAT_S16) {
+		static const int16_t expected[] = { 32767, -32767, 32767, -32768, 32767, -32768, 0, 16384 };
+		int16_t actual[8];
+		memcpy(actual, out.data(), sizeof(actual));
+		check(memcmp(actual, expected, sizeof(actual)) == 0, test, "s16 does not clip at full scale");
+	}
+	else {
+		static const int32_t expected[] = { 2147483520, INT32_MIN, 2147483520, INT32_MIN, 2147483520, INT32_MIN, 0, 1073741824 };
+		int32_t actual[8];
+		memcpy(actual, out.data(), sizeof(actual));
+		check(memcmp(actual, expected, sizeof(actual)) == 0, test, "s32 does not clip at full scale");
+	}
+}
+
+// Converts the frames in pieces into planes longer than the frames, the
+// way AltSoundRender() fills a host buffer a period at a time
+static void checkPlanarPieces(const FormatCase& test, const std::vector<float>& frames)
+{
+	if (!test.planar)
+		return;
+
+	AltsoundOutputFormat whole, pieces;
+	whole.init(test.format, true, test.dither, test.channels, (uint32_t)PIECE_FRAMES);
+	pieces.init(test.format, true, test.dither, test.channels, (uint32_t)PIECE_FRAMES);
+
+	const size_t sample_bytes = whole.bytesPerFrame() / test.channels;
+	Buffer a(MAX_FRAMES * whole.bytesPerFrame()), b(MAX_FRAMES * whole.bytesPerFrame());
+	whole.convert(frames.data(), MAX_FRAMES, a.data());
+	for (size_t done = 0; done < MAX_FRAMES; done += PIECE_FRAMES) {
+		const size_t n = std::min(PIECE_FRAMES, MAX_FRAMES - done);
+		pieces.convert(frames.data() + done * test.channels, n, b.data(), MAX_FRAMES, done);
+	}
+	check(a.bytes == b.bytes, test, "planar pieces differ from the whole buffer", MAX_FRAMES);
+	check(b.guarded(), test, "planar pieces wrote outside the planes", MAX_FRAMES);
+
+	// a silent piece in the middle of each plane, and nothing else
+	const size_t first = PIECE_FRAMES, count = PIECE_FRAMES + 1;
+	pieces.silence(b.data(), count, MAX_FRAMES, first);
+	bool silent = true, untouched = true;
+	for (uint32_t c = 0; c < test.channels; ++c) {
+		for (size_t i = 0; i < MAX_FRAMES; ++i) {
+			const size_t at = (c * MAX_FRAMES + i) * sample_bytes;
+			const bool zero = std::all_of(b.data() + at, b.data() + at + sample_bytes, [](uint8_t v) { return v == 0; });
+			if (i >= first && i < first + count)
+				silent &= zero;
+			else
+				untouched &= memcmp(a.data() + at, b.data() + at, sample_bytes) == 0;
+		}
+	}
+	check(silent && untouched && b.guarded(), test, "planar silence outside its piece, or not zero", count);
+}
+
+static void checkSilence(const FormatCase& test)
+{
+	AltsoundOutputFormat format;
+	format.init(test.format, test.planar, test.dither, test.channels, (uint32_t)MAX_FRAMES);
+	Buffer out(MAX_FRAMES * format.bytesPerFrame());
+	format.silence(out.data(), MAX_FRAMES);
+	check(std::all_of(out.data(), out.data() + out.size, [](uint8_t v) { return v == 0; }) && out.guarded(), test,
+	      "silence is not exact zero", MAX_FRAMES);
+}
+
+// Renders idle periods with dither on: the host gets exact zeros
+static void checkRenderedSilence(const fs::path& work)
+{
+	const FormatCase test = { "render_dither", ALTSOUND_SAMPLE_FORMAT_S16, true, true, 2 };
+
+	const string game = "output_format";
+	const TestPackage package = { "", "altsound.csv",
+		"ID,CHANNEL,DUCK,GAIN,LOOP,STOP,NAME,FNAME,GROUP,SHAKER,SERIAL,PRELOAD,STOPCMD\n"
+		"0x0001,,100,100,0,0,tone,tone.wav,3,,,0,\n",
+		{ { "tone.wav", 4410, 100, 6000 } } };
+	if (!createTestPackage(work, game, package)) {
+		check(false, test, "unable to write the package");
+		return;
+	}
+
+	AltSoundOptions options;
+	options.sampleRate = 44100;
+	options.channels = test.channels;
+	options.bufferSizeFrames = 256;
+	options.manualRender = true;
+	options.outputFormat = test.format;
+	options.outputPlanar = test.planar;
+	options.outputDither = test.dither;
+	if (!AltSoundInitWithOptions(work.string(), game, options)) {
+		check(false, test, "AltSoundInitWithOptions failed");
+		return;
+	}
+
+	const size_t frames = 1000;
+	std::vector<int16_t> out(frames * test.channels, 1);
+	AltSoundRender(out.data(), frames);
+	AltSoundShutdown();
+	check(std::all_of(out.begin(), out.end(), [](int16_t v) { return v == 0; }), test,
+	      "idle periods rendered with dither are not exact zero", frames);
+}
+
+// ---------------------------------------------------------------------------
+
+int main(int argc, const char* argv[])
+{
+	if (argc != 2) {
+		printf("Usage: %s <work dir>\n", argv[0]);
+		return 1;
+	}
+
+	const fs::path work = argv[1];
+	std::error_code ec;
+	fs::create_directories(work, ec);
+	AltSoundSetLogger(work.string() + '/', ALTSOUND_LOG_LEVEL_NONE, false);
+
+	printf("kernels: %s\n", AltsoundOutputFormat::kernelName());
+	for (const FormatCase& test : formatCases()) {
+		const unsigned int failures = g_failures;
+		const std::vector<float> frames = testFrames(test.channels);
+		compareKernels(test, frames);
+		checkClipping(test, frames);
+		checkPlanarPieces(test, frames);
+		checkSilence(test);
+		printf("%-18s %s\n", test.name, g_failures == failures ? "ok" : "FAILED");
+	}
+	checkRenderedSilence(work);
+
+	return g_failures ? 1 : 0;
+}
@@ -0,0 +1,213 @@
+// ---------------------------------------------------------------------------
+// rate_matcher.cpp
+//
+// Drift compensation test.  Runs the rate matcher and the output ring on a
+// simulated clock: a mixer writes 256-frame periods of a sine wave at the
+// nominal rate, and a host reads 10 ms periods at a rate a little off.
+// Each case runs several simulated minutes and fails if
+//
+//   - the average fill level has not converged to the target, or the ratio
+//     to the clock difference, once the loop has settled;
+//   - the ring resyncs more often than the case provokes, or at all after
+//     settling;
+//   - the output the host reads after settling is not a continuous sine
+//     wave, which it is not if the fractional position is lost between
+//     periods.
+//
+// Usage: altsound_rate_matcher <work dir>
+// ---------------------------------------------------------------------------
+// license:BSD-3-Clause
+// copyright-holders: Dave Roscoe
+// ---------------------------------------------------------------------------
+
+#include "altsound.h"
+#include "altsound_rate_matcher.hpp"
+#include "altsound_ring.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+constexpr uint32_t SAMPLE_RATE = 44100;
+constexpr uint32_t CHANNELS = 2;
+constexpr uint32_t PERIOD_FRAMES = 256;
+constexpr uint32_t HOST_FRAMES = SAMPLE_RATE / 100;
+constexpr uint32_t RING_FRAMES = 16 * PERIOD_FRAMES;
+constexpr uint32_t TARGET_FRAMES = 8 * PERIOD_FRAMES;
+
+constexpr double RUN_S = 240.0;
+constexpr double SETTLED_S = 150.0;   // checks apply from here on
+constexpr double SINE_HZ = 110.0;
+constexpr float SINE_AMPLITUDE = 0.5f;
+
+constexpr double PI = 3.14159265358979323846;
+
+struct DriftCase {
+	const char* name;
+	double host_ppm;     // host clock relative to the mixer's
+	double event_s;      // when the host misbehaves, 0 = never
+	double stall_s;      // the host skips its reads for this long
+	uint32_t burst;      // the host reads this many periods at once
+	uint64_t resyncs;    // expected
+};
+
+static const std::vector<DriftCase>& driftCases()
+{
+	static const std::vector<DriftCase> cases = {
+		{ "host_fast",      1000.0,  0.0, 0.0, 0, 0 },
+		{ "host_slow",     -1000.0,  0.0, 0.0, 0, 0 },
+		// longer than the ring: the ring overruns and drains to the target
+		{ "host_stall",      500.0, 30.0, 0.3, 0, 1 },
+		// more than the ring holds: the ring underruns and is refilled
+		{ "host_burst",     -500.0, 30.0, 0.0, 6, 1 },
+	};
+	return cases;
+}
+
+// ---------------------------------------------------------------------------
+
+struct Host {
+	std::vector<float> last;     // last frame read, per channel
+	uint64_t frames = 0;
+	double max_step = 0.0;       // largest sample-to-sample change after settling
+
+	// reads up to frameCount frames, in as many spans as the ring returns
+	void read(AltsoundRing& ring, size_t frameCount, bool settled)
+	{
+		for (size_t done = 0; done < frameCount;) {
+			const float* samples;
+			const size_t n = ring.read(&samples, frameCount - done);
+			if (n == 0)
+				break;
+
+			for (size_t i = 0; i < n; ++i) {
+				for (uint32_t c = 0; c < CHANNELS; ++c) {
+					const float s = samples[i * CHANNELS + c];
+					if (settled && frames > 0)
+						max_step = std::max(max_step, (double)std::abs(s - last[c]));
+					last[c] = s;
+				}
+				++frames;
+			}
+			ring.commit(n);
+			done += n;
+		}
+	}
+};
+
+static bool run(const DriftCase& test)
+{
+	AltsoundRing ring;
+	ring.init(RING_FRAMES, CHANNELS);
+	AltsoundRateMatcher matcher;
+	if (!matcher.init(ring, SAMPLE_RATE, CHANNELS, PERIOD_FRAMES, TARGET_FRAMES)) {
+		fprintf(stderr, "%s: init failed\n", test.name);
+		return false;
+	}
+
+	std::vector<float> period(PERIOD_FRAMES * CHANNELS);
+	uint64_t mixed = 0;
+	Host host;
+	host.last.assign(CHANNELS, 0.0f);
+
+	const double mixer_interval = (double)PERIOD_FRAMES / SAMPLE_RATE;
+	const double host_interval = (double)HOST_FRAMES / (SAMPLE_RATE * (1.0 + test.host_ppm / 1e6));
+	double next_mix = 0.0;
+	double next_read = 4.0 * mixer_interval; // the host starts once the ring holds some periods
+	bool burst_done = false;
+	uint64_t settled_resyncs = 0;
+	double fill_sum = 0.0;       // after each write, as the matcher sees it
+	uint64_t fill_count = 0;
+
+	while (next_mix < RUN_S || next_read < RUN_S) {
+		if (next_mix <= next_read) {
+			for (uint32_t i = 0; i < PERIOD_FRAMES; ++i, ++mixed) {
+				const float s = SINE_AMPLITUDE * (float)std::sin(2.0 * PI * SINE_HZ * (double)mixed / SAMPLE_RATE);
+				for (uint32_t c = 0; c < CHANNELS; ++c)
+					period[i * CHANNELS + c] = s;
+			}
+			matcher.write(period.data(), PERIOD_FRAMES);
+			if (next_mix >= SETTLED_S) {
+				if (fill_count == 0) {
+					AltSoundRingStats stats;
+					matcher.snapshot(stats);
+					settled_resyncs = stats.resyncs;
+				}
+				fill_sum += (double)ring.fill();
+				++fill_count;
+			}
+			next_mix += mixer_interval;
+			continue;
+		}
+
+		const double now = next_read;
+		next_read += host_interval;
+
+		if (test.event_s > 0.0 && now >= test.event_s && now < test.event_s + test.stall_s)
+			continue;
+
+		size_t frames = HOST_FRAMES;
+		if (test.burst && test.event_s > 0.0 && now >= test.event_s && !burst_done) {
+			frames *= test.burst;
+			burst_done = true;
+		}
+
+		host.read(ring, frames, now >= SETTLED_S);
+	}
+
+	AltSoundRingStats stats = {};
+	ring.snapshot(stats);
+	matcher.snapshot(stats);
+
+	const double fill_avg = fill_count ? fill_sum / (double)fill_count : 0.0;
+	const double ratio_ppm = ((double)stats.rate_ratio - 1.0) * 1e6;
+	// one step of the sine, with room for the interpolation
+	const double max_step = 1.05 * SINE_AMPLITUDE * 2.0 * PI * SINE_HZ / SAMPLE_RATE;
+
+	printf("%-12s fill %7.1f (target %u), ratio %+7.1f ppm, %llu resyncs, max step %.5f\n", test.name, fill_avg,
+	       TARGET_FRAMES, ratio_ppm, (unsigned long long)stats.resyncs, host.max_step);
+
+	bool success = true;
+	if (std::abs(fill_avg - TARGET_FRAMES) > PERIOD_FRAMES / 4) {
+		fprintf(stderr, "%s: fill level did not converge to the target\n", test.name);
+		success = false;
+	}
+	if (std::abs(ratio_ppm - test.host_ppm) > 100.0) {
+		fprintf(stderr, "%s: ratio does not track the %+.0f ppm clock difference\n", test.name, test.host_ppm);
+		success = false;
+	}
+	if (stats.resyncs != test.resyncs || stats.resyncs != settled_resyncs) {
+		fprintf(stderr, "%s: %llu resyncs, %llu expected, none after settling\n", test.name,
+		        (unsigned long long)stats.resyncs, (unsigned long long)test.resyncs);
+		success = false;
+	}
+	if (host.max_step > max_step) {
+		fprintf(stderr, "%s: output discontinuous, step %.5f exceeds %.5f\n", test.name, host.max_step, max_step);
+		success = false;
+	}
+	return success;
+}
+
+// ---------------------------------------------------------------------------
+
+int main(int argc, const char* argv[])
+{
+	if (argc != 2) {
+		printf("Usage: %s <work dir>\n", argv[0]);
+		return 1;
+	}
+
+	const fs::path work = argv[1];
+	std::error_code ec;
+	fs::create_directories(work, ec);
+	AltSoundSetLogger(work.string() + '/', ALTSOUND_LOG_LEVEL_NONE, false);
+
+	bool success = true;
+	for (const DriftCase& test : driftCases())
+		success = run(test) && success;
+	return success ? 0 : 1;
+}
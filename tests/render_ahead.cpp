@@ -0,0 +1,226 @@
+// ---------------------------------------------------------------------------
+// render_ahead.cpp
+//
+// Render-ahead test.  Plays a click package with render-ahead on and reads
+// the output ring the way a slow host does: late reads, short reads and
+// stalls longer than the frames mixed ahead.  A click command is sent every
+// few reads.  The test fails if
+//
+//   - the library drops mixed frames while the host is slow,
+//   - the ring holds more than the render-ahead depth,
+//   - a click is never heard, or heard twice,
+//   - the frames read do not add up to the frames mixed,
+//   - an init whose render-ahead thread cannot start succeeds, or leaves
+//     the context unusable.
+//
+// Usage: altsound_render_ahead [options] <work dir>
+//   --count <n>    clicks (default 24)
+//   --period <n>   period size in frames (default 256)
+//   --depth <n>    render-ahead depth in periods (default 8)
+// ---------------------------------------------------------------------------
+// license:BSD-3-Clause
+// copyright-holders: Dave Roscoe
+// ---------------------------------------------------------------------------
+
+#include "altsound.h"
+#include "test_package.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+using std::string;
+
+constexpr uint32_t SAMPLE_RATE = 44100;
+constexpr uint32_t CHANNELS = 2;
+
+// host pacing: one read per period, at a bit over half the real-time rate,
+// and every STALL_EVERY reads a stall longer than the default depth
+constexpr double READ_INTERVAL_MS = 10.0;
+constexpr double STALL_MS = 100.0;
+constexpr unsigned int STALL_EVERY = 16;
+constexpr unsigned int READS_PER_CLICK = 8;
+
+// ---------------------------------------------------------------------------
+// Slow host
+// ---------------------------------------------------------------------------
+
+// Reads up to frameCount frames, in as many spans as the ring returns them
+static size_t readRing(OnsetDetector& detector, size_t frameCount)
+{
+	size_t done = 0;
+	while (done < frameCount) {
+		const float* samples;
+		const size_t n = AltSoundRingRead(&samples, frameCount - done);
+		if (n == 0)
+			break;
+		detector.feed(samples, n, CHANNELS);
+		AltSoundRingCommit(n);
+		done += n;
+	}
+	return done;
+}
+
+static void checkRing(uint32_t depth_frames)
+{
+	AltSoundRingStats stats;
+	AltSoundGetRingStats(&stats);
+	if (stats.fill_frames > depth_frames)
+		fail("the ring holds more than the render-ahead depth");
+}
+
+static bool playSlowHost(const fs::path& work, const string& game, uint32_t period, uint32_t depth,
+                         unsigned int count)
+{
+	AltSoundOptions options;
+	options.sampleRate = SAMPLE_RATE;
+	options.channels = CHANNELS;
+	options.bufferSizeFrames = period;
+	options.renderAheadPeriods = depth;
+	if (!AltSoundInitWithOptions(work.string(), game, options)) {
+		fprintf(stderr, "AltSoundInitWithOptions failed for %s\n", game.c_str());
+		return false;
+	}
+	AltSoundSetHardwareGen(ALTSOUND_HARDWARE_GEN_WPCDCS);
+
+	const uint32_t depth_frames = depth * period;
+	AltSoundRingStats stats;
+	AltSoundGetRingStats(&stats);
+	if (stats.render_ahead_frames != depth_frames)
+		fail("render-ahead depth not reported");
+
+	// the host starts once the ring is primed
+	for (int i = 0; i < 1000 && stats.fill_frames < depth_frames; ++i) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		AltSoundGetRingStats(&stats);
+	}
+
+	OnsetDetector detector;
+	unsigned int sent = 0;
+	unsigned int reads = 0;
+	while (sent < count) {
+		if (reads % READS_PER_CLICK == 0) {
+			AltSoundProcessCommand(0x00, 0);
+			AltSoundProcessCommand(0x01, 0);
+			++sent;
+		}
+
+		// a read cut short by a late mixer is completed on the next pass,
+		// as a host would
+		readRing(detector, period);
+		checkRing(depth_frames);
+		++reads;
+
+		std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(
+			reads % STALL_EVERY == 0 ? STALL_MS : READ_INTERVAL_MS));
+	}
+
+	// the last click is mixed at most the depth after its command
+	for (uint32_t i = 0; i < 2 * depth; ++i) {
+		readRing(detector, period);
+		std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(READ_INTERVAL_MS));
+	}
+
+	AltSoundGetRingStats(&stats);
+	AltSoundShutdown();
+
+	printf("%u clicks, %u heard, %llu frames read, %llu batches, %llu overruns, %llu underruns\n", sent,
+	       (unsigned int)detector.count, (unsigned long long)detector.frames,
+	       (unsigned long long)stats.render_batches, (unsigned long long)stats.overruns,
+	       (unsigned long long)stats.underruns);
+
+	if (detector.count != sent)
+		fail("clicks lost or repeated");
+	if (stats.overruns != 0)
+		fail("mixed frames dropped while the host was slow");
+	if (stats.read_frames != detector.frames || stats.written_frames != stats.read_frames + stats.fill_frames)
+		fail("frames read do not add up to the frames mixed");
+	if (stats.render_batches == 0)
+		fail("no render-ahead batches");
+	return true;
+}
+
+// A zero period leaves render-ahead nothing to mix.  The init fails and the
+// context can be initialized again
+static bool checkFailedStart(const fs::path& work, const string& game, uint32_t period, uint32_t depth)
+{
+	AltSoundOptions options;
+	options.sampleRate = SAMPLE_RATE;
+	options.channels = CHANNELS;
+	options.bufferSizeFrames = 0;
+	options.renderAheadPeriods = depth;
+	if (AltSoundInitWithOptions(work.string(), game, options)) {
+		fail("init succeeded without a render-ahead thread");
+		AltSoundShutdown();
+	}
+
+	options.bufferSizeFrames = period;
+	if (!AltSoundInitWithOptions(work.string(), game, options)) {
+		fail("init failed after a failed render-ahead start");
+		return true;
+	}
+	AltSoundShutdown();
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+
+static void usage(const char* name)
+{
+	printf("Usage: %s [options] <work dir>\n", name);
+	printf("  --count <n>    clicks (default 24)\n");
+	printf("  --period <n>   period size in frames (default 256)\n");
+	printf("  --depth <n>    render-ahead depth in periods (default 8)\n");
+}
+
+int main(int argc, const char* argv[])
+{
+	unsigned int count = 24;
+	uint32_t period = 256;
+	uint32_t depth = 8;
+	string work;
+
+	for (int i = 1; i < argc; ++i) {
+		const string arg = argv[i];
+		const bool has_value = i + 1 < argc;
+
+		if (arg == "--count" && has_value)
+			count = (unsigned int)std::atoi(argv[++i]);
+		else if (arg == "--period" && has_value)
+			period = (uint32_t)std::atoi(argv[++i]);
+		else if (arg == "--depth" && has_value)
+			depth = (uint32_t)std::atoi(argv[++i]);
+		else if (work.empty() && arg.rfind("--", 0) != 0)
+			work = arg;
+		else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (work.empty() || count == 0 || period == 0 || depth == 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	std::error_code ec;
+	fs::create_directories(work, ec);
+	AltSoundSetLogger(fs::path(work).string() + '/', ALTSOUND_LOG_LEVEL_NONE, false);
+
+	const string game = "render_ahead";
+	if (!createTestPackage(work, game, CLICK_PACKAGE))
+		return 1;
+
+	if (!checkFailedStart(work, game, period, depth) || !playSlowHost(work, game, period, depth, count))
+		return 1;
+
+	if (g_failures) {
+		fprintf(stderr, "%u failures\n", g_failures.load());
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,219 @@
+// ---------------------------------------------------------------------------
+// retrigger.cpp
+//
+// Retrigger policy test.  Each case sets one [retrigger] policy in a G-Sound
+// package, renders a short command storm offline and checks
+//
+//   - how many streams each command created, and how many were restarted;
+//   - the coalesced, restarted, ignored and limited counters of
+//     AltSoundStats.
+//
+// Samples are 1 s long, so every instance is still playing when the next
+// command arrives.
+//
+// Usage: altsound_retrigger <work dir>
+// ---------------------------------------------------------------------------
+// license:BSD-3-Clause
+// copyright-holders: Dave Roscoe
+// ---------------------------------------------------------------------------
+
+#include "altsound.h"
+#include "miniaudio_bass_compat.hpp"
+#include "test_package.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+using std::string;
+
+constexpr uint32_t SAMPLE_RATE = 44100;
+constexpr uint32_t CHANNELS = 2;
+constexpr uint32_t PERIOD_FRAMES = 256;
+
+struct Command {
+	unsigned int cmd;
+	uint32_t time_ms;
+};
+
+struct Counts {
+	unsigned int creates_1 = 0; // streams of command 0x0001
+	unsigned int creates_2 = 0; // streams of command 0x0002
+	unsigned int restarts = 0;
+	uint64_t coalesced = 0;
+	uint64_t restarted = 0;
+	uint64_t ignored = 0;
+	uint64_t limited = 0;
+};
+
+struct RetriggerCase {
+	const char* name;
+	const char* policy;       // [retrigger] section
+	std::vector<Command> storm;
+	Counts expected;
+};
+
+static const std::vector<RetriggerCase>& retriggerCases()
+{
+	static const std::vector<RetriggerCase> cases = {
+		// the window starts at the last command let through: 0, 40 and 80
+		// play, the rest fall into a window
+		{ "dedup", "sfx_dedup_ms = 30\n",
+		  { { 1, 0 }, { 1, 10 }, { 1, 20 }, { 1, 40 }, { 1, 50 }, { 1, 80 } },
+		  { 3, 0, 0, 3, 0, 0, 0 } },
+
+		{ "max_instances", "sfx_max_instances = 2\n",
+		  { { 1, 0 }, { 1, 100 }, { 1, 200 }, { 1, 300 } },
+		  { 2, 0, 0, 0, 0, 0, 2 } },
+
+		{ "restart", "sfx_mode = restart\n",
+		  { { 1, 0 }, { 1, 100 }, { 1, 200 } },
+		  { 1, 0, 2, 0, 2, 0, 0 } },
+
+		{ "ignore", "sfx_mode = ignore\n",
+		  { { 1, 0 }, { 1, 100 }, { 1, 200 } },
+		  { 1, 0, 0, 0, 0, 2, 0 } },
+
+		// the command policy overrides the type policy for 0x0001 only
+		{ "command", "sfx_mode = ignore\ncmd_0x0001 = mode:new, max_instances:3\n",
+		  { { 1, 0 }, { 2, 0 }, { 1, 100 }, { 2, 100 }, { 1, 200 }, { 1, 300 } },
+		  { 3, 1, 0, 0, 0, 1, 1 } },
+	};
+	return cases;
+}
+
+static TestPackage retriggerPackage(const RetriggerCase& test)
+{
+	return { string(
+		"[system]\n"
+		"record_sound_cmds = 0\n"
+		"rom_volume_ctrl = 1\n"
+		"cmd_skip_count = 0\n"
+		"\n"
+		"[format]\n"
+		"format = g-sound\n"
+		"\n"
+		"[logging]\n"
+		"logging_level = None\n"
+		"\n"
+		"[sfx]\n"
+		"group_vol = 100\n"
+		"\n"
+		"[retrigger]\n") + test.policy,
+		"g-sound.csv",
+		"ID,TYPE,GAIN,DUCKING_PROFILE,FNAME\n"
+		"0x0001,sfx,80,0,sfx_1.wav\n"
+		"0x0002,sfx,80,0,sfx_2.wav\n",
+		{ { "sfx_1.wav", SAMPLE_RATE, 40, 6000 },
+		  { "sfx_2.wav", SAMPLE_RATE, 60, 6000 } } };
+}
+
+// ---------------------------------------------------------------------------
+
+static void onStreamEvent(MiniAudioStreamEvent event, unsigned int /*hstream*/, uint64_t /*frame*/,
+                          float /*value*/, const char* file, void* user)
+{
+	Counts& counts = *static_cast<Counts*>(user);
+
+	if (event == MiniAudioStreamEvent::Restart)
+		++counts.restarts;
+	else if (event == MiniAudioStreamEvent::Create && file) {
+		const string path = file;
+		if (path.find("sfx_1.wav") != string::npos)
+			++counts.creates_1;
+		else if (path.find("sfx_2.wav") != string::npos)
+			++counts.creates_2;
+	}
+}
+
+static bool run(const fs::path& work, const RetriggerCase& test)
+{
+	const string game = string("retrigger_") + test.name;
+	if (!createTestPackage(work, game, retriggerPackage(test)))
+		return false;
+
+	Counts actual;
+	MiniAudio_SetStreamEventProc(onStreamEvent, &actual);
+
+	AltSoundOptions options;
+	options.sampleRate = SAMPLE_RATE;
+	options.channels = CHANNELS;
+	options.bufferSizeFrames = PERIOD_FRAMES;
+	options.manualRender = true;
+	options.randomSeed = 1;
+	if (!AltSoundInitWithOptions(work.string(), game, options)) {
+		fprintf(stderr, "%s: AltSoundInitWithOptions failed\n", test.name);
+		MiniAudio_SetStreamEventProc(nullptr, nullptr);
+		return false;
+	}
+	AltSoundSetHardwareGen(ALTSOUND_HARDWARE_GEN_WPCDCS);
+	AltSoundSetCommandLookahead(0);
+	// the counters outlive a shutdown
+	AltSoundResetStats();
+
+	std::vector<float> period(PERIOD_FRAMES * CHANNELS);
+	uint64_t rendered = 0;
+	for (const Command& command : test.storm) {
+		const uint64_t frame = (uint64_t)command.time_ms * SAMPLE_RATE / 1000;
+		while (rendered < frame)
+			rendered += AltSoundRender(period.data(), (size_t)std::min<uint64_t>(PERIOD_FRAMES, frame - rendered));
+
+		// a 16-bit command is complete with its second byte
+		const uint64_t time_ns = (uint64_t)command.time_ms * 1000000ull;
+		AltSoundProcessCommandAt(command.cmd >> 8, 0, time_ns);
+		AltSoundProcessCommandAt(command.cmd & 0xFF, 0, time_ns);
+	}
+	AltSoundRender(period.data(), PERIOD_FRAMES);
+
+	AltSoundStats stats;
+	AltSoundGetStats(&stats);
+	actual.coalesced = stats.retrigger_coalesced;
+	actual.restarted = stats.retrigger_restarted;
+	actual.ignored = stats.retrigger_ignored;
+	actual.limited = stats.retrigger_limited;
+
+	AltSoundShutdown();
+	MiniAudio_SetStreamEventProc(nullptr, nullptr);
+
+	const Counts& expected = test.expected;
+	const bool success = actual.creates_1 == expected.creates_1 && actual.creates_2 == expected.creates_2 &&
+	                     actual.restarts == expected.restarts && actual.coalesced == expected.coalesced &&
+	                     actual.restarted == expected.restarted && actual.ignored == expected.ignored &&
+	                     actual.limited == expected.limited;
+
+	auto print = [](FILE* out, const char* label, const Counts& counts) {
+		fprintf(out, "  %-8s streams %u/%u, %u restarts, %llu coalesced, %llu restarted, %llu ignored, %llu limited\n",
+		        label, counts.creates_1, counts.creates_2, counts.restarts, (unsigned long long)counts.coalesced,
+		        (unsigned long long)counts.restarted, (unsigned long long)counts.ignored,
+		        (unsigned long long)counts.limited);
+	};
+
+	printf("%-14s %s\n", test.name, success ? "ok" : "FAILED");
+	if (!success) {
+		print(stderr, "expected", expected);
+		print(stderr, "actual", actual);
+	}
+	return success;
+}
+
+// ---------------------------------------------------------------------------
+
+int main(int argc, const char* argv[])
+{
+	if (argc != 2) {
+		printf("Usage: %s <work dir>\n", argv[0]);
+		return 1;
+	}
+
+	const fs::path work = argv[1];
+	std::error_code ec;
+	fs::create_directories(work, ec);
+	AltSoundSetLogger(work.string() + '/', ALTSOUND_LOG_LEVEL_NONE, false);
+
+	bool success = true;
+	for (const RetriggerCase& test : retriggerCases())
+		success = run(work, test) && success;
+	return success ? 0 : 1;
+}
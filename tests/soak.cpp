@@ -0,0 +1,426 @@
+// ---------------------------------------------------------------------------
+// soak.cpp
+//
+// Command-storm and concurrency soak test.  Runs the library the way a busy
+// table does, only much harder:
+//
+//   - an emulator thread fires commands as fast as it can (or at --rate),
+//     through AltSoundProcessCommand(), AltSoundProcessCommandAt() and
+//     AltSoundProcessCommands(), with attenuation, ROM volume sequences and
+//     stray bytes, switching hardware generations as it goes;
+//   - a control thread pauses and resumes playback, swaps the audio
+//     callback and checks the runtime statistics;
+//   - the audio thread mixes, fires SYNCPROCs and calls the audio callback.
+//
+// Each phase runs one sample package (G-Sound, then altsound CSV).  The test
+// fails if
+//
+//   - the voice count exceeds the channel limit,
+//   - the audio callback sees non-finite samples or a torn callback swap,
+//   - the audio thread stalls,
+//   - streams or channel entries are left behind after shutdown,
+//   - the audio thread allocates, locks or does file I/O outside the known
+//     violations (builds with -DENABLE_RT_CHECK=ON).
+//
+// Use-after-free and data races are left to the sanitizers: build with
+// -DENABLE_SANITIZERS=ON (ASan/UBSan) or -DENABLE_TSAN=ON and
+// CMAKE_BUILD_TYPE=Debug.  The sustained command throughput is reported.
+//
+// Usage: altsound_soak [--seconds <n>] [--rate <commands/s>] <work dir>
+//   --seconds  duration of each phase (default 30)
+//   --rate     command rate, 0 = as fast as possible (default 0)
+// ---------------------------------------------------------------------------
+// license:BSD-3-Clause
+// copyright-holders: Dave Roscoe
+// ---------------------------------------------------------------------------
+
+#include "altsound.h"
+#include "altsound_context.hpp"
+#include "altsound_data.hpp"
+#include "miniaudio_bass_compat.hpp"
+#include "test_package.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+using std::string;
+
+// ---------------------------------------------------------------------------
+// Packages
+// ---------------------------------------------------------------------------
+
+// IDs stay below 0x40, so generations with 8-bit commands reach samples too.
+// Samples are short, so streams end (and SYNCPROCs run) all the time
+static TestPackage gsoundPackage()
+{
+	TestPackage package;
+	package.ini =
+		"[system]\n"
+		"record_sound_cmds = 0\n"
+		"rom_volume_ctrl = 1\n"
+		"cmd_skip_count = 0\n"
+		"virtual_voice_db = -60\n"
+		"\n"
+		"[format]\n"
+		"format = g-sound\n"
+		"\n"
+		"[logging]\n"
+		"logging_level = None\n"
+		"\n"
+		"[callout]\n"
+		"ducks = sfx, music, overlay\n"
+		"pauses = music\n"
+		"\n"
+		"[callout_ducking_profiles]\n"
+		"ducking_profile1 = sfx:65, music:50, overlay:50\n"
+		"\n"
+		"[sfx]\n"
+		"ducks = music\n"
+		"\n"
+		"[sfx_ducking_profiles]\n"
+		"ducking_profile1 = music:50\n"
+		"\n"
+		"[solo]\n"
+		"stops = music, overlay, callout\n"
+		"\n"
+		"[overlay]\n"
+		"ducks = music, sfx\n"
+		"\n"
+		"[overlay_ducking_profiles]\n"
+		"ducking_profile1 = sfx:65, music:65\n";
+
+	package.csv_name = "g-sound.csv";
+	package.csv = "ID,TYPE,GAIN,DUCKING_PROFILE,FNAME\n"
+	              "0x0001,music,70,0,music1.wav\n"
+	              "0x0002,music,70,0,music2.wav\n"
+	              "0x0003,callout,90,1,callout1.wav\n"
+	              "0x0003,callout,90,1,callout2.wav\n"
+	              "0x0004,callout,90,1,callout2.wav\n"
+	              "0x0010,solo,100,0,solo.wav\n"
+	              "0x0011,overlay,60,1,overlay.wav\n";
+	for (unsigned int id = 0x05; id < 0x10; ++id) {
+		char row[64];
+		snprintf(row, sizeof(row), "0x%04X,sfx,80,1,sfx%u.wav\n", id, id % 3);
+		package.csv += row;
+	}
+
+	package.tones = { { "music1.wav", 44100, 200, 6000 }, { "music2.wav", 33075, 250, 6000 },
+	                  { "callout1.wav", 6615, 80, 8000 }, { "callout2.wav", 8820, 95, 8000 },
+	                  { "solo.wav", 11025, 160, 9000 }, { "overlay.wav", 4410, 140, 5000 },
+	                  { "sfx0.wav", 882, 35, 7000 }, { "sfx1.wav", 2205, 45, 7000 },
+	                  { "sfx2.wav", 3528, 25, 7000 } };
+	return package;
+}
+
+static TestPackage altsoundPackage()
+{
+	TestPackage package;
+	package.csv_name = "altsound.csv";
+	package.csv = "ID,CHANNEL,DUCK,GAIN,LOOP,STOP,NAME,FNAME,GROUP,SHAKER,SERIAL,PRELOAD,STOPCMD\n"
+	              "0x0001,0,100,60,100,0,music1,music1.wav,1,,,0,\n"
+	              "0x0002,0,100,60,100,0,music2,music2.wav,1,,,0,\n"
+	              "0x0003,1,30,80,0,0,jingle,jingle.wav,2,,,0,\n"
+	              "0x0004,1,30,80,0,1,single,jingle.wav,2,,,0,\n";
+	for (unsigned int id = 0x05; id < 0x30; ++id) {
+		char row[96];
+		snprintf(row, sizeof(row), "0x%04X,,80,70,%d,0,sfx,sfx%u.wav,3,,,0,\n", id, id % 11 == 0 ? 100 : 0, id % 3);
+		package.csv += row;
+	}
+
+	package.tones = { { "music1.wav", 44100, 180, 6000 }, { "music2.wav", 33075, 250, 6000 },
+	                  { "jingle.wav", 6615, 70, 8000 }, { "sfx0.wav", 882, 30, 9000 },
+	                  { "sfx1.wav", 2205, 45, 9000 }, { "sfx2.wav", 3528, 20, 4000 } };
+	return package;
+}
+
+// ---------------------------------------------------------------------------
+// Audio callback
+// ---------------------------------------------------------------------------
+
+struct CallbackState {
+	unsigned int tag;
+	std::atomic<uint64_t> frames{ 0 };
+};
+
+static CallbackState g_callbackA{ 0xA };
+static CallbackState g_callbackB{ 0xB };
+
+static void checkFrames(const float* frames, size_t count, uint32_t channels)
+{
+	for (size_t i = 0; i < count * channels; ++i) {
+		if (!std::isfinite(frames[i]) || std::abs(frames[i]) > 64.0f) {
+			fail("audio callback received a non-finite or runaway sample");
+			return;
+		}
+	}
+}
+
+static void audioCallbackA(const float* frames, size_t count, uint32_t, uint32_t channels, void* user)
+{
+	if (user != &g_callbackA || g_callbackA.tag != 0xA)
+		fail("callback A called with the user data of another callback");
+	checkFrames(frames, count, channels);
+	g_callbackA.frames += count;
+}
+
+static void audioCallbackB(const float* frames, size_t count, uint32_t, uint32_t channels, void* user)
+{
+	if (user != &g_callbackB || g_callbackB.tag != 0xB)
+		fail("callback B called with the user data of another callback");
+	checkFrames(frames, count, channels);
+	g_callbackB.frames += count;
+}
+
+// ---------------------------------------------------------------------------
+// Threads
+// ---------------------------------------------------------------------------
+
+static const ALTSOUND_HARDWARE_GEN hardwareGens[] = {
+	ALTSOUND_HARDWARE_GEN_WPCDCS, ALTSOUND_HARDWARE_GEN_WPC95, ALTSOUND_HARDWARE_GEN_WPCALPHA_2,
+	ALTSOUND_HARDWARE_GEN_S11C, ALTSOUND_HARDWARE_GEN_DEDMD32, ALTSOUND_HARDWARE_GEN_WS,
+	ALTSOUND_HARDWARE_GEN_GTS80
+};
+
+struct PhaseState {
+	std::atomic<bool> running{ true };
+	std::atomic<uint64_t> commands{ 0 }; // command bytes sent
+	double rate = 0.0;
+};
+
+static void emulatorThread(PhaseState& state, uint32_t seed)
+{
+	std::mt19937 random(seed);
+	uint64_t emu_time_ns = 0;
+	uint64_t sent = 0;
+	size_t gen = 0;
+	const auto start = std::chrono::steady_clock::now();
+
+	while (state.running.load(std::memory_order_relaxed)) {
+		// the emulator is the only caller of SetHardwareGen, as in PinMAME
+		if (sent % 2000 == 0)
+			AltSoundSetHardwareGen(hardwareGens[gen++ % std::size(hardwareGens)]);
+
+		const unsigned int kind = random() % 100;
+		const unsigned int id = 1 + random() % 0x30;
+		const int attenuation = kind < 2 ? -(int)(random() % 4) : 0;
+		std::vector<uint32_t> bytes;
+
+		if (kind < 80)
+			bytes = { 0x00, id };                                // 16-bit command
+		else if (kind < 85)
+			bytes = { 0x03, 0xE3 };                              // DCS stop music
+		else if (kind < 90)
+			bytes = { 0x55, 0xAA, 0x60, 0x9F };                  // DCS master volume
+		else if (kind < 95)
+			bytes = { 0x7A, id };                                // WPC prefix
+		else
+			bytes = { (uint32_t)(random() % 256), (uint32_t)(random() % 256), (uint32_t)(random() % 256) }; // noise
+
+		switch (random() % 3) {
+			case 0:
+				for (const uint32_t b : bytes)
+					AltSoundProcessCommand(b, attenuation);
+				break;
+
+			case 1:
+				for (const uint32_t b : bytes)
+					AltSoundProcessCommandAt(b, attenuation, emu_time_ns);
+				break;
+
+			default:
+				AltSoundProcessCommands(bytes.data(), bytes.size(), attenuation);
+				break;
+		}
+		emu_time_ns += 20000 + random() % 500000;
+		sent += bytes.size();
+		state.commands.store(sent, std::memory_order_relaxed);
+
+		if (state.rate > 0.0) {
+			const auto due = start + std::chrono::duration<double>((double)sent / state.rate);
+			std::this_thread::sleep_until(std::chrono::time_point_cast<std::chrono::steady_clock::duration>(due));
+		}
+	}
+}
+
+static void controlThread(PhaseState& state, uint32_t seed)
+{
+	std::mt19937 random(seed);
+
+	while (state.running.load(std::memory_order_relaxed)) {
+		switch (random() % 8) {
+			case 0:
+				AltSoundPause(true);
+				break;
+
+			case 1:
+				AltSoundPause(false);
+				break;
+
+			case 2:
+				AltSoundSetAudioCallback(audioCallbackA, &g_callbackA);
+				break;
+
+			case 3:
+				AltSoundSetAudioCallback(audioCallbackB, &g_callbackB);
+				break;
+
+			case 4:
+				AltSoundSetAudioCallback(nullptr, nullptr);
+				break;
+
+			default: {
+				AltSoundStats stats;
+				AltSoundGetStats(&stats);
+
+				uint32_t voices = 0;
+				for (const uint32_t v : stats.voices)
+					voices += v;
+				if (voices > ALT_MAX_CHANNELS)
+					fail("more voices than channels");
+				for (const uint32_t v : stats.peak_voices)
+					if (v > ALT_MAX_CHANNELS)
+						fail("voice peak above the channel count");
+				if (stats.virtual_voices > ALT_MAX_CHANNELS)
+					fail("more virtual voices than channels");
+				break;
+			}
+		}
+		std::this_thread::sleep_for(std::chrono::microseconds(200 + random() % 800));
+	}
+	AltSoundPause(false);
+}
+
+// ---------------------------------------------------------------------------
+// Phases
+// ---------------------------------------------------------------------------
+
+static bool runPhase(const fs::path& work, const string& game, const TestPackage& package, double seconds,
+                     double rate, uint32_t seed)
+{
+	if (!createTestPackage(work, game, package))
+		return false;
+
+	const unsigned int failures_before = g_failures.load();
+
+	if (!AltSoundInit(work.string(), game)) {
+		fprintf(stderr, "AltSoundInit failed for %s\n", game.c_str());
+		return false;
+	}
+	AltSoundResetStats();
+	AltSoundSetAudioCallback(audioCallbackA, &g_callbackA);
+
+	PhaseState state;
+	state.rate = rate;
+	const uint64_t frames_before = g_callbackA.frames + g_callbackB.frames;
+	const auto start = std::chrono::steady_clock::now();
+
+	std::thread emulator(emulatorThread, std::ref(state), seed);
+	std::thread control(controlThread, std::ref(state), seed + 1);
+
+	// the audio thread must keep running through the storm
+	uint64_t last_frames = frames_before;
+	auto last_progress = start;
+	while (std::chrono::steady_clock::now() - start < std::chrono::duration<double>(seconds)) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+		const uint64_t frames = g_callbackA.frames + g_callbackB.frames;
+		const auto now = std::chrono::steady_clock::now();
+		if (frames != last_frames) {
+			last_frames = frames;
+			last_progress = now;
+		}
+		else if (now - last_progress > std::chrono::seconds(2)) {
+			// the callback may be unset for a while, but not for seconds
+			fail("audio thread stalled");
+			break;
+		}
+	}
+
+	state.running = false;
+	emulator.join();
+	control.join();
+	const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	AltSoundStats stats;
+	AltSoundGetStats(&stats);
+	AltSoundShutdown();
+
+	// each call site is reported on stderr with its backtrace
+	if (stats.rt_violations)
+		fail((std::to_string(stats.rt_violations) + " realtime-safety violation(s) on the audio thread").c_str());
+
+	// everything the storm created must be gone
+	const size_t streams = MiniAudio_GetStreamCount();
+	if (streams)
+		fail((std::to_string(streams) + " stream(s) not freed after shutdown").c_str());
+	for (const AltsoundStreamInfo* stream : AltsoundContext::current().channel_stream)
+		if (stream) {
+			fail("channel entry left after shutdown");
+			break;
+		}
+
+	uint32_t peak_voices = 0;
+	for (const uint32_t v : stats.peak_voices)
+		peak_voices = std::max(peak_voices, v);
+
+	const uint64_t commands = state.commands.load();
+	printf("%-10s %9llu command bytes in %5.1f s: %9.0f /s  p99 %6.1f us  max %8.1f us  "
+	       "peak voices %u  channel full %llu  %s\n",
+	       game.c_str(), (unsigned long long)commands, elapsed, (double)commands / elapsed,
+	       (double)AltSoundHistogramPercentile(&stats.process_command, 99) / 1000.0,
+	       (double)stats.process_command.max_ns / 1000.0, peak_voices, (unsigned long long)stats.channel_full,
+	       g_failures.load() == failures_before ? "ok" : "FAILED");
+
+	return g_failures.load() == failures_before;
+}
+
+// ---------------------------------------------------------------------------
+
+int main(int argc, const char* argv[])
+{
+	double seconds = 30.0;
+	double rate = 0.0;
+	string work;
+
+	for (int i = 1; i < argc; ++i) {
+		const string arg = argv[i];
+		if (arg == "--seconds" && i + 1 < argc)
+			seconds = std::atof(argv[++i]);
+		else if (arg == "--rate" && i + 1 < argc)
+			rate = std::atof(argv[++i]);
+		else if (work.empty() && arg.rfind("--", 0) != 0)
+			work = arg;
+		else
+			work.clear(), seconds = 0.0;
+	}
+
+	if (work.empty() || seconds <= 0.0) {
+		printf("Usage: %s [--seconds <n>] [--rate <commands/s>] <work dir>\n", argv[0]);
+		return 1;
+	}
+
+	std::error_code ec;
+	fs::create_directories(work, ec);
+	AltSoundSetLogger(fs::path(work).string() + '/', ALTSOUND_LOG_LEVEL_NONE, false);
+
+	printf("Soak test: %.0f s per phase, %s\n", seconds,
+	       rate > 0.0 ? (std::to_string((int)rate) + " commands/s").c_str() : "commands as fast as possible");
+
+	bool success = runPhase(work, "soak_gsound", gsoundPackage(), seconds, rate, 1);
+	success = runPhase(work, "soak_altsound", altsoundPackage(), seconds, rate, 2) && success;
+
+	if (!success) {
+		fprintf(stderr, "%u failure(s)\n", g_failures.load());
+		return 1;
+	}
+	printf("No failures\n");
+	return 0;
+}
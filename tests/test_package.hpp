@@ -0,0 +1,170 @@
+// ---------------------------------------------------------------------------
+// test_package.hpp
+//
+// Synthetic sample packages for the test programs.  Samples are square
+// waves with integer samples, so the input is bit-exact on every platform.
+// Also the click package, the onset detector that hears it and the failure
+// report the timing tests share
+// ---------------------------------------------------------------------------
+// license:BSD-3-Clause
+// copyright-holders: Dave Roscoe
+// ---------------------------------------------------------------------------
+
+#ifndef ALTSOUND_TEST_PACKAGE_HPP
+#define ALTSOUND_TEST_PACKAGE_HPP
+#if !defined(__GNUC__) || (__GNUC__ == 3 && __GNUC_MINOR__ >= 4) || (__GNUC__ >= 4)	// GCC supports "pragma once" correctly since 3.4
+#pragma once
+#endif
+
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct ToneFile {
+	std::string path;  // relative to the package directory
+	uint32_t frames;
+	uint32_t period;   // in frames
+	int16_t amplitude;
+	uint32_t tone_frames = 0; // followed by silence, 0 = tone throughout
+};
+
+struct TestPackage {
+	std::string ini;       // altsound.ini; the library creates a default when empty
+	std::string csv_name;  // altsound.csv, g-sound.csv or empty for legacy
+	std::string csv;
+	std::vector<ToneFile> tones;
+};
+
+// 16-bit stereo 44.1 kHz WAV holding a square wave, or a burst of one
+inline bool writeTone(const std::filesystem::path& path, const ToneFile& tone)
+{
+	std::ofstream out(path, std::ios::binary);
+	if (!out.is_open())
+		return false;
+
+	auto u32 = [&](uint32_t v) {
+		const uint8_t b[4] = { (uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24) };
+		out.write((const char*)b, 4);
+	};
+	auto u16 = [&](uint16_t v) {
+		const uint8_t b[2] = { (uint8_t)v, (uint8_t)(v >> 8) };
+		out.write((const char*)b, 2);
+	};
+
+	const uint32_t data_size = tone.frames * 4;
+	out.write("RIFF", 4); u32(36 + data_size);
+	out.write("WAVEfmt ", 8); u32(16); u16(1); u16(2); u32(44100); u32(44100 * 4); u16(4); u16(16);
+	out.write("data", 4); u32(data_size);
+
+	for (uint32_t i = 0; i < tone.frames; ++i) {
+		int16_t s = (i % tone.period) < tone.period / 2 ? tone.amplitude : (int16_t)-tone.amplitude;
+		if (tone.tone_frames && i >= tone.tone_frames)
+			s = 0;
+		u16((uint16_t)s);
+		u16((uint16_t)s);
+	}
+	return out.good();
+}
+
+// Creates <vpm_path>/altsound/<game>/ from scratch
+inline bool createTestPackage(const std::filesystem::path& vpm_path, const std::string& game,
+                              const TestPackage& package)
+{
+	namespace fs = std::filesystem;
+
+	const fs::path dir = vpm_path / "altsound" / game;
+	std::error_code ec;
+	fs::remove_all(dir, ec);
+	fs::create_directories(dir, ec);
+
+	bool success = !ec;
+	for (const ToneFile& tone : package.tones) {
+		const fs::path path = dir / tone.path;
+		fs::create_directories(path.parent_path(), ec);
+		success = success && !ec && writeTone(path, tone);
+	}
+
+	auto writeText = [&](const fs::path& path, const std::string& text) {
+		std::ofstream out(path);
+		out << text;
+		return out.good();
+	};
+	if (!package.csv_name.empty())
+		success = success && writeText(dir / package.csv_name, package.csv);
+	if (!package.ini.empty())
+		success = success && writeText(dir / "altsound.ini", package.ini);
+
+	if (!success)
+		fprintf(stderr, "Unable to write sample package in %s\n", dir.string().c_str());
+	return success;
+}
+
+// ---------------------------------------------------------------------------
+// Clicks
+// ---------------------------------------------------------------------------
+
+// 2 ms click, then silence; shorter than the spacing of the click commands
+inline const ToneFile CLICK_TONE = { "click.wav", 44100 / 20, 8, 20000, 44100 / 500 };
+
+// AltSound package playing the click on command 0x0001
+inline const TestPackage CLICK_PACKAGE = { "", "altsound.csv",
+	"ID,CHANNEL,DUCK,GAIN,LOOP,STOP,NAME,FNAME,GROUP,SHAKER,SERIAL,PRELOAD,STOPCMD\n"
+	"0x0001,,100,100,0,0,click,click.wav,3,,,0,\n",
+	{ CLICK_TONE } };
+
+constexpr float ONSET_THRESHOLD = 0.001f;
+constexpr uint32_t ONSET_MIN_GAP = 44100 / 100; // silent frames before an onset
+constexpr size_t MAX_ONSETS = 4096;
+
+// Finds the clicks in interleaved output: an onset is an audible frame
+// after at least ONSET_MIN_GAP silent ones.  Allocates nothing, so it can
+// run in the audio callback
+struct OnsetDetector {
+	std::array<uint64_t, MAX_ONSETS> onsets; // output frame of each onset
+	size_t count = 0;
+	uint64_t frames = 0;                     // output frames so far
+	uint64_t silent_frames = ONSET_MIN_GAP;
+
+	void feed(const float* samples, size_t frameCount, uint32_t channels)
+	{
+		for (size_t i = 0; i < frameCount; ++i) {
+			bool audible = false;
+			for (uint32_t ch = 0; ch < channels; ++ch)
+				audible |= std::abs(samples[i * channels + ch]) > ONSET_THRESHOLD;
+
+			if (!audible) {
+				++silent_frames;
+				continue;
+			}
+
+			if (silent_frames >= ONSET_MIN_GAP && count < MAX_ONSETS)
+				onsets[count++] = frames + i;
+			silent_frames = 0;
+		}
+		frames += frameCount;
+	}
+};
+
+// ---------------------------------------------------------------------------
+// Failures
+// ---------------------------------------------------------------------------
+
+// From any thread; the first 20 are reported
+inline std::atomic<unsigned int> g_failures{ 0 };
+inline std::mutex g_failMutex;
+
+inline void fail(const char* what)
+{
+	std::lock_guard<std::mutex> lock(g_failMutex);
+	if (g_failures++ < 20)
+		fprintf(stderr, "FAILED: %s\n", what);
+}
+
+#endif // ALTSOUND_TEST_PACKAGE_HPP